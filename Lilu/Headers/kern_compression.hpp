@@ -15,6 +15,8 @@
 #include <Headers/kern_util.hpp>
 #include <stdint.h>
 
+struct z_stream_s;
+
 namespace Compression {
 
 	/**
@@ -24,6 +26,23 @@ namespace Compression {
 	static constexpr uint32_t ModeLZVN {0x6E767A6C}; //lzvn
 	static constexpr uint32_t ModeLZSS {0x73737A6C}; //lzss
 	static constexpr uint32_t ModeZLIB {0x9C787A6C}; //zlib
+	static constexpr uint32_t ModeLZFSE {0x73667A6C}; //lzfs, Lilu identifier for bare lzfse streams, not written by Apple tooling
+
+	/**
+	 *  First block magics of bare lzfse streams as written by Apple tooling
+	 */
+	static constexpr uint32_t LZFSEMagicV2 {0x32787662}; //bvx2
+	static constexpr uint32_t LZFSEMagicLZVN {0x6E787662}; //bvxn
+	static constexpr uint32_t LZFSEMagicRaw {0x2D787662}; //bvx-
+
+	/**
+	 *  Compression effort levels trading ratio for speed
+	 */
+	enum Level : uint32_t {
+		LevelFast,
+		LevelDefault,
+		LevelMax
+	};
 
 	/**
 	 *  Compressed header structure
@@ -39,7 +58,7 @@ namespace Compression {
 	};
 
 	/**
-	 *  Typed decompressing function (currently for lzvn, lzss, and zlib)
+	 *  Typed decompressing function (currently for lzvn, lzss, lzfse, and zlib)
 	 *
 	 *  @param compression compression type
 	 *  @param dstlen      decompression buffer size
@@ -52,7 +71,7 @@ namespace Compression {
 	EXPORT uint8_t *decompress(uint32_t compression, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer=nullptr);
 
 	/**
-	 *  Typed decompressing function (currently for lzvn, lzss, and zlib)
+	 *  Typed decompressing function (currently for lzvn, lzss, lzfse, and zlib)
 	 *
 	 *  @param compression compression type
 	 *  @param dstlen      decompression buffer size, actual decompressed size on success
@@ -65,7 +84,31 @@ namespace Compression {
 	EXPORT uint8_t *decompress(uint32_t compression, uint32_t *dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer=nullptr);
 
 	/**
-	 *  Typed compressing function (currently for lzss)
+	 *  Typed decompressing function stopping after the requested amount of data (currently for lzvn, lzss, lzfse, and zlib)
+	 *
+	 *  @param compression compression type
+	 *  @param dstlen      decompressed prefix size
+	 *  @param src         compressed data
+	 *  @param srclen      compressed data size
+	 *  @param consumed    compressed data size used to produce the prefix
+	 *  @param buffer      preallocated buffer to use
+	 *
+	 *  @return decompressed buffer (must be freeded by Buffer::deleter if not preallocated)
+	 */
+	EXPORT uint8_t *decompressPrefix(uint32_t compression, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t &consumed, uint8_t *buffer=nullptr);
+
+	/**
+	 *  Obtain decompressed size of a bare lzfse stream by walking its block headers
+	 *
+	 *  @param src         compressed data
+	 *  @param srclen      compressed data size
+	 *
+	 *  @return decompressed size or 0 for malformed or unsupported streams
+	 */
+	EXPORT uint32_t lzfseDecompressedSize(const uint8_t *src, uint32_t srclen);
+
+	/**
+	 *  Typed compressing function (currently for lzss and lzvn)
 	 *
 	 *  @param compression compression type
 	 *  @param dstlen      maximum compression buffer size
@@ -77,6 +120,166 @@ namespace Compression {
 	 */
 	EXPORT uint8_t *compress(uint32_t compression, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer=nullptr);
 
+	/**
+	 *  Typed compressing function with selectable effort (currently for lzss and lzvn)
+	 *
+	 *  @param compression compression type
+	 *  @param dstlen      maximum compression buffer size
+	 *  @param src         uncompressed data
+	 *  @param srclen      uncompressed data size
+	 *  @param level       compression effort (lzvn has a single level)
+	 *  @param buffer      preallocated buffer to use
+	 *
+	 *  @return compressed buffer with its actual size in dstlen (must be freeded by Buffer::deleter if not preallocated)
+	 */
+	EXPORT uint8_t *compress(uint32_t compression, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, Level level, uint8_t *buffer=nullptr);
+
+	/**
+	 *  Compute adler32 checksum as stored in compressed header hash
+	 *
+	 *  @param adler  checksum of preceding data, 1 initially
+	 *  @param data   data to checksum
+	 *  @param size   data size
+	 *
+	 *  @return updated checksum
+	 */
+	EXPORT uint32_t adler32(uint32_t adler, const uint8_t *data, size_t size);
+
+	/**
+	 *  Incremental decompressor fed with compressed data chunks (currently for lzvn, lzss, and zlib)
+	 *  Decompressed data is written to a single caller-provided buffer, which also serves as match history,
+	 *  so that only one chunk of compressed data has to be resident at a time.
+	 */
+	class Stream {
+	public:
+		/**
+		 *  Maximum compressed chunk size accepted by feed
+		 */
+		static constexpr uint32_t ChunkSize {64*1024};
+
+		/**
+		 *  Prepare for decompression
+		 *
+		 *  @param mode      compression type
+		 *  @param dst       decompression buffer
+		 *  @param dstlen    decompression buffer size
+		 *  @param checksum  compute adler32 of decompressed data while it is produced
+		 *
+		 *  @return true on success
+		 */
+		EXPORT bool init(uint32_t mode, uint8_t *dst, uint32_t dstlen, bool checksum=false);
+
+		/**
+		 *  Obtain the buffer to put the next compressed chunk to
+		 *
+		 *  @return buffer of ChunkSize bytes
+		 */
+		uint8_t *input() {
+			return inbuf + carry;
+		}
+
+		/**
+		 *  Decompress the chunk put to input buffer, incomplete trailing data is kept for the next chunk
+		 *
+		 *  @param size  chunk size, at most ChunkSize
+		 *  @param last  no more chunks follow
+		 *
+		 *  @return true on success
+		 */
+		EXPORT bool feed(uint32_t size, bool last);
+
+		/**
+		 *  Obtain the amount of decompressed data
+		 *
+		 *  @return decompressed size
+		 */
+		uint32_t produced() const {
+			return static_cast<uint32_t>(dstpos);
+		}
+
+		/**
+		 *  Obtain adler32 checksum of decompressed data when requested in init
+		 *
+		 *  @return checksum of produced data
+		 */
+		uint32_t checksum() const {
+			return adler;
+		}
+
+		/**
+		 *  Release resources allocated by init, must be called regardless of the init result
+		 */
+		EXPORT void deinit();
+
+	private:
+		/**
+		 *  Trailing data kept between chunks, sufficient for any lzvn instruction
+		 */
+		static constexpr size_t CarrySize {512};
+
+		uint32_t compression {0};
+		uint8_t *dst {nullptr};
+		size_t dstlen {0};
+		size_t dstpos {0};
+		uint8_t *inbuf {nullptr};
+		size_t carry {0};
+		size_t dprev {0};
+		bool done {false};
+		bool verify {false};
+		uint32_t adler {1};
+		z_stream_s *zstream {nullptr};
+	};
+
+	/**
+	 *  Reusable zlib decompressor, all inflate memory is taken from a single preallocated arena
+	 *  and the inflate state is reset instead of being reinitialised between calls.
+	 *  Compression::decompress with ModeZLIB already reuses a shared context, a private one
+	 *  avoids falling back to a temporary context when decompressing concurrently.
+	 */
+	class Inflate {
+	public:
+		/**
+		 *  Arena size covering zlib inflate state, single call inflate with Z_FINISH allocates no window
+		 */
+		static constexpr size_t ArenaSize {16*1024};
+
+		/**
+		 *  Allocate the arena and initialise inflate state
+		 *
+		 *  @return true on success
+		 */
+		EXPORT bool init();
+
+		/**
+		 *  Decompress a zlib stream
+		 *
+		 *  @param dst       decompression buffer
+		 *  @param dstlen    decompression buffer size, actual decompressed size on success
+		 *  @param src       compressed data
+		 *  @param srclen    compressed data size
+		 *  @param consumed  compressed data size used, optional
+		 *
+		 *  @return true when the stream ended or filled the buffer
+		 */
+		EXPORT bool decompress(uint8_t *dst, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed=nullptr);
+
+		/**
+		 *  Release resources allocated by init, must be called regardless of the init result
+		 */
+		EXPORT void deinit();
+
+	private:
+		/**
+		 *  zlib allocation callbacks using the arena and falling back to the general allocator
+		 */
+		static void *arenaAlloc(void *opaque, unsigned int items, unsigned int size);
+		static void arenaFree(void *opaque, void *ptr);
+
+		uint8_t *arena {nullptr};
+		size_t arenaUsed {0};
+		z_stream_s *zstream {nullptr};
+	};
+
 }
 
 #endif /* LILU_COMPRESSION_SUPPORT */
@@ -46,6 +46,17 @@ class Disassembler {
 	 *  Max instruction size
 	 */
 	static constexpr size_t MaxInstruction {15};
+
+#if defined(__x86_64__)
+	/**
+	 *  Table-driven instruction length decoder for common prologue instructions
+	 *
+	 *  @param code  instruction pointer, should point to at least MaxInstruction valid bytes
+	 *
+	 *  @return instruction size or 0 if HDE engine should be used instead
+	 */
+	static size_t fastInstructionSize(const uint8_t *code);
+#endif
 public:
 
 #if defined(__i386__)
@@ -73,6 +84,34 @@ public:
 	/* Note, code should point to at least 32 valid bytes. */
 	EXPORT static size_t hdeDisasm(mach_vm_address_t code, hde_t *hs);
 
+	/**
+	 *  Copy instructions to a different address fixing up relative addressing
+	 *  RIP-relative displacements are adjusted, relative calls and jumps are rewritten
+	 *  to 32-bit relative or absolute forms. Branches into the copied range are not supported.
+	 *  Note: instruction pointer should point to at least size + 32 valid bytes.
+	 *
+	 *  @param src      source instruction pointer
+	 *  @param size     amount of bytes to copy, must end on instruction boundary
+	 *  @param dst      destination buffer
+	 *  @param dstSize  destination buffer size
+	 *  @param dstAddr  address the destination buffer will be executed at
+	 *
+	 *  @return amount of bytes written to dst on success or 0
+	 */
+	EXPORT static size_t relocateInstructions(mach_vm_address_t src, size_t size, uint8_t *dst, size_t dstSize, mach_vm_address_t dstAddr);
+
+	/**
+	 *  Check that execution falls through the first size bytes, i.e. no return, unconditional jump or trap
+	 *  ends the code before them and they cannot belong to the next function or padding.
+	 *  Note: instruction pointer should point to at least size + 32 valid bytes.
+	 *
+	 *  @param src   instruction pointer
+	 *  @param size  amount of bytes
+	 *
+	 *  @return true if the bytes are covered by fall-through instructions
+	 */
+	EXPORT static bool isLinearCode(mach_vm_address_t src, size_t size);
+
 #ifdef LILU_ADVANCED_DISASSEMBLY
 
 	/**
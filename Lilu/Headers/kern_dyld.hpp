@@ -0,0 +1,221 @@
+//
+//  kern_dyld.hpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef kern_dyld_hpp
+#define kern_dyld_hpp
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_util.hpp>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ *  dyld shared cache parsing independent of the way cache files are accessed
+ */
+namespace DyldCache {
+	/**
+	 *  Image segment ranges looked up in the cache or its .map file
+	 */
+	struct MapEntry {
+		const char *filename;
+		size_t length;
+		vm_address_t startTEXT;
+		vm_address_t endTEXT;
+		vm_address_t startDATA;
+		vm_address_t endDATA;
+		bool mapped;
+	};
+
+	/**
+	 *  dyld shared cache header, only fields used for image lookup
+	 */
+	struct Header {
+		char magic[16];
+		uint32_t mappingOffset;
+		uint32_t mappingCount;
+		uint32_t imagesOffsetOld;
+		uint32_t imagesCountOld;
+		uint8_t reserved1[360];
+		uint32_t subCacheArrayOffset;
+		uint32_t subCacheArrayCount;
+		uint8_t reserved2[48];
+		uint32_t imagesOffset;
+		uint32_t imagesCount;
+		uint32_t cacheSubType;
+		uint32_t padding;
+	};
+
+	static_assert(offsetof(Header, subCacheArrayOffset) == 392, "Invalid dyld shared cache header layout");
+	static_assert(offsetof(Header, imagesOffset) == 448, "Invalid dyld shared cache header layout");
+
+	/**
+	 *  dyld shared cache mapping entry
+	 */
+	struct Mapping {
+		uint64_t address;
+		uint64_t size;
+		uint64_t fileOffset;
+		uint32_t maxProt;
+		uint32_t initProt;
+	};
+
+	/**
+	 *  dyld shared cache image entry
+	 */
+	struct Image {
+		uint64_t address;
+		uint64_t modTime;
+		uint64_t inode;
+		uint32_t pathFileOffset;
+		uint32_t pad;
+	};
+
+	/**
+	 *  dyld shared cache subcache entry, older caches (12.x) omit fileSuffix and use .N suffixes
+	 */
+	struct SubCache {
+		uint8_t uuid[16];
+		uint64_t cacheVMOffset;
+		char fileSuffix[32];
+	};
+
+	/**
+	 *  Maximum amount of mappings read from a single cache file
+	 */
+	static constexpr size_t MaxMappings {16};
+
+	/**
+	 *  Maximum load command size read for a single cache image
+	 */
+	static constexpr size_t MaxCommands {64*1024};
+
+	/**
+	 *  Image table and path window sizes used when reading the cache
+	 */
+	static constexpr size_t ImageBatch {64};
+	static constexpr size_t PathWindow {16*1024};
+
+	/**
+	 *  Minimum path lookup table size, kept at least twice larger than the amount of entries
+	 */
+	static constexpr size_t MinTableSize {16};
+
+	/**
+	 *  Cache file access provided by the caller
+	 */
+	struct Reader {
+		/**
+		 *  Open cache file
+		 *
+		 *  @param path  file path
+		 *  @param user  user pointer
+		 *
+		 *  @return file handle or nullptr if missing
+		 */
+		void *(*open)(const char *path, void *user);
+
+		/**
+		 *  Read cache file contents
+		 *
+		 *  @param file    file handle
+		 *  @param buffer  output buffer
+		 *  @param off     file offset
+		 *  @param size    amount of bytes to read
+		 *  @param user    user pointer
+		 *
+		 *  @return 0 on success
+		 */
+		int (*read)(void *file, void *buffer, off_t off, size_t size, void *user);
+
+		/**
+		 *  Close cache file
+		 *
+		 *  @param file  file handle
+		 *  @param user  user pointer
+		 */
+		void (*close)(void *file, void *user);
+
+		/**
+		 *  User pointer passed to the callbacks
+		 */
+		void *user;
+	};
+
+	/**
+	 *  Compute image path hash for path lookups
+	 *
+	 *  @param path  image path
+	 *  @param len   path length
+	 *
+	 *  @return path hash
+	 */
+	EXPORT uint64_t hashPath(const char *path, size_t len);
+
+	/**
+	 *  Translates cache virtual address to file offset within a single cache file
+	 *
+	 *  @param reader   file access
+	 *  @param file     cache file handle
+	 *  @param address  virtual address
+	 *  @param offset   resulting file offset
+	 *
+	 *  @return true if the address belongs to this file
+	 */
+	EXPORT bool findOffset(const Reader &reader, void *file, uint64_t address, off_t &offset);
+
+	/**
+	 *  Reads __TEXT and __DATA segment ranges of a cache image
+	 *
+	 *  @param reader  file access
+	 *  @param file    cache file handle
+	 *  @param offset  image mach header file offset
+	 *  @param entry   entry to fill
+	 *
+	 *  @return true if __TEXT was found
+	 */
+	EXPORT bool readSegments(const Reader &reader, void *file, off_t offset, MapEntry &entry);
+
+	/**
+	 *  Locates cache image in the main cache or its subcaches and reads its segment ranges
+	 *
+	 *  @param reader     file access
+	 *  @param cachePath  main cache file path
+	 *  @param header     main cache header
+	 *  @param file       main cache file handle
+	 *  @param address    image mach header address
+	 *  @param entry      entry to fill
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool mapImage(const Reader &reader, const char *cachePath, const Header &header, void *file, uint64_t address, MapEntry &entry);
+
+	/**
+	 *  Checks whether a path read through the cache path window is null-terminated within it
+	 *
+	 *  @param path  path start
+	 *  @param size  bytes available in the window
+	 *
+	 *  @return true if the whole path is available
+	 */
+	EXPORT bool hasPathInWindow(const char *path, size_t size);
+
+	/**
+	 *  Obtains __TEXT and __DATA addresses from dyld shared cache header and images table
+	 *
+	 *  @param reader     file access
+	 *  @param cachePath  main cache file path
+	 *  @param mapEntries entries to look for
+	 *  @param nentries   number of entries
+	 *  @param nfound     number of entries found
+	 *
+	 *  @return true if the cache was read
+	 */
+	EXPORT bool mapAddresses(const Reader &reader, const char *cachePath, MapEntry *mapEntries, size_t nentries, size_t &nfound);
+}
+
+#endif /* kern_dyld_hpp */
@@ -0,0 +1,201 @@
+//
+//  kern_lookup.hpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef kern_lookup_hpp
+#define kern_lookup_hpp
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_util.hpp>
+
+#include <mach/vm_param.h>
+
+/**
+ *  Quick page lookup by fingerprint values read at fixed page offsets
+ */
+class PageLookup {
+	/**
+	 *  Open-addressed hash table mapping page keys to page indices plus one (0 is empty)
+	 */
+	uint32_t *index {nullptr};
+	size_t indexMask {0};
+
+	/**
+	 *  Bit filter of page keys with 8 bits per index slot, rejects most foreign pages before probing
+	 */
+	uint64_t *filter {nullptr};
+	size_t filterMask {0};
+
+	/**
+	 *  Compute secondary page key hash for the filter
+	 *
+	 *  @param value page key
+	 *
+	 *  @return unmasked hash
+	 */
+	static size_t filterHash(uint64_t value) {
+		return static_cast<size_t>((value * 0xC2B2AE3D27D4EB4FULL) >> 32);
+	}
+
+	/**
+	 *  Add page key to the filter
+	 *
+	 *  @param value page key
+	 */
+	void addFilter(uint64_t value) {
+		size_t a = hash(value) & filterMask, b = filterHash(value) & filterMask;
+		filter[a / 64] |= 1ULL << (a % 64);
+		filter[b / 64] |= 1ULL << (b % 64);
+	}
+
+	/**
+	 *  Chooses offs by the amount of distinct non-trivial values across the pages
+	 *
+	 *  @param pages  page contents of PAGE_SIZE bytes each
+	 *  @param num    amount of pages
+	 *
+	 *  @return true on success
+	 */
+	bool chooseOffsets(const uint8_t *const *pages, size_t num);
+
+	/**
+	 *  Builds index and filter from page keys
+	 *
+	 *  @return true on success
+	 */
+	bool loadIndex();
+
+public:
+	/**
+	 *  Amount of fingerprint values per page
+	 */
+	static constexpr size_t matchNum {4};
+
+	/**
+	 *  Page offsets of fingerprint values
+	 */
+	uint32_t offs[matchNum] {};
+
+	/**
+	 *  Fingerprint values of every page in page order
+	 */
+	evector<uint64_t> c[matchNum];
+
+	/**
+	 *  Keys combining every fingerprint value of a page in page order,
+	 *  pages sharing a single value (like zeroes in data pages) still get distinct keys
+	 */
+	evector<uint64_t> keys;
+
+	/**
+	 *  Minimum index size, kept at least twice larger than the amount of pages
+	 */
+	static constexpr size_t MinIndexSize {16};
+
+	/**
+	 *  Compute page key hash
+	 *
+	 *  @param value page key
+	 *
+	 *  @return unmasked hash
+	 */
+	static size_t hash(uint64_t value) {
+		return static_cast<size_t>((value * 0x9E3779B97F4A7C15ULL) >> 32);
+	}
+
+	/**
+	 *  Counts distinct values other than 0 and ~0, sorting them in place
+	 *
+	 *  @param values  value array
+	 *  @param num     amount of values
+	 *
+	 *  @return amount of distinct values
+	 */
+	EXPORT static size_t countDistinctValues(uint64_t *values, size_t num);
+
+	/**
+	 *  Chooses fingerprint offsets and builds the index, must be called once
+	 *
+	 *  @param pages  page contents of PAGE_SIZE bytes each, only accessed during the call
+	 *  @param num    amount of pages
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool init(const uint8_t *const *pages, size_t num);
+
+	/**
+	 *  Release allocated memory
+	 */
+	EXPORT void deinit();
+
+	/**
+	 *  Check whether the lookup is ready, it may be used without locking afterwards
+	 *
+	 *  @return true if init succeeded
+	 */
+	bool loaded() const {
+		return index != nullptr;
+	}
+
+	/**
+	 *  Amount of pages in the lookup
+	 *
+	 *  @return page count
+	 */
+	size_t size() const {
+		return keys.size();
+	}
+
+	/**
+	 *  Combine fingerprint values of a page into its key
+	 *
+	 *  @param page  page contents
+	 *
+	 *  @return page key
+	 */
+	uint64_t key(const uint8_t *page) const {
+		uint64_t k = 0;
+		for (size_t i = 0; i < matchNum; i++) {
+			k = (k ^ *reinterpret_cast<const uint64_t *>(page + offs[i])) * 0x9E3779B97F4A7C15ULL;
+			k ^= k >> 29;
+		}
+		return k;
+	}
+
+	/**
+	 *  Check whether the filter may contain page key
+	 *
+	 *  @param value page key
+	 *
+	 *  @return false when no stored page has this key
+	 */
+	bool mayContain(uint64_t value) const {
+		size_t a = hash(value) & filterMask, b = filterHash(value) & filterMask;
+		return ((filter[a / 64] >> (a % 64)) & (filter[b / 64] >> (b % 64)) & 1) != 0;
+	}
+
+	/**
+	 *  Finds the next candidate page by its key
+	 *
+	 *  @param value  page key
+	 *  @param slot   index slot to continue probing from, initially hash(value), left at the empty slot on failure
+	 *
+	 *  @return page index or size() if not found
+	 */
+	EXPORT size_t findCandidate(uint64_t value, size_t &slot) const;
+
+	/**
+	 *  Compares fingerprint values of a candidate page
+	 *
+	 *  @param page  page contents
+	 *  @param p     candidate page index
+	 *
+	 *  @return true if every value matches
+	 */
+	EXPORT bool matchCandidate(const uint8_t *page, size_t p) const;
+};
+
+#endif /* kern_lookup_hpp */
@@ -12,6 +12,7 @@
 
 #include <Headers/kern_config.hpp>
 #include <Headers/kern_util.hpp>
+#include <Headers/kern_compression.hpp>
 
 #include <sys/time.h>
 #include <sys/types.h>
@@ -51,6 +52,14 @@ class MachInfo {
 	uint8_t *prelink_addr {nullptr};         // prelink text base address
 	mach_vm_address_t prelink_vmaddr {0};    // prelink text base vm address (for kexts this is their actual slide)
 	uint32_t file_buf_size {0};              // read file data size
+#ifdef LILU_COMPRESSION_SUPPORT
+	Compression::Stream file_stream;         // pending decompression of file data
+	bool file_stream_active {false};         // file_stream needs to be released
+	off_t file_stream_off {0};               // file offset of the remaining compressed data
+	uint32_t file_stream_left {0};           // remaining compressed data size
+	uint32_t file_stream_size {0};           // complete decompressed data size
+	uint32_t file_stream_hash {0};           // expected adler32 of decompressed data
+#endif
 	uint8_t *sym_buf {nullptr};              // pointer to buffer (normally __LINKEDIT) containing symbols to solve
 	bool sym_buf_ro {false};                 // sym_buf is read-only (not copy).
 	uint64_t sym_fileoff {0};                // file offset of symbols (normally __LINKEDIT) so we can read
@@ -62,14 +71,34 @@ class MachInfo {
 	mach_header_native *running_mh {nullptr};    // pointer to mach-o header of running kernel item
 	mach_vm_address_t address_slots {0};     // pointer after mach-o header to store pointers
 	mach_vm_address_t address_slots_end {0}; // pointer after mach-o header to store pointers
+	evector<mach_vm_address_t> free_address_slots; // released address slots available for reuse
+	size_t address_slots_allocated {0};      // address slots taken from mach-o header padding
+	size_t address_slots_reused {0};         // address slots taken from the released ones
+	size_t address_slots_overflown {0};      // address slots taken from the shared overflow page
+	size_t address_slots_wasted {0};         // address slots discarded as out of reach
+	bool overflow_address_slots_unreachable {false}; // shared overflow page is out of reach for this image
 	off_t fat_offset {0};                    // additional fat offset
 	size_t memory_size {HeaderSize};         // memory size
 	bool kaslr_slide_set {false};            // kaslr can be null, used for disambiguation
 	bool allow_decompress {true};            // allows mach decompression
+	bool verify_decompress {false};          // verifies decompressed mach checksum
 	bool prelink_slid {false};               // assume kaslr-slid kext addresses
 	bool kernel_collection {false};          // kernel collection (11.0+)
 	uint64_t self_uuid[2] {};                // saved uuid of the loaded kext or kernel
 
+	/**
+	 *  Shared address slots used once mach-o header padding is exhausted
+	 *  They reside in Lilu image, which is not guaranteed to be within 32-bit displacement reach
+	 *  of kernel collection code on 11.0+. The overflow path is thus best-effort, and callers
+	 *  must check the reach and fall back to long jumps by discarding the slot.
+	 */
+	static mach_vm_address_t overflow_address_slots[PAGE_SIZE / sizeof(mach_vm_address_t)];
+
+	/**
+	 *  Amount of used overflow address slots, shared by all the images
+	 */
+	static _Atomic(size_t) overflow_address_slots_used;
+
 	/**
 	 *  Kernel slide is aligned by 20 bits
 	 */
@@ -126,6 +155,24 @@ class MachInfo {
 	 */
 	kern_return_t readSymbols(vnode_t vnode, vfs_context_t ctxt);
 
+#ifdef LILU_COMPRESSION_SUPPORT
+	/**
+	 *  Continue decompressing file data from disk until the requested prefix is available in file_buf
+	 *
+	 *  @param vnode file node
+	 *  @param ctxt  filesystem context
+	 *  @param size  requested decompressed data size
+	 *
+	 *  @return KERN_SUCCESS if file_buf contains no less than size bytes
+	 */
+	kern_return_t decompressFileData(vnode_t vnode, vfs_context_t ctxt, size_t size);
+
+	/**
+	 *  Release pending file data decompression, already decompressed data is kept
+	 */
+	void finishFileDecompression();
+#endif /* LILU_COMPRESSION_SUPPORT */
+
 	/**
 	 *  Retrieve necessary mach-o header information from the mach header
 	 *
@@ -238,12 +285,57 @@ public:
 
 	/**
 	 *  Get address slot if present
+	 *  Released slots are reused first, then mach-o header padding, then the shared overflow page
+	 *  unless it was previously found out of reach for this image.
 	 *
 	 *  @return address slot on success
-	 *  @return NULL on success
+	 *  @return NULL on failure
 	 */
 	mach_vm_address_t getAddressSlot();
 
+	/**
+	 *  Check whether the address is an address slot of this image
+	 *
+	 *  @param slot  address to check
+	 *
+	 *  @return true if slot was obtained from getAddressSlot
+	 */
+	bool isAddressSlot(mach_vm_address_t slot);
+
+	/**
+	 *  Return address slot for later reuse
+	 *
+	 *  @param slot  address slot previously obtained from getAddressSlot
+	 */
+	void releaseAddressSlot(mach_vm_address_t slot);
+
+	/**
+	 *  Drop address slot that cannot be used, it is never returned again
+	 *  Discarding an overflow slot stops further overflow allocations for this image.
+	 *
+	 *  @param slot  address slot previously obtained from getAddressSlot
+	 */
+	void discardAddressSlot(mach_vm_address_t slot);
+
+	/**
+	 *  Address slot usage statistics
+	 */
+	struct AddressSlotStatistics {
+		size_t allocated {0};   // slots taken from mach-o header padding
+		size_t reused {0};      // slots taken from the released ones
+		size_t overflown {0};   // slots taken from the shared overflow page
+		size_t released {0};    // slots currently awaiting reuse
+		size_t wasted {0};      // slots discarded as out of reach
+		size_t available {0};   // slots left in mach-o header padding
+	};
+
+	/**
+	 *  Retrieve address slot usage statistics
+	 *
+	 *  @param stats  statistics to fill
+	 */
+	void getAddressSlotStatistics(AddressSlotStatistics &stats);
+
 	/**
 	 *  Retrieve the mach header and __TEXT addresses
 	 *
@@ -54,6 +54,18 @@ public:
 	 */
 	EXPORT uint8_t *compress(const uint8_t *src, uint32_t &size, bool sensitive=false);
 
+	/**
+	 *  Compress data with compression chosen by storage options
+	 *
+	 *  @param src        source data
+	 *  @param size       data size (updated with new size)
+	 *  @param sensitive  contains sensitive data
+	 *  @param opts       bitmask of Options, OptCompressFast selects faster compression, OptCompressLZVN selects LZVN
+	 *
+	 *  @return compressed data (must be freed with Buffer::deleter) or nullptr
+	 */
+	EXPORT uint8_t *compress(const uint8_t *src, uint32_t &size, bool sensitive, uint8_t opts);
+
 	/**
 	 *  Decompress data compressed with compress
 	 *
@@ -65,6 +77,18 @@ public:
 	 */
 	EXPORT uint8_t *decompress(const uint8_t *src, uint32_t &size, bool sensitive=false);
 
+	/**
+	 *  Decompress data compressed with compress using storage options
+	 *
+	 *  @param src        compressed data
+	 *  @param size       data size (updated with new size)
+	 *  @param sensitive  contains sensitive data
+	 *  @param opts       bitmask of Options, OptCompressLZVN selects LZVN
+	 *
+	 *  @return decompressed data (must be freed with Buffer::deleter) or nullptr
+	 */
+	EXPORT uint8_t *decompress(const uint8_t *src, uint32_t &size, bool sensitive, uint8_t opts);
+
 	/**
 	 *  Value storage options
 	 */
@@ -74,7 +98,9 @@ public:
 		OptCompressed   = 2,  // Apply compression (see kern_compression.hpp)
 		OptEncrypted    = 4,  // Apply encryption with device-unique key (see kern_crypto.hpp)
 		OptChecksum     = 8,  // Append CRC32 checksum to the end
-		OptSensitive    = 16  // Value contains sensitive data
+		OptSensitive    = 16, // Value contains sensitive data
+		OptCompressFast = 32, // Prefer compression speed over ratio with OptCompressed (not stored)
+		OptCompressLZVN = 64  // Use LZVN instead of LZSS with OptCompressed (written as version 2, not required for reading)
 	};
 
 	/**
@@ -88,11 +114,12 @@ public:
 	 */
 	struct PACKED Header {
 		static constexpr uint16_t Magic = 0xC717;
-		static constexpr uint8_t MaxVer = 1;
+		static constexpr uint8_t MaxVer = 2;
+		static constexpr uint8_t LZSSVer = 1;
 		using Checksum = uint32_t;
 
 		uint16_t magic {Magic};
-		uint8_t version {MaxVer};
+		uint8_t version {LZSSVer};
 		uint8_t opts {OptAuto};
 	};
 
@@ -591,6 +591,34 @@ public:
 		return routeMultipleShort(id, requests, N, start, size, kernelRoute, force);
 	}
 
+	/**
+	 *  Serialize applied patch journal for post-mortem inspection
+	 *  Each record consists of 64-bit address, 8-bit size, and 16 bytes of original contents.
+	 *
+	 *  @param buffer  destination buffer or nullptr to query the size
+	 *  @param size    destination buffer size
+	 *
+	 *  @return journal size in bytes, 0 if the buffer is too small
+	 */
+	EXPORT size_t serializePatchJournal(uint8_t *buffer, size_t size);
+
+	/**
+	 *  Revert a revertible kernel route made by routeFunction or routeMultiple
+	 *  The address slot of a medium route is returned for reuse, the trampoline is not freed.
+	 *  Routes that were routed again afterwards cannot be reverted.
+	 *
+	 *  @param from  routed function
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool revertRoute(mach_vm_address_t from);
+
+	/**
+	 *  Print call and cycle statistics of instrumented routes to the system log
+	 *  Routes are only instrumented when -liluprof boot argument is passed.
+	 */
+	EXPORT void dumpRouteStatistics();
+
 	/**
 	 *  Find one pattern with optional masking within a block of memory
 	 *
@@ -654,11 +682,31 @@ private:
 	 */
 	static uint8_t tempExecutableMemory[TempExecutableMemorySize];
 
+	/**
+	 *  Maximum size of a relocated function prologue in a trampoline
+	 */
+	static constexpr size_t MaxTrampolinePrologue {256};
+
 	/**
 	 *  Offset to tempExecutableMemory that is safe to use
 	 */
 	size_t tempExecutableMemoryOff {0};
 
+	/**
+	 *  Executable memory reserved for instrumented wrappers, enough for about 52 routes
+	 */
+	static constexpr size_t InstrumentedExecutableMemorySize {8192};
+
+	/**
+	 *  Instrumented wrappers are kept apart from trampolines, so that -liluprof does not exhaust tempExecutableMemory
+	 */
+	static uint8_t instrumentedExecutableMemory[InstrumentedExecutableMemorySize];
+
+	/**
+	 *  Offset to instrumentedExecutableMemory that is safe to use
+	 */
+	size_t instrumentedExecutableMemoryOff {0};
+
 	/**
 	 *  Patcher status
 	 */
@@ -674,6 +722,16 @@ private:
 	 */
 	mach_vm_address_t readChain(mach_vm_address_t from, JumpType &jumpType);
 
+	/**
+	 *  Obtain an address slot reachable with a medium jump
+	 *
+	 *  @param info  info to access address slots
+	 *  @param from  function to route
+	 *
+	 *  @return address slot or 0
+	 */
+	mach_vm_address_t getReachableAddressSlot(MachInfo *info, mach_vm_address_t from);
+
 	/**
 	 *  Created routed trampoline page
 	 *
@@ -686,6 +744,16 @@ private:
 	 */
 	mach_vm_address_t createTrampoline(mach_vm_address_t func, size_t min, const uint8_t *opcodes=nullptr, size_t opnum=0);
 
+	/**
+	 *  Check whether a long jump can be written over the function directly instead of a slotted one:
+	 *  the overwritten prologue must stay within the function and be relocatable into the next trampoline
+	 *
+	 *  @param from  function to route
+	 *
+	 *  @return true if no address slot is needed
+	 */
+	bool canRouteLong(mach_vm_address_t from);
+
 	/**
 	 *  Route function to function
 	 *
@@ -702,6 +770,101 @@ private:
 	 */
 	mach_vm_address_t routeFunctionInternal(mach_vm_address_t from, mach_vm_address_t to, bool buildWrapper=false, bool kernelRoute=true, bool revertible=true, JumpType jumpType=JumpType::Auto, MachInfo *info=nullptr, mach_vm_address_t *org=nullptr);
 
+	/**
+	 *  Amount of per-CPU counter slots of instrumented routes, XNU MAX_CPUS
+	 */
+	static constexpr size_t InstrumentedCpuSlots {64};
+
+	/**
+	 *  Routed function statistics updated by instrumented wrappers
+	 *  Every CPU updates counters in its own cache line, they are summed when dumping.
+	 */
+	struct RouteStatistics {
+		/**
+		 *  Counters of one CPU slot, field order and size are relied upon by the generated wrapper code.
+		 */
+		struct CpuCounters {
+			_Atomic(uint64_t) calls;
+			_Atomic(uint64_t) cycles;
+			_Atomic(uint64_t) maxCycles;
+			uint64_t padding[5];
+		};
+
+		/**
+		 *  Counter slots indexed by the logical CPU number, aligned to a cache line
+		 */
+		CpuCounters *cpus {nullptr};
+
+		/**
+		 *  Allocated counter memory
+		 */
+		uint8_t *storage {nullptr};
+
+		const char *symbol {nullptr};
+
+		static RouteStatistics *create(const char *s) {
+			auto stats = new RouteStatistics;
+			if (!stats) return nullptr;
+			size_t size = sizeof(CpuCounters) * InstrumentedCpuSlots;
+			stats->storage = Buffer::create<uint8_t>(size + sizeof(CpuCounters));
+			if (!stats->storage) {
+				delete stats;
+				return nullptr;
+			}
+			auto addr = reinterpret_cast<uintptr_t>(stats->storage);
+			addr = (addr + sizeof(CpuCounters) - 1) & ~(static_cast<uintptr_t>(sizeof(CpuCounters)) - 1);
+			stats->cpus = reinterpret_cast<CpuCounters *>(addr);
+			memset(stats->cpus, 0, size);
+			stats->symbol = s;
+			return stats;
+		}
+		static void deleter(RouteStatistics *i NONNULL) {
+			Buffer::deleter(i->storage);
+			delete i;
+		}
+	};
+
+	/**
+	 *  Instrument routes with call and cycle counters (-liluprof)
+	 */
+	bool instrumentRoutes {false};
+
+	/**
+	 *  Offset of the logical CPU number in the per-CPU data at gs, 0 when unknown
+	 */
+	uint32_t cpuNumberOffset {0};
+
+	/**
+	 *  Find the per-CPU data offset read by cpu_number()
+	 *
+	 *  @return offset or 0
+	 */
+	uint32_t findCpuNumberOffset();
+
+	/**
+	 *  Statistics of instrumented routes
+	 */
+	evector<RouteStatistics *, RouteStatistics::deleter> routeStatistics;
+
+	/**
+	 *  Amount of stack arguments copied by instrumented wrappers
+	 */
+	static constexpr size_t InstrumentedStackArgs {8};
+
+	/**
+	 *  Create a wrapper calling the routed function and accounting its calls and TSC cycles
+	 *  in the counter slot of the current CPU, or in the first slot when cpuNumberOffset is unknown.
+	 *  Only the first InstrumentedStackArgs stack argument slots are passed to the routed function,
+	 *  so functions taking more than 6 + InstrumentedStackArgs integer arguments must not be instrumented.
+	 *  Routes are left uninstrumented once instrumentedExecutableMemory is exhausted.
+	 *
+	 *  @param symbol  routed symbol name
+	 *  @param to      routed function
+	 *
+	 *  @return wrapper pointer or 0
+	 */
+	mach_vm_address_t createInstrumentedWrapper(const char *symbol, mach_vm_address_t to);
+
 	/**
 	 *  Simple route multiple functions with basic error handling with long routes
 	 *
@@ -780,9 +943,54 @@ private:
 	evector<MachInfo *, MachInfo::deleter> kinfos;
 
 	/**
-	 *  Applied patches
+	 *  Applied patch journal record storing the original memory contents
+	 */
+	struct PACKED PatchRecord {
+		mach_vm_address_t address;
+		uint8_t size;
+		uint8_t original[sizeof(uint64_t) * 2];
+	};
+
+	/**
+	 *  Applied patches journal, restored in reverse order
+	 */
+	evector<PatchRecord> kpatches;
+
+	/**
+	 *  Revertible route record
+	 */
+	struct RouteRecord {
+		mach_vm_address_t from;
+		mach_vm_address_t to;
+		mach_vm_address_t slot;
+		MachInfo *info;
+	};
+
+	/**
+	 *  Revertible routes with their address slots
+	 */
+	evector<RouteRecord> kroutes;
+
+	/**
+	 *  Append applied patch to the journal
+	 *
+	 *  @param patch  patch to record
+	 *
+	 *  @return true on success
+	 */
+	bool journalPatch(const Patch::All *patch);
+
+	/**
+	 *  Restore journaled patch, kernel writing must be enabled
+	 *
+	 *  @param record  patch record
+	 */
+	static void restorePatch(const PatchRecord &record);
+
+	/**
+	 *  Restore all the journaled patches, kernel writing must be enabled
 	 */
-	evector<Patch::All *, Patch::deleter> kpatches;
+	void restorePatches();
 
 #ifdef LILU_KEXTPATCH_SUPPORT	
 	/**
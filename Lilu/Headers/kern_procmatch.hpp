@@ -0,0 +1,145 @@
+//
+//  kern_procmatch.hpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef kern_procmatch_hpp
+#define kern_procmatch_hpp
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_util.hpp>
+
+#include <stdint.h>
+
+/**
+ *  Process path matcher: a trie for exact and prefix paths,
+ *  a reversed trie for suffix paths, and an Aho-Corasick automaton for substrings
+ */
+class ProcMatcher {
+	struct Node {
+		uint32_t child {0};
+		uint32_t sibling {0};
+		uint32_t fail {0};
+		uint8_t label {0};
+		uint8_t flags {0};
+	};
+
+	/**
+	 *  Node terminal flags
+	 */
+	enum : uint8_t {
+		TerminalExact  = 1,
+		TerminalPrefix = 2,
+		TerminalSuffix = 4,
+		TerminalAny    = 8
+	};
+
+	/**
+	 *  Roots of the forward, reversed and substring tries
+	 */
+	enum : uint32_t {
+		RootForward,
+		RootReverse,
+		RootAny,
+		RootTotal
+	};
+
+	/**
+	 *  All trie nodes, 0 child or sibling means none as the first node is a root
+	 */
+	evector<Node> nodes;
+
+	/**
+	 *  Find node child by label
+	 *
+	 *  @param node   parent node
+	 *  @param label  child label
+	 *
+	 *  @return child node or 0
+	 */
+	uint32_t findChild(uint32_t node, uint8_t label) const;
+
+	/**
+	 *  Insert string into a trie
+	 *
+	 *  @param root     trie root
+	 *  @param str      string
+	 *  @param len      string length
+	 *  @param reverse  insert string characters in reverse order
+	 *  @param flag     terminal flag to set on the last node
+	 *
+	 *  @return true on success
+	 */
+	bool insert(uint32_t root, const char *str, uint32_t len, bool reverse, uint8_t flag);
+
+public:
+	/**
+	 *  Path matching modes
+	 */
+	enum Mode {
+		ModeExact,
+		ModePrefix,
+		ModeSuffix,
+		ModeAny
+	};
+
+	/**
+	 *  Previously published matcher, kept alive by the owner until deinit as readers may still use it
+	 */
+	ProcMatcher *previous {nullptr};
+
+	/**
+	 *  Prepare an empty matcher, must be called before adding paths
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool init();
+
+	/**
+	 *  Add path to match
+	 *
+	 *  @param path  path or its part
+	 *  @param len   path length
+	 *  @param mode  matching mode
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool add(const char *path, uint32_t len, Mode mode);
+
+	/**
+	 *  Build Aho-Corasick failure links for the substring trie, must be called after adding paths
+	 *
+	 *  @return true on success
+	 */
+	EXPORT bool finish();
+
+	/**
+	 *  Check whether any added path matches the path
+	 *
+	 *  @param path  null-terminated binary path
+	 *  @param len   path length
+	 *
+	 *  @return true on match
+	 */
+	EXPORT bool match(const char *path, uint32_t len) const;
+
+	/**
+	 *  Amount of trie nodes
+	 *
+	 *  @return node count
+	 */
+	size_t size() const {
+		return nodes.size();
+	}
+
+	/**
+	 *  Release matcher memory
+	 */
+	void deinit() {
+		nodes.deinit();
+	}
+};
+
+#endif /* kern_procmatch_hpp */
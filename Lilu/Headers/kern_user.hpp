@@ -10,6 +10,9 @@
 
 #include <Headers/kern_config.hpp>
 #include <Headers/kern_patcher.hpp>
+#include <Headers/kern_dyld.hpp>
+#include <Headers/kern_lookup.hpp>
+#include <Headers/kern_procmatch.hpp>
 
 #include <mach/shared_region.h>
 #include <sys/kauth.h>
@@ -301,29 +304,64 @@ private:
 	 */
 	void performPagePatch(const void *data_ptr, size_t data_size);
 
+	/**
+	 *  Maximum amount of pages which fingerprints are gathered and filtered at once
+	 */
+	static constexpr size_t PagePatchBatch {8};
+
+	/**
+	 *  Verifies a page that passed the lookup filter and applies its patches
+	 *
+	 *  @param ptr    page in kernel memory
+	 *  @param value  page key computed by lookup.key
+	 */
+	void patchLookupPage(const uint8_t *ptr, uint64_t value);
+
 	/**
 	 * dyld shared cache map entry structure
 	 */
-	struct MapEntry {
-		const char *filename;
-		size_t length;
-		vm_address_t startTEXT;
-		vm_address_t endTEXT;
-		vm_address_t startDATA;
-		vm_address_t endDATA;
-	};
+	using MapEntry = DyldCache::MapEntry;
 
 	/**
-	 *  Obtains __TEXT addresses from .map files
+	 *  Obtains __TEXT and __DATA addresses from dyld shared cache header and images table
+	 *  Cache files are accessed through vnodes, parsing is done by DyldCache.
 	 *
-	 *  @param mapBuf     read .map file
-	 *  @param mapSz      .map file size
+	 *  @param cachePath  main cache file path
 	 *  @param mapEntries entries to look for
 	 *  @param nentries   number of entries
+	 *  @param nfound     number of entries found
 	 *
-	 *  @return number of entries found
+	 *  @return true if the cache was read
+	 */
+	bool mapAddressesFromCache(const char *cachePath, MapEntry *mapEntries, size_t nentries, size_t &nfound);
+
+	/**
+	 *  Size of a single .map file read, lines longer than this are ignored
 	 */
-	size_t mapAddresses(const char *mapBuf, MapEntry *mapEntries, size_t nentries);
+	static constexpr size_t MapReadChunkSize {64*1024};
+
+	/**
+	 *  Parses image segment line of a .map file
+	 *
+	 *  @param line        segment line
+	 *  @param path        image path the segment belongs to
+	 *  @param len         image path length
+	 *  @param mapEntries  entries to update
+	 *  @param nentries    number of entries
+	 */
+	static void mapSegment(const char *line, const char *path, size_t len, MapEntry *mapEntries, size_t nentries);
+
+	/**
+	 *  Obtains __TEXT and __DATA addresses from .map files, reading them in chunks
+	 *
+	 *  @param mapPath    .map file path
+	 *  @param mapEntries entries to look for
+	 *  @param nentries   number of entries
+	 *  @param nfound     number of entries found
+	 *
+	 *  @return true if the file was read
+	 */
+	bool mapAddresses(const char *mapPath, MapEntry *mapEntries, size_t nentries, size_t &nfound);
 
 	/**
 	 *  Stored ASLR slide of dyld shared cache
@@ -360,10 +398,21 @@ private:
 		uint32_t pathLen {0};
 	};
 
+	/**
+	 *  Minimum number of threads with pending callbacks
+	 */
+	static constexpr size_t MinPendingUsers {256};
+
+	/**
+	 *  Number of threads with pending callbacks reserved per logical CPU, enough for
+	 *  exec storms on high core count machines
+	 */
+	static constexpr size_t PendingUsersPerCpu {8};
+
 	/**
 	 *  Stored pending callback
 	 */
-	ThreadLocal<PendingUser *, 32> pending;
+	ThreadLocalMap<PendingUser *> pending;
 
 	/**
 	 *  Current minimal proc name length
@@ -390,6 +439,22 @@ private:
 	 */
 	size_t procInfoSize {0};
 
+	/**
+	 *  Compile process path matcher from the process list
+	 *
+	 *  @param matcher  matcher to fill
+	 *  @param procs    process list
+	 *  @param procNum  process list size
+	 *
+	 *  @return true on success
+	 */
+	static bool compileProcMatcher(ProcMatcher &matcher, ProcInfo **procs, size_t procNum);
+
+	/**
+	 *  Compiled process path matcher, replaced atomically as onPath may run concurrently
+	 */
+	_Atomic(ProcMatcher *) procMatcher {};
+
 	/**
 	 *  Provided global callback for on proc invocation
 	 */
@@ -405,6 +470,15 @@ private:
 	 */
 	void patchSharedCache(vm_map_t map, uint32_t slide, cpu_type_t cpu, bool applyChanges=true);
 
+	/**
+	 *  Shared cache patch place in the current process
+	 */
+	struct SharedCachePlace {
+		vm_address_t address;
+		const BinaryModPatch *patch;
+		size_t order;
+	};
+
 	/**
 	 *  Structure holding userspace lookup patches
 	 */
@@ -428,6 +502,16 @@ private:
 		Page *page {nullptr};
 		vm_address_t pageOff {0};
 
+		/**
+		 *  Original page digest keyed with digestKey, the page copy is released once lookups are loaded
+		 */
+		uint64_t digest[2] {};
+
+		/**
+		 *  Original bytes of every range to be patched in refs and pageOffs order, verified before writing
+		 */
+		evector<uint8_t> original;
+
 		static LookupStorage *create() {
 			auto p = new LookupStorage;
 			if (p) {
@@ -446,18 +530,25 @@ private:
 				p->page = nullptr;
 			}
 			p->refs.deinit();
+			p->original.deinit();
 			delete p;
 		}
 	};
 
-	struct Lookup {
-		uint32_t offs[4] {};
-		static constexpr size_t matchNum {4};
-		evector<uint64_t> c[matchNum];
-	};
-
 	evector<LookupStorage *, LookupStorage::deleter> lookupStorage;
-	Lookup lookup;
+	PageLookup lookup;
+
+	/**
+	 *  Per-boot random page digest key, so that pages colliding with the patched ones cannot be prepared in advance
+	 */
+	uint64_t digestKey[2] {};
+
+	/**
+	 *  Open-addressed hash table mapping page offsets to lookupStorage indices plus one (0 is empty),
+	 *  only valid while loading files for patching
+	 */
+	uint32_t *storageMap {nullptr};
+	size_t storageMapMask {0};
 	
 	/**
 	 *  Restrict 64-bit entry overlapping DYLD_SHARED_CACHE to enforce manual library loading
@@ -533,6 +624,16 @@ private:
 	 */
 	void onPath(const char *path, uint32_t len);
 
+	/**
+	 *  Check whether the path matches any process by going through procInfo
+	 *
+	 *  @param path binary path
+	 *  @param len  path length
+	 *
+	 *  @return true on match
+	 */
+	bool matchProcInfo(const char *path, uint32_t len);
+
 	/**
 	 *  Reads files from BinaryModInfos and prepares lookupStorage
 	 *
@@ -540,6 +641,69 @@ private:
 	 */
 	bool loadFilesForPatching();
 
+	/**
+	 *  Checks whether a patch is matched in the same section pass as the given first patch
+	 *
+	 *  @param patch  patch to check
+	 *  @param first  first enabled patch of the pass
+	 *
+	 *  @return true if both patches target the same segment and cpu
+	 */
+	static bool isSameScanGroup(const BinaryModPatch &patch, const BinaryModPatch &first);
+
+	/**
+	 *  Matches all patches of the same scan group in a single pass over the section
+	 *
+	 *  @param mod         binary modification info
+	 *  @param first       first enabled patch of the group
+	 *  @param sectionptr  section data in the file buffer
+	 *  @param size        section size
+	 *  @param vmsegment   segment virtual address
+	 *  @param vmsection   section virtual address
+	 */
+	void scanSectionForPatches(const BinaryModInfo *mod, size_t first, uint8_t *sectionptr, size_t size, vm_address_t vmsegment, vm_address_t vmsection);
+
+	/**
+	 *  Records a found patch occurrence in lookupStorage
+	 *
+	 *  @param mod         binary modification info
+	 *  @param p           patch index
+	 *  @param sectionptr  section data in the file buffer
+	 *  @param sectOff     occurrence offset in the section
+	 *  @param vmsegment   segment virtual address
+	 *  @param vmsection   section virtual address
+	 *
+	 *  @return true on success
+	 */
+	bool addPatchReference(const BinaryModInfo *mod, size_t p, uint8_t *sectionptr, off_t sectOff, vm_address_t vmsegment, vm_address_t vmsection);
+
+	/**
+	 *  Compute page offset hash for storageMap
+	 *
+	 *  @param pageOff  page offset
+	 *
+	 *  @return unmasked hash
+	 */
+	static size_t hashPageOffset(vm_address_t pageOff);
+
+	/**
+	 *  Finds lookupStorage entry by page offset
+	 *
+	 *  @param pageOff  page offset
+	 *
+	 *  @return entry or nullptr
+	 */
+	LookupStorage *findLookupStorage(vm_address_t pageOff);
+
+	/**
+	 *  Adds lookupStorage entry to storageMap, growing it when needed
+	 *
+	 *  @param index  lookupStorage index
+	 *
+	 *  @return true on success
+	 */
+	bool mapLookupStorage(size_t index);
+
 	/**
 	 *  Reads dyld shared cache and obtains segment offsets
 	 *
@@ -548,12 +712,41 @@ private:
 	bool loadDyldSharedCacheMapping();
 
 	/**
-	 *  Prepares quick page lookup based on lookupStorage values
+	 *  Prepares quick page lookup based on lookupStorage values,
+	 *  must be called once before memory access is hooked
 	 *
 	 *  @return true on success
 	 */
 	bool loadLookups();
 
+	/**
+	 *  Computes 128-bit SipHash-2-4 digest of page contents
+	 *
+	 *  @param page    page contents of PAGE_SIZE bytes
+	 *  @param key     secret key
+	 *  @param digest  resulting digest
+	 */
+	static void computePageDigest(const uint8_t *page, const uint64_t key[2], uint64_t digest[2]);
+
+	/**
+	 *  Saves original bytes of the ranges to be patched from the page copy
+	 *
+	 *  @param storage  lookup storage entry with its page copy
+	 *
+	 *  @return true on success
+	 */
+	static bool savePatchRanges(LookupStorage *storage);
+
+	/**
+	 *  Checks that the ranges to be patched still hold their original bytes
+	 *
+	 *  @param storage  lookup storage entry
+	 *  @param ptr      page contents
+	 *
+	 *  @return true if every range matches
+	 */
+	static bool matchPatchRanges(const LookupStorage *storage, const uint8_t *ptr);
+
 	/**
 	 *  Hooks memory access to get ready for patching
 	 *
@@ -757,6 +757,181 @@ public:
 	}
 };
 
+/**
+ *  Thread specific container of T values with capacity chosen at runtime.
+ *  Slots are found by hashing the thread identifier with linear probing,
+ *  so that operations do not scan the whole container.
+ */
+template <typename T>
+class ThreadLocalMap {
+	/**
+	 *  A list of tread identifiers
+	 */
+	_Atomic(thread_t) *threads {nullptr};
+
+	/**
+	 *  A list of value references
+	 */
+	T *values {nullptr};
+
+	/**
+	 *  Capacity mask, capacity is a power of two
+	 */
+	size_t mask {0};
+
+	/**
+	 *  Largest distance from a home slot any thread was stored at, never exceeds ProbeLimit
+	 *  It only grows, as lowering it would race with concurrent insertions.
+	 */
+	_Atomic(size_t) maxProbe {};
+
+	/**
+	 *  Maximum distance from a home slot, bounds the cost of every operation
+	 *  With capacity sized well above the amount of threads longer probes are practically unreachable.
+	 */
+	static constexpr size_t ProbeLimit {32};
+
+	/**
+	 *  Compute thread home slot
+	 *
+	 *  @param thread  thread identifier
+	 *
+	 *  @return slot index
+	 */
+	size_t home(thread_t thread) {
+		return static_cast<size_t>((reinterpret_cast<uintptr_t>(thread) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	}
+
+	/**
+	 *  Find thread slot
+	 *
+	 *  @param thread  thread identifier
+	 *
+	 *  @return slot index or capacity if missing
+	 */
+	size_t find(thread_t thread) {
+		if (!threads)
+			return mask + 1;
+
+		size_t start = home(thread);
+		size_t probe = atomic_load_explicit(&maxProbe, memory_order_acquire);
+		for (size_t i = 0; i <= probe; i++) {
+			size_t slot = (start + i) & mask;
+			if (atomic_load_explicit(&threads[slot], memory_order_acquire) == thread)
+				return slot;
+		}
+
+		return mask + 1;
+	}
+
+public:
+	/**
+	 *  Initialise storage
+	 *
+	 *  @param capacity  maximum number of threads, rounded up to a power of two
+	 *
+	 *  @return true on success
+	 */
+	bool init(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity)
+			size *= 2;
+
+		threads = Buffer::create<_Atomic(thread_t)>(size);
+		values = Buffer::create<T>(size);
+		if (!threads || !values) {
+			deinit();
+			return false;
+		}
+
+		for (size_t i = 0; i < size; i++) {
+			atomic_init(&threads[i], nullptr);
+			values[i] = {};
+		}
+
+		mask = size - 1;
+		atomic_init(&maxProbe, 0);
+		return true;
+	}
+
+	/**
+	 *  Deinitialise storage, must not be called while other threads may still access it
+	 */
+	void deinit() {
+		if (threads) {
+			Buffer::deleter(threads);
+			threads = nullptr;
+		}
+		if (values) {
+			Buffer::deleter(values);
+			values = nullptr;
+		}
+		mask = 0;
+	}
+
+	/**
+	 *  Set or overwrite thread specific value
+	 *
+	 *  @param value  value to store
+	 *
+	 *  @return true on success
+	 */
+	bool set(T value) {
+		if (!threads)
+			return false;
+
+		auto currThread = current_thread();
+		T *ptr = get();
+
+		// Claim the closest free slot starting from the home one
+		size_t start = home(currThread);
+		for (size_t i = 0; ptr == nullptr && i <= mask && i < ProbeLimit; i++) {
+			size_t slot = (start + i) & mask;
+			thread_t nullThread = nullptr;
+			if (atomic_compare_exchange_strong_explicit(&threads[slot], &nullThread, currThread,
+				memory_order_acq_rel, memory_order_acquire)) {
+				// Let lookups reach the slot
+				size_t probe = atomic_load_explicit(&maxProbe, memory_order_relaxed);
+				while (probe < i && !atomic_compare_exchange_weak_explicit(&maxProbe, &probe, i,
+					memory_order_acq_rel, memory_order_relaxed));
+				ptr = &values[slot];
+			}
+		}
+
+		// Insert if we can
+		if (ptr) *ptr = value;
+
+		return ptr != nullptr;
+	}
+
+	/**
+	 *  Get thread specific value
+	 *
+	 *  @return pointer to stored value on success
+	 */
+	T *get() {
+		size_t slot = find(current_thread());
+		return slot <= mask && threads ? &values[slot] : nullptr;
+	}
+
+	/**
+	 *  Unset thread specific value if present
+	 *
+	 *  @return true on success
+	 */
+	bool erase() {
+		auto currThread = current_thread();
+		size_t slot = find(currThread);
+		if (slot > mask || !threads)
+			return false;
+
+		values[slot] = {};
+		thread_t nullThread = nullptr;
+		return atomic_compare_exchange_strong_explicit(&threads[slot], &currThread,
+			nullThread, memory_order_acq_rel, memory_order_acquire);
+	}
+};
+
 /**
  *  Use this deleter when storing scalar types
  */
@@ -31,6 +31,8 @@ class Configuration {
 	static constexpr const char *bootargLowMem {"-lilulowmem"};     // Disable decompression
 	static constexpr const char *bootargDelay {"liludelay"};        // Extra delay timeout after each printed message
 	static constexpr const char *bootargDump {"liludump"};          // Dump lilu log to /Lilu...txt after N seconds
+	static constexpr const char *bootargProfile {"-liluprof"};      // Collect call and cycle statistics for routed functions
+	static constexpr const char *bootargVerify {"-liluverify"};     // Verify checksums of decompressed binaries
 
 public:
 	/**
@@ -219,6 +221,16 @@ public:
 	 */
 	bool allowDecompress {true};
 
+	/**
+	 *  Verify adler32 checksums of decompressed binaries
+	 */
+	bool verifyDecompress {false};
+
+	/**
+	 *  Instrument function routes with call and cycle counters
+	 */
+	bool profileRoutes {false};
+
 	/**
 	 *  Install or recovery
 	 */
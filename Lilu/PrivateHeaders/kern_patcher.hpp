@@ -116,6 +116,36 @@ namespace Patch {
 				default: PANIC("patcher", "unsupported patch type %d, cannot restore", static_cast<int>(u8.type));
 			}
 		}
+
+		mach_vm_address_t address() const {
+			return u8.address;
+		}
+
+		size_t size() const {
+			switch (u8.type) {
+				case Variant::U8: return sizeof(u8.original);
+				case Variant::U16: return sizeof(u16.original);
+				case Variant::U32: return sizeof(u32.original);
+				case Variant::U64: return sizeof(u64.original);
+#if defined(__x86_64__)
+				case Variant::U128: return sizeof(u128.original);
+#endif
+				default: PANIC("patcher", "unsupported patch type %d, cannot get size", static_cast<int>(u8.type));
+			}
+		}
+
+		const void *original() const {
+			switch (u8.type) {
+				case Variant::U8: return &u8.original;
+				case Variant::U16: return &u16.original;
+				case Variant::U32: return &u32.original;
+				case Variant::U64: return &u64.original;
+#if defined(__x86_64__)
+				case Variant::U128: return &u128.original;
+#endif
+				default: PANIC("patcher", "unsupported patch type %d, cannot get original", static_cast<int>(u8.type));
+			}
+		}
 	};
 
 	template <Variant T>
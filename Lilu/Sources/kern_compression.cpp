@@ -19,390 +19,801 @@
 
 //
 // Zlib compression
-// Taken from /apple/xnu/libkern/c++/OSKext.cpp
 //
 #include <libkern/zlib.h>
-#include <libkern/crypto/sha1.h>
-
-extern "C" {
-	static void* z_alloc(void*, u_int items, u_int size);
-	static void z_free(void*, void *ptr);
-	
-	typedef struct z_mem {
-		UInt32 alloc_size;
-		UInt8 data[0];
-	} z_mem;
-
-	/*
-	 * Space allocation and freeing routines for use by zlib routines.
-	 */
-	void* z_alloc(void* notused __unused, u_int num_items, u_int size)
-	{
-		void* result = NULL;
-		z_mem* zmem = NULL;
-		UInt32 total = num_items * size;
-		UInt32 allocSize =  total + sizeof(zmem);
-
-		zmem = (z_mem*)IOMalloc(allocSize);
-
-		if (zmem)
-		{
-			zmem->alloc_size = allocSize;
-			result = (void*)&(zmem->data);
-		}
 
-		return result;
-	}
+/**
+ *  Space allocation and freeing routines for use by zlib routines.
+ *  kern_os_malloc keeps the allocation size itself, so no size prefix is needed.
+ */
+static void *z_alloc(void *, u_int items, u_int size) {
+	return Buffer::create<uint8_t>(static_cast<size_t>(items) * size);
+}
 
-	void z_free(void* notused __unused, void* ptr)
-	{
-		UInt32* skipper = (UInt32 *)ptr - 1;
-		z_mem* zmem = (z_mem*)skipper;
-		IOFree((void*)zmem, zmem->alloc_size);
+static void z_free(void *, void *ptr) {
+	if (ptr)
+		Buffer::deleter(static_cast<uint8_t *>(ptr));
+}
+
+/**
+ *  Inflate context shared by one-shot zlib decompression, it is never released.
+ *  Concurrent callers do not wait for it and use a temporary context instead.
+ */
+static Compression::Inflate sharedInflater;
+static _Atomic(bool) sharedInflaterBusy {};
+static bool sharedInflaterReady = false;
+
+static size_t decompress_zlib(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed) {
+	bool busy = false;
+	bool shared = atomic_compare_exchange_strong_explicit(&sharedInflaterBusy, &busy, true, memory_order_acquire, memory_order_relaxed);
+
+	Compression::Inflate temporary;
+	auto inflater = shared ? &sharedInflater : &temporary;
+	bool ready = shared && sharedInflaterReady;
+	if (!ready) {
+		ready = inflater->init();
+		if (!ready)
+			inflater->deinit();
+		else if (shared)
+			sharedInflaterReady = true;
 	}
-};
 
-static size_t decompress_zlib(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen) {
-	z_stream zstream;
-	int zlib_result;
 	size_t result = 0;
+	if (ready && inflater->decompress(dst, dstlen, src, srclen, consumed))
+		result = dstlen;
 
-	bzero(&zstream, sizeof(zstream));
+	if (shared)
+		atomic_store_explicit(&sharedInflaterBusy, false, memory_order_release);
+	else
+		temporary.deinit();
+
+	return result;
+}
 
-	zstream.next_in   = (unsigned char*)src;
-	zstream.avail_in  = srclen;
+// LZSS stream format of kext_tools/compression.c
 
-	zstream.next_out  = (unsigned char*)dst;
-	zstream.avail_out = dstlen;
+const size_t RBSIZE = 4096;      /* size of ring buffer - must be power of 2 */
+const size_t UPLIM = 18;         /* upper limit for match_length */
+const size_t THRESHOLD = 2;      /* encode string into position and length if match_length is greater than this */
 
-	zstream.zalloc    = z_alloc;
-	zstream.zfree     = z_free;
+/*
+ * Decoded data is its own history window: ring position i of a match maps to
+ * (RBSIZE - UPLIM + output offset) & (RBSIZE - 1), and positions preceding the
+ * output start read as the ' ' characters the ring buffer is filled with.
+ */
+static constexpr size_t LZSS_FAST_DST = 8 * (UPLIM + 8); /* room for a whole flag group with wide copy overrun */
+static constexpr size_t LZSS_FAST_SRC = 16;              /* longest flag group after its flag byte */
+
+static size_t lzss_decode(uint8_t *dststart, size_t dstpos, size_t dstlen, const uint8_t *&src, const uint8_t *srcend) {
+	uint8_t *dst = dststart + dstpos;
+	const uint8_t *dstend = dststart + dstlen;
+
+	while (src < srcend) {
+		unsigned int flags = *src++;
+		/* Away from buffer edges the whole group needs no bounds checks. */
+		bool fast = static_cast<size_t>(srcend - src) >= LZSS_FAST_SRC && static_cast<size_t>(dstend - dst) >= LZSS_FAST_DST;
+
+		for (int bit = 0; bit < 8; bit++, flags >>= 1) {
+			if (flags & 1) {
+				if (!fast && (src >= srcend || dst >= dstend))
+					return dst - dststart;
+				*dst++ = *src++;
+				continue;
+			}
 
-	zlib_result = inflateInit(&zstream);
+			if (!fast && srcend - src < 2)
+				return dst - dststart;
+
+			size_t i = src[0] | ((src[1] & 0xF0) << 4);
+			size_t len = (src[1] & 0x0F) + THRESHOLD + 1;
+			size_t pos = dst - dststart;
+			size_t dist = ((RBSIZE - UPLIM + pos - i - 1) & (RBSIZE - 1)) + 1;
+			src += 2;
+
+			if (fast && dist <= pos) {
+				if (dist >= sizeof(uint64_t)) {
+					/* Overlapping 8-byte chunks are safe, each one only reads already written data. */
+					for (size_t k = 0; k < len; k += sizeof(uint64_t))
+						memcpy(dst + k, dst + k - dist, sizeof(uint64_t));
+				} else {
+					for (size_t k = 0; k < len; k++)
+						dst[k] = dst[k - dist];
+				}
+				dst += len;
+				continue;
+			}
 
-	if (zlib_result != Z_OK)
-	{
-		return 0;
+			for (size_t k = 0; k < len; k++, pos++) {
+				if (dst >= dstend)
+					return dst - dststart;
+				*dst++ = pos >= dist ? dststart[pos - dist] : ' ';
+			}
+		}
 	}
 
-	zlib_result = inflate(&zstream, Z_FINISH);
+	return dst - dststart;
+}
 
-	if (zlib_result == Z_STREAM_END || zlib_result == Z_OK) {
-		result = zstream.total_out;
-	}
+static size_t decompress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed) {
+	const uint8_t *pos = src;
+	size_t size = lzss_decode(dst, 0, dstlen, pos, src + srclen);
+	if (consumed) *consumed = static_cast<uint32_t>(pos - src);
+	return size;
+}
 
-	inflateEnd(&zstream);
-	return result;
+static size_t decompress_lzvn(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed) {
+	size_t size = 0, dprev = 0;
+	size_t used = lzvn_decode_partial(dst, dstlen, &size, &dprev, src, srclen);
+	if (consumed) *consumed = static_cast<uint32_t>(used);
+	return size;
 }
 
-// Taken from kext_tools/compression.c
+/* Size of the leading complete flag groups, each is a flag byte with 1-byte literals and 2-byte matches. */
+static size_t lzss_complete_groups(const uint8_t *src, size_t srclen) {
+	size_t pos = 0;
+	while (pos < srclen) {
+		size_t group = 1 + 2 * 8 - __builtin_popcount(src[pos]);
+		if (srclen - pos < group)
+			break;
+		pos += group;
+	}
+	return pos;
+}
 
-const size_t RBSIZE = 4096;      /* size of ring buffer - must be power of 2 */
-const size_t UPLIM = 18;         /* upper limit for match_length */
-const size_t THRESHOLD = 2;      /* encode string into position and length if match_length is greater than this */
-const size_t NIL = RBSIZE;       /* index for root of binary search trees */
-
-struct encode_state {
-	/*
-	 * left & right children & parent. These constitute binary search trees.
-	 */
-	int lchild[RBSIZE + 1], rchild[RBSIZE + 257], parent[RBSIZE + 1];
-
-	/* ring buffer of size N, with extra F-1 bytes to aid string comparison */
-	uint8_t text_buf[RBSIZE + UPLIM - 1];
-
-	/*
-	 * match_length of longest match.
-	 * These are set by the insert_node() procedure.
-	 */
-	int match_position, match_length;
+/*
+ * Hash chain match finder state, positions are stored incremented by one,
+ * so that 0 terminates a chain.
+ */
+static constexpr size_t LZSS_HASH_SIZE = 4096;
+static constexpr size_t LZSS_WINDOW = RBSIZE - UPLIM;  /* farthest match distance */
+
+struct lzss_chain_state {
+	uint32_t head[LZSS_HASH_SIZE];  /* latest position for every hash */
+	uint32_t prev[RBSIZE];          /* previous position with the same hash, indexed by position */
 };
 
-static size_t decompress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen) {
-	/* ring buffer of size N, with extra F-1 bytes to aid string comparison */
-	uint8_t text_buf[RBSIZE + UPLIM - 1];
-	uint8_t *dststart = dst;
-	const uint8_t *dstend = dst + dstlen;
-	const uint8_t *srcend = src + srclen;
-	int  i, j, k, r, c;
-	unsigned int flags;
-
-	dst = dststart;
-	for (i = 0; i < static_cast<int>(RBSIZE - UPLIM); i++)
-		text_buf[i] = ' ';
-	r = RBSIZE - UPLIM;
-	flags = 0;
-	for ( ; ; ) {
-		if (((flags >>= 1) & 0x100) == 0) {
-			if (src < srcend) c = *src++; else break;
-			flags = c | 0xFF00;  /* uses higher byte cleverly */
-		}   /* to count eight */
-		if (flags & 1) {
-			if (src < srcend) c = *src++; else break;
-			if (dst < dstend) *dst++ = c; else break;
-			text_buf[r++] = c;
-			r &= (RBSIZE - 1);
+static inline size_t lzss_hash(const uint8_t *p) {
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 0x9E3779B1U) >> 20;
+}
+
+static uint8_t *compress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen, Compression::Level level) {
+	/* Chain depth and lazy evaluation for every effort level */
+	static constexpr uint32_t depths[] {4, 32, LZSS_WINDOW};
+	uint32_t depth = depths[level <= Compression::LevelMax ? level : Compression::LevelDefault];
+	bool lazy = level != Compression::LevelFast;
+
+	auto dstend = dst + dstlen;
+	uint8_t *result = nullptr;
+	uint8_t code_buf[17], mask = 1;
+	size_t code_buf_ptr = 1;
+	uint32_t pos = 0, mlen = 0, mpos = 0;
+	bool pending = false;
+
+	if (srclen == 0)
+		return nullptr;
+
+	auto sp = Buffer::create<lzss_chain_state>(1);
+	if (!sp)
+		return nullptr;
+
+	memset(sp->head, 0, sizeof(sp->head));
+	code_buf[0] = 0;
+
+	auto insert = [sp, src, srclen](uint32_t p) {
+		if (p + THRESHOLD < srclen) {
+			size_t h = lzss_hash(src + p);
+			sp->prev[p & (RBSIZE - 1)] = sp->head[h];
+			sp->head[h] = p + 1;
+		}
+	};
+
+	auto find = [sp, src, srclen, depth](uint32_t p, uint32_t &found) -> uint32_t {
+		uint32_t limit = srclen - p < UPLIM ? srclen - p : UPLIM;
+		if (limit <= THRESHOLD)
+			return 0;
+
+		uint32_t best = THRESHOLD;
+		uint32_t cand = sp->head[lzss_hash(src + p)];
+		for (uint32_t n = depth; cand != 0 && n > 0; n--) {
+			uint32_t c = cand - 1;
+			if (p - c > LZSS_WINDOW)
+				break;
+
+			if (src[c + best] == src[p + best]) {
+				uint32_t l = 0;
+				while (l < limit && src[c + l] == src[p + l])
+					l++;
+				if (l > best) {
+					best = l;
+					found = c;
+					if (l == limit)
+						break;
+				}
+			}
+
+			cand = sp->prev[c & (RBSIZE - 1)];
+		}
+
+		return best > THRESHOLD ? best : 0;
+	};
+
+	/* Send at most 8 units of code together, "1" flag bits mark literals. */
+	auto emit = [&](bool literal, uint8_t a, uint8_t b) {
+		if (literal) {
+			code_buf[0] |= mask;
+			code_buf[code_buf_ptr++] = a;
 		} else {
-			if (src < srcend) i = *src++; else break;
-			if (src < srcend) j = *src++; else break;
-			i |= ((j & 0xF0) << 4);
-			j  =  (j & 0x0F) + THRESHOLD;
-			for (k = 0; k <= j; k++) {
-				c = text_buf[(i + k) & (RBSIZE - 1)];
-				if (dst < dstend) *dst++ = c; else break;
-				text_buf[r++] = c;
-				r &= (RBSIZE - 1);
+			code_buf[code_buf_ptr++] = a;
+			code_buf[code_buf_ptr++] = b;
+		}
+
+		if ((mask <<= 1) == 0) {
+			if (static_cast<size_t>(dstend - dst) < code_buf_ptr)
+				return false;
+			lilu_os_memcpy(dst, code_buf, code_buf_ptr);
+			dst += code_buf_ptr;
+			code_buf[0] = 0;
+			code_buf_ptr = mask = 1;
+		}
+
+		return true;
+	};
+
+	while (pos < srclen) {
+		if (!pending)
+			mlen = find(pos, mpos);
+		pending = false;
+		insert(pos);
+
+		/* Prefer a literal when the next position starts a longer match. */
+		if (lazy && mlen > 0 && mlen < UPLIM) {
+			uint32_t npos = 0;
+			uint32_t nlen = find(pos + 1, npos);
+			if (nlen > mlen) {
+				if (!emit(true, src[pos], 0))
+					goto finish;
+				pos++;
+				mlen = nlen;
+				mpos = npos;
+				pending = true;
+				continue;
 			}
 		}
+
+		if (mlen > 0) {
+			/* Ring buffer position of the match as seen by the decoder. */
+			uint32_t r = (RBSIZE - UPLIM + mpos) & (RBSIZE - 1);
+			if (!emit(false, static_cast<uint8_t>(r), static_cast<uint8_t>(((r >> 4) & 0xF0) | (mlen - (THRESHOLD + 1)))))
+				goto finish;
+			for (uint32_t k = 1; k < mlen; k++)
+				insert(pos + k);
+			pos += mlen;
+		} else {
+			if (!emit(true, src[pos], 0))
+				goto finish;
+			pos++;
+		}
 	}
 
-	return dst - dststart;
+	/* Send remaining code. */
+	if (code_buf_ptr > 1) {
+		if (static_cast<size_t>(dstend - dst) < code_buf_ptr)
+			goto finish;
+		lilu_os_memcpy(dst, code_buf, code_buf_ptr);
+		dst += code_buf_ptr;
+	}
+
+	result = dst;
+
+finish:
+	Buffer::deleter(sp);
+
+	return result;
 }
 
+// LZFSE stream format of Apple lzfse, only compressed v2, lzvn, and raw blocks are produced by its encoder
+
+static constexpr uint32_t LZFSE_ENDOFSTREAM_BLOCK_MAGIC  = 0x24787662; /* bvx$ */
+static constexpr uint32_t LZFSE_UNCOMPRESSED_BLOCK_MAGIC = 0x2d787662; /* bvx- */
+static constexpr uint32_t LZFSE_COMPRESSEDV2_BLOCK_MAGIC = 0x32787662; /* bvx2 */
+static constexpr uint32_t LZFSE_COMPRESSEDLZVN_BLOCK_MAGIC = 0x6e787662; /* bvxn */
+
+static constexpr size_t LZFSE_L_SYMBOLS = 20;
+static constexpr size_t LZFSE_M_SYMBOLS = 20;
+static constexpr size_t LZFSE_D_SYMBOLS = 64;
+static constexpr size_t LZFSE_LITERAL_SYMBOLS = 256;
+static constexpr size_t LZFSE_L_STATES = 64;
+static constexpr size_t LZFSE_M_STATES = 64;
+static constexpr size_t LZFSE_D_STATES = 256;
+static constexpr size_t LZFSE_LITERAL_STATES = 1024;
+static constexpr size_t LZFSE_MATCHES_PER_BLOCK = 10000;
+static constexpr size_t LZFSE_LITERALS_PER_BLOCK = 4 * LZFSE_MATCHES_PER_BLOCK;
+static constexpr size_t LZFSE_V2_HEADER_SIZE = 32;
+
+static const uint8_t lzfse_l_extra_bits[LZFSE_L_SYMBOLS] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 5, 8
+};
+static const int32_t lzfse_l_base_value[LZFSE_L_SYMBOLS] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 20, 28, 60
+};
+static const uint8_t lzfse_m_extra_bits[LZFSE_M_SYMBOLS] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 5, 8, 11
+};
+static const int32_t lzfse_m_base_value[LZFSE_M_SYMBOLS] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 24, 56, 312
+};
+static const uint8_t lzfse_d_extra_bits[LZFSE_D_SYMBOLS] = {
+	0,  0,  0,  0,  1,  1,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,
+	4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,
+	8,  8,  8,  8,  9,  9,  9,  9,  10, 10, 10, 10, 11, 11, 11, 11,
+	12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+};
+static const int32_t lzfse_d_base_value[LZFSE_D_SYMBOLS] = {
+	0,      1,      2,      3,     4,     6,     8,     10,    12,    16,
+	20,     24,     28,     36,    44,    52,    60,    76,    92,    108,
+	124,    156,    188,    220,   252,   316,   380,   444,   508,   636,
+	764,    892,    1020,   1276,  1532,  1788,  2044,  2556,  3068,  3580,
+	4092,   5116,   6140,   7164,  8188,  10236, 12284, 14332, 16380, 20476,
+	24572,  28668,  32764,  40956, 49148, 57340, 65532, 81916, 98300, 114684,
+	131068, 163836, 196604, 229372
+};
+
+struct lzfse_literal_entry {
+	uint8_t k;
+	uint8_t symbol;
+	int16_t delta;
+};
+
+struct lzfse_value_entry {
+	uint8_t total_bits;
+	uint8_t value_bits;
+	int16_t delta;
+	int32_t vbase;
+};
+
+/*
+ * Decoder scratch memory, its size does not depend on the data.
+ * Frequencies are stored in the L, M, D, literal order of the block header.
+ */
+struct lzfse_decoder_state {
+	uint16_t freq[LZFSE_L_SYMBOLS + LZFSE_M_SYMBOLS + LZFSE_D_SYMBOLS + LZFSE_LITERAL_SYMBOLS];
+	lzfse_literal_entry literal_table[LZFSE_LITERAL_STATES];
+	lzfse_value_entry l_table[LZFSE_L_STATES];
+	lzfse_value_entry m_table[LZFSE_M_STATES];
+	lzfse_value_entry d_table[LZFSE_D_STATES];
+	uint8_t literals[LZFSE_LITERALS_PER_BLOCK + 64];
+};
+
 /*
- * initialize state, mostly the trees
- *
- * For i = 0 to N - 1, rchild[i] and lchild[i] will be the right and left
- * children of node i.  These nodes need not be initialized.  Also, parent[i]
- * is the parent of node i.  These are initialized to NIL (= N), which stands
- * for 'not used.'  For i = 0 to 255, rchild[N + i + 1] is the root of the
- * tree for strings that begin with character i.  These are initialized to NIL.
- * Note there are 256 trees. */
-static void init_state(encode_state *sp) {
-	size_t i;
-
-	memset(sp, 0, sizeof(*sp));
-
-	for (i = 0; i < RBSIZE - UPLIM; i++)
-		sp->text_buf[i] = ' ';
-	for (i = RBSIZE + 1; i <= RBSIZE + 256; i++)
-		sp->rchild[i] = NIL;
-	for (i = 0; i < RBSIZE; i++)
-		sp->parent[i] = NIL;
+ * Backward bit stream, the encoder flushes its bits from the end of the payload.
+ */
+struct lzfse_in_stream {
+	uint64_t accum;
+	int nbits;
+	const uint8_t *pos;
+	const uint8_t *start;
+};
+
+static uint64_t lzfse_load64(const uint8_t *src, size_t size) {
+	uint64_t v = 0;
+	memcpy(&v, src, size);
+	return v;
+}
+
+static uint32_t lzfse_load32(const uint8_t *src) {
+	uint32_t v;
+	memcpy(&v, src, sizeof(v));
+	return v;
+}
+
+static uint64_t lzfse_field(uint64_t v, int offset, int nbits) {
+	return (v >> offset) & ((1ULL << nbits) - 1);
+}
+
+static bool lzfse_in_init(lzfse_in_stream &in, int n, const uint8_t *start, const uint8_t *end) {
+	size_t size = n != 0 ? 8 : 7;
+	if (n < -7 || n > 0 || static_cast<size_t>(end - start) < size)
+		return false;
+	in.start = start;
+	in.pos = end - size;
+	in.accum = lzfse_load64(in.pos, size);
+	in.nbits = n + static_cast<int>(size) * 8;
+	return (in.accum >> in.nbits) == 0;
+}
+
+/* Refill to 56..63 bits, the bytes past the current position were consumed already. */
+static bool lzfse_in_flush(lzfse_in_stream &in) {
+	int nbits = (63 - in.nbits) & -8;
+	if (nbits == 0)
+		return true;
+	if (static_cast<size_t>(in.pos - in.start) < static_cast<size_t>(nbits >> 3))
+		return false;
+	in.pos -= nbits >> 3;
+	in.accum = (in.accum << nbits) | (lzfse_load64(in.pos, sizeof(uint64_t)) & ((1ULL << nbits) - 1));
+	in.nbits += nbits;
+	return true;
+}
+
+static uint64_t lzfse_in_pull(lzfse_in_stream &in, int n) {
+	in.nbits -= n;
+	uint64_t result = in.accum >> in.nbits;
+	in.accum &= (1ULL << in.nbits) - 1;
+	return result;
 }
 
 /*
- * Inserts string of length F, text_buf[r..r+F-1], into one of the trees
- * (text_buf[r]'th tree) and returns the longest-match position and length
- * via the global variables match_position and match_length.
- * If match_length = F, then removes the old node in favor of the new one,
- * because the old one will be deleted sooner. Note r plays double role,
- * as tree node and position in buffer.
+ * State table layout shared by literal and value decoders: a symbol of frequency f takes
+ * f consecutive states, each state encodes the next one in k or k - 1 bits plus a delta.
  */
-static void insert_node(encode_state *sp, int r) {
-	int  i, p, cmp;
-	uint8_t  *key;
-
-	cmp = 1;
-	key = &sp->text_buf[r];
-	p = RBSIZE + 1 + key[0];
-	sp->rchild[r] = sp->lchild[r] = NIL;
-	sp->match_length = 0;
-	for ( ; ; ) {
-		if (cmp >= 0) {
-			if (sp->rchild[p] != NIL)
-				p = sp->rchild[p];
-			else {
-				sp->rchild[p] = r;
-				sp->parent[r] = p;
-				return;
-			}
-		} else {
-			if (sp->lchild[p] != NIL)
-				p = sp->lchild[p];
-			else {
-				sp->lchild[p] = r;
-				sp->parent[r] = p;
-				return;
-			}
-		}
-		for (i = 1; i < static_cast<int>(UPLIM); i++) {
-			if ((cmp = key[i] - sp->text_buf[p + i]) != 0)
-				break;
-		}
-		if (i > sp->match_length) {
-			sp->match_position = p;
-			if ((sp->match_length = i) >= static_cast<int>(UPLIM))
-				break;
+template <typename F>
+static bool lzfse_init_table(size_t nstates, size_t nsymbols, const uint16_t *freq, F entry) {
+	int nclz = __builtin_clz(static_cast<uint32_t>(nstates));
+	size_t sum = 0;
+	for (size_t i = 0; i < nsymbols; i++) {
+		int f = freq[i];
+		if (f == 0)
+			continue;
+		if (f > static_cast<int>(nstates) - static_cast<int>(sum))
+			return false;
+		int k = __builtin_clz(static_cast<uint32_t>(f)) - nclz;
+		int j0 = ((2 * static_cast<int>(nstates)) >> k) - f;
+		for (int j = 0; j < f; j++, sum++) {
+			if (j < j0)
+				entry(sum, i, k, ((f + j) << k) - static_cast<int>(nstates));
+			else
+				entry(sum, i, k - 1, (j - j0) << (k - 1));
 		}
 	}
-	sp->parent[r] = sp->parent[p];
-	sp->lchild[r] = sp->lchild[p];
-	sp->rchild[r] = sp->rchild[p];
-	sp->parent[sp->lchild[p]] = r;
-	sp->parent[sp->rchild[p]] = r;
-	if (sp->rchild[sp->parent[p]] == p)
-		sp->rchild[sp->parent[p]] = r;
-	else
-		sp->lchild[sp->parent[p]] = r;
-	sp->parent[p] = NIL;  /* remove p */
-}
-
-/* deletes node p from tree */
-static void delete_node(encode_state *sp, int p) {
-	int  q;
-
-	if (sp->parent[p] == NIL)
-		return;  /* not in tree */
-	if (sp->rchild[p] == NIL)
-		q = sp->lchild[p];
-	else if (sp->lchild[p] == NIL)
-		q = sp->rchild[p];
-	else {
-		q = sp->lchild[p];
-		if (sp->rchild[q] != NIL) {
-			do {
-				q = sp->rchild[q];
-			} while (sp->rchild[q] != NIL);
-			sp->rchild[sp->parent[q]] = sp->lchild[q];
-			sp->parent[sp->lchild[q]] = sp->parent[q];
-			sp->lchild[q] = sp->lchild[p];
-			sp->parent[sp->lchild[p]] = q;
+	return true;
+}
+
+static bool lzfse_init_value_table(lzfse_value_entry *table, size_t nstates, size_t nsymbols, const uint16_t *freq,
+								   const uint8_t *extra_bits, const int32_t *base_value) {
+	memset(table, 0, nstates * sizeof(lzfse_value_entry));
+	return lzfse_init_table(nstates, nsymbols, freq, [&](size_t state, size_t symbol, int k, int delta) {
+		table[state].total_bits = static_cast<uint8_t>(k + extra_bits[symbol]);
+		table[state].value_bits = extra_bits[symbol];
+		table[state].delta = static_cast<int16_t>(delta);
+		table[state].vbase = base_value[symbol];
+	});
+}
+
+static int32_t lzfse_decode_value(uint32_t &state, const lzfse_value_entry *table, lzfse_in_stream &in) {
+	auto &e = table[state];
+	uint32_t bits = static_cast<uint32_t>(lzfse_in_pull(in, e.total_bits));
+	state = static_cast<uint32_t>(e.delta + (bits >> e.value_bits));
+	return e.vbase + static_cast<int32_t>(bits & ((1U << e.value_bits) - 1));
+}
+
+/* Frequencies are stored with a prefix code of 2 to 14 bits per value. */
+static bool lzfse_decode_freq(uint16_t *freq, const uint8_t *src, const uint8_t *srcend) {
+	static const uint8_t nbits_table[32] = {
+		2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14,
+		2, 3, 2, 5, 2, 3, 2, 8, 2, 3, 2, 5, 2, 3, 2, 14
+	};
+	static const uint8_t value_table[32] = {
+		0, 2, 1, 4, 0, 3, 1, 0, 0, 2, 1, 5, 0, 3, 1, 0,
+		0, 2, 1, 6, 0, 3, 1, 0, 0, 2, 1, 7, 0, 3, 1, 0
+	};
+
+	uint32_t accum = 0;
+	int accum_nbits = 0;
+	for (size_t i = 0; i < LZFSE_L_SYMBOLS + LZFSE_M_SYMBOLS + LZFSE_D_SYMBOLS + LZFSE_LITERAL_SYMBOLS; i++) {
+		while (src < srcend && accum_nbits + 8 <= 32) {
+			accum |= static_cast<uint32_t>(*src++) << accum_nbits;
+			accum_nbits += 8;
 		}
-		sp->rchild[q] = sp->rchild[p];
-		sp->parent[sp->rchild[p]] = q;
+
+		int nbits = nbits_table[accum & 31];
+		if (nbits > accum_nbits)
+			return false;
+
+		if (nbits == 8)
+			freq[i] = 8 + ((accum >> 4) & 0xF);
+		else if (nbits == 14)
+			freq[i] = 24 + ((accum >> 4) & 0x3FF);
+		else
+			freq[i] = value_table[accum & 31];
+
+		accum >>= nbits;
+		accum_nbits -= nbits;
 	}
-	sp->parent[q] = sp->parent[p];
-	if (sp->rchild[sp->parent[p]] == p)
-		sp->rchild[sp->parent[p]] = q;
-	else
-		sp->lchild[sp->parent[p]] = q;
-	sp->parent[p] = NIL;
-}
 
-static uint8_t *compress_lzss(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen) {
-	uint8_t *result = nullptr;
-	/* Encoding state, mostly tree but some current match stuff */
-	encode_state *sp;
+	return accum_nbits < 8 && src == srcend;
+}
 
-	int  i, c, len, r, s, last_match_length, code_buf_ptr;
-	uint8_t code_buf[17], mask;
-	auto srcend = src + srclen;
-	auto dstend = dst + dstlen;
+/* Copy a match, which may overlap its own output. */
+static void lzfse_copy_match(uint8_t *dst, size_t dist, size_t len, bool wide) {
+	if (wide && dist >= sizeof(uint64_t)) {
+		for (size_t k = 0; k < len; k += sizeof(uint64_t))
+			memcpy(dst + k, dst + k - dist, sizeof(uint64_t));
+	} else {
+		for (size_t k = 0; k < len; k++)
+			dst[k] = dst[k - dist];
+	}
+}
 
-	/* initialize trees */
-	sp = Buffer::create<encode_state>(1);
-	if (!sp) goto finish;
+/*
+ * Decode a compressed v2 block payload following its header.
+ * Returns false for malformed data, stops early with dst at dstend once the output is full.
+ */
+static bool lzfse_decode_v2(lzfse_decoder_state *s, uint8_t *dststart, uint8_t *&dst, uint8_t *dstend, uint32_t nraw,
+							const uint8_t *&src, const uint8_t *srcend) {
+	if (static_cast<size_t>(srcend - src) < LZFSE_V2_HEADER_SIZE)
+		return false;
+
+	uint64_t v0 = lzfse_load64(src + 8, sizeof(uint64_t));
+	uint64_t v1 = lzfse_load64(src + 16, sizeof(uint64_t));
+	uint64_t v2 = lzfse_load64(src + 24, sizeof(uint64_t));
+
+	uint32_t n_literals = static_cast<uint32_t>(lzfse_field(v0, 0, 20));
+	uint32_t n_literal_payload = static_cast<uint32_t>(lzfse_field(v0, 20, 20));
+	uint32_t n_matches = static_cast<uint32_t>(lzfse_field(v0, 40, 20));
+	int literal_bits = static_cast<int>(lzfse_field(v0, 60, 3)) - 7;
+	uint32_t literal_state[4];
+	for (int i = 0; i < 4; i++)
+		literal_state[i] = static_cast<uint32_t>(lzfse_field(v1, 10 * i, 10));
+	uint32_t n_lmd_payload = static_cast<uint32_t>(lzfse_field(v1, 40, 20));
+	int lmd_bits = static_cast<int>(lzfse_field(v1, 60, 3)) - 7;
+	uint32_t header_size = static_cast<uint32_t>(lzfse_field(v2, 0, 32));
+	uint32_t l_state = static_cast<uint32_t>(lzfse_field(v2, 32, 10));
+	uint32_t m_state = static_cast<uint32_t>(lzfse_field(v2, 42, 10));
+	uint32_t d_state = static_cast<uint32_t>(lzfse_field(v2, 52, 10));
+
+	if (header_size < LZFSE_V2_HEADER_SIZE || header_size > static_cast<size_t>(srcend - src) ||
+		n_literals > LZFSE_LITERALS_PER_BLOCK || n_matches > LZFSE_MATCHES_PER_BLOCK ||
+		l_state >= LZFSE_L_STATES || m_state >= LZFSE_M_STATES || d_state >= LZFSE_D_STATES)
+		return false;
+
+	if (header_size > LZFSE_V2_HEADER_SIZE) {
+		if (!lzfse_decode_freq(s->freq, src + LZFSE_V2_HEADER_SIZE, src + header_size))
+			return false;
+	} else {
+		memset(s->freq, 0, sizeof(s->freq));
+	}
 
-	init_state(sp);
+	src += header_size;
+	if (static_cast<size_t>(srcend - src) < static_cast<size_t>(n_literal_payload) + n_lmd_payload)
+		return false;
+
+	const uint16_t *l_freq = s->freq;
+	const uint16_t *m_freq = l_freq + LZFSE_L_SYMBOLS;
+	const uint16_t *d_freq = m_freq + LZFSE_M_SYMBOLS;
+	const uint16_t *literal_freq = d_freq + LZFSE_D_SYMBOLS;
+
+	memset(s->literal_table, 0, sizeof(s->literal_table));
+	bool valid = lzfse_init_table(LZFSE_LITERAL_STATES, LZFSE_LITERAL_SYMBOLS, literal_freq, [&](size_t state, size_t symbol, int k, int delta) {
+		s->literal_table[state].k = static_cast<uint8_t>(k);
+		s->literal_table[state].symbol = static_cast<uint8_t>(symbol);
+		s->literal_table[state].delta = static_cast<int16_t>(delta);
+	});
+	valid = valid && lzfse_init_value_table(s->l_table, LZFSE_L_STATES, LZFSE_L_SYMBOLS, l_freq, lzfse_l_extra_bits, lzfse_l_base_value);
+	valid = valid && lzfse_init_value_table(s->m_table, LZFSE_M_STATES, LZFSE_M_SYMBOLS, m_freq, lzfse_m_extra_bits, lzfse_m_base_value);
+	valid = valid && lzfse_init_value_table(s->d_table, LZFSE_D_STATES, LZFSE_D_SYMBOLS, d_freq, lzfse_d_extra_bits, lzfse_d_base_value);
+	if (!valid)
+		return false;
+
+	// Literals are interleaved between four states, the literal count is padded to a multiple of 4.
+	lzfse_in_stream in;
+	if (!lzfse_in_init(in, literal_bits, src, src + n_literal_payload))
+		return false;
+	for (uint32_t i = 0; i < n_literals; i += 4) {
+		if (!lzfse_in_flush(in))
+			return false;
+		for (int j = 0; j < 4; j++) {
+			auto &e = s->literal_table[literal_state[j]];
+			literal_state[j] = static_cast<uint32_t>(e.delta + static_cast<int>(lzfse_in_pull(in, e.k)));
+			s->literals[i + j] = e.symbol;
+		}
+	}
 
-	/*
-	 * code_buf[1..16] saves eight units of code, and code_buf[0] works
-	 * as eight flags, "1" representing that the unit is an unencoded
-	 * letter (1 byte), "0" a position-and-length pair (2 bytes).
-	 * Thus, eight units require at most 16 bytes of code.
-	 */
-	code_buf[0] = 0;
-	code_buf_ptr = mask = 1;
-
-	/* Clear the buffer with any character that will appear often. */
-	s = 0;  r = RBSIZE - UPLIM;
-
-	/* Read F bytes into the last F bytes of the buffer */
-	for (len = 0; len < static_cast<int>(UPLIM) && src < srcend; len++)
-		sp->text_buf[r + len] = *src++;
-	if (!len)
-		goto finish;
-
-	/*
-	 * Insert the F strings, each of which begins with one or more
-	 * 'space' characters.  Note the order in which these strings are
-	 * inserted.  This way, degenerate trees will be less likely to occur.
-	 */
-	for (i = 1; i <= static_cast<int>(UPLIM); i++)
-		insert_node(sp, r - i);
-
-	/*
-	 * Finally, insert the whole string just read.
-	 * The global variables match_length and match_position are set.
-	 */
-	insert_node(sp, r);
-	do {
-		/* match_length may be spuriously long near the end of text. */
-		if (sp->match_length > len)
-			sp->match_length = len;
-		if (sp->match_length <= static_cast<int>(THRESHOLD)) {
-			sp->match_length = 1;  /* Not long enough match.  Send one byte. */
-			code_buf[0] |= mask;  /* 'send one byte' flag */
-			code_buf[code_buf_ptr++] = sp->text_buf[r];  /* Send uncoded. */
+	src += n_literal_payload;
+	if (!lzfse_in_init(in, lmd_bits, src, src + n_lmd_payload))
+		return false;
+	src += n_lmd_payload;
+
+	const uint8_t *lit = s->literals;
+	const uint8_t *litend = s->literals + n_literals;
+	uint8_t *blockend = dst + nraw;
+	size_t d = 0;
+	for (uint32_t i = 0; i < n_matches; i++) {
+		if (!lzfse_in_flush(in))
+			return false;
+		size_t l = static_cast<size_t>(lzfse_decode_value(l_state, s->l_table, in));
+		size_t m = static_cast<size_t>(lzfse_decode_value(m_state, s->m_table, in));
+		size_t newd = static_cast<size_t>(lzfse_decode_value(d_state, s->d_table, in));
+		if (newd != 0)
+			d = newd;
+
+		if (l > static_cast<size_t>(litend - lit) || l + m > static_cast<size_t>(blockend - dst) ||
+			(m > 0 && (d == 0 || d > static_cast<size_t>(dst - dststart + l))))
+			return false;
+
+		// Both literals and matches may use up to 8 bytes of slack, the literals buffer is padded accordingly.
+		size_t room = static_cast<size_t>(dstend - dst);
+		bool wide = room >= l + m + sizeof(uint64_t);
+		if (wide) {
+			for (size_t k = 0; k < l; k += sizeof(uint64_t))
+				memcpy(dst + k, lit + k, sizeof(uint64_t));
 		} else {
-			/* Send position and length pair. Note match_length > THRESHOLD. */
-			code_buf[code_buf_ptr++] = static_cast<uint8_t>(sp->match_position);
-			code_buf[code_buf_ptr++] = static_cast<uint8_t>
-			( ((sp->match_position >> 4) & 0xF0)
-			 |  (sp->match_length - (THRESHOLD + 1)) );
+			memcpy(dst, lit, l < room ? l : room);
+			if (l >= room) {
+				dst = dstend;
+				return true;
+			}
 		}
-		if ((mask <<= 1) == 0) {  /* Shift mask left one bit. */
-			/* Send at most 8 units of code together */
-			for (i = 0; i < code_buf_ptr; i++)
-				if (dst < dstend)
-					*dst++ = code_buf[i];
-				else
-					goto finish;
-			code_buf[0] = 0;
-			code_buf_ptr = mask = 1;
+		dst += l;
+		lit += l;
+
+		if (!wide && m >= static_cast<size_t>(dstend - dst)) {
+			lzfse_copy_match(dst, d, dstend - dst, false);
+			dst = dstend;
+			return true;
 		}
-		last_match_length = sp->match_length;
-		for (i = 0; i < last_match_length && src < srcend; i++) {
-			delete_node(sp, s);    /* Delete old strings and */
-			c = *src++;
-			sp->text_buf[s] = c;    /* read new bytes */
-
-			/*
-			 * If the position is near the end of buffer, extend the buffer
-			 * to make string comparison easier.
-			 */
-			if (s < static_cast<int>(UPLIM - 1))
-				sp->text_buf[s + RBSIZE] = c;
-
-			/* Since this is a ring buffer, increment the position modulo N. */
-			s = (s + 1) & (RBSIZE - 1);
-			r = (r + 1) & (RBSIZE - 1);
-
-			/* Register the string in text_buf[r..r+F-1] */
-			insert_node(sp, r);
+		lzfse_copy_match(dst, d, m, wide);
+		dst += m;
+	}
+
+	return dst == blockend;
+}
+
+static size_t decompress_lzfse(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed) {
+	auto state = Buffer::create<lzfse_decoder_state>(1);
+	if (!state) {
+		SYSLOG("comp", "failed to allocate lzfse decoder state");
+		return 0;
+	}
+
+	uint8_t *dststart = dst;
+	uint8_t *dstend = dst + dstlen;
+	const uint8_t *srcstart = src;
+	const uint8_t *srcend = src + srclen;
+	bool valid = true;
+
+	while (valid && dst < dstend && srcend - src >= 4) {
+		uint32_t magic = lzfse_load32(src);
+		if (magic == LZFSE_ENDOFSTREAM_BLOCK_MAGIC) {
+			src += 4;
+			break;
 		}
-		while (i++ < last_match_length) {
-			delete_node(sp, s);
-
-			/* After the end of text, no need to read, */
-			s = (s + 1) & (RBSIZE - 1);
-			r = (r + 1) & (RBSIZE - 1);
-			/* but buffer may not be empty. */
-			if (--len)
-				insert_node(sp, r);
+
+		if (srcend - src < 8) {
+			valid = false;
+			break;
 		}
-	} while (len > 0);   /* until length of string to be processed is zero */
 
-	if (code_buf_ptr > 1) {    /* Send remaining code. */
-		for (i = 0; i < code_buf_ptr; i++)
-			if (dst < dstend)
-				*dst++ = code_buf[i];
-			else
-				goto finish;
+		uint32_t nraw = lzfse_load32(src + 4);
+		switch (magic) {
+			case LZFSE_UNCOMPRESSED_BLOCK_MAGIC: {
+				src += 8;
+				if (nraw > static_cast<size_t>(srcend - src)) {
+					valid = false;
+					break;
+				}
+				size_t size = nraw < static_cast<size_t>(dstend - dst) ? nraw : dstend - dst;
+				memcpy(dst, src, size);
+				dst += size;
+				src += size;
+				break;
+			}
+			case LZFSE_COMPRESSEDLZVN_BLOCK_MAGIC: {
+				if (srcend - src < 12) {
+					valid = false;
+					break;
+				}
+				uint32_t npayload = lzfse_load32(src + 8);
+				src += 12;
+				if (npayload > static_cast<size_t>(srcend - src)) {
+					valid = false;
+					break;
+				}
+				size_t pos = dst - dststart, dprev = 0;
+				size_t limit = nraw < static_cast<size_t>(dstend - dst) ? pos + nraw : dstlen;
+				lzvn_decode_partial(dststart, limit, &pos, &dprev, src, npayload);
+				valid = pos == limit;
+				dst = dststart + pos;
+				src += npayload;
+				break;
+			}
+			case LZFSE_COMPRESSEDV2_BLOCK_MAGIC:
+				valid = lzfse_decode_v2(state, dststart, dst, dstend, nraw, src, srcend);
+				break;
+			default:
+				SYSLOG("comp", "unsupported lzfse block %08X", magic);
+				valid = false;
+				break;
+		}
 	}
 
-	result = dst;
+	Buffer::deleter(state);
 
-finish:
-	if (sp) Buffer::deleter(sp);
+	if (!valid) {
+		SYSLOG("comp", "malformed lzfse block at %lu", static_cast<size_t>(src - srcstart));
+		return 0;
+	}
 
-	return result;
+	if (consumed) *consumed = static_cast<uint32_t>(src - srcstart);
+	return dst - dststart;
 }
 
-static uint8_t *decompressInternal(uint32_t compression, uint32_t *dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer, bool checkResult) {
+uint32_t Compression::lzfseDecompressedSize(const uint8_t *src, uint32_t srclen) {
+	const uint8_t *srcend = src + srclen;
+	uint64_t total = 0;
+
+	while (srcend - src >= 4) {
+		uint32_t magic = lzfse_load32(src);
+		if (magic == LZFSE_ENDOFSTREAM_BLOCK_MAGIC)
+			return total <= UINT32_MAX ? static_cast<uint32_t>(total) : 0;
+
+		if (srcend - src < 8)
+			break;
+
+		uint32_t nraw = lzfse_load32(src + 4);
+		uint64_t size = 0;
+		switch (magic) {
+			case LZFSE_UNCOMPRESSED_BLOCK_MAGIC:
+				size = 8ULL + nraw;
+				break;
+			case LZFSE_COMPRESSEDLZVN_BLOCK_MAGIC:
+				if (srcend - src < 12)
+					return 0;
+				size = 12ULL + lzfse_load32(src + 8);
+				break;
+			case LZFSE_COMPRESSEDV2_BLOCK_MAGIC: {
+				if (static_cast<size_t>(srcend - src) < LZFSE_V2_HEADER_SIZE)
+					return 0;
+				uint64_t v0 = lzfse_load64(src + 8, sizeof(uint64_t));
+				uint64_t v1 = lzfse_load64(src + 16, sizeof(uint64_t));
+				uint64_t v2 = lzfse_load64(src + 24, sizeof(uint64_t));
+				size = lzfse_field(v2, 0, 32) + lzfse_field(v0, 20, 20) + lzfse_field(v1, 40, 20);
+				break;
+			}
+			default:
+				SYSLOG("comp", "unsupported lzfse block %08X", magic);
+				return 0;
+		}
+
+		if (size > static_cast<size_t>(srcend - src))
+			break;
+
+		src += size;
+		total += nraw;
+	}
+
+	SYSLOG("comp", "truncated lzfse stream");
+	return 0;
+}
+
+static uint8_t *compress_lzvn(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen) {
+	auto work = Buffer::create<uint8_t>(lzvn_encode_scratch_size());
+	if (!work) {
+		SYSLOG("comp", "failed to allocate lzvn encoder state");
+		return nullptr;
+	}
+
+	size_t size = lzvn_encode_buffer(dst, dstlen, src, srclen, work);
+	Buffer::deleter(work);
+
+	return size > 0 ? dst + size : nullptr;
+}
+
+static uint8_t *decompressInternal(uint32_t compression, uint32_t *dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer, bool checkResult, uint32_t *consumed=nullptr) {
 	auto decompressedBuf = buffer ? buffer : Buffer::create<uint8_t>(*dstlen);
 	if (decompressedBuf) {
 		size_t size {0};
 		switch (compression) {
 			case Compression::ModeLZSS:
-				size = decompress_lzss(decompressedBuf, *dstlen, src, srclen);
+				size = decompress_lzss(decompressedBuf, *dstlen, src, srclen, consumed);
 				break;
 			case Compression::ModeLZVN:
-				size = lzvn_decode_buffer(decompressedBuf, *dstlen, src, srclen);
+				size = decompress_lzvn(decompressedBuf, *dstlen, src, srclen, consumed);
 				break;
 			case Compression::ModeZLIB:
-				size = decompress_zlib(decompressedBuf, *dstlen, src, srclen);
+				size = decompress_zlib(decompressedBuf, *dstlen, src, srclen, consumed);
+				break;
+			case Compression::ModeLZFSE:
+				size = decompress_lzfse(decompressedBuf, *dstlen, src, srclen, consumed);
 				break;
 			default:
 				SYSLOG("comp", "unsupported decompression format %X", compression);
@@ -423,6 +834,230 @@ static uint8_t *decompressInternal(uint32_t compression, uint32_t *dstlen, const
 	return 0;
 }
 
+uint32_t Compression::adler32(uint32_t adler, const uint8_t *data, size_t size) {
+	// Largest block for which sums cannot overflow 32 bits before the modulo.
+	static constexpr uint32_t AdlerBase {65521};
+	static constexpr size_t AdlerBlock {5552};
+
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while (size > 0) {
+		size_t n = size < AdlerBlock ? size : AdlerBlock;
+		size -= n;
+
+		// Per 8 bytes b gains 8 copies of a and the bytes weighted by their remaining count, which avoids a dependency chain.
+		for (; n >= 8; n -= 8, data += 8) {
+			uint32_t s = data[0] + data[1] + data[2] + data[3] + data[4] + data[5] + data[6] + data[7];
+			uint32_t w = 8 * data[0] + 7 * data[1] + 6 * data[2] + 5 * data[3] + 4 * data[4] + 3 * data[5] + 2 * data[6] + data[7];
+			b += 8 * a + w;
+			a += s;
+		}
+
+		while (n--) {
+			a += *data++;
+			b += a;
+		}
+
+		a %= AdlerBase;
+		b %= AdlerBase;
+	}
+
+	return (b << 16) | a;
+}
+
+bool Compression::Stream::init(uint32_t mode, uint8_t *buffer, uint32_t size, bool checksum) {
+	compression = mode;
+	dst = buffer;
+	dstlen = size;
+	dstpos = carry = dprev = 0;
+	done = false;
+	verify = checksum;
+	adler = 1;
+
+	if (mode != ModeLZSS && mode != ModeLZVN && mode != ModeZLIB) {
+		SYSLOG("comp", "unsupported stream decompression format %X", mode);
+		return false;
+	}
+
+	inbuf = Buffer::create<uint8_t>(ChunkSize + CarrySize);
+	if (!inbuf) {
+		SYSLOG("comp", "failed to allocate stream input buffer");
+		return false;
+	}
+
+	if (mode == ModeZLIB) {
+		zstream = Buffer::create<z_stream>(1);
+		if (!zstream) {
+			SYSLOG("comp", "failed to allocate zlib stream");
+			return false;
+		}
+
+		bzero(zstream, sizeof(z_stream));
+		zstream->zalloc = z_alloc;
+		zstream->zfree  = z_free;
+
+		if (inflateInit(zstream) != Z_OK) {
+			SYSLOG("comp", "failed to initialise zlib stream");
+			Buffer::deleter(zstream);
+			zstream = nullptr;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Compression::Stream::feed(uint32_t size, bool last) {
+	if (done)
+		return true;
+
+	if (!inbuf || size > ChunkSize) {
+		SYSLOG("comp", "invalid stream feed of %u bytes", size);
+		return false;
+	}
+
+	size_t avail = carry + size;
+	size_t used = 0;
+	size_t start = dstpos;
+
+	switch (compression) {
+		case ModeLZSS: {
+			const uint8_t *src = inbuf;
+			dstpos = lzss_decode(dst, dstpos, dstlen, src, inbuf + (last ? avail : lzss_complete_groups(inbuf, avail)));
+			used = src - inbuf;
+			break;
+		}
+		case ModeLZVN:
+			used = lzvn_decode_partial(dst, dstlen, &dstpos, &dprev, inbuf, avail);
+			break;
+		case ModeZLIB: {
+			zstream->next_in   = inbuf;
+			zstream->avail_in  = static_cast<uInt>(avail);
+			zstream->next_out  = dst + dstpos;
+			zstream->avail_out = static_cast<uInt>(dstlen - dstpos);
+			int zlib_result = inflate(zstream, last ? Z_FINISH : Z_NO_FLUSH);
+			if (zlib_result != Z_OK && zlib_result != Z_STREAM_END && zlib_result != Z_BUF_ERROR) {
+				SYSLOG("comp", "zlib stream failed with %d", zlib_result);
+				return false;
+			}
+			used = avail - zstream->avail_in;
+			dstpos = dstlen - zstream->avail_out;
+			break;
+		}
+		default:
+			return false;
+	}
+
+	// Fresh output is still in cache, so checksumming it here costs no extra pass over memory.
+	if (verify)
+		adler = adler32(adler, dst + start, dstpos - start);
+
+	// Nothing more to decode once the output is complete, remaining input is ignored like in decompress.
+	if (last || dstpos == dstlen) {
+		done = true;
+		carry = 0;
+		return true;
+	}
+
+	carry = avail - used;
+	if (carry > CarrySize) {
+		SYSLOG("comp", "stream stopped at %lu with %lu bytes left", dstpos, carry);
+		return false;
+	}
+
+	memmove(inbuf, inbuf + used, carry);
+	return true;
+}
+
+void Compression::Stream::deinit() {
+	if (zstream) {
+		inflateEnd(zstream);
+		Buffer::deleter(zstream);
+		zstream = nullptr;
+	}
+
+	if (inbuf) {
+		Buffer::deleter(inbuf);
+		inbuf = nullptr;
+	}
+}
+
+void *Compression::Inflate::arenaAlloc(void *opaque, unsigned int items, unsigned int size) {
+	auto inflater = static_cast<Inflate *>(opaque);
+	uint64_t total = (static_cast<uint64_t>(items) * size + 15) & ~static_cast<uint64_t>(15);
+	if (total <= ArenaSize - inflater->arenaUsed) {
+		void *result = inflater->arena + inflater->arenaUsed;
+		inflater->arenaUsed += total;
+		return result;
+	}
+
+	DBGLOG("comp", "inflate arena exhausted by %u x %u", items, size);
+	return z_alloc(nullptr, items, size);
+}
+
+void Compression::Inflate::arenaFree(void *opaque, void *ptr) {
+	auto inflater = static_cast<Inflate *>(opaque);
+	// Arena memory is released at once in deinit.
+	if (static_cast<uint8_t *>(ptr) < inflater->arena || static_cast<uint8_t *>(ptr) >= inflater->arena + ArenaSize)
+		z_free(nullptr, ptr);
+}
+
+bool Compression::Inflate::init() {
+	arena = Buffer::create<uint8_t>(ArenaSize);
+	if (!arena) {
+		SYSLOG("comp", "failed to allocate inflate arena");
+		return false;
+	}
+
+	arenaUsed = 0;
+	auto stream = static_cast<z_stream *>(arenaAlloc(this, 1, sizeof(z_stream)));
+	bzero(stream, sizeof(z_stream));
+	stream->zalloc = arenaAlloc;
+	stream->zfree  = arenaFree;
+	stream->opaque = this;
+
+	if (inflateInit(stream) != Z_OK) {
+		SYSLOG("comp", "failed to initialise inflate context");
+		return false;
+	}
+
+	zstream = stream;
+	return true;
+}
+
+bool Compression::Inflate::decompress(uint8_t *dst, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, uint32_t *consumed) {
+	// Reset keeps the allocated window, so only the first call allocates it.
+	if (!zstream || inflateReset(zstream) != Z_OK)
+		return false;
+
+	zstream->next_in   = const_cast<uint8_t *>(src);
+	zstream->avail_in  = srclen;
+	zstream->next_out  = dst;
+	zstream->avail_out = dstlen;
+
+	int zlib_result = inflate(zstream, Z_FINISH);
+
+	// Running out of output space is fine when only a prefix is requested.
+	if (zlib_result == Z_STREAM_END || zlib_result == Z_OK || (zlib_result == Z_BUF_ERROR && zstream->avail_out == 0)) {
+		dstlen = dstlen - zstream->avail_out;
+		if (consumed) *consumed = srclen - zstream->avail_in;
+		return true;
+	}
+
+	return false;
+}
+
+void Compression::Inflate::deinit() {
+	if (zstream) {
+		inflateEnd(zstream);
+		zstream = nullptr;
+	}
+
+	if (arena) {
+		Buffer::deleter(arena);
+		arena = nullptr;
+	}
+}
+
 uint8_t *Compression::decompress(uint32_t compression, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer) {
 	return decompressInternal(compression, &dstlen, src, srclen, buffer, true);
 }
@@ -431,12 +1066,23 @@ uint8_t *Compression::decompress(uint32_t compression, uint32_t *dstlen, const u
 	return decompressInternal(compression, dstlen, src, srclen, buffer, false);
 }
 
+uint8_t *Compression::decompressPrefix(uint32_t compression, uint32_t dstlen, const uint8_t *src, uint32_t srclen, uint32_t &consumed, uint8_t *buffer) {
+	consumed = 0;
+	return decompressInternal(compression, &dstlen, src, srclen, buffer, true, &consumed);
+}
+
 uint8_t *Compression::compress(uint32_t compression, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, uint8_t *buffer) {
+	return compress(compression, dstlen, src, srclen, LevelDefault, buffer);
+}
+
+uint8_t *Compression::compress(uint32_t compression, uint32_t &dstlen, const uint8_t *src, uint32_t srclen, Level level, uint8_t *buffer) {
 	auto compressedBuf = buffer ? buffer : Buffer::create<uint8_t>(dstlen);
 	if (compressedBuf) {
 		uint8_t *endptr = nullptr;
 		if (compression == ModeLZSS)
-			endptr = compress_lzss(compressedBuf, dstlen, src, srclen);
+			endptr = compress_lzss(compressedBuf, dstlen, src, srclen, level);
+		else if (compression == ModeLZVN)
+			endptr = compress_lzvn(compressedBuf, dstlen, src, srclen);
 		else
 			SYSLOG("comp", "unsupported compression format %X", compression);
 
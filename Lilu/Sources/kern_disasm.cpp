@@ -68,15 +68,168 @@ void Disassembler::deinit() {
 
 #endif /* LILU_ADVANCED_DISASSEMBLY */
 
+#if defined(__x86_64__)
+
+namespace InstructionLength {
+	/**
+	 *  Instruction length decoding flags
+	 */
+	enum : uint8_t {
+		None   = 0,
+		ModRM  = 1,   // ModRM byte with optional SIB and displacement follows
+		Imm8   = 2,   // 8-bit immediate
+		Imm16  = 4,   // 16-bit immediate
+		ImmZ   = 8,   // 16-bit or 32-bit immediate depending on operand size
+		ImmV   = 16,  // 16-bit, 32-bit or 64-bit immediate depending on operand size
+		Group3 = 32,  // immediate present only for /0 and /1 (test)
+		Prefix = 64,  // legacy prefix
+		Rare   = 128  // rare, invalid, or VEX/EVEX/XOP encoded instruction left to HDE
+	};
+
+	static constexpr uint8_t M = ModRM, I8 = Imm8, I16 = Imm16, IZ = ImmZ, IV = ImmV,
+		G3 = Group3, P = Prefix, R = Rare, N = None;
+
+	/**
+	 *  One-byte opcode map (0F and REX are handled separately)
+	 */
+	static constexpr uint8_t map[256] {
+		/* 0x */ M, M, M, M, I8, IZ, R, R, M, M, M, M, I8, IZ, R, R,
+		/* 1x */ M, M, M, M, I8, IZ, R, R, M, M, M, M, I8, IZ, R, R,
+		/* 2x */ M, M, M, M, I8, IZ, P, R, M, M, M, M, I8, IZ, P, R,
+		/* 3x */ M, M, M, M, I8, IZ, P, R, M, M, M, M, I8, IZ, P, R,
+		/* 4x */ R, R, R, R, R, R, R, R, R, R, R, R, R, R, R, R,
+		/* 5x */ N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N,
+		/* 6x */ R, R, R, M, P, P, P, P, IZ, M|IZ, I8, M|I8, N, N, N, N,
+		/* 7x */ I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8, I8,
+		/* 8x */ M|I8, M|IZ, R, M|I8, M, M, M, M, M, M, M, M, M, M, M, R,
+		/* 9x */ N, N, N, N, N, N, N, N, N, N, R, N, N, N, N, N,
+		/* Ax */ R, R, R, R, N, N, N, N, I8, IZ, N, N, N, N, N, N,
+		/* Bx */ I8, I8, I8, I8, I8, I8, I8, I8, IV, IV, IV, IV, IV, IV, IV, IV,
+		/* Cx */ M|I8, M|I8, I16, N, R, R, M|I8, M|IZ, I16|I8, N, I16, N, N, I8, R, N,
+		/* Dx */ M, M, M, M, R, R, R, N, M, M, M, M, M, M, M, M,
+		/* Ex */ I8, I8, I8, I8, I8, I8, I8, I8, IZ, IZ, R, I8, N, N, N, N,
+		/* Fx */ P, N, P, P, N, N, M|G3|I8, M|G3|IZ, N, N, N, N, N, N, M, M
+	};
+
+	/**
+	 *  Two-byte opcode map (0F xx)
+	 */
+	static constexpr uint8_t map0F[256] {
+		/* 0x */ R, R, R, R, R, R, R, R, R, R, R, N, R, M, R, R,
+		/* 1x */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* 2x */ R, R, R, R, R, R, R, R, M, M, M, M, M, M, M, M,
+		/* 3x */ R, N, R, R, R, R, R, R, R, R, R, R, R, R, R, R,
+		/* 4x */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* 5x */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* 6x */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* 7x */ M|I8, M|I8, M|I8, M|I8, M, M, M, N, R, R, R, R, M, M, M, M,
+		/* 8x */ IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,
+		/* 9x */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* Ax */ N, N, N, M, M|I8, M, R, R, N, N, R, M, M|I8, M, M, M,
+		/* Bx */ M, M, R, M, R, R, M, M, R, M, M|I8, M, M, M, M, M,
+		/* Cx */ M, M, M|I8, M, M|I8, M|I8, M|I8, M, N, N, N, N, N, N, N, N,
+		/* Dx */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* Ex */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+		/* Fx */ M, M, M, M, M, M, R, R, M, M, M, M, M, M, M, M
+	};
+}
+
+size_t Disassembler::fastInstructionSize(const uint8_t *code) {
+	using namespace InstructionLength;
+
+	static constexpr uint8_t PrefixRexFirst {0x40};
+	static constexpr uint8_t PrefixRexLast {0x4F};
+	static constexpr uint8_t PrefixRexW {0x08};
+	static constexpr uint8_t OpcodeTwoByte {0x0F};
+	static constexpr uint8_t OpcodeCall {0xE8};
+	static constexpr uint8_t OpcodeJmp {0xE9};
+
+	const uint8_t *p = code;
+	bool opsize16 = false;
+	bool rexw = false;
+
+	uint8_t flags;
+	while ((flags = map[*p]) & Prefix) {
+		// Address size override changes displacement sizes, leave it to HDE.
+		if (*p == PREFIX_ADDRESS_SIZE)
+			return 0;
+		opsize16 |= *p == PREFIX_OPERAND_SIZE;
+		if (static_cast<size_t>(++p - code) >= MaxInstruction)
+			return 0;
+	}
+
+	if (*p >= PrefixRexFirst && *p <= PrefixRexLast) {
+		rexw = (*p & PrefixRexW) != 0;
+		p++;
+	}
+
+	uint8_t opcode = *p++;
+	bool relative;
+	if (opcode == OpcodeTwoByte) {
+		opcode = *p++;
+		flags = map0F[opcode];
+		relative = (flags & ImmZ) != 0;
+	} else {
+		flags = map[opcode];
+		relative = opcode == OpcodeCall || opcode == OpcodeJmp;
+	}
+
+	// Near branches with operand size override are decoded differently across vendors.
+	if ((flags & (Rare | Prefix)) || (relative && opsize16))
+		return 0;
+
+	if (flags & ModRM) {
+		uint8_t modrm = *p++;
+		uint8_t mod = modrm >> 6;
+		uint8_t rm = modrm & 7;
+
+		if ((flags & Group3) && ((modrm >> 3) & 7) >= 2)
+			flags &= ~(Imm8 | ImmZ);
+
+		if (mod != 3) {
+			// SIB with no base or RIP-relative addressing carry 32-bit displacement.
+			if (rm == 4 && (*p++ & 7) == 5 && mod == 0)
+				p += sizeof(uint32_t);
+			else if (mod == 0 && rm == 5)
+				p += sizeof(uint32_t);
+
+			if (mod == 1)
+				p += sizeof(uint8_t);
+			else if (mod == 2)
+				p += sizeof(uint32_t);
+		}
+	}
+
+	if (flags & Imm8)
+		p += sizeof(uint8_t);
+	if (flags & Imm16)
+		p += sizeof(uint16_t);
+	if (flags & ImmZ)
+		p += opsize16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	if (flags & ImmV)
+		p += rexw ? sizeof(uint64_t) : (opsize16 ? sizeof(uint16_t) : sizeof(uint32_t));
+
+	size_t len = static_cast<size_t>(p - code);
+	return len <= MaxInstruction ? len : 0;
+}
+
+#endif
+
 size_t Disassembler::quickInstructionSize(mach_vm_address_t addr, size_t min) {
 	size_t total = 0;
 
 	do {
-		hde_t hs;
-		auto len = hde_disasm(reinterpret_cast<void *>(addr), &hs);
-		if (hs.flags & F_ERROR) {
-			SYSLOG("disasm", "hde decoding failure");
-			return 0;
+		size_t len = 0;
+#if defined(__x86_64__)
+		len = fastInstructionSize(reinterpret_cast<const uint8_t *>(addr));
+#endif
+		if (len == 0) {
+			hde_t hs;
+			len = hde_disasm(reinterpret_cast<void *>(addr), &hs);
+			if (hs.flags & F_ERROR) {
+				SYSLOG("disasm", "hde decoding failure");
+				return 0;
+			}
 		}
 
 		addr += len;
@@ -90,6 +243,174 @@ size_t Disassembler::hdeDisasm(mach_vm_address_t code, hde_t *hs) {
 	return hde_disasm(reinterpret_cast<void*>(code), hs);
 }
 
+size_t Disassembler::relocateInstructions(mach_vm_address_t src, size_t size, uint8_t *dst, size_t dstSize, mach_vm_address_t dstAddr) {
+	static constexpr uint8_t OpcodeCall {0xE8};
+	static constexpr uint8_t OpcodeJmp {0xE9};
+	static constexpr uint8_t OpcodeJmpShort {0xEB};
+	static constexpr uint8_t OpcodeJccShort {0x70};
+	static constexpr uint8_t OpcodeJccShortLast {0x7F};
+	static constexpr uint8_t OpcodeTwoByte {0x0F};
+	static constexpr uint8_t OpcodeJcc {0x80};
+	static constexpr uint8_t OpcodeJccLast {0x8F};
+	// Longest emitted sequence: jcc over an absolute indirect jump.
+	static constexpr size_t MaxRelocatedInstruction {16};
+
+	size_t inPos = 0, outPos = 0;
+	while (inPos < size) {
+		auto insn = src + inPos;
+		auto out = dstAddr + outPos;
+
+		hde_t hs;
+		auto len = hde_disasm(reinterpret_cast<void *>(insn), &hs);
+		if (hs.flags & F_ERROR) {
+			SYSLOG("disasm", "hde decoding failure at relocation");
+			return 0;
+		}
+
+		if (outPos + MaxRelocatedInstruction > dstSize) {
+			SYSLOG("disasm", "not enough space for relocation %lu", dstSize);
+			return 0;
+		}
+
+		auto outPtr = dst + outPos;
+		if (hs.flags & F_RELATIVE) {
+			int64_t rel;
+			if (hs.flags & F_IMM8)
+				rel = static_cast<int8_t>(hs.imm.imm8);
+			else if (hs.flags & F_IMM32)
+				rel = static_cast<int32_t>(hs.imm.imm32);
+			else {
+				SYSLOG("disasm", "unsupported relative operand at " PRIKADDR, CASTKADDR(insn));
+				return 0;
+			}
+
+			mach_vm_address_t target = insn + len + rel;
+			if (target >= src && target < src + size) {
+				SYSLOG("disasm", "unsupported branch into relocated code at " PRIKADDR, CASTKADDR(insn));
+				return 0;
+			}
+
+			bool isCall = hs.opcode == OpcodeCall;
+			bool isJmp = hs.opcode == OpcodeJmp || hs.opcode == OpcodeJmpShort;
+			int cond = -1;
+			if (hs.opcode >= OpcodeJccShort && hs.opcode <= OpcodeJccShortLast)
+				cond = hs.opcode - OpcodeJccShort;
+			else if (hs.opcode == OpcodeTwoByte && hs.opcode2 >= OpcodeJcc && hs.opcode2 <= OpcodeJccLast)
+				cond = hs.opcode2 - OpcodeJcc;
+
+			if (!isCall && !isJmp && cond < 0) {
+				// loop, jrcxz, xbegin and similar have no equivalent 32-bit form.
+				SYSLOG("disasm", "unsupported relative instruction %02X at " PRIKADDR, hs.opcode, CASTKADDR(insn));
+				return 0;
+			}
+
+			size_t relLen = cond >= 0 ? 6 : 5;
+			int64_t diff = static_cast<int64_t>(target - (out + relLen));
+#if defined(__x86_64__)
+			bool fits = diff == static_cast<int32_t>(diff);
+#else
+			bool fits = true;
+#endif
+			if (fits) {
+				if (cond >= 0) {
+					*outPtr++ = OpcodeTwoByte;
+					*outPtr++ = static_cast<uint8_t>(OpcodeJcc + cond);
+				} else {
+					*outPtr++ = isCall ? OpcodeCall : OpcodeJmp;
+				}
+				int32_t rel32 = static_cast<int32_t>(diff);
+				lilu_os_memcpy(outPtr, &rel32, sizeof(rel32));
+				outPos += relLen;
+			} else {
+#if defined(__x86_64__)
+				if (isCall) {
+					// call qword ptr [rip+2]; jmp +8; dq target
+					static constexpr uint8_t CallAbs[] {0xFF, 0x15, 0x02, 0x00, 0x00, 0x00, 0xEB, 0x08};
+					lilu_os_memcpy(outPtr, CallAbs, sizeof(CallAbs));
+					outPtr += sizeof(CallAbs);
+				} else {
+					// Inverted jcc skips the absolute jump when the condition is false.
+					if (cond >= 0) {
+						*outPtr++ = static_cast<uint8_t>(OpcodeJccShort + (cond ^ 1));
+						*outPtr++ = 6 + sizeof(uint64_t);
+					}
+					// jmp qword ptr [rip]; dq target
+					static constexpr uint8_t JmpAbs[] {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+					lilu_os_memcpy(outPtr, JmpAbs, sizeof(JmpAbs));
+					outPtr += sizeof(JmpAbs);
+				}
+				lilu_os_memcpy(outPtr, &target, sizeof(uint64_t));
+				outPtr += sizeof(uint64_t);
+				outPos = outPtr - dst;
+#endif
+			}
+		} else {
+			lilu_os_memcpy(outPtr, reinterpret_cast<void *>(insn), len);
+#if defined(__x86_64__)
+			if ((hs.flags & F_MODRM) && hs.modrm_mod == 0 && hs.modrm_rm == 5) {
+				// RIP-relative displacement is followed only by the immediate if any.
+				size_t immSize = 0;
+				if (hs.flags & F_IMM8) immSize += sizeof(uint8_t);
+				if (hs.flags & F_IMM16) immSize += sizeof(uint16_t);
+				if (hs.flags & F_IMM32) immSize += sizeof(uint32_t);
+				if (hs.flags & F_IMM64) immSize += sizeof(uint64_t);
+				size_t dispOff = len - immSize - sizeof(int32_t);
+				int64_t disp = static_cast<int32_t>(hs.disp.disp32) + static_cast<int64_t>(insn - out);
+				if (disp != static_cast<int32_t>(disp)) {
+					SYSLOG("disasm", "rip-relative operand out of range at " PRIKADDR, CASTKADDR(insn));
+					return 0;
+				}
+				int32_t disp32 = static_cast<int32_t>(disp);
+				lilu_os_memcpy(outPtr + dispOff, &disp32, sizeof(disp32));
+			}
+#endif
+			outPos += len;
+		}
+
+		inPos += len;
+	}
+
+	return outPos;
+}
+
+bool Disassembler::isLinearCode(mach_vm_address_t src, size_t size) {
+	static constexpr uint8_t OpcodeRetImm {0xC2};
+	static constexpr uint8_t OpcodeRet {0xC3};
+	static constexpr uint8_t OpcodeRetFarImm {0xCA};
+	static constexpr uint8_t OpcodeRetFar {0xCB};
+	static constexpr uint8_t OpcodeInt3 {0xCC};
+	static constexpr uint8_t OpcodeJmp {0xE9};
+	static constexpr uint8_t OpcodeJmpShort {0xEB};
+	static constexpr uint8_t OpcodeHlt {0xF4};
+	static constexpr uint8_t OpcodeGroup5 {0xFF};
+	static constexpr uint8_t Group5JmpNear {4};
+	static constexpr uint8_t Group5JmpFar {5};
+	static constexpr uint8_t OpcodeTwoByte {0x0F};
+	static constexpr uint8_t OpcodeUd2 {0x0B};
+
+	size_t pos = 0;
+	while (pos < size) {
+		hde_t hs;
+		pos += hde_disasm(reinterpret_cast<void *>(src + pos), &hs);
+		if (hs.flags & F_ERROR)
+			return false;
+
+		// The instruction reaching the end may transfer control, all bytes before belong to it.
+		if (pos >= size)
+			break;
+
+		bool end = hs.opcode == OpcodeRetImm || hs.opcode == OpcodeRet || hs.opcode == OpcodeRetFarImm ||
+			hs.opcode == OpcodeRetFar || hs.opcode == OpcodeInt3 || hs.opcode == OpcodeJmp ||
+			hs.opcode == OpcodeJmpShort || hs.opcode == OpcodeHlt ||
+			(hs.opcode == OpcodeGroup5 && (hs.modrm_reg == Group5JmpNear || hs.modrm_reg == Group5JmpFar)) ||
+			(hs.opcode == OpcodeTwoByte && hs.opcode2 == OpcodeUd2);
+		if (end)
+			return false;
+	}
+
+	return true;
+}
+
 #ifdef LILU_ADVANCED_DISASSEMBLY
 
 size_t Disassembler::disasmBuf(mach_vm_address_t addr, size_t size, cs_insn **result) {
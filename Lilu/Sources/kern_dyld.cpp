@@ -0,0 +1,257 @@
+//
+//  kern_dyld.cpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_dyld.hpp>
+
+#include <mach-o/loader.h>
+#include <sys/param.h>
+
+uint64_t DyldCache::hashPath(const char *path, size_t len) {
+	// FNV-1a
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= static_cast<uint8_t>(path[i]);
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+bool DyldCache::findOffset(const Reader &reader, void *file, uint64_t address, off_t &offset) {
+	Header header {};
+	if (reader.read(file, &header, 0, offsetof(Header, imagesOffsetOld), reader.user) ||
+		strncmp(header.magic, "dyld_v1", strlen("dyld_v1")))
+		return false;
+
+	Mapping mappings[MaxMappings];
+	uint32_t count = header.mappingCount < MaxMappings ? header.mappingCount : MaxMappings;
+	if (count == 0 || reader.read(file, mappings, header.mappingOffset, count * sizeof(Mapping), reader.user))
+		return false;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (address >= mappings[i].address && address - mappings[i].address < mappings[i].size) {
+			offset = static_cast<off_t>(mappings[i].fileOffset + (address - mappings[i].address));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool DyldCache::readSegments(const Reader &reader, void *file, off_t offset, MapEntry &entry) {
+	mach_header_64 header {};
+	if (reader.read(file, &header, offset, sizeof(header), reader.user) || header.magic != MH_MAGIC_64 ||
+		header.sizeofcmds == 0 || header.sizeofcmds > MaxCommands) {
+		DBGLOG("dyld", "invalid cache image header at %llX", static_cast<uint64_t>(offset));
+		return false;
+	}
+
+	auto cmds = Buffer::create<uint8_t>(header.sizeofcmds);
+	if (!cmds) {
+		SYSLOG("dyld", "failed to allocate %u bytes for cache image commands", header.sizeofcmds);
+		return false;
+	}
+
+	if (!reader.read(file, cmds, offset + sizeof(header), header.sizeofcmds, reader.user)) {
+		size_t off = 0;
+		for (uint32_t i = 0; i < header.ncmds && off + sizeof(load_command) <= header.sizeofcmds; i++) {
+			auto cmd = reinterpret_cast<load_command *>(cmds + off);
+			if (cmd->cmdsize < sizeof(load_command) || off + cmd->cmdsize > header.sizeofcmds)
+				break;
+
+			if (cmd->cmd == LC_SEGMENT_64 && cmd->cmdsize >= sizeof(segment_command_64)) {
+				auto seg = reinterpret_cast<segment_command_64 *>(cmd);
+				if (!strncmp(seg->segname, "__TEXT", sizeof(seg->segname))) {
+					entry.startTEXT = static_cast<vm_address_t>(seg->vmaddr);
+					entry.endTEXT = static_cast<vm_address_t>(seg->vmaddr + seg->vmsize);
+				} else if (!entry.startDATA && !strncmp(seg->segname, "__DATA", strlen("__DATA"))) {
+					// The first __DATA-prefixed segment is used like with .map files.
+					entry.startDATA = static_cast<vm_address_t>(seg->vmaddr);
+					entry.endDATA = static_cast<vm_address_t>(seg->vmaddr + seg->vmsize);
+				}
+			}
+
+			off += cmd->cmdsize;
+		}
+	}
+
+	Buffer::deleter(cmds);
+	return entry.startTEXT && entry.endTEXT;
+}
+
+bool DyldCache::mapImage(const Reader &reader, const char *cachePath, const Header &header, void *file, uint64_t address, MapEntry &entry) {
+	off_t offset;
+	if (findOffset(reader, file, address, offset))
+		return readSegments(reader, file, offset, entry);
+
+	// Split caches (12.x and newer) keep image contents in subcache files.
+	if (header.mappingOffset <= offsetof(Header, subCacheArrayCount))
+		return false;
+
+	bool hasSuffix = header.mappingOffset > offsetof(Header, cacheSubType);
+	size_t entrySize = hasSuffix ? sizeof(SubCache) : offsetof(SubCache, fileSuffix);
+
+	for (uint32_t i = 0; i < header.subCacheArrayCount; i++) {
+		SubCache subCache {};
+		if (reader.read(file, &subCache, header.subCacheArrayOffset + i * entrySize, entrySize, reader.user))
+			return false;
+
+		char path[PATH_MAX];
+		if (hasSuffix) {
+			subCache.fileSuffix[sizeof(subCache.fileSuffix) - 1] = '\0';
+			snprintf(path, sizeof(path), "%s%s", cachePath, subCache.fileSuffix);
+		} else {
+			snprintf(path, sizeof(path), "%s.%u", cachePath, i + 1);
+		}
+
+		auto subFile = reader.open(path, reader.user);
+		if (!subFile) {
+			DBGLOG("dyld", "failed to find subcache %s", path);
+			continue;
+		}
+
+		bool found = findOffset(reader, subFile, address, offset);
+		if (found)
+			found = readSegments(reader, subFile, offset, entry);
+
+		reader.close(subFile, reader.user);
+
+		if (found) {
+			DBGLOG("dyld", "found image %llX in subcache %s", address, path);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool DyldCache::hasPathInWindow(const char *path, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		if (path[i] == '\0')
+			return true;
+	}
+	return false;
+}
+
+bool DyldCache::mapAddresses(const Reader &reader, const char *cachePath, MapEntry *mapEntries, size_t nentries, size_t &nfound) {
+	nfound = 0;
+	if (nentries == 0 || !cachePath)
+		return false;
+
+	auto file = reader.open(cachePath, reader.user);
+	if (!file) {
+		DBGLOG("dyld", "failed to find %s", cachePath);
+		return false;
+	}
+
+	bool res = false;
+	Header header {};
+	size_t tableSize = MinTableSize;
+	while (tableSize < nentries * 2)
+		tableSize *= 2;
+
+	auto images = Buffer::create<Image>(ImageBatch);
+	auto window = Buffer::create<char>(PathWindow + 1);
+	auto table = Buffer::create<uint32_t>(tableSize);
+
+	if (!images || !window || !table) {
+		SYSLOG("dyld", "failed to allocate memory for reading %s", cachePath);
+	} else if (reader.read(file, &header, 0, sizeof(header), reader.user) || strncmp(header.magic, "dyld_v1", strlen("dyld_v1"))) {
+		SYSLOG("dyld", "invalid dyld shared cache header in %s", cachePath);
+	} else {
+		// Newer caches moved the images table to a new header field.
+		uint32_t imagesOffset = header.imagesOffsetOld;
+		uint32_t imagesCount = header.imagesCountOld;
+		if (header.mappingOffset > offsetof(Header, imagesCount) && header.imagesCount > 0) {
+			imagesOffset = header.imagesOffset;
+			imagesCount = header.imagesCount;
+		}
+
+		DBGLOG("dyld", "%s has %u images at %X", cachePath, imagesCount, imagesOffset);
+
+		size_t tableMask = tableSize - 1;
+		size_t remaining = 0;
+		memset(table, 0, tableSize * sizeof(uint32_t));
+		for (size_t j = 0; j < nentries; j++) {
+			if (!mapEntries[j].filename)
+				continue;
+			size_t slot = hashPath(mapEntries[j].filename, mapEntries[j].length) & tableMask;
+			while (table[slot] != 0)
+				slot = (slot + 1) & tableMask;
+			table[slot] = static_cast<uint32_t>(j + 1);
+			remaining++;
+		}
+
+		// Image paths are mostly stored together, read them through a window.
+		off_t windowStart = 0;
+		size_t windowSize = 0;
+		res = true;
+
+		for (uint32_t i = 0; i < imagesCount && remaining > 0 && res; i += ImageBatch) {
+			uint32_t batch = imagesCount - i < ImageBatch ? imagesCount - i : ImageBatch;
+			if (reader.read(file, images, imagesOffset + i * sizeof(Image), batch * sizeof(Image), reader.user)) {
+				SYSLOG("dyld", "failed to read images table of %s", cachePath);
+				res = false;
+				break;
+			}
+
+			for (uint32_t k = 0; k < batch && remaining > 0; k++) {
+				off_t pathOff = images[k].pathFileOffset;
+				if (pathOff < windowStart || pathOff >= windowStart + static_cast<off_t>(windowSize) ||
+					!hasPathInWindow(window + (pathOff - windowStart), windowSize - static_cast<size_t>(pathOff - windowStart))) {
+					windowStart = pathOff;
+					windowSize = PathWindow;
+					if (reader.read(file, window, windowStart, windowSize, reader.user)) {
+						// The window may go past the end of file, retry with a single path.
+						windowSize = MAXPATHLEN;
+						if (reader.read(file, window, windowStart, windowSize, reader.user)) {
+							SYSLOG("dyld", "failed to read image path of %s", cachePath);
+							res = false;
+							break;
+						}
+					}
+					window[windowSize] = '\0';
+				}
+
+				const char *path = window + (pathOff - windowStart);
+				size_t len = strlen(path);
+
+				for (size_t slot = hashPath(path, len) & tableMask; table[slot] != 0; slot = (slot + 1) & tableMask) {
+					auto &entry = mapEntries[table[slot] - 1];
+					if (entry.mapped || entry.length != len || strncmp(entry.filename, path, len))
+						continue;
+
+					MapEntry found {};
+					if (mapImage(reader, cachePath, header, file, images[k].address, found)) {
+						DBGLOG("dyld", "found %s in shared cache at %llX", entry.filename, images[k].address);
+						for (size_t j = 0; j < nentries; j++) {
+							auto &curr = mapEntries[j];
+							if (curr.filename && !curr.mapped && curr.length == len && !strncmp(curr.filename, path, len)) {
+								curr.startTEXT = found.startTEXT;
+								curr.endTEXT = found.endTEXT;
+								curr.startDATA = found.startDATA;
+								curr.endDATA = found.endDATA;
+								curr.mapped = true;
+								nfound++;
+								remaining--;
+							}
+						}
+					} else {
+						SYSLOG("dyld", "failed to read %s segments from shared cache", entry.filename);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	if (images) Buffer::deleter(images);
+	if (window) Buffer::deleter(window);
+	if (table) Buffer::deleter(table);
+	reader.close(file, reader.user);
+	return res;
+}
@@ -0,0 +1,183 @@
+//
+//  kern_lookup.cpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_lookup.hpp>
+
+bool PageLookup::init(const uint8_t *const *pages, size_t num) {
+	// Lookups are read without locking once ready, so they are only built once.
+	if (index) {
+		SYSLOG("lookup", "lookups are already loaded");
+		return false;
+	}
+
+	if (!chooseOffsets(pages, num))
+		return false;
+
+	for (size_t i = 0; i < matchNum; i++) {
+		DBGLOG("lookup", "loading lookup %lu at off %X for %lu pages", i, offs[i], num);
+
+		for (size_t p = 0; p < num; p++) {
+			uint64_t val = *reinterpret_cast<const uint64_t *>(pages[p] + offs[i]);
+			if (!c[i].push_back<2>(val)) {
+				SYSLOG("lookup", "failed to store lookup %lu value for %lu", i, p);
+				return false;
+			}
+		}
+	}
+
+	for (size_t p = 0; p < num; p++) {
+		if (!keys.push_back<2>(key(pages[p]))) {
+			SYSLOG("lookup", "failed to store lookup key for %lu", p);
+			return false;
+		}
+	}
+
+	return loadIndex();
+}
+
+void PageLookup::deinit() {
+	for (size_t i = 0; i < matchNum; i++)
+		c[i].deinit();
+	keys.deinit();
+	if (index) {
+		Buffer::deleter(index);
+		index = nullptr;
+		indexMask = 0;
+	}
+	if (filter) {
+		Buffer::deleter(filter);
+		filter = nullptr;
+		filterMask = 0;
+	}
+}
+
+bool PageLookup::chooseOffsets(const uint8_t *const *pages, size_t num) {
+	static constexpr size_t offNum {PAGE_SIZE / sizeof(uint64_t)};
+
+	auto values = Buffer::create<uint64_t>(num);
+	auto scores = Buffer::create<uint32_t>(offNum);
+	if (!values || !scores) {
+		SYSLOG("lookup", "failed to allocate lookup offset scores for %lu pages", num);
+		if (values)
+			Buffer::deleter(values);
+		if (scores)
+			Buffer::deleter(scores);
+		return false;
+	}
+
+	memset(scores, 0, offNum * sizeof(uint32_t));
+
+	// Score every offset by the amount of distinct values, stop early once enough offsets identify every page.
+	size_t perfect = 0;
+	for (size_t o = 0; o < offNum && perfect < matchNum; o++) {
+		for (size_t p = 0; p < num; p++)
+			values[p] = *reinterpret_cast<const uint64_t *>(pages[p] + o * sizeof(uint64_t));
+		scores[o] = static_cast<uint32_t>(countDistinctValues(values, num));
+		if (scores[o] == num)
+			perfect++;
+	}
+
+	// Take the best scoring offsets, earlier offsets win ties.
+	for (size_t i = 0; i < matchNum; i++) {
+		size_t best = offNum;
+		for (size_t o = 0; o < offNum; o++) {
+			bool taken = false;
+			for (size_t j = 0; j < i && !taken; j++)
+				taken = offs[j] == o * sizeof(uint64_t);
+			if (!taken && (best == offNum || scores[o] > scores[best]))
+				best = o;
+		}
+
+		offs[i] = static_cast<uint32_t>(best * sizeof(uint64_t));
+		DBGLOG("lookup", "chose lookup %lu at off %X with %u distinct values of %lu", i, offs[i], scores[best], num);
+	}
+
+	Buffer::deleter(values);
+	Buffer::deleter(scores);
+	return true;
+}
+
+size_t PageLookup::countDistinctValues(uint64_t *values, size_t num) {
+	qsort(values, num, sizeof(uint64_t), [](const void *a, const void *b) {
+		auto va = *static_cast<const uint64_t *>(a);
+		auto vb = *static_cast<const uint64_t *>(b);
+		return va < vb ? -1 : (va > vb ? 1 : 0);
+	});
+
+	// Zero and all-ones words are common to many pages and identify nothing.
+	size_t distinct = 0;
+	for (size_t i = 0; i < num; i++) {
+		if (values[i] != 0 && values[i] != UINT64_MAX && (i == 0 || values[i] != values[i - 1]))
+			distinct++;
+	}
+
+	return distinct;
+}
+
+bool PageLookup::loadIndex() {
+	size_t sz = size();
+	size_t indexSize = MinIndexSize;
+	while (indexSize < sz * 2)
+		indexSize *= 2;
+
+	auto newIndex = Buffer::create<uint32_t>(indexSize);
+	auto newFilter = Buffer::create<uint64_t>(indexSize / 8);
+	if (!newIndex || !newFilter) {
+		SYSLOG("lookup", "failed to allocate lookup index of %lu entries", indexSize);
+		if (newIndex)
+			Buffer::deleter(newIndex);
+		if (newFilter)
+			Buffer::deleter(newFilter);
+		return false;
+	}
+
+	memset(newIndex, 0, indexSize * sizeof(uint32_t));
+	memset(newFilter, 0, indexSize / 8 * sizeof(uint64_t));
+	indexMask = indexSize - 1;
+	filter = newFilter;
+	filterMask = indexSize * 8 - 1;
+
+	// Insert in page order, so that the first page with a given key is probed first.
+	for (size_t p = 0; p < sz; p++) {
+		size_t slot = hash(keys[p]) & indexMask;
+		while (newIndex[slot] != 0)
+			slot = (slot + 1) & indexMask;
+		newIndex[slot] = static_cast<uint32_t>(p + 1);
+		addFilter(keys[p]);
+	}
+
+	// Only a complete index makes the lookup usable.
+	index = newIndex;
+
+	DBGLOG("lookup", "loaded lookup index of %lu entries for %lu pages", indexSize, sz);
+	return true;
+}
+
+size_t PageLookup::findCandidate(uint64_t value, size_t &slot) const {
+	for (slot &= indexMask; index[slot] != 0; slot = (slot + 1) & indexMask) {
+		size_t p = index[slot] - 1;
+		if (keys[p] == value) {
+			slot = (slot + 1) & indexMask;
+			return p;
+		}
+	}
+
+	return size();
+}
+
+bool PageLookup::matchCandidate(const uint8_t *page, size_t p) const {
+	for (size_t i = 0; i < matchNum; i++) {
+		uint64_t next = *reinterpret_cast<const uint64_t *>(page + offs[i]);
+		if (c[i][p] != next) {
+			DBGLOG("lookup", "failure not matching %lu of %llX to expected %llX", i, next, c[i][p]);
+			return false;
+		}
+	}
+
+	return true;
+}
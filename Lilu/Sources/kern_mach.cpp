@@ -36,6 +36,7 @@ kern_return_t MachInfo::init(const char * const paths[], size_t num, MachInfo *p
 	kern_return_t error = KERN_FAILURE;
 
 	allow_decompress = ADDPR(config).allowDecompress;
+	verify_decompress = ADDPR(config).verifyDecompress;
 
 	// Attempt to load directly from the filesystem
 	(void)fsfallback;
@@ -78,6 +79,10 @@ kern_return_t MachInfo::init(const char * const paths[], size_t num, MachInfo *p
 void MachInfo::deinit() {
 	freeFileBufferResources();
 
+	DBGLOG("mach", "%s used %lu slots, %lu reused, %lu overflown, %lu wasted", safeString(objectId),
+		   address_slots_allocated, address_slots_reused, address_slots_overflown, address_slots_wasted);
+	free_address_slots.deinit();
+
 	if (sym_buf) {
 		if (!sym_buf_ro)
 			Buffer::deleter(sym_buf);
@@ -184,6 +189,9 @@ kern_return_t MachInfo::initFromFileSystem(const char * const paths[], size_t nu
 					break;
 				}
 
+#ifdef LILU_COMPRESSION_SUPPORT
+				finishFileDecompression();
+#endif
 				vnode_put(vnode);
 			} else {
 				DBGLOG("mach", "vnode_lookup failed for %s with %d", path, err);
@@ -209,6 +217,13 @@ kern_return_t MachInfo::initFromFileSystem(const char * const paths[], size_t nu
 			   sym_fileoff, symboltable_fileoff);
 	}
 
+#ifdef LILU_COMPRESSION_SUPPORT
+	// Prelinked kexts are looked up in the whole kernel image after the file is closed.
+	if (isKernel && file_stream_active)
+		decompressFileData(vnode, ctxt, file_stream_size);
+	finishFileDecompression();
+#endif
+
 	vnode_put(vnode);
 	vfs_context_rele(ctxt);
 	// drop the iocount due to vnode_lookup()
@@ -385,6 +400,10 @@ kern_return_t MachInfo::readMachHeader(uint8_t *buffer, vnode_t vnode, vfs_conte
 		return KERN_FAILURE;
 	}
 
+#ifdef LILU_COMPRESSION_SUPPORT
+	bool lzfseDecompressed = false;
+#endif /* LILU_COMPRESSION_SUPPORT */
+
 	while (1) {
 		auto magicPtr = reinterpret_cast<uint32_t *>(buffer);
 		if (!isAligned(magicPtr)) {
@@ -431,38 +450,100 @@ kern_return_t MachInfo::readMachHeader(uint8_t *buffer, vnode_t vnode, vfs_conte
 			case Compression::Magic: { // comp
 				if (allow_decompress) {
 					auto header = reinterpret_cast<Compression::Header *>(buffer);
-					auto compressedBuf = Buffer::create<uint8_t>(OSSwapInt32(header->compressed));
-					if (!compressedBuf) {
-						SYSLOG("mach", "failed to allocate memory for reading mach binary");
-					} else if (FileIO::readFileData(compressedBuf, off+sizeof(Compression::Header), OSSwapInt32(header->compressed),
-													vnode, ctxt) != KERN_SUCCESS) {
-						SYSLOG("mach", "failed to read compressed binary");
-					} else {
-						uint32_t comp = OSSwapInt32(header->compressed);
-						uint32_t dec  = OSSwapInt32(header->decompressed);
-						DBGLOG("mach", "decompressing %u bytes (estimated %u bytes) with %X compression mode", comp, dec, header->compression);
-
-						if (header->decompressed > HeaderSize) {
-							if (file_buf) Buffer::deleter(file_buf);
-							file_buf = Compression::decompress(header->compression, dec, compressedBuf, comp);
-							// Try again
-							if (file_buf) {
-								file_buf_size = dec;
+					uint32_t comp = OSSwapInt32(header->compressed);
+					uint32_t dec  = OSSwapInt32(header->decompressed);
+					DBGLOG("mach", "decompressing %u bytes (estimated %u bytes) with %X compression mode", comp, dec, header->compression);
+
+					if (dec > HeaderSize) {
+						finishFileDecompression();
+						if (file_buf) Buffer::deleter(file_buf);
+						file_buf_size = 0;
+						file_buf = Buffer::create<uint8_t>(dec);
+
+						if (file_buf) {
+							// Only the header is decompressed here, the rest is decompressed on demand.
+							file_stream_active = true;
+							file_stream_off = off + sizeof(Compression::Header);
+							file_stream_left = comp;
+							file_stream_size = dec;
+							file_stream_hash = OSSwapInt32(header->hash);
+							// Checksum covers the whole binary, so verification gives up on-demand decompression.
+							if (file_stream.init(header->compression, file_buf, dec, verify_decompress) &&
+								decompressFileData(vnode, ctxt, verify_decompress ? dec : HeaderSize) == KERN_SUCCESS) {
+								// Try again
 								lilu_os_memcpy(buffer, file_buf, HeaderSize);
-								Buffer::deleter(compressedBuf);
 								continue;
 							}
-						} else {
-							SYSLOG("mach", "decompression disallowed due to low out size %u", header->decompressed);
 						}
-					}
 
-					Buffer::deleter(compressedBuf);
+						SYSLOG("mach", "failed to decompress %u bytes of mach binary", comp);
+						finishFileDecompression();
+						if (file_buf) {
+							Buffer::deleter(file_buf);
+							file_buf = nullptr;
+						}
+						file_buf_size = 0;
+					} else {
+						SYSLOG("mach", "decompression disallowed due to low out size %u", dec);
+					}
 				} else {
 					SYSLOG("mach", "decompression disallowed due to lowmem flag");
 				}
 				return KERN_FAILURE;
 			}
+			case Compression::LZFSEMagicV2:
+			case Compression::LZFSEMagicLZVN:
+			case Compression::LZFSEMagicRaw: { // bare lzfse
+				if (!allow_decompress) {
+					SYSLOG("mach", "decompression disallowed due to lowmem flag");
+					return KERN_FAILURE;
+				}
+
+				if (lzfseDecompressed) {
+					SYSLOG("mach", "lzfse found a recursion");
+					return KERN_FAILURE;
+				}
+
+				// The stream has no header with sizes, and its blocks exceed stream chunks, so it is read at once.
+				size_t fileSize = FileIO::readFileSize(vnode, ctxt);
+				if (fileSize <= static_cast<size_t>(off) || fileSize - off > UINT32_MAX) {
+					SYSLOG("mach", "invalid lzfse binary size %lu at %lld", fileSize, off);
+					return KERN_FAILURE;
+				}
+
+				uint32_t comp = static_cast<uint32_t>(fileSize - off);
+				uint32_t dec = 0;
+				auto compressedBuf = Buffer::create<uint8_t>(comp);
+				if (compressedBuf && FileIO::readFileData(compressedBuf, off, comp, vnode, ctxt) == KERN_SUCCESS)
+					dec = Compression::lzfseDecompressedSize(compressedBuf, comp);
+				DBGLOG("mach", "decompressing %u bytes (estimated %u bytes) with lzfse compression", comp, dec);
+
+				if (dec > HeaderSize) {
+					finishFileDecompression();
+					if (file_buf) Buffer::deleter(file_buf);
+					file_buf_size = 0;
+					file_buf = Buffer::create<uint8_t>(dec);
+					if (file_buf && Compression::decompress(Compression::ModeLZFSE, dec, compressedBuf, comp, file_buf)) {
+						Buffer::deleter(compressedBuf);
+						// Try again
+						file_buf_size = dec;
+						lilu_os_memcpy(buffer, file_buf, HeaderSize);
+						lzfseDecompressed = true;
+						continue;
+					}
+
+					SYSLOG("mach", "failed to decompress %u bytes of lzfse mach binary", comp);
+					if (file_buf) {
+						Buffer::deleter(file_buf);
+						file_buf = nullptr;
+					}
+				} else {
+					SYSLOG("mach", "decompression disallowed due to low out size %u", dec);
+				}
+
+				if (compressedBuf) Buffer::deleter(compressedBuf);
+				return KERN_FAILURE;
+			}
 #endif /* LILU_COMPRESSION_SUPPORT */
 			default:
 				SYSLOG("mach", "read mach has unsupported %X magic", *magicPtr);
@@ -473,6 +554,55 @@ kern_return_t MachInfo::readMachHeader(uint8_t *buffer, vnode_t vnode, vfs_conte
 	return KERN_FAILURE;
 }
 
+#ifdef LILU_COMPRESSION_SUPPORT
+kern_return_t MachInfo::decompressFileData(vnode_t vnode, vfs_context_t ctxt, size_t size) {
+	// Compressed data is read and decompressed by chunks to avoid keeping it resident.
+	bool success = true;
+	while (file_stream_active && file_buf_size < size && file_stream_left > 0) {
+		uint32_t chunk = file_stream_left < Compression::Stream::ChunkSize ? file_stream_left : Compression::Stream::ChunkSize;
+		int error = FileIO::readFileData(file_stream.input(), file_stream_off, chunk, vnode, ctxt);
+		if (error != KERN_SUCCESS) {
+			SYSLOG("mach", "failed to read compressed binary with %d", error);
+			success = false;
+			break;
+		}
+
+		file_stream_off += chunk;
+		file_stream_left -= chunk;
+		if (!file_stream.feed(chunk, file_stream_left == 0)) {
+			success = false;
+			break;
+		}
+
+		file_buf_size = file_stream.produced();
+	}
+
+	// Trailing compressed data is ignored once the output is complete.
+	bool complete = file_stream_left == 0 || file_buf_size == file_stream_size;
+	if (file_stream_active && complete && file_buf_size != file_stream_size) {
+		SYSLOG("mach", "decompressed %u bytes instead of %u", file_buf_size, file_stream_size);
+		success = false;
+	}
+
+	if (success && file_stream_active && complete && verify_decompress && file_stream.checksum() != file_stream_hash) {
+		SYSLOG("mach", "decompressed binary checksum %08X mismatches %08X", file_stream.checksum(), file_stream_hash);
+		success = false;
+	}
+
+	if (!success || complete)
+		finishFileDecompression();
+
+	return success && file_buf_size >= size ? KERN_SUCCESS : KERN_FAILURE;
+}
+
+void MachInfo::finishFileDecompression() {
+	if (file_stream_active) {
+		file_stream.deinit();
+		file_stream_active = false;
+	}
+}
+#endif /* LILU_COMPRESSION_SUPPORT */
+
 kern_return_t MachInfo::readSymbols(vnode_t vnode, vfs_context_t ctxt) {
 	// we know the location of linkedit and offsets into symbols and their strings
 	// now we need to read linkedit into a buffer so we can process it later
@@ -488,6 +618,7 @@ kern_return_t MachInfo::readSymbols(vnode_t vnode, vfs_context_t ctxt) {
 
 #ifdef LILU_COMPRESSION_SUPPORT
 	if (file_buf) {
+		decompressFileData(vnode, ctxt, sym_fileoff + sym_size);
 		if (file_buf_size >= sym_size && file_buf_size - sym_size >= sym_fileoff) {
 			lilu_os_memcpy(sym_buf, file_buf + sym_fileoff, sym_size);
 			return KERN_SUCCESS;
@@ -643,6 +774,10 @@ void MachInfo::findSectionBounds(void *ptr, size_t sourceSize, vm_address_t &vms
 }
 
 void MachInfo::freeFileBufferResources() {
+#ifdef LILU_COMPRESSION_SUPPORT
+	finishFileDecompression();
+#endif
+
 	if (file_buf) {
 		Buffer::deleter(file_buf);
 		file_buf = nullptr;
@@ -907,15 +1042,79 @@ kern_return_t MachInfo::kcGetRunningAddresses(mach_vm_address_t slide) {
 #endif
 }
 
+mach_vm_address_t MachInfo::overflow_address_slots[PAGE_SIZE / sizeof(mach_vm_address_t)];
+_Atomic(size_t) MachInfo::overflow_address_slots_used {0};
+
 mach_vm_address_t MachInfo::getAddressSlot() {
+	if (free_address_slots.size() > 0) {
+		auto slot = free_address_slots[free_address_slots.last()];
+		free_address_slots.erase(free_address_slots.last(), false);
+		address_slots_reused++;
+		return slot;
+	}
+
 	if (address_slots && address_slots + sizeof(mach_vm_address_t) <= address_slots_end) {
 		auto slot = address_slots;
 		address_slots += sizeof(mach_vm_address_t);
+		address_slots_allocated++;
 		return slot;
 	}
+
+	if (!address_slots || overflow_address_slots_unreachable)
+		return 0;
+
+	// Overflow page is shared by all the images, which may be patched concurrently.
+	size_t used = atomic_load_explicit(&overflow_address_slots_used, memory_order_relaxed);
+	while (used < arrsize(overflow_address_slots)) {
+		if (atomic_compare_exchange_weak_explicit(&overflow_address_slots_used, &used, used + 1,
+			memory_order_relaxed, memory_order_relaxed)) {
+			auto slot = reinterpret_cast<mach_vm_address_t>(&overflow_address_slots[used]);
+			address_slots_overflown++;
+			DBGLOG("mach", "using overflow slot " PRIKADDR " for %s", CASTKADDR(slot), safeString(objectId));
+			return slot;
+		}
+	}
+
 	return 0;
 }
 
+bool MachInfo::isAddressSlot(mach_vm_address_t slot) {
+	if (!address_slots || (slot & (sizeof(mach_vm_address_t) - 1)) != 0)
+		return false;
+	auto start = reinterpret_cast<mach_vm_address_t>(running_mh + 1) + running_mh->sizeofcmds;
+	if (slot >= start && slot < address_slots)
+		return true;
+	auto overflow = reinterpret_cast<mach_vm_address_t>(overflow_address_slots);
+	size_t used = atomic_load_explicit(&overflow_address_slots_used, memory_order_relaxed);
+	return slot >= overflow && slot < overflow + used * sizeof(mach_vm_address_t);
+}
+
+void MachInfo::releaseAddressSlot(mach_vm_address_t slot) {
+	if (slot && !free_address_slots.push_back<2>(slot))
+		SYSLOG("mach", "failed to release address slot " PRIKADDR, CASTKADDR(slot));
+}
+
+void MachInfo::discardAddressSlot(mach_vm_address_t slot) {
+	if (!slot)
+		return;
+	address_slots_wasted++;
+	auto overflow = reinterpret_cast<mach_vm_address_t>(overflow_address_slots);
+	if (slot >= overflow && slot < overflow + sizeof(overflow_address_slots)) {
+		DBGLOG("mach", "overflow slots are out of reach for %s", safeString(objectId));
+		overflow_address_slots_unreachable = true;
+	}
+}
+
+void MachInfo::getAddressSlotStatistics(AddressSlotStatistics &stats) {
+	stats.allocated = address_slots_allocated;
+	stats.reused = address_slots_reused;
+	stats.overflown = address_slots_overflown;
+	stats.released = free_address_slots.size();
+	stats.wasted = address_slots_wasted;
+	stats.available = address_slots && address_slots_end > address_slots ?
+		(address_slots_end - address_slots) / sizeof(mach_vm_address_t) : 0;
+}
+
 kern_return_t MachInfo::getRunningAddresses(mach_vm_address_t slide, size_t size, bool force) {
 	if (force) {
 		kaslr_slide_set = false;
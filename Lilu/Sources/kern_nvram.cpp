@@ -77,7 +77,9 @@ uint8_t *NVStorage::read(const char *key, uint32_t &size, uint8_t opts, const ui
 		};
 
 		auto hdr = static_cast<const Header *>(data->getBytesNoCopy());
-		if (hdr->magic != Header::Magic || hdr->version > Header::MaxVer || (hdr->opts & opts) != opts) {
+		// Compression format is chosen by the header, so LZVN and LZSS values are both readable.
+		uint8_t stored = opts & ~(OptCompressFast | OptCompressLZVN);
+		if (hdr->magic != Header::Magic || hdr->version > Header::MaxVer || (hdr->opts & stored) != stored) {
 			SYSLOG("nvram", "read %s contains invalid header (%X, %u, %X vs %X, %u, %X)",
 						 key, hdr->magic, hdr->version, hdr->opts, Header::Magic, Header::MaxVer, opts);
 			return nullptr;
@@ -111,7 +113,7 @@ uint8_t *NVStorage::read(const char *key, uint32_t &size, uint8_t opts, const ui
 
 		if (hdr->opts & OptCompressed) {
 			auto orgSize = payloadSize;
-			replacePayload(decompress(payloadBuf, payloadSize, opts & OptSensitive), orgSize);
+			replacePayload(decompress(payloadBuf, payloadSize, opts & OptSensitive, hdr->opts), orgSize);
 
 			if (!payloadBuf) {
 				SYSLOG("nvram", "read %s contains invalid compressed data", key);
@@ -168,11 +170,17 @@ bool NVStorage::write(const char *key, const uint8_t *src, uint32_t size, uint8_
 
 	if (!(opts & OptRaw)) {
 		Header hdr {};
-		hdr.opts = opts & ~OptSensitive;
+		hdr.opts = opts & ~(OptSensitive | OptCompressFast);
+
+		// LZVN payloads are unreadable for older versions, which do not know OptCompressLZVN.
+		if (!(opts & OptCompressed))
+			hdr.opts &= ~OptCompressLZVN;
+		else if (opts & OptCompressLZVN)
+			hdr.version = Header::MaxVer;
 
 		if (opts & OptCompressed) {
 			auto orgSize = payloadSize;
-			replacePayload(compress(payloadBuf, payloadSize, opts & OptSensitive), orgSize);
+			replacePayload(compress(payloadBuf, payloadSize, opts & OptSensitive, opts), orgSize);
 
 			if (!payloadBuf) {
 				SYSLOG("nvram", "write %s can't compressed data", key);
@@ -288,13 +296,19 @@ bool NVStorage::save(const char *filename, uint32_t max, bool sensitive) {
 }
 
 uint8_t *NVStorage::compress(const uint8_t *src, uint32_t &size, bool sensitive) {
+	return compress(src, size, sensitive, OptAuto);
+}
+
+uint8_t *NVStorage::compress(const uint8_t *src, uint32_t &size, bool sensitive, uint8_t opts) {
 #ifdef LILU_COMPRESSION_SUPPORT
+	auto mode = (opts & OptCompressLZVN) ? Compression::ModeLZVN : Compression::ModeLZSS;
+	auto level = (opts & OptCompressFast) ? Compression::LevelFast : Compression::LevelDefault;
 	uint32_t dstSize = size + 1024;
 	auto buf = Buffer::create<uint8_t>(dstSize);
 	if (buf) {
 		*reinterpret_cast<uint32_t *>(buf) = size;
 		DBGLOG("nvram", "compress saves dstSize = %u, srcSize = %u", dstSize, size);
-		if (Compression::compress(Compression::ModeLZSS, dstSize, src, size, buf + sizeof(uint32_t))) {
+		if (Compression::compress(mode, dstSize, src, size, level, buf + sizeof(uint32_t))) {
 			// Buffer was already resized by compress
 			size = dstSize + sizeof(uint32_t);
 			DBGLOG("nvram", "compress result size = %u", size);
@@ -313,7 +327,12 @@ uint8_t *NVStorage::compress(const uint8_t *src, uint32_t &size, bool sensitive)
 }
 
 uint8_t *NVStorage::decompress(const uint8_t *src, uint32_t &size, bool sensitive) {
+	return decompress(src, size, sensitive, OptAuto);
+}
+
+uint8_t *NVStorage::decompress(const uint8_t *src, uint32_t &size, bool sensitive, uint8_t opts) {
 #ifdef LILU_COMPRESSION_SUPPORT
+	auto mode = (opts & OptCompressLZVN) ? Compression::ModeLZVN : Compression::ModeLZSS;
 	if (size <= sizeof(uint32_t)) {
 		SYSLOG("nvram", "decompress too few bytes %u", size);
 		return nullptr;
@@ -324,7 +343,7 @@ uint8_t *NVStorage::decompress(const uint8_t *src, uint32_t &size, bool sensitiv
 	if (buf) {
 		size -= sizeof(uint32_t);
 		DBGLOG("nvram", "decompress restores dstSize = %u, srcSize = %u", dstSize, size);
-		if (Compression::decompress(Compression::ModeLZSS, dstSize, src + sizeof(uint32_t), size, buf)) {
+		if (Compression::decompress(mode, dstSize, src + sizeof(uint32_t), size, buf)) {
 			size = dstSize;
 			DBGLOG("nvram", "decompress result size = %u", size);
 			return buf;
@@ -7,9 +7,11 @@
 
 #include <Headers/kern_config.hpp>
 #include <Headers/kern_compat.hpp>
+#include <PrivateHeaders/kern_config.hpp>
 #include <PrivateHeaders/kern_patcher.hpp>
 #include <Headers/kern_patcher.hpp>
 #include <Headers/kern_iokit.hpp>
+#include <Headers/kern_cpu.hpp>
 
 #include <mach/mach_types.h>
 
@@ -64,21 +66,29 @@ void KernelPatcher::init() {
 		code = Error::KernRunningInitFailure;
 		return;
 	}
+
+	instrumentRoutes = ADDPR(config).profileRoutes;
+	if (instrumentRoutes)
+		cpuNumberOffset = findCpuNumberOffset();
 }
 
 void KernelPatcher::deinit() {
 	// Remove the patches
 	if (kinfos.size() > 0) {
 		if (MachInfo::setKernelWriting(true, kernelWriteLock) == KERN_SUCCESS) {
-			for (size_t i = 0, n = kpatches.size(); i < n; i++) {
-				kpatches[i]->restore();
-			}
+			restorePatches();
 			MachInfo::setKernelWriting(false, kernelWriteLock);
 		} else {
 			SYSLOG("patcher", "failed to change kernel protection at patch removal");
 		}
 	}
 	kpatches.deinit();
+	kroutes.deinit();
+
+	// Statistics are only safe to release once the wrappers are no longer reachable
+	if (routeStatistics.size() > 0)
+		dumpRouteStatistics();
+	routeStatistics.deinit();
 
 	// Deallocate kinfos
 	kinfos.deinit();
@@ -413,6 +423,7 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 	JumpType prevJump;
 	mach_vm_address_t trampoline = readChain(from, prevJump);
 	mach_vm_address_t addressSlot = 0;
+	bool ownSlot = false;
 	if (trampoline) {
 		// Do not perform double revert
 		revertible = false;
@@ -431,7 +442,14 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 			// If this happens, we can corrupt memory. Force everyone use new APIs.
 			if (!info)
 				PANIC("patcher", "trying to use long jump on top of slotted jump, please use routeMultipleLong");
-			addressSlot = info->getAddressSlot();
+			// Previous slot is referenced by this function only, so just update its value.
+			auto prevSlot = from + MediumJump + *reinterpret_cast<int32_t *>(from + sizeof(LongJumpPrefix));
+			if (info->isAddressSlot(prevSlot)) {
+				addressSlot = prevSlot;
+			} else {
+				addressSlot = getReachableAddressSlot(info, from);
+				ownSlot = addressSlot != 0;
+			}
 			DBGLOG("patcher", "using slotted jumping for previous via " PRIKADDR, CASTKADDR(addressSlot));
 			// If this happens, then we should allow slotted jumping only for Auto type.
 			if (addressSlot == 0)
@@ -439,12 +457,17 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 		}
 
 	} else if (buildWrapper) {
-		if (info && absolute && (jumpType == JumpType::Auto || jumpType == JumpType::Long)) {
-			addressSlot = info->getAddressSlot();
+		// Relocatable prologues take direct long jumps and leave address slots to the ones that are not.
+		if (info && absolute && (jumpType == JumpType::Auto || jumpType == JumpType::Long) && !canRouteLong(from)) {
+			addressSlot = getReachableAddressSlot(info, from);
+			ownSlot = addressSlot != 0;
 			DBGLOG("patcher", "using slotted jumping via " PRIKADDR, CASTKADDR(addressSlot));
 		}
 		trampoline = createTrampoline(from, absolute ? (addressSlot ? MediumJump : LongJump) : SmallJump);
-		if (!trampoline) return EINVAL;
+		if (!trampoline) {
+			if (ownSlot) info->releaseAddressSlot(addressSlot);
+			return EINVAL;
+		}
 	}
 
 	// Write original function before making route to avoid null pointer dereference.
@@ -457,6 +480,7 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 	// put in the beginning of the image, right after the Mach-O commands.
 	// This solves the problem of having short prologues followed by non-movable
 	// commands like mov rax, <vtable_address> commonly found in 11.0 (e.g. ATIController::start).
+	// Prologues that relocate into the trampoline do not need slots, see canRouteLong.
 
 	if (addressSlot) {
 		patch.m.opcode = LongJumpPrefix;
@@ -502,6 +526,7 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 		code = Error::MemoryIssue;
 		Patch::deleter(opcode); Patch::deleter(argument);
 		if (disp) Patch::deleter(disp);
+		if (ownSlot) info->releaseAddressSlot(addressSlot);
 		return EINVAL;
 	}
 
@@ -510,6 +535,7 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 		code = Error::MemoryProtection;
 		Patch::deleter(opcode); Patch::deleter(argument);
 		if (disp) Patch::deleter(disp);
+		if (ownSlot) info->releaseAddressSlot(addressSlot);
 		return EINVAL;
 	}
 
@@ -541,19 +567,15 @@ mach_vm_address_t KernelPatcher::routeFunctionInternal(mach_vm_address_t from, m
 		MachInfo::setKernelWriting(false, kernelWriteLock);
 
 		if (revertible) {
-			auto oidx = kpatches.push_back<4>(opcode);
-			auto aidx = kpatches.push_back<4>(argument);
-			auto didx = disp ? kpatches.push_back<4>(disp) : 0;
-
-			if (oidx && aidx && (!disp || didx))
-				return trampoline;
-
-			SYSLOG("patcher", "failed to store patches for later removal, you are in trouble");
-#ifndef __clang_analyzer__
-			if (oidx) kpatches.erase(oidx);
-			if (aidx) kpatches.erase(aidx);
-			if (didx) kpatches.erase(didx);
-#endif
+			// Slot is written first and thus must be restored last.
+			size_t journaled = kpatches.size();
+			if ((disp && !journalPatch(disp)) || !journalPatch(opcode) || !journalPatch(argument)) {
+				SYSLOG("patcher", "failed to store patches for later removal, you are in trouble");
+				while (kpatches.size() > journaled)
+					kpatches.erase(kpatches.last(), false);
+			} else if (!kroutes.push_back<2>(RouteRecord {from, to, ownSlot ? addressSlot : 0, info})) {
+				SYSLOG("patcher", "failed to store route for later removal");
+			}
 		}
 	}
 
@@ -728,7 +750,17 @@ bool KernelPatcher::routeMultipleInternal(size_t id, RouteRequest *requests, siz
 		auto &request = requests[i];
 		if (!request.from) continue;
 		if (request.to) eraseCoverageInstPrefix(request.from, 5, LongJump);
-		auto wrapper = routeFunctionInternal(request.from, request.to, request.org, kernelRoute, true, jump, kinfos[id], request.org);
+		auto to = request.to;
+		if (instrumentRoutes && to && kernelRoute) {
+			auto instrumented = createInstrumentedWrapper(request.symbol, to);
+			if (instrumented) {
+				to = instrumented;
+			} else {
+				SYSLOG("patcher", "failed to instrument %s, routing directly, err %d", request.symbol, getError());
+				clearError();
+			}
+		}
+		auto wrapper = routeFunctionInternal(request.from, to, request.org, kernelRoute, true, jump, kinfos[id], request.org);
 		if (request.org) {
 			if (wrapper) {
 				DBGLOG("patcher", "wrapped %s", request.symbol);
@@ -755,6 +787,115 @@ bool KernelPatcher::routeMultipleInternal(size_t id, RouteRequest *requests, siz
 }
 
 uint8_t KernelPatcher::tempExecutableMemory[TempExecutableMemorySize] __attribute__((section("__TEXT,__text")));
+uint8_t KernelPatcher::instrumentedExecutableMemory[InstrumentedExecutableMemorySize] __attribute__((section("__TEXT,__text")));
+
+bool KernelPatcher::journalPatch(const Patch::All *patch) {
+	PatchRecord record {};
+	record.address = patch->address();
+	record.size = static_cast<uint8_t>(patch->size());
+	lilu_os_memcpy(record.original, patch->original(), record.size);
+	return kpatches.push_back<4>(record);
+}
+
+void KernelPatcher::restorePatch(const PatchRecord &record) {
+	switch (record.size) {
+		case sizeof(uint8_t):
+			Patch::writeType(record.address, record.original[0]);
+			break;
+		case sizeof(uint16_t): {
+			uint16_t value;
+			lilu_os_memcpy(&value, record.original, sizeof(value));
+			Patch::writeType(record.address, value);
+			break;
+		}
+		case sizeof(uint32_t): {
+			uint32_t value;
+			lilu_os_memcpy(&value, record.original, sizeof(value));
+			Patch::writeType(record.address, value);
+			break;
+		}
+		case sizeof(uint64_t): {
+			uint64_t value;
+			lilu_os_memcpy(&value, record.original, sizeof(value));
+			Patch::writeType(record.address, value);
+			break;
+		}
+		default:
+			lilu_os_memcpy(reinterpret_cast<void *>(record.address), record.original, record.size);
+			break;
+	}
+}
+
+void KernelPatcher::restorePatches() {
+	for (size_t i = kpatches.size(); i > 0; i--)
+		restorePatch(kpatches[i - 1]);
+}
+
+size_t KernelPatcher::serializePatchJournal(uint8_t *buffer, size_t size) {
+	size_t total = kpatches.size() * sizeof(PatchRecord);
+	if (!buffer)
+		return total;
+	if (size < total)
+		return 0;
+	if (total > 0)
+		lilu_os_memcpy(buffer, kpatches.data(), total);
+	return total;
+}
+
+bool KernelPatcher::revertRoute(mach_vm_address_t from) {
+	size_t route = 0;
+	while (route < kroutes.size() && kroutes[route].from != from)
+		route++;
+	if (route == kroutes.size()) {
+		SYSLOG("patcher", "no revertible route at " PRIKADDR, CASTKADDR(from));
+		return false;
+	}
+
+	// Another route on top would be lost together with ours.
+	auto &record = kroutes[route];
+	JumpType jumpType;
+	if (readChain(from, jumpType) != record.to) {
+		SYSLOG("patcher", "route at " PRIKADDR " was routed again and cannot be reverted", CASTKADDR(from));
+		return false;
+	}
+
+	if (MachInfo::setKernelWriting(true, kernelWriteLock) != KERN_SUCCESS) {
+		SYSLOG("patcher", "cannot change kernel memory protection at route removal");
+		code = Error::MemoryProtection;
+		return false;
+	}
+
+	// The prologue is restored before the slot, just like restorePatches does.
+	for (size_t i = kpatches.size(); i > 0; i--) {
+		auto &patch = kpatches[i - 1];
+		if ((patch.address >= from && patch.address < from + sizeof(FunctionPatch)) || (record.slot && patch.address == record.slot)) {
+			restorePatch(patch);
+			kpatches.erase(i - 1, false);
+		}
+	}
+
+	MachInfo::setKernelWriting(false, kernelWriteLock);
+
+	if (record.slot)
+		record.info->releaseAddressSlot(record.slot);
+	kroutes.erase(route, false);
+	return true;
+}
+
+mach_vm_address_t KernelPatcher::getReachableAddressSlot(MachInfo *info, mach_vm_address_t from) {
+	auto slot = info->getAddressSlot();
+	if (slot) {
+		// Overflow slots may be out of 32-bit displacement reach, fallback to long jumps then.
+		int64_t diff = static_cast<int64_t>(slot - (from + MediumJump));
+		if (diff != static_cast<int32_t>(diff)) {
+			DBGLOG("patcher", "address slot " PRIKADDR " is out of reach from " PRIKADDR, CASTKADDR(slot), CASTKADDR(from));
+			// Do not recycle it, it will likely be out of reach for other functions too.
+			info->discardAddressSlot(slot);
+			slot = 0;
+		}
+	}
+	return slot;
+}
 
 mach_vm_address_t KernelPatcher::readChain(mach_vm_address_t from, JumpType &jumpType) {
 	// Note, unaligned access for simplicity
@@ -778,6 +919,19 @@ mach_vm_address_t KernelPatcher::readChain(mach_vm_address_t from, JumpType &jum
 	return 0;
 }
 
+bool KernelPatcher::canRouteLong(mach_vm_address_t from) {
+	size_t off = Disassembler::quickInstructionSize(from, LongJump);
+	if (!off || off > MaxTrampolinePrologue || !Disassembler::isLinearCode(from, LongJump))
+		return false;
+
+	// The trampoline is created right after this check at the current executable memory offset.
+	uint8_t prologue[MaxTrampolinePrologue];
+	auto dstAddr = reinterpret_cast<mach_vm_address_t>(tempExecutableMemory) + tempExecutableMemoryOff;
+	bool res = Disassembler::relocateInstructions(from, off, prologue, sizeof(prologue), dstAddr) != 0;
+	DBGLOG("patcher", "prologue of " PRIKADDR " of %lu bytes is %s", CASTKADDR(from), off, res ? "relocatable" : "not relocatable");
+	return res;
+}
+
 mach_vm_address_t KernelPatcher::createTrampoline(mach_vm_address_t func, size_t min, const uint8_t *opcodes, size_t opnum) {
 	// Doing it earlier to workaround stack corruption due to a possible 10.12 bug.
 	// Otherwise in rare cases there will be random KPs with corrupted stack data.
@@ -799,7 +953,19 @@ mach_vm_address_t KernelPatcher::createTrampoline(mach_vm_address_t func, size_t
 
 	uint8_t *tempDataPtr = reinterpret_cast<uint8_t *>(tempExecutableMemory) + tempExecutableMemoryOff;
 
-	tempExecutableMemoryOff += off + LongJump + opnum;
+	// Relocate the prologue, so that RIP-relative operands and branches keep their targets
+	uint8_t prologue[MaxTrampolinePrologue];
+	size_t relocated = Disassembler::relocateInstructions(func, off, prologue, sizeof(prologue),
+		reinterpret_cast<mach_vm_address_t>(tempDataPtr + opnum));
+
+	if (!relocated) {
+		MachInfo::setKernelWriting(false, kernelWriteLock);
+		SYSLOG("patcher", "unable to relocate %lu prologue bytes", off);
+		code = Error::DisasmFailure;
+		return 0;
+	}
+
+	tempExecutableMemoryOff += relocated + LongJump + opnum;
 
 	if (tempExecutableMemoryOff >= TempExecutableMemorySize) {
 		MachInfo::setKernelWriting(false, kernelWriteLock);
@@ -810,8 +976,8 @@ mach_vm_address_t KernelPatcher::createTrampoline(mach_vm_address_t func, size_t
 		if (opnum > 0)
 			lilu_os_memcpy(tempDataPtr, opcodes, opnum);
 
-		// Copy the prologue, assuming it is PIC
-		lilu_os_memcpy(tempDataPtr + opnum, reinterpret_cast<void *>(func), off);
+		// Copy the relocated prologue
+		lilu_os_memcpy(tempDataPtr + opnum, prologue, relocated);
 
 		MachInfo::setKernelWriting(false, kernelWriteLock);
 
@@ -819,7 +985,7 @@ mach_vm_address_t KernelPatcher::createTrampoline(mach_vm_address_t func, size_t
 		clearError();
 
 		// Add a jump, this one type is honestly irrelevant to us, thus auto.
-		routeFunctionInternal(reinterpret_cast<mach_vm_address_t>(tempDataPtr+opnum+off), func+off, false, true, false);
+		routeFunctionInternal(reinterpret_cast<mach_vm_address_t>(tempDataPtr+opnum+relocated), func+off, false, true, false);
 
 		if (getError() == Error::NoError) {
 			return reinterpret_cast<mach_vm_address_t>(tempDataPtr);
@@ -831,6 +997,192 @@ mach_vm_address_t KernelPatcher::createTrampoline(mach_vm_address_t func, size_t
 	return 0;
 }
 
+mach_vm_address_t KernelPatcher::createInstrumentedWrapper(const char *symbol, mach_vm_address_t to) {
+#if defined(__x86_64__)
+	using CpuCounters = RouteStatistics::CpuCounters;
+	static_assert(offsetof(CpuCounters, calls) == 0x00 &&
+				  offsetof(CpuCounters, cycles) == 0x08 &&
+				  offsetof(CpuCounters, maxCycles) == 0x10 &&
+				  sizeof(CpuCounters) == 0x40, "Invalid route statistics layout");
+	static_assert(InstrumentedCpuSlots == CPUInfo::MaxCpus, "Invalid per-CPU slot count");
+
+	// Preserve rax (al for varargs) and rdx (3rd argument) around rdtsc, keep start time in rbx.
+	static constexpr uint8_t Prologue[] {
+		0x55,             // push rbp
+		0x48, 0x89, 0xE5, // mov rbp, rsp
+		0x53,             // push rbx
+		0x41, 0x54,       // push r12
+		0x49, 0x89, 0xC4, // mov r12, rax
+		0x49, 0x89, 0xD3, // mov r11, rdx
+		0x0F, 0x31,       // rdtsc
+		0x48, 0xC1, 0xE2, 0x20, // shl rdx, 32
+		0x48, 0x09, 0xD0, // or rax, rdx
+		0x48, 0x89, 0xC3, // mov rbx, rax
+		0x4C, 0x89, 0xDA, // mov rdx, r11
+		0x4C, 0x89, 0xE0  // mov rax, r12
+	};
+	// push qword ptr [rbp + disp8], copies stack arguments keeping 16-byte alignment
+	static constexpr uint8_t PushArgument[] {0xFF, 0x75};
+	static_assert(InstrumentedStackArgs % 2 == 0 && 16 + InstrumentedStackArgs * sizeof(uint64_t) < 0x80, "Invalid stack argument count");
+	static constexpr uint8_t CallPrefix[] {0x49, 0xBB}; // mov r11, imm64
+	static constexpr uint8_t Call[] {
+		0x41, 0xFF, 0xD3, // call r11
+		0x48, 0x83, 0xC4, static_cast<uint8_t>(InstrumentedStackArgs * sizeof(uint64_t)), // add rsp, imm8
+		0x49, 0x89, 0xC4, // mov r12, rax
+		0x49, 0x89, 0xD3, // mov r11, rdx
+		0x0F, 0x31,       // rdtsc
+		0x48, 0xC1, 0xE2, 0x20, // shl rdx, 32
+		0x48, 0x09, 0xD0, // or rax, rdx
+		0x48, 0x29, 0xD8, // sub rax, rbx
+		0x48, 0x89, 0xC3  // mov rbx, rax
+	};
+	static constexpr uint8_t StatsPrefix[] {0x48, 0xBA}; // mov rdx, imm64
+	// mov ecx, dword ptr gs:[disp32], the logical CPU number from the per-CPU data
+	static constexpr uint8_t CpuNumberPrefix[] {0x65, 0x8B, 0x0C, 0x25};
+	// xor ecx, ecx; nop word ptr [rax+rax], the first slot when the per-CPU data offset is unknown
+	static constexpr uint8_t NoCpuNumber[] {0x31, 0xC9, 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00};
+	static_assert(sizeof(NoCpuNumber) == sizeof(CpuNumberPrefix) + sizeof(uint32_t), "Invalid cpu number load");
+	static constexpr uint8_t CpuSlot[] {
+		0x83, 0xE1, static_cast<uint8_t>(InstrumentedCpuSlots - 1), // and ecx, imm8
+		0xC1, 0xE1, 0x06,             // shl ecx, 6
+		0x48, 0x01, 0xCA              // add rdx, rcx
+	};
+	// Counters stay locked, as the thread may migrate between reading the CPU number and updating the slot.
+	static constexpr uint8_t Epilogue[] {
+		0xF0, 0x48, 0xFF, 0x02,       // lock inc qword ptr [rdx]
+		0xF0, 0x48, 0x01, 0x5A, 0x08, // lock add qword ptr [rdx+8], rbx
+		0x48, 0x8B, 0x42, 0x10,       // mov rax, qword ptr [rdx+16]
+		0x48, 0x39, 0xC3,             // cmp rbx, rax
+		0x76, 0x08,                   // jbe done
+		0xF0, 0x48, 0x0F, 0xB1, 0x5A, 0x10, // lock cmpxchg qword ptr [rdx+16], rbx
+		0x75, 0xF3,                   // jne cmp
+		0x4C, 0x89, 0xE0,             // done: mov rax, r12
+		0x4C, 0x89, 0xDA,             // mov rdx, r11
+		0x41, 0x5C,                   // pop r12
+		0x5B,                         // pop rbx
+		0x5D,                         // pop rbp
+		0xC3                          // ret
+	};
+
+	static constexpr size_t WrapperSize = sizeof(Prologue) + InstrumentedStackArgs * (sizeof(PushArgument) + 1) +
+		sizeof(CallPrefix) + sizeof(uint64_t) + sizeof(Call) + sizeof(StatsPrefix) + sizeof(uint64_t) +
+		sizeof(NoCpuNumber) + sizeof(CpuSlot) + sizeof(Epilogue);
+
+	if (instrumentedExecutableMemoryOff + WrapperSize > InstrumentedExecutableMemorySize) {
+		SYSLOG("patcher", "not enough executable memory for instrumenting %s", safeString(symbol));
+		code = Error::MemoryIssue;
+		return 0;
+	}
+
+	auto stats = RouteStatistics::create(symbol);
+	if (!stats || !routeStatistics.push_back<2>(stats)) {
+		SYSLOG("patcher", "failed to allocate statistics for %s", safeString(symbol));
+		if (stats) RouteStatistics::deleter(stats);
+		code = Error::MemoryIssue;
+		return 0;
+	}
+
+	uint8_t wrapper[WrapperSize];
+	size_t off = 0;
+	auto append = [&wrapper, &off](const void *src, size_t size) {
+		lilu_os_memcpy(&wrapper[off], src, size);
+		off += size;
+	};
+
+	append(Prologue, sizeof(Prologue));
+	for (size_t i = InstrumentedStackArgs; i > 0; i--) {
+		uint8_t disp = static_cast<uint8_t>(16 + (i - 1) * sizeof(uint64_t));
+		append(PushArgument, sizeof(PushArgument));
+		append(&disp, sizeof(disp));
+	}
+	append(CallPrefix, sizeof(CallPrefix));
+	append(&to, sizeof(uint64_t));
+	append(Call, sizeof(Call));
+	append(StatsPrefix, sizeof(StatsPrefix));
+	uint64_t statsAddr = reinterpret_cast<uint64_t>(stats->cpus);
+	append(&statsAddr, sizeof(statsAddr));
+	if (cpuNumberOffset) {
+		append(CpuNumberPrefix, sizeof(CpuNumberPrefix));
+		append(&cpuNumberOffset, sizeof(cpuNumberOffset));
+	} else {
+		append(NoCpuNumber, sizeof(NoCpuNumber));
+	}
+	append(CpuSlot, sizeof(CpuSlot));
+	append(Epilogue, sizeof(Epilogue));
+
+	if (MachInfo::setKernelWriting(true, kernelWriteLock) != KERN_SUCCESS) {
+		SYSLOG("patcher", "failed to set executable permissions for instrumentation");
+		routeStatistics.erase(routeStatistics.last());
+		code = Error::MemoryProtection;
+		return 0;
+	}
+
+	uint8_t *tempDataPtr = reinterpret_cast<uint8_t *>(instrumentedExecutableMemory) + instrumentedExecutableMemoryOff;
+	instrumentedExecutableMemoryOff += WrapperSize;
+	lilu_os_memcpy(tempDataPtr, wrapper, WrapperSize);
+
+	MachInfo::setKernelWriting(false, kernelWriteLock);
+
+	DBGLOG("patcher", "instrumented %s via " PRIKADDR, safeString(symbol), CASTKADDR(tempDataPtr));
+	return reinterpret_cast<mach_vm_address_t>(tempDataPtr);
+#else
+	// Instrumented wrappers are only implemented for 64-bit kernels.
+	(void)symbol;
+	(void)to;
+	code = Error::Unsupported;
+	return 0;
+#endif
+}
+
+uint32_t KernelPatcher::findCpuNumberOffset() {
+#if defined(__x86_64__)
+	// cpu_number reads the logical CPU number from the per-CPU data, e.g. mov eax, dword ptr gs:[0x1C].
+	static constexpr uint8_t OpcodeMov {0x8B};
+	static constexpr uint8_t OpcodeRet {0xC3};
+	static constexpr uint8_t ModRMSib {4};
+	static constexpr uint8_t SibNoIndex {4};
+	static constexpr uint8_t SibNoBase {5};
+	static constexpr size_t MaxInstructions {8};
+
+	auto addr = reinterpret_cast<mach_vm_address_t>(cpu_number);
+	for (size_t i = 0; i < MaxInstructions; i++) {
+		Disassembler::hde_t hs;
+		auto len = Disassembler::hdeDisasm(addr, &hs);
+		if ((hs.flags & F_ERROR) || hs.opcode == OpcodeRet)
+			break;
+
+		if (hs.p_seg == PREFIX_SEGMENT_GS && hs.opcode == OpcodeMov && (hs.flags & F_DISP32) && hs.modrm_mod == 0 &&
+			hs.modrm_rm == ModRMSib && hs.sib_index == SibNoIndex && hs.sib_base == SibNoBase) {
+			DBGLOG("patcher", "cpu number is at gs:%X", hs.disp.disp32);
+			return hs.disp.disp32;
+		}
+
+		addr += len;
+	}
+#endif
+
+	SYSLOG("patcher", "failed to find cpu number offset, instrumented routes will share counters");
+	return 0;
+}
+
+void KernelPatcher::dumpRouteStatistics() {
+	SYSLOG("patcher", "%-64s %12s %16s %12s %12s", "symbol", "calls", "total cycles", "avg cycles", "max cycles");
+	for (size_t i = 0; i < routeStatistics.size(); i++) {
+		auto stats = routeStatistics[i];
+		uint64_t calls = 0, cycles = 0, maxCycles = 0;
+		for (size_t cpu = 0; cpu < InstrumentedCpuSlots; cpu++) {
+			auto &counters = stats->cpus[cpu];
+			calls += atomic_load_explicit(&counters.calls, memory_order_relaxed);
+			cycles += atomic_load_explicit(&counters.cycles, memory_order_relaxed);
+			uint64_t cpuMax = atomic_load_explicit(&counters.maxCycles, memory_order_relaxed);
+			if (cpuMax > maxCycles)
+				maxCycles = cpuMax;
+		}
+		SYSLOG("patcher", "%-64s %12llu %16llu %12llu %12llu", safeString(stats->symbol), calls, cycles,
+			calls > 0 ? cycles / calls : 0, maxCycles);
+	}
+}
+
 #ifdef LILU_KEXTPATCH_SUPPORT
 OSReturn KernelPatcher::onOSKextUnload(void *thisKext) {
 	OSReturn status = kOSReturnError;
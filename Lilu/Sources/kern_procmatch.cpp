@@ -0,0 +1,153 @@
+//
+//  kern_procmatch.cpp
+//  Lilu
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_config.hpp>
+#include <Headers/kern_procmatch.hpp>
+
+uint32_t ProcMatcher::findChild(uint32_t node, uint8_t label) const {
+	for (uint32_t child = nodes[node].child; child != 0; child = nodes[child].sibling) {
+		if (nodes[child].label == label)
+			return child;
+	}
+
+	return 0;
+}
+
+bool ProcMatcher::insert(uint32_t root, const char *str, uint32_t len, bool reverse, uint8_t flag) {
+	uint32_t node = root;
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t label = static_cast<uint8_t>(reverse ? str[len - i - 1] : str[i]);
+		uint32_t child = findChild(node, label);
+		if (child == 0) {
+			Node entry {};
+			entry.label = label;
+			entry.sibling = nodes[node].child;
+			if (!nodes.push_back<2>(entry))
+				return false;
+			child = static_cast<uint32_t>(nodes.last());
+			nodes[node].child = child;
+		}
+		node = child;
+	}
+
+	nodes[node].flags |= flag;
+	return true;
+}
+
+bool ProcMatcher::init() {
+	nodes.deinit();
+
+	for (uint32_t i = 0; i < RootTotal; i++) {
+		Node root {};
+		if (!nodes.push_back<2>(root)) {
+			nodes.deinit();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ProcMatcher::add(const char *path, uint32_t len, Mode mode) {
+	if (nodes.size() < RootTotal)
+		return false;
+
+	switch (mode) {
+		case ModeExact:
+			return insert(RootForward, path, len, false, TerminalExact);
+		case ModePrefix:
+			return insert(RootForward, path, len, false, TerminalPrefix);
+		case ModeSuffix:
+			return insert(RootReverse, path, len, true, TerminalSuffix);
+		case ModeAny:
+			return insert(RootAny, path, len, false, TerminalAny);
+	}
+
+	return false;
+}
+
+bool ProcMatcher::finish() {
+	if (nodes.size() < RootTotal)
+		return false;
+
+	// Breadth-first traversal, children of the root fail to the root.
+	evector<uint32_t> queue;
+	bool res = true;
+
+	for (uint32_t child = nodes[RootAny].child; child != 0 && res; child = nodes[child].sibling) {
+		nodes[child].fail = RootAny;
+		res = queue.push_back<2>(child);
+	}
+
+	for (size_t head = 0; head < queue.size() && res; head++) {
+		uint32_t node = queue[head];
+		for (uint32_t child = nodes[node].child; child != 0 && res; child = nodes[child].sibling) {
+			uint32_t fail = nodes[node].fail;
+			uint32_t next = findChild(fail, nodes[child].label);
+			while (next == 0 && fail != RootAny) {
+				fail = nodes[fail].fail;
+				next = findChild(fail, nodes[child].label);
+			}
+
+			nodes[child].fail = next != 0 ? next : RootAny;
+			nodes[child].flags |= nodes[nodes[child].fail].flags & TerminalAny;
+			res = queue.push_back<2>(child);
+		}
+	}
+
+	queue.deinit();
+	return res;
+}
+
+bool ProcMatcher::match(const char *path, uint32_t len) const {
+	// Exact and prefix paths
+	uint32_t node = RootForward;
+	uint32_t i = 0;
+	for (; i < len; i++) {
+		if (nodes[node].flags & TerminalPrefix)
+			return true;
+		node = findChild(node, static_cast<uint8_t>(path[i]));
+		if (node == 0)
+			break;
+	}
+
+	if (i == len && (nodes[node].flags & (TerminalExact | TerminalPrefix)))
+		return true;
+
+	// Suffix paths
+	node = RootReverse;
+	for (i = 0; i < len; i++) {
+		if (nodes[node].flags & TerminalSuffix)
+			return true;
+		node = findChild(node, static_cast<uint8_t>(path[len - i - 1]));
+		if (node == 0)
+			break;
+	}
+
+	if (i == len && (nodes[node].flags & TerminalSuffix))
+		return true;
+
+	// Substrings
+	if (nodes[RootAny].flags & TerminalAny)
+		return true;
+
+	node = RootAny;
+	for (i = 0; i < len; i++) {
+		uint8_t label = static_cast<uint8_t>(path[i]);
+		uint32_t next = findChild(node, label);
+		while (next == 0 && node != RootAny) {
+			node = nodes[node].fail;
+			next = findChild(node, label);
+		}
+
+		node = next != 0 ? next : RootAny;
+		if (nodes[node].flags & TerminalAny)
+			return true;
+	}
+
+	return false;
+}
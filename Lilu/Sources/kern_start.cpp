@@ -275,6 +275,9 @@ bool Configuration::getBootArguments() {
 	ADDPR(debugEnabled) |= checkKernelArgument(bootargDebug);
 
 	allowDecompress = !checkKernelArgument(bootargLowMem);
+	verifyDecompress = checkKernelArgument(bootargVerify);
+
+	profileRoutes = checkKernelArgument(bootargProfile);
 
 	auto entry = IORegistryEntry::fromPath("/chosen", gIODTPlane);
 	if (entry) {
@@ -314,8 +317,8 @@ bool Configuration::getBootArguments() {
 
 	readArguments = true;
 
-	DBGLOG("config", "version %s (%s), args: disabled %d, debug %d, slow %d, decompress %d",
-		   kextVersion, currentArch, isDisabled, ADDPR(debugEnabled), preferSlowMode, allowDecompress);
+	DBGLOG("config", "version %s (%s), args: disabled %d, debug %d, slow %d, decompress %d, verify %d, profile %d",
+		   kextVersion, currentArch, isDisabled, ADDPR(debugEnabled), preferSlowMode, allowDecompress, verifyDecompress, profileRoutes);
 
 	if (isDisabled) {
 		SYSLOG("config", "found a disabling argument or no arguments, exiting");
@@ -18,6 +18,7 @@
 #include <kern/task.h>
 #include <kern/cs_blobs.h>
 #include <sys/vm.h>
+#include <sys/random.h>
 
 static UserPatcher *that {nullptr};
 
@@ -112,7 +113,17 @@ bool UserPatcher::init(KernelPatcher &kernelPatcher, bool preferSlowMode) {
 	patchDyldSharedCache = !preferSlowMode;
 	patcher = &kernelPatcher;
 
-	pending.init();
+	// Pending storage cannot grow while hooks access it, so size it from the CPU count.
+	size_t pendingUsers = MinPendingUsers;
+	auto ncpus = reinterpret_cast<unsigned int *>(patcher->solveSymbol(KernelPatcher::KernelID, "_real_ncpus"));
+	if (ncpus && *ncpus * PendingUsersPerCpu > pendingUsers)
+		pendingUsers = *ncpus * PendingUsersPerCpu;
+	patcher->clearError();
+
+	if (!pending.init(pendingUsers)) {
+		SYSLOG("user", "failed to allocate pending user storage for %lu threads", pendingUsers);
+		return false;
+	}
 
 	listener = kauth_listen_scope(KAUTH_SCOPE_FILEOP, execListener, &cookie);
 
@@ -144,6 +155,18 @@ bool UserPatcher::registerPatches(ProcInfo **procs, size_t procNum, BinaryModInf
 		}
 	}
 
+	// The exec listener is already running, so the matcher is only published once complete.
+	auto matcher = new ProcMatcher;
+	if (matcher && compileProcMatcher(*matcher, procs, procNum)) {
+		matcher->previous = atomic_exchange_explicit(&procMatcher, matcher, memory_order_acq_rel);
+	} else {
+		SYSLOG("user", "failed to compile process matcher, falling back to linear matching");
+		if (matcher) {
+			matcher->deinit();
+			delete matcher;
+		}
+	}
+
 	return loadFilesForPatching() && (!patchDyldSharedCache || loadDyldSharedCacheMapping()) && loadLookups() && hookMemoryAccess();
 }
 
@@ -157,102 +180,128 @@ void UserPatcher::deinit() {
 		listener = nullptr;
 	}
 
-	pending.deinit();
+	// task_set_main_thread_qos route is only removed by KernelPatcher::deinit and keeps getting and erasing
+	// pending entries till then, so the storage is intentionally left allocated once the route is installed.
+	if (!orgTaskSetMainThreadQos)
+		pending.deinit();
+
+	auto matcher = atomic_exchange_explicit(&procMatcher, nullptr, memory_order_acq_rel);
+	while (matcher) {
+		auto previous = matcher->previous;
+		matcher->deinit();
+		delete matcher;
+		matcher = previous;
+	}
+
 	lookupStorage.deinit();
-	for (size_t i = 0; i < Lookup::matchNum; i++)
-		lookup.c[i].deinit();
+	lookup.deinit();
 }
 
 void UserPatcher::performPagePatch(const void *data_ptr, size_t data_size) {
-	for (size_t data_off = 0; data_off < data_size; data_off += PAGE_SIZE) {
-		size_t sz = that->lookupStorage.size();
-		size_t maybe = 0;
-		auto ptr = static_cast<const uint8_t *>(data_ptr) + data_off;
-
-		if (sz > 0) {
-			for (size_t i = 0; i < Lookup::matchNum && maybe != sz; i++) {
-				uint64_t value = *reinterpret_cast<const uint64_t *>(ptr + lookup.offs[i]);
-
-				if (i == 0) {
-					for (maybe = 0; maybe < sz; maybe++) {
-						if (lookup.c[i][maybe] == value) {
-							// We have a possible match
-							DBGLOG("user", "found a possible match for %lu of %llX", i, value);
-							break;
-						}
-					}
-				} else {
-					if (lookup.c[i][maybe] != value) {
-						// We failed
-						DBGLOG("user", "failure not matching %lu of %llX to expected %llX", i, value, lookup.c[i][maybe]);
-						maybe = sz;
-					} else {
-						DBGLOG("user", "found a possible match for %lu of %llX", i, value);
-					}
-				}
+	if (!lookup.loaded())
+		return;
+
+	// Gather fingerprint keys of several pages at once, only the pages passing the filter are probed.
+	auto base = static_cast<const uint8_t *>(data_ptr);
+	for (size_t data_off = 0; data_off < data_size; data_off += PagePatchBatch * PAGE_SIZE) {
+		size_t num = (data_size - data_off + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (num > PagePatchBatch)
+			num = PagePatchBatch;
+
+		uint64_t values[PagePatchBatch];
+		uint32_t hits = 0;
+		for (size_t i = 0; i < num; i++) {
+			values[i] = lookup.key(base + data_off + i * PAGE_SIZE);
+			hits |= static_cast<uint32_t>(lookup.mayContain(values[i])) << i;
+		}
 
+		for (size_t i = 0; hits != 0; i++, hits >>= 1) {
+			if (hits & 1)
+				patchLookupPage(base + data_off + i * PAGE_SIZE, values[i]);
+		}
+	}
+}
+
+void UserPatcher::patchLookupPage(const uint8_t *ptr, uint64_t value) {
+	size_t sz = lookupStorage.size();
+	size_t maybe = 0;
+	uint64_t digest[2];
+	bool hasDigest = false;
+	size_t slot = PageLookup::hash(value);
+
+	// Several pages may share the key, try each of them.
+	while ((maybe = lookup.findCandidate(value, slot)) < sz) {
+		DBGLOG("user", "found a possible match for key %llX", value);
+
+		if (!lookup.matchCandidate(ptr, maybe))
+			continue;
+
+		if (!hasDigest) {
+			computePageDigest(ptr, digestKey, digest);
+			hasDigest = true;
+		}
+
+		auto &storage = that->lookupStorage[maybe];
+		if (digest[0] == storage->digest[0] && digest[1] == storage->digest[1] && matchPatchRanges(storage, ptr))
+			break;
+
+		DBGLOG("user", "failed to match a complete page with %lu", maybe);
+	}
+
+	if (maybe < sz) {
+		auto &storage = that->lookupStorage[maybe];
+
+		// That's a patch
+		for (size_t r = 0, rsz = storage->refs.size(); r < rsz; r++) {
+			// Apply the patches
+			auto &ref = storage->refs[r];
+			auto &rpatch = storage->mod->patches[ref->i];
+			sz = ref->pageOffs.size();
+
+			// Skip patches that are meant to apply only to select processes.
+			if (rpatch.flags & LocalOnly) {
+				continue;
 			}
 
-			if (maybe < sz) {
-				auto &storage = that->lookupStorage[maybe];
-
-				// That's a patch
-				if (!memcmp(storage->page->p, ptr, PAGE_SIZE)) {
-					for (size_t r = 0, rsz = storage->refs.size(); r < rsz; r++) {
-						// Apply the patches
-						auto &ref = storage->refs[r];
-						auto &rpatch = storage->mod->patches[ref->i];
-						sz = ref->pageOffs.size();
-
-						// Skip patches that are meant to apply only to select processes.
-						if (rpatch.flags & LocalOnly) {
-							continue;
-						}
-
-						DBGLOG("user", "found what we are looking for %X %X %X %X %X %X %X %X", rpatch.find[0],
-								rpatch.size > 1 ? rpatch.find[1] : 0xff,
-								rpatch.size > 2 ? rpatch.find[2] : 0xff,
-								rpatch.size > 3 ? rpatch.find[3] : 0xff,
-								rpatch.size > 4 ? rpatch.find[4] : 0xff,
-								rpatch.size > 5 ? rpatch.find[5] : 0xff,
-								rpatch.size > 6 ? rpatch.find[6] : 0xff,
-								rpatch.size > 7 ? rpatch.find[7] : 0xff
-						);
-
-						if (sz > 0 && MachInfo::setKernelWriting(true, KernelPatcher::kernelWriteLock) == KERN_SUCCESS) {
-							DBGLOG("user", "obtained write permssions");
-
-							for (size_t i = 0; i < sz; i++) {
-								uint8_t *patch = const_cast<uint8_t *>(ptr + ref->pageOffs[i]);
-
-								switch(rpatch.size) {
-									case sizeof(uint8_t):
-										*const_cast<uint8_t *>(patch) = *rpatch.replace;
-										break;
-									case sizeof(uint16_t):
-										*reinterpret_cast<uint16_t *>(patch) = *reinterpret_cast<const uint16_t *>(rpatch.replace);
-										break;
-									case sizeof(uint32_t):
-										*reinterpret_cast<uint32_t *>(patch) = *reinterpret_cast<const uint32_t *>(rpatch.replace);
-										break;
-									case sizeof(uint64_t):
-										*reinterpret_cast<uint64_t *>(patch) = *reinterpret_cast<const uint64_t *>(rpatch.replace);
-										break;
-									default:
-										lilu_os_memcpy(patch, rpatch.replace, rpatch.size);
-								}
-							}
-
-							if (MachInfo::setKernelWriting(false, KernelPatcher::kernelWriteLock) == KERN_SUCCESS) {
-								DBGLOG("user", "restored write permssions");
-							}
-						} else {
-							SYSLOG("user", "failed to obtain write permssions for %lu", sz);
-						}
+			DBGLOG("user", "found what we are looking for %X %X %X %X %X %X %X %X", rpatch.find[0],
+					rpatch.size > 1 ? rpatch.find[1] : 0xff,
+					rpatch.size > 2 ? rpatch.find[2] : 0xff,
+					rpatch.size > 3 ? rpatch.find[3] : 0xff,
+					rpatch.size > 4 ? rpatch.find[4] : 0xff,
+					rpatch.size > 5 ? rpatch.find[5] : 0xff,
+					rpatch.size > 6 ? rpatch.find[6] : 0xff,
+					rpatch.size > 7 ? rpatch.find[7] : 0xff
+			);
+
+			if (sz > 0 && MachInfo::setKernelWriting(true, KernelPatcher::kernelWriteLock) == KERN_SUCCESS) {
+				DBGLOG("user", "obtained write permssions");
+
+				for (size_t i = 0; i < sz; i++) {
+					uint8_t *patch = const_cast<uint8_t *>(ptr + ref->pageOffs[i]);
+
+					switch(rpatch.size) {
+						case sizeof(uint8_t):
+							*const_cast<uint8_t *>(patch) = *rpatch.replace;
+							break;
+						case sizeof(uint16_t):
+							*reinterpret_cast<uint16_t *>(patch) = *reinterpret_cast<const uint16_t *>(rpatch.replace);
+							break;
+						case sizeof(uint32_t):
+							*reinterpret_cast<uint32_t *>(patch) = *reinterpret_cast<const uint32_t *>(rpatch.replace);
+							break;
+						case sizeof(uint64_t):
+							*reinterpret_cast<uint64_t *>(patch) = *reinterpret_cast<const uint64_t *>(rpatch.replace);
+							break;
+						default:
+							lilu_os_memcpy(patch, rpatch.replace, rpatch.size);
 					}
-				} else {
-					DBGLOG("user", "failed to match a complete page with %lu", maybe);
 				}
+
+				if (MachInfo::setKernelWriting(false, KernelPatcher::kernelWriteLock) == KERN_SUCCESS) {
+					DBGLOG("user", "restored write permssions");
+				}
+			} else {
+				SYSLOG("user", "failed to obtain write permssions for %lu", sz);
 			}
 		}
 	}
@@ -274,51 +323,99 @@ boolean_t UserPatcher::codeSignValidateRangeWrapper(void *blobs, memory_object_t
 }
 
 void UserPatcher::onPath(const char *path, uint32_t len) {
-	if (len >= currentMinProcLength) {
-		for (uint32_t i = 0; i < procInfoSize; i++) {
-			auto p = procInfo[i];
-			if (len >= p->len) {
-				auto match = p->flags & ProcInfo::MatchMask;
-				if ((match == ProcInfo::MatchExact && len == p->len && !strncmp(p->path, path, len)) ||
-					(match == ProcInfo::MatchPrefix && !strncmp(p->path, path, p->len)) ||
-					(match == ProcInfo::MatchSuffix && !strncmp(p->path, path + (len - p->len), p->len+1)) ||
-					(match == ProcInfo::MatchAny && strstr(path, p->path))) {
-					DBGLOG("user", "caught %s performing injection", path);
-					if (orgTaskSetMainThreadQos) {
-						DBGLOG("user", "requesting delayed patch " PRIKADDR, CASTKADDR(current_thread()));
-
-						auto previous = pending.get();
-						if (previous) {
-							// This is possible when execution does not happen, and thus we do not remove the patch.
-							DBGLOG("user", "found dangling user patch request");
-							PANIC_COND(!pending.erase(), "user", "failed to remove dangling user patch");
-							delete *previous;
-						}
-
-						auto pend = new PendingUser;
-						if (pend != nullptr) {
-							lilu_strlcpy(pend->path, path, MAXPATHLEN);
-							pend->pathLen = len;
-							// This should not happen after we added task_set_main_thread_qos hook, which gets always called
-							// unlike proc_exec_switch_task. Increasing pending count to 32 should accomodate for most CPUs.
-							// Still do not cause a kernel panic but rather just report this.
-							if (!pending.set(pend)) {
-								SYSLOG("user", "failed to set user patch request, report this!!!");
-								delete pend;
-							}
-						} else {
-							SYSLOG("user", "failed to allocate pending user callback");
-						}
+	if (len < currentMinProcLength)
+		return;
 
-					} else {
-						patchBinary(orgCurrentMap(), path, len);
-					}
+	auto matcher = atomic_load_explicit(&procMatcher, memory_order_acquire);
+	bool matched = matcher ? matcher->match(path, len) : matchProcInfo(path, len);
+	if (!matched)
+		return;
 
-					return;
-				}
+	DBGLOG("user", "caught %s performing injection", path);
+	if (orgTaskSetMainThreadQos) {
+		DBGLOG("user", "requesting delayed patch " PRIKADDR, CASTKADDR(current_thread()));
+
+		auto previous = pending.get();
+		if (previous) {
+			// This is possible when execution does not happen, and thus we do not remove the patch.
+			DBGLOG("user", "found dangling user patch request");
+			PANIC_COND(!pending.erase(), "user", "failed to remove dangling user patch");
+			delete *previous;
+		}
+
+		auto pend = new PendingUser;
+		if (pend != nullptr) {
+			lilu_strlcpy(pend->path, path, MAXPATHLEN);
+			pend->pathLen = len;
+			// This should not happen after we added task_set_main_thread_qos hook, which gets always called
+			// unlike proc_exec_switch_task. PendingUsersPerCpu should accomodate for concurrent execs on any CPU.
+			// Still do not cause a kernel panic but rather just report this.
+			if (!pending.set(pend)) {
+				SYSLOG("user", "failed to set user patch request, report this!!!");
+				delete pend;
 			}
+		} else {
+			SYSLOG("user", "failed to allocate pending user callback");
+		}
+
+	} else {
+		patchBinary(orgCurrentMap(), path, len);
+	}
+}
+
+bool UserPatcher::matchProcInfo(const char *path, uint32_t len) {
+	for (uint32_t i = 0; i < procInfoSize; i++) {
+		auto p = procInfo[i];
+		if (len >= p->len) {
+			auto match = p->flags & ProcInfo::MatchMask;
+			if ((match == ProcInfo::MatchExact && len == p->len && !strncmp(p->path, path, len)) ||
+				(match == ProcInfo::MatchPrefix && !strncmp(p->path, path, p->len)) ||
+				(match == ProcInfo::MatchSuffix && !strncmp(p->path, path + (len - p->len), p->len+1)) ||
+				(match == ProcInfo::MatchAny && strstr(path, p->path))) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool UserPatcher::compileProcMatcher(ProcMatcher &matcher, ProcInfo **procs, size_t procNum) {
+	if (!matcher.init())
+		return false;
+
+	for (size_t i = 0; i < procNum; i++) {
+		auto p = procs[i];
+		bool res = true;
+		// Combined matching flags never match, like in matchProcInfo.
+		switch (p->flags & ProcInfo::MatchMask) {
+			case ProcInfo::MatchExact:
+				res = matcher.add(p->path, p->len, ProcMatcher::ModeExact);
+				break;
+			case ProcInfo::MatchPrefix:
+				res = matcher.add(p->path, p->len, ProcMatcher::ModePrefix);
+				break;
+			case ProcInfo::MatchSuffix:
+				res = matcher.add(p->path, p->len, ProcMatcher::ModeSuffix);
+				break;
+			case ProcInfo::MatchAny:
+				res = matcher.add(p->path, p->len, ProcMatcher::ModeAny);
+				break;
+		}
+
+		if (!res) {
+			matcher.deinit();
+			return false;
 		}
 	}
+
+	if (!matcher.finish()) {
+		matcher.deinit();
+		return false;
+	}
+
+	DBGLOG("user", "compiled process matcher of %lu nodes for %lu processes", matcher.size(), procNum);
+	return true;
 }
 
 void UserPatcher::patchBinary(vm_map_t map, const char *path, uint32_t len) {
@@ -630,6 +727,9 @@ void UserPatcher::patchSharedCache(vm_map_t taskPort, uint32_t slide, cpu_type_t
 		sharedCacheSlideStored = true;
 	}
 
+	// Collect all patch places first to handle every page once.
+	evector<SharedCachePlace> places;
+
 	for (size_t i = 0, sz = lookupStorage.size(); i < sz; i++) {
 		auto &storageEntry = lookupStorage[i];
 		auto &mod = storageEntry->mod;
@@ -650,103 +750,332 @@ void UserPatcher::patchSharedCache(vm_map_t taskPort, uint32_t slide, cpu_type_t
 				modEnd = mod->endDATA;
 			}
 
-			if (modStart && modEnd && offNum && patch.cpu == cpu) {
+			if (modStart && modEnd && offNum && patch.size > 0 && patch.cpu == cpu) {
 				DBGLOG("user", "patch for %s in %llX %llX", mod->path, (uint64_t)modStart, (uint64_t)modEnd);
-				auto tmp = Buffer::create<uint8_t>(patch.size);
-				if (tmp) {
-					for (size_t k = 0; k < offNum; k++) {
-						auto place = modStart+ref->segOffs[k]+slide;
-						auto r = orgVmMapReadUser(taskPort, place, tmp, patch.size);
-						if (!r) {
-							bool comparison = !memcmp(tmp, applyChanges? patch.find : patch.replace, patch.size);
-							DBGLOG("user", "%d/%d found %X %X %X %X", applyChanges, comparison, tmp[0], tmp[1], tmp[2], tmp[3]);
-							if (comparison) {
-								r = vmProtect(taskPort, (vm_offset_t)(place & -PAGE_SIZE), PAGE_SIZE, FALSE, VM_PROT_READ|VM_PROT_WRITE|VM_PROT_EXECUTE);
-								if (r == KERN_SUCCESS) {
-									DBGLOG("user", "obtained write permssions");
-
-									r = orgVmMapWriteUser(taskPort, applyChanges ? patch.replace : patch.find, place, patch.size);
-
-									if (r != KERN_SUCCESS)
-										SYSLOG("user", "patching %llX -> res %d", place, r);
-
-									r = vmProtect(taskPort, (vm_offset_t)(place & -PAGE_SIZE), PAGE_SIZE, FALSE, VM_PROT_READ|VM_PROT_EXECUTE);
-									if (r == KERN_SUCCESS)
-										DBGLOG("user", "restored write permssions");
-									else
-										DBGLOG("user", "failed to restore write permssions %d", r);
-								} else {
-									SYSLOG("user", "failed to obtain write permissions for patching %d", r);
-								}
-							} else if (ADDPR(debugEnabled)) {
-								for (size_t l = 0; l < patch.size; l++) {
-									auto v = (applyChanges? patch.find : patch.replace)[l];
-									if (tmp[l] != v) {
-										DBGLOG("user", "miss at %lu: %02X vs %02X", l, tmp[l], v);
-										break;
-									}
-								}
-							}
-						}
-
-						DBGLOG("user", "done reading patches for %llX", ref->segOffs[k]);
+				for (size_t k = 0; k < offNum; k++) {
+					SharedCachePlace place {modStart+ref->segOffs[k]+slide, &patch, places.size()};
+					if (!places.push_back<4>(place))
+						SYSLOG("user", "failed to record shared cache patch place %llX", (uint64_t)place.address);
+				}
+			}
+		}
+	}
+
+	size_t num = places.size();
+	if (num == 0) {
+		places.deinit();
+		return;
+	}
+
+	qsort(places.data(), num, sizeof(SharedCachePlace), [](const void *a, const void *b) {
+		auto &pa = *static_cast<const SharedCachePlace *>(a);
+		auto &pb = *static_cast<const SharedCachePlace *>(b);
+		if (pa.address != pb.address)
+			return pa.address < pb.address ? -1 : 1;
+		// Keep the original order for patches at the same place.
+		return pa.order < pb.order ? -1 : (pa.order > pb.order ? 1 : 0);
+	});
+
+	uint8_t *span {nullptr};
+	size_t spanCapacity {0};
+
+	for (size_t first = 0, last = 0; first < num; first = last) {
+		// Group all places starting in the same page, their span may reach the next page.
+		vm_address_t page = places[first].address & -PAGE_SIZE;
+		vm_address_t spanStart = places[first].address;
+		vm_address_t spanEnd = spanStart;
+		for (last = first; last < num && (places[last].address & -PAGE_SIZE) == page; last++) {
+			auto end = places[last].address + places[last].patch->size;
+			if (end > spanEnd)
+				spanEnd = end;
+		}
+
+		size_t spanSize = spanEnd - spanStart;
+		if (spanSize > spanCapacity) {
+			if (!Buffer::resize(span, spanSize)) {
+				SYSLOG("user", "failed to allocate %lu bytes for shared cache patching", spanSize);
+				continue;
+			}
+			spanCapacity = spanSize;
+		}
+
+		auto r = orgVmMapReadUser(taskPort, spanStart, span, spanSize);
+		if (r) {
+			DBGLOG("user", "failed to read shared cache at %llX of %lu bytes %d", (uint64_t)spanStart, spanSize, r);
+			continue;
+		}
+
+		// Compare and apply all patches of the page to the local copy first.
+		bool modified = false;
+		for (size_t k = first; k < last; k++) {
+			auto &patch = *places[k].patch;
+			auto curr = span + (places[k].address - spanStart);
+			auto from = applyChanges ? patch.find : patch.replace;
+			bool comparison = !memcmp(curr, from, patch.size);
+			DBGLOG("user", "%d/%d found %X %X %X %X", applyChanges, comparison, curr[0],
+				   patch.size > 1 ? curr[1] : 0xff, patch.size > 2 ? curr[2] : 0xff, patch.size > 3 ? curr[3] : 0xff);
+			if (comparison) {
+				lilu_os_memcpy(curr, applyChanges ? patch.replace : patch.find, patch.size);
+				modified = true;
+			} else if (ADDPR(debugEnabled)) {
+				for (size_t l = 0; l < patch.size; l++) {
+					if (curr[l] != from[l]) {
+						DBGLOG("user", "miss at %lu: %02X vs %02X", l, curr[l], from[l]);
+						break;
 					}
-					Buffer::deleter(tmp);
 				}
 			}
 		}
+
+		if (!modified)
+			continue;
+
+		vm_size_t protSize = ((spanEnd + PAGE_SIZE - 1) & -PAGE_SIZE) - page;
+		r = vmProtect(taskPort, (vm_offset_t)page, protSize, FALSE, VM_PROT_READ|VM_PROT_WRITE|VM_PROT_EXECUTE);
+		if (r == KERN_SUCCESS) {
+			DBGLOG("user", "obtained write permssions for %lu places", last - first);
+
+			r = orgVmMapWriteUser(taskPort, span, spanStart, spanSize);
+
+			if (r != KERN_SUCCESS)
+				SYSLOG("user", "patching %llX of %lu bytes -> res %d", (uint64_t)spanStart, spanSize, r);
+
+			r = vmProtect(taskPort, (vm_offset_t)page, protSize, FALSE, VM_PROT_READ|VM_PROT_EXECUTE);
+			if (r == KERN_SUCCESS)
+				DBGLOG("user", "restored write permssions");
+			else
+				DBGLOG("user", "failed to restore write permssions %d", r);
+		} else {
+			SYSLOG("user", "failed to obtain write permissions for patching %d", r);
+		}
+	}
+
+	if (span)
+		Buffer::deleter(span);
+	places.deinit();
+}
+
+void UserPatcher::mapSegment(const char *line, const char *path, size_t len, MapEntry *mapEntries, size_t nentries) {
+	while (*line == ' ' || *line == '\t')
+		line++;
+
+	// Lines look like: __TEXT 0x7FFF20001000 -> 0x7FFF20038000
+	const char *name = line;
+	while (*line && *line != ' ' && *line != '\t' && *line != '\n')
+		line++;
+
+	size_t nameLen = static_cast<size_t>(line - name);
+	bool isText = nameLen == strlen("__TEXT") && !strncmp(name, "__TEXT", nameLen);
+	bool isData = nameLen >= strlen("__DATA") && !strncmp(name, "__DATA", strlen("__DATA"));
+	if (!isText && !isData)
+		return;
+
+	const char *start = line;
+	while (*line && *line != '-' && *line != '\n')
+		line++;
+	if (line[0] != '-' || line[1] != '>')
+		return;
+
+	vm_address_t segStart = lilu_strtou(start, nullptr, 16);
+	vm_address_t segEnd = lilu_strtou(line + strlen("->"), nullptr, 16);
+
+	for (size_t j = 0; j < nentries; j++) {
+		auto &entry = mapEntries[j];
+		if (!entry.filename || entry.length != len || strncmp(entry.filename, path, len))
+			continue;
+
+		if (isText) {
+			entry.startTEXT = segStart;
+			entry.endTEXT = segEnd;
+		} else if (!entry.startDATA) {
+			// The first __DATA-prefixed segment is used like before.
+			entry.startDATA = segStart;
+			entry.endDATA = segEnd;
+		}
 	}
 }
 
-size_t UserPatcher::mapAddresses(const char *mapBuf, MapEntry *mapEntries, size_t nentries) {
-	if (nentries == 0 || !mapBuf)
-		return 0;
+bool UserPatcher::mapAddresses(const char *mapPath, MapEntry *mapEntries, size_t nentries, size_t &nfound) {
+	nfound = 0;
+	if (nentries == 0 || !mapPath)
+		return false;
 
-	size_t nfound = 0;
-	const char *ptr = mapBuf;
-	while (*ptr) {
-		size_t i = 1;
-		if (*ptr == '\n') {
-			MapEntry *currEntry = nullptr;
+	vnode_t vnode = NULLVP;
+	vfs_context_t ctxt = vfs_context_create(nullptr);
+	errno_t err = vnode_lookup(mapPath, 0, &vnode, ctxt);
+	if (err) {
+		DBGLOG("user", "failed to find %s", mapPath);
+		vfs_context_rele(ctxt);
+		return false;
+	}
 
+	size_t fileSize = FileIO::readFileSize(vnode, ctxt);
+	size_t tableSize = DyldCache::MinTableSize;
+	while (tableSize < nentries * 2)
+		tableSize *= 2;
+
+	auto chunk = fileSize > 0 ? Buffer::create<char>(MapReadChunkSize + 1) : nullptr;
+	auto table = fileSize > 0 ? Buffer::create<uint32_t>(tableSize) : nullptr;
+	if (!chunk || !table) {
+		if (fileSize > 0)
+			SYSLOG("user", "failed to allocate memory for reading %s", mapPath);
+		else
+			SYSLOG("user", "failed to obtain %s size", mapPath);
+		if (chunk) Buffer::deleter(chunk);
+		if (table) Buffer::deleter(table);
+		vnode_put(vnode);
+		vfs_context_rele(ctxt);
+		return false;
+	}
+
+	// Requested paths are hashed once, map lines are then looked up in this table.
+	size_t tableMask = tableSize - 1;
+	size_t remaining = 0;
+	memset(table, 0, tableSize * sizeof(uint32_t));
+	for (size_t j = 0; j < nentries; j++) {
+		if (!mapEntries[j].filename)
+			continue;
+		size_t slot = DyldCache::hashPath(mapEntries[j].filename, mapEntries[j].length) & tableMask;
+		while (table[slot] != 0)
+			slot = (slot + 1) & tableMask;
+		table[slot] = static_cast<uint32_t>(j + 1);
+		remaining++;
+	}
+
+	// Image being parsed, if it was requested.
+	const char *currPath = nullptr;
+	size_t currLen = 0;
+
+	auto finishImage = [&]() {
+		if (!currPath)
+			return;
+		for (size_t j = 0; j < nentries; j++) {
+			auto &entry = mapEntries[j];
+			if (entry.filename && !entry.mapped && entry.startTEXT && entry.endTEXT &&
+				entry.length == currLen && !strncmp(entry.filename, currPath, currLen)) {
+				entry.mapped = true;
+				nfound++;
+				remaining--;
+			}
+		}
+		currPath = nullptr;
+	};
+
+	auto processLine = [&](const char *line, size_t len) {
+		if (len > 0 && line[len - 1] == '\r')
+			len--;
+		if (len == 0)
+			return;
+
+		if (line[0] == ' ' || line[0] == '\t') {
+			if (currPath)
+				mapSegment(line, currPath, currLen, mapEntries, nentries);
+			return;
+		}
+
+		finishImage();
+
+		for (size_t slot = DyldCache::hashPath(line, len) & tableMask; table[slot] != 0; slot = (slot + 1) & tableMask) {
+			auto &entry = mapEntries[table[slot] - 1];
+			if (entry.length == len && !strncmp(entry.filename, line, len)) {
+				DBGLOG("user", "found %s in shared cache map", entry.filename);
+				currPath = entry.filename;
+				currLen = len;
+				break;
+			}
+		}
+	};
+
+	size_t off = 0;
+	size_t carry = 0;
+	bool skipLine = false;
+	while (off < fileSize && remaining > 0) {
+		size_t want = MapReadChunkSize - carry;
+		if (want > fileSize - off)
+			want = fileSize - off;
+		if (FileIO::readFileData(chunk + carry, off, want, vnode, ctxt)) {
+			// An unreadable map is no map, so that the callers fall back like before.
+			SYSLOG("user", "failed to read %s at %lu", mapPath, off);
 			for (size_t j = 0; j < nentries; j++) {
-				if (!mapEntries[j].filename)
-					continue;
-				if (!strncmp(&ptr[i], mapEntries[j].filename, mapEntries[j].length)) {
-					currEntry = &mapEntries[j];
-					i += mapEntries[j].length;
-					break;
-				}
+				mapEntries[j].startTEXT = mapEntries[j].endTEXT = mapEntries[j].startDATA = mapEntries[j].endDATA = 0;
+				mapEntries[j].mapped = false;
 			}
+			nfound = 0;
+			Buffer::deleter(chunk);
+			Buffer::deleter(table);
+			vnode_put(vnode);
+			vfs_context_rele(ctxt);
+			return false;
+		}
 
-			if (currEntry) {
-				const char *text = strstr(&ptr[i], "__TEXT", strlen("__TEXT"));
-				if (text) {
-					i += strlen("__TEXT");
-					const char *arrow = strstr(&ptr[i], "->", strlen("->"));
-					if (arrow) {
-						currEntry->startTEXT = lilu_strtou(text + strlen("__TEXT") + 1, nullptr, 16);
-						currEntry->endTEXT = lilu_strtou(arrow + strlen("->") + 1, nullptr, 16);
-
-						const char *data = strstr(&ptr[i], "__DATA", strlen("__DATA"));
-						if (data) {
-							i += strlen("__DATA");
-							arrow = strstr(&ptr[i], "->", strlen("->"));
-							if (arrow) {
-								currEntry->startDATA = lilu_strtou(data + strlen("__DATA") + 1, nullptr, 16);
-								currEntry->endDATA = lilu_strtou(arrow + strlen("->") + 1, nullptr, 16);
-							}
-						}
-
-						nfound++;
-					}
-				}
+		off += want;
+		size_t avail = carry + want;
+		chunk[avail] = '\0';
+
+		size_t start = 0;
+		for (size_t i = 0; i < avail && remaining > 0; i++) {
+			if (chunk[i] == '\n') {
+				if (!skipLine)
+					processLine(chunk + start, i - start);
+				skipLine = false;
+				start = i + 1;
 			}
 		}
-		ptr += i;
+
+		carry = avail - start;
+		if (carry == MapReadChunkSize) {
+			// Overlong line, ignore it up to the next newline.
+			skipLine = true;
+			carry = 0;
+		} else if (carry > 0) {
+			memmove(chunk, chunk + start, carry);
+		}
 	}
 
-	return nfound;
+	if (carry > 0 && !skipLine && remaining > 0) {
+		chunk[carry] = '\0';
+		processLine(chunk, carry);
+	}
+
+	finishImage();
+
+	DBGLOG("user", "read %lu out of %lu bytes of %s", off, fileSize, mapPath);
+
+	Buffer::deleter(chunk);
+	Buffer::deleter(table);
+	vnode_put(vnode);
+	vfs_context_rele(ctxt);
+	return true;
+}
+
+/**
+ *  Cache file access through vnodes for DyldCache
+ */
+static void *openCacheFile(const char *path, void *user) {
+	vnode_t vnode = NULLVP;
+	if (vnode_lookup(path, 0, &vnode, static_cast<vfs_context_t>(user)))
+		return nullptr;
+	return vnode;
+}
+
+static int readCacheFile(void *file, void *buffer, off_t off, size_t size, void *user) {
+	return FileIO::readFileData(buffer, off, size, static_cast<vnode_t>(file), static_cast<vfs_context_t>(user));
+}
+
+static void closeCacheFile(void *file, void *) {
+	vnode_put(static_cast<vnode_t>(file));
+}
+
+bool UserPatcher::mapAddressesFromCache(const char *cachePath, MapEntry *mapEntries, size_t nentries, size_t &nfound) {
+	nfound = 0;
+	if (nentries == 0 || !cachePath)
+		return false;
+
+	vfs_context_t ctxt = vfs_context_create(nullptr);
+	DyldCache::Reader reader {openCacheFile, readCacheFile, closeCacheFile, ctxt};
+	bool res = DyldCache::mapAddresses(reader, cachePath, mapEntries, nentries, nfound);
+	vfs_context_rele(ctxt);
+	return res;
 }
 
 bool UserPatcher::loadDyldSharedCacheMapping() {
@@ -755,61 +1084,71 @@ bool UserPatcher::loadDyldSharedCacheMapping() {
 	if (binaryModSize == 0)
 		return true;
 
-	uint8_t *buffer {nullptr};
-	size_t bufferSize {0};
+	auto entries = Buffer::create<MapEntry>(binaryModSize);
+	if (!entries) {
+		SYSLOG("user", "failed to allocate memory for MapEntry %lu", binaryModSize);
+		return false;
+	}
+
+	for (size_t i = 0; i < binaryModSize; i++) {
+		entries[i].filename = binaryMod[i]->path;
+		entries[i].length = strlen(binaryMod[i]->path);
+		entries[i].startTEXT = entries[i].endTEXT = entries[i].startDATA = entries[i].endDATA = 0;
+		entries[i].mapped = false;
+	}
+
+	const char *cachePath {nullptr};
+	const char *mapPath {nullptr};
 	bool isHaswell = BaseDeviceInfo::get().cpuHasAvx2;
 	if (getKernelVersion() >= KernelVersion::Ventura) {
-		buffer = FileIO::readFileToBuffer(isHaswell ? venturaSharedCacheMapHaswell : venturaSharedCacheMapLegacy, bufferSize);
+		cachePath = isHaswell ? venturaSharedCacheHaswell : venturaSharedCacheLegacy;
+		mapPath = isHaswell ? venturaSharedCacheMapHaswell : venturaSharedCacheMapLegacy;
 	}
 	else if (getKernelVersion() >= KernelVersion::BigSur) {
-		buffer = FileIO::readFileToBuffer(isHaswell ? bigSurSharedCacheMapHaswell : bigSurSharedCacheMapLegacy, bufferSize);
+		cachePath = isHaswell ? bigSurSharedCacheHaswell : bigSurSharedCacheLegacy;
+		mapPath = isHaswell ? bigSurSharedCacheMapHaswell : bigSurSharedCacheMapLegacy;
 	}
 	else if (isHaswell && getKernelVersion() >= KernelVersion::Yosemite) {
-		buffer = FileIO::readFileToBuffer(SharedCacheMapHaswell, bufferSize);
+		cachePath = sharedCacheHaswell;
+		mapPath = SharedCacheMapHaswell;
 	}
 
-	if (!buffer)
-		buffer = FileIO::readFileToBuffer(SharedCacheMapLegacy, bufferSize);
+	// Prefer reading the cache itself, .map files are large and may be missing.
+	size_t nEntries {0};
+	auto loadMapping = [&](const char *cache, const char *map) {
+		if (mapAddressesFromCache(cache, entries, binaryModSize, nEntries) && nEntries > 0)
+			return true;
+		return mapAddresses(map, entries, binaryModSize, nEntries);
+	};
+
+	bool hasMap = mapPath && loadMapping(cachePath, mapPath);
+	if (!hasMap)
+		hasMap = loadMapping(sharedCacheLegacy, SharedCacheMapLegacy);
 
 	bool res {false};
 
-	if (buffer && bufferSize > 0) {
-		auto entries = Buffer::create<MapEntry>(binaryModSize);
-		if (entries) {
+	if (hasMap) {
+		if (nEntries > 0) {
+			DBGLOG("user", "mapped %lu entries out of %lu", nEntries, binaryModSize);
+
 			for (size_t i = 0; i < binaryModSize; i++) {
-				entries[i].filename = binaryMod[i]->path;
-				entries[i].length = strlen(binaryMod[i]->path);
-				entries[i].startTEXT = entries[i].endTEXT = entries[i].startDATA = entries[i].endDATA = 0;
+				binaryMod[i]->startTEXT = entries[i].startTEXT;
+				binaryMod[i]->endTEXT = entries[i].endTEXT;
+				binaryMod[i]->startDATA = entries[i].startDATA;
+				binaryMod[i]->endDATA = entries[i].endDATA;
 			}
 
-			size_t nEntries = mapAddresses(reinterpret_cast<char *>(buffer), entries, binaryModSize);
-
-			if (nEntries > 0) {
-				DBGLOG("user", "mapped %lu entries out of %lu", nEntries, binaryModSize);
-
-				for (size_t i = 0; i < binaryModSize; i++) {
-					binaryMod[i]->startTEXT = entries[i].startTEXT;
-					binaryMod[i]->endTEXT = entries[i].endTEXT;
-					binaryMod[i]->startDATA = entries[i].startDATA;
-					binaryMod[i]->endDATA = entries[i].endDATA;
-				}
-
-				res = true;
-			} else {
-				SYSLOG("user", "failed to map any entry out of %lu", binaryModSize);
-			}
+			res = true;
 		} else {
-			SYSLOG("user", "failed to allocate memory for MapEntry %lu", binaryModSize);
+			SYSLOG("user", "failed to map any entry out of %lu", binaryModSize);
 		}
-
-		if (entries) Buffer::deleter(entries);
 	} else {
 		SYSLOG("user", "no dyld_shared_cache discovered, fallback to slow!");
 		patchDyldSharedCache = false;
 		res = true;
 	}
 
-	if (buffer) Buffer::deleter(buffer);
+	Buffer::deleter(entries);
 
 	return res;
 }
@@ -857,110 +1196,20 @@ bool UserPatcher::loadFilesForPatching() {
 					continue;
 				}
 
+				// Patches for the same section are matched together when their first patch is reached.
+				bool scanned = false;
+				for (size_t q = 0; q < p && !scanned; q++)
+					scanned = isSameScanGroup(binaryMod[i]->patches[q], patch);
+				if (scanned)
+					continue;
+
 				MachInfo::findSectionBounds(buf, fileSize, vmsegment, vmsection, sectionptr, size,
 											fileSegments[patch.segment], fileSections[patch.segment], patch.cpu);
 
 				DBGLOG("user", "findSectionBounds returned vmsegment %llX vmsection %llX sectionptr %p size %lu", (uint64_t)vmsegment, (uint64_t)vmsection, sectionptr, size);
 
 				if (size) {
-					uint8_t *start = reinterpret_cast<uint8_t *>(sectionptr);
-					uint8_t *end = start + size - patch.size;
-					size_t skip = patch.skip;
-					size_t count = patch.count;
-
-					DBGLOG("user", "this patch will start from %lu entry and will replace %lu findings", skip, count);
-
-					while (start < end && count) {
-						if (!memcmp(start, patch.find, patch.size)) {
-							DBGLOG("user", "found entry of %X %X patch", patch.find[0], patch.find[1]);
-
-							if (skip == 0) {
-								off_t sectOff = start - reinterpret_cast<uint8_t *>(sectionptr);
-								vm_address_t vmpage = (vmsection + (vm_address_t)sectOff) & -PAGE_SIZE;
-								vm_address_t pageOff = vmpage - vmsection;
-								off_t valueOff = reinterpret_cast<uintptr_t>(start - pageOff - reinterpret_cast<uintptr_t>(sectionptr));
-								off_t segOff = vmsection-vmsegment+sectOff;
-
-								DBGLOG("user", "using it off %llX pageOff %llX new %llX segOff %llX", sectOff, (uint64_t)pageOff, (uint64_t)vmpage, segOff);
-
-								// We need binary entry, i.e. the page our patch belong to
-								LookupStorage *entry = nullptr;
-								for (size_t e = 0, esz = lookupStorage.size(); e < esz && !entry; e++) {
-									if (lookupStorage[e]->pageOff == static_cast<vm_address_t>(pageOff))
-										entry = lookupStorage[e];
-								}
-
-
-								if (!entry) {
-									entry = LookupStorage::create();
-									if (entry) {
-										entry->mod = binaryMod[i];
-										if (!entry->page->alloc()) {
-											LookupStorage::deleter(entry);
-											entry = nullptr;
-										} else {
-											// One could find entries by flooring first ref address but that's unreasonably complicated
-											entry->pageOff = pageOff;
-											// Now copy page data
-											lilu_os_memcpy(entry->page->p, reinterpret_cast<uint8_t *>(sectionptr) + pageOff, PAGE_SIZE);
-											DBGLOG("user", "first page bytes are %X %X %X %X %X %X %X %X",
-												   entry->page->p[0], entry->page->p[1], entry->page->p[2], entry->page->p[3],
-												   entry->page->p[4], entry->page->p[5], entry->page->p[6], entry->page->p[7]);
-											// Save entry in lookupStorage
-											if (!lookupStorage.push_back<2>(entry)) {
-												SYSLOG("user", "failed to push entry to LookupStorage");
-												LookupStorage::deleter(entry);
-												entry = nullptr;
-												continue;
-											}
-										}
-									}
-
-									if (!entry) {
-										SYSLOG("user", "failed to allocate memory for LookupStorage");
-										continue;
-									}
-								}
-
-								// Use an existent reference to the same patch in the same page if any.
-								// Happens when a patch has 2+ replacements and they are close to each other.
-								LookupStorage::PatchRef *ref = nullptr;
-								for (size_t r = 0, rsz = entry->refs.size(); r < rsz && !ref; r++) {
-									if (entry->refs[r]->i == p) {
-										ref = entry->refs[r];
-									}
-								}
-
-								DBGLOG("user", "ref find %d", ref != nullptr);
-
-								// Or add a new patch reference
-								if (!ref) {
-									ref = LookupStorage::PatchRef::create();
-									if (!ref) {
-										SYSLOG("user", "failed to allocate memory for PatchRef");
-										continue;
-									}
-									ref->i = p; // Set the reference patch
-									if (!entry->refs.push_back<2>(ref)) {
-										SYSLOG("user", "failed to insert PatchRef");
-										LookupStorage::PatchRef::deleter(ref);
-										continue;
-									}
-								}
-
-								if (ref) {
-									DBGLOG("user", "pushing off %llX to patch", valueOff);
-									// These values belong to the current ref
-									ref->pageOffs.push_back<2>(valueOff);
-									ref->segOffs.push_back<2>(segOff);
-								}
-								count--;
-							} else {
-								skip--;
-							}
-						}
-						start++;
-					}
+					scanSectionForPatches(binaryMod[i], p, static_cast<uint8_t *>(sectionptr), size, vmsegment, vmsection);
 				} else {
 					SYSLOG("user", "failed to obtain a corresponding section");
 				}
@@ -969,74 +1218,354 @@ bool UserPatcher::loadFilesForPatching() {
 			Buffer::deleter(buf);
 		}
 	}
+
+	if (storageMap) {
+		Buffer::deleter(storageMap);
+		storageMap = nullptr;
+		storageMapMask = 0;
+	}
+
 	return true;
 }
 
-bool UserPatcher::loadLookups() {
-	uint32_t off = 0;
+bool UserPatcher::isSameScanGroup(const BinaryModPatch &patch, const BinaryModPatch &first) {
+	return patch.section != ProcInfo::SectionDisabled && patch.segment < FileSegment::SegmentTotal &&
+		patch.segment == first.segment && patch.cpu == first.cpu;
+}
 
-	for (size_t i = 0; i < Lookup::matchNum; i++) {
-		auto &lookupCurr = lookup.c[i];
+void UserPatcher::scanSectionForPatches(const BinaryModInfo *mod, size_t first, uint8_t *sectionptr, size_t size, vm_address_t vmsegment, vm_address_t vmsection) {
+	size_t num = mod->count;
 
-		DBGLOG("user", "loading lookup %lu current off is %X", i, off);
+	// Patch indices ordered by their first byte, bucket b spans order[bucket[b]] to order[bucket[b+1]].
+	auto bucket = Buffer::create<uint32_t>(256 + 1 + 256 + num);
+	auto state = Buffer::create<size_t>(num * 2);
+	if (!bucket || !state) {
+		SYSLOG("user", "failed to allocate scan buckets for %s", mod->path);
+		if (bucket) Buffer::deleter(bucket);
+		if (state) Buffer::deleter(state);
+		return;
+	}
 
-		auto obtainValues = [&lookupCurr, &off, this]() {
-			for (size_t p = 0; p < lookupStorage.size(); p++) {
-				uint64_t val = *reinterpret_cast<uint64_t *>(lookupStorage[p]->page->p + off);
-				if (p >= lookupCurr.size()) {
-					lookupCurr.push_back<2>(val);
-				} else {
-					lookupCurr[p] = val;
-				}
+	auto fill = bucket + 256 + 1;
+	auto order = fill + 256;
+	auto skip = state;
+	auto count = state + num;
+	size_t active = 0;
+
+	memset(bucket, 0, (256 + 1) * sizeof(uint32_t));
+	for (size_t p = first; p < num; p++) {
+		auto &patch = mod->patches[p];
+		skip[p] = patch.skip;
+		count[p] = 0;
+		if (!isSameScanGroup(patch, mod->patches[first]) || patch.size == 0 || patch.count == 0)
+			continue;
+		count[p] = patch.count;
+		bucket[patch.find[0] + 1]++;
+		active++;
+		DBGLOG("user", "patch %lu will start from %lu entry and will replace %lu findings", p, skip[p], count[p]);
+	}
+
+	for (size_t b = 0; b < 256; b++)
+		bucket[b + 1] += bucket[b];
+
+	lilu_os_memcpy(fill, bucket, 256 * sizeof(uint32_t));
+	for (size_t p = first; p < num; p++) {
+		if (count[p] > 0)
+			order[fill[mod->patches[p].find[0]]++] = static_cast<uint32_t>(p);
+	}
+
+	for (size_t pos = 0; pos < size && active > 0; pos++) {
+		uint8_t b = sectionptr[pos];
+		for (uint32_t k = bucket[b]; k < bucket[b + 1]; k++) {
+			size_t p = order[k];
+			auto &patch = mod->patches[p];
+
+			if (count[p] == 0 || pos + patch.size >= size || memcmp(sectionptr + pos, patch.find, patch.size))
+				continue;
+
+			DBGLOG("user", "found entry of %X %X patch", patch.find[0], patch.find[1]);
+
+			if (skip[p] > 0) {
+				skip[p]--;
+				continue;
 			}
-		};
 
-		auto hasSameValues = [&lookupCurr]() {
-			for (size_t i = 0, sz = lookupCurr.size(); i < sz; i++) {
-				for (size_t j = i + 1; j < sz; j++) {
-					if (lookupCurr[i] == lookupCurr[j]) {
-						return true;
-					}
-				}
+			if (addPatchReference(mod, p, sectionptr, static_cast<off_t>(pos), vmsegment, vmsection)) {
+				count[p]--;
+				if (count[p] == 0)
+					active--;
 			}
+		}
+	}
 
-			return false;
-		};
-
-		// First match must choose a page
-		if (i == 0) {
-			// Find non matching off
-			while (off < PAGE_SIZE) {
-				// Obtain values
-				obtainValues();
-
-				if (!hasSameValues()) {
-					DBGLOG("user", "successful finding at %X", off);
-					lookup.offs[i] = off;
-					break;
+	Buffer::deleter(bucket);
+	Buffer::deleter(state);
+}
+
+bool UserPatcher::addPatchReference(const BinaryModInfo *mod, size_t p, uint8_t *sectionptr, off_t sectOff, vm_address_t vmsegment, vm_address_t vmsection) {
+	vm_address_t vmpage = (vmsection + (vm_address_t)sectOff) & -PAGE_SIZE;
+	vm_address_t pageOff = vmpage - vmsection;
+	off_t valueOff = sectOff - static_cast<off_t>(pageOff);
+	off_t segOff = vmsection-vmsegment+sectOff;
+
+	DBGLOG("user", "using it off %llX pageOff %llX new %llX segOff %llX", sectOff, (uint64_t)pageOff, (uint64_t)vmpage, segOff);
+
+	// We need binary entry, i.e. the page our patch belong to
+	LookupStorage *entry = findLookupStorage(pageOff);
+
+	if (!entry) {
+		entry = LookupStorage::create();
+		if (entry) {
+			entry->mod = mod;
+			if (!entry->page->alloc()) {
+				LookupStorage::deleter(entry);
+				entry = nullptr;
+			} else {
+				// One could find entries by flooring first ref address but that's unreasonably complicated
+				entry->pageOff = pageOff;
+				// Now copy page data
+				lilu_os_memcpy(entry->page->p, sectionptr + pageOff, PAGE_SIZE);
+				DBGLOG("user", "first page bytes are %X %X %X %X %X %X %X %X",
+					   entry->page->p[0], entry->page->p[1], entry->page->p[2], entry->page->p[3],
+					   entry->page->p[4], entry->page->p[5], entry->page->p[6], entry->page->p[7]);
+				// Save entry in lookupStorage
+				if (!lookupStorage.push_back<2>(entry)) {
+					SYSLOG("user", "failed to push entry to LookupStorage");
+					LookupStorage::deleter(entry);
+					return false;
 				}
 
-				off += sizeof(uint64_t);
-			}
-		} else {
-			if (off == PAGE_SIZE) {
-				DBGLOG("user", "resetting off to 0");
-				off = 0;
+				if (!mapLookupStorage(lookupStorage.last()))
+					SYSLOG("user", "failed to map LookupStorage entry, lookups will be slower");
 			}
+		}
+
+		if (!entry) {
+			SYSLOG("user", "failed to allocate memory for LookupStorage");
+			return false;
+		}
+	}
+
+	// Use an existent reference to the same patch in the same page if any.
+	// Happens when a patch has 2+ replacements and they are close to each other.
+	LookupStorage::PatchRef *ref = nullptr;
+	for (size_t r = 0, rsz = entry->refs.size(); r < rsz && !ref; r++) {
+		if (entry->refs[r]->i == p) {
+			ref = entry->refs[r];
+		}
+	}
+
+	DBGLOG("user", "ref find %d", ref != nullptr);
 
-			if (off == lookup.offs[0]) {
-				DBGLOG("user", "matched off %X with 0th", off);
-				off += sizeof(uint64_t);
+	// Or add a new patch reference
+	if (!ref) {
+		ref = LookupStorage::PatchRef::create();
+		if (!ref) {
+			SYSLOG("user", "failed to allocate memory for PatchRef");
+			return false;
+		}
+		ref->i = p; // Set the reference patch
+		if (!entry->refs.push_back<2>(ref)) {
+			SYSLOG("user", "failed to insert PatchRef");
+			LookupStorage::PatchRef::deleter(ref);
+			return false;
+		}
+
+		// Patches within a page are applied in patch order, regardless of which was found first.
+		for (size_t r = entry->refs.last(); r > 0 && entry->refs[r - 1]->i > p; r--) {
+			entry->refs[r] = entry->refs[r - 1];
+			entry->refs[r - 1] = ref;
+		}
+	}
+
+	DBGLOG("user", "pushing off %llX to patch", valueOff);
+	// These values belong to the current ref
+	ref->pageOffs.push_back<2>(valueOff);
+	ref->segOffs.push_back<2>(segOff);
+	return true;
+}
+
+size_t UserPatcher::hashPageOffset(vm_address_t pageOff) {
+	return static_cast<size_t>((static_cast<uint64_t>(pageOff / PAGE_SIZE) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+UserPatcher::LookupStorage *UserPatcher::findLookupStorage(vm_address_t pageOff) {
+	if (!storageMap) {
+		for (size_t e = 0, esz = lookupStorage.size(); e < esz; e++) {
+			if (lookupStorage[e]->pageOff == pageOff)
+				return lookupStorage[e];
+		}
+		return nullptr;
+	}
+
+	for (size_t slot = hashPageOffset(pageOff) & storageMapMask; storageMap[slot] != 0; slot = (slot + 1) & storageMapMask) {
+		auto entry = lookupStorage[storageMap[slot] - 1];
+		if (entry->pageOff == pageOff)
+			return entry;
+	}
+
+	return nullptr;
+}
+
+bool UserPatcher::mapLookupStorage(size_t index) {
+	size_t mapSize = storageMapMask + 1;
+	if (!storageMap || (index + 1) * 2 > mapSize) {
+		// Keep the map at most half full, rebuilding it from lookupStorage when growing.
+		mapSize = storageMap ? mapSize * 2 : PageLookup::MinIndexSize;
+		while ((index + 1) * 2 > mapSize)
+			mapSize *= 2;
+
+		auto map = Buffer::create<uint32_t>(mapSize);
+		if (!map) {
+			// Fall back to linear lookup for the rest of loading.
+			if (storageMap) {
+				Buffer::deleter(storageMap);
+				storageMap = nullptr;
+				storageMapMask = 0;
 			}
+			return false;
+		}
+
+		if (storageMap)
+			Buffer::deleter(storageMap);
+		memset(map, 0, mapSize * sizeof(uint32_t));
+		storageMap = map;
+		storageMapMask = mapSize - 1;
+
+		for (size_t e = 0; e < index; e++) {
+			size_t slot = hashPageOffset(lookupStorage[e]->pageOff) & storageMapMask;
+			while (storageMap[slot] != 0)
+				slot = (slot + 1) & storageMapMask;
+			storageMap[slot] = static_cast<uint32_t>(e + 1);
+		}
+	}
+
+	size_t slot = hashPageOffset(lookupStorage[index]->pageOff) & storageMapMask;
+	while (storageMap[slot] != 0)
+		slot = (slot + 1) & storageMapMask;
+	storageMap[slot] = static_cast<uint32_t>(index + 1);
+	return true;
+}
+
+bool UserPatcher::loadLookups() {
+	size_t sz = lookupStorage.size();
+
+	// Lookups are read without locking once memory access is hooked, so they are only built once.
+	if (lookup.loaded()) {
+		SYSLOG("user", "lookups are already loaded");
+		return false;
+	}
 
-			DBGLOG("user", "chose %X", off);
+	if (sz == 0) {
+		DBGLOG("user", "no pages to load lookups for");
+		return true;
+	}
 
-			obtainValues();
-			lookup.offs[i] = off;
+	auto pages = Buffer::create<const uint8_t *>(sz);
+	if (!pages) {
+		SYSLOG("user", "failed to allocate lookup pages for %lu pages", sz);
+		return false;
+	}
 
-			off += sizeof(uint64_t);
+	// Keyed page digests and patched ranges are kept for verification instead of page copies.
+	read_random(digestKey, sizeof(digestKey));
+	for (size_t p = 0; p < sz; p++) {
+		auto storage = lookupStorage[p];
+		computePageDigest(storage->page->p, digestKey, storage->digest);
+		if (!savePatchRanges(storage)) {
+			SYSLOG("user", "failed to save patched ranges of %lu", p);
+			Buffer::deleter(pages);
+			return false;
 		}
+		pages[p] = storage->page->p;
+	}
+
+	// Only a complete lookup enables performPagePatch.
+	bool res = lookup.init(pages, sz);
+	Buffer::deleter(pages);
+	if (!res)
+		return false;
 
+	for (size_t p = 0; p < sz; p++) {
+		Page::deleter(lookupStorage[p]->page);
+		lookupStorage[p]->page = nullptr;
+	}
+
+	return true;
+}
+
+void UserPatcher::computePageDigest(const uint8_t *page, const uint64_t key[2], uint64_t digest[2]) {
+	auto rotl = [](uint64_t v, uint32_t n) { return (v << n) | (v >> (64 - n)); };
+
+	// SipHash-2-4 with 128-bit output, the key is only known to the kernel.
+	uint64_t v0 = key[0] ^ 0x736F6D6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646F72616E646F6DULL ^ 0xEE;
+	uint64_t v2 = key[0] ^ 0x6C7967656E657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+
+	auto round = [&]() {
+		v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+		v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+		v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+		v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+	};
+
+	auto words = reinterpret_cast<const uint64_t *>(page);
+	for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++) {
+		v3 ^= words[i];
+		round();
+		round();
+		v0 ^= words[i];
+	}
+
+	// Final block only holds the length, which is a multiple of 256.
+	uint64_t b = (static_cast<uint64_t>(PAGE_SIZE) & 0xFF) << 56;
+	v3 ^= b;
+	round();
+	round();
+	v0 ^= b;
+
+	v2 ^= 0xEE;
+	for (int i = 0; i < 4; i++)
+		round();
+	digest[0] = v0 ^ v1 ^ v2 ^ v3;
+
+	v1 ^= 0xDD;
+	for (int i = 0; i < 4; i++)
+		round();
+	digest[1] = v0 ^ v1 ^ v2 ^ v3;
+}
+
+bool UserPatcher::savePatchRanges(LookupStorage *storage) {
+	for (size_t r = 0, rsz = storage->refs.size(); r < rsz; r++) {
+		auto ref = storage->refs[r];
+		auto &rpatch = storage->mod->patches[ref->i];
+		for (size_t i = 0, osz = ref->pageOffs.size(); i < osz; i++) {
+			// Only the part within this page can be verified.
+			size_t off = static_cast<size_t>(ref->pageOffs[i]);
+			size_t size = rpatch.size < PAGE_SIZE - off ? rpatch.size : PAGE_SIZE - off;
+			for (size_t b = 0; b < size; b++) {
+				if (!storage->original.push_back<2>(storage->page->p[off + b]))
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool UserPatcher::matchPatchRanges(const LookupStorage *storage, const uint8_t *ptr) {
+	size_t pos = 0;
+	for (size_t r = 0, rsz = storage->refs.size(); r < rsz; r++) {
+		auto ref = storage->refs[r];
+		auto &rpatch = storage->mod->patches[ref->i];
+		for (size_t i = 0, osz = ref->pageOffs.size(); i < osz; i++) {
+			size_t off = static_cast<size_t>(ref->pageOffs[i]);
+			size_t size = rpatch.size < PAGE_SIZE - off ? rpatch.size : PAGE_SIZE - off;
+			if (memcmp(ptr + off, storage->original.data() + pos, size) != 0)
+				return false;
+			pos += size;
+		}
 	}
 
 	return true;
@@ -55,17 +55,10 @@ const char *strstr(const char *stack, const char *needle, size_t len) {
 		if (len == 0) return stack;
 	}
 
-	const char *i = needle;
-
-	while (*stack) {
-		if (*stack == *i) {
-			i++;
-			if (static_cast<size_t>(i - needle) == len)
-				return stack - len + 1;
-		} else {
-			i = needle;
-		}
-		stack++;
+	// Compare at every position, a partial match must not skip the next candidate (e.g. "ab" in "aab").
+	for (; *stack; stack++) {
+		if (!strncmp(stack, needle, len))
+			return stack;
 	}
 
 	return nullptr;
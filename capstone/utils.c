@@ -18,7 +18,8 @@ static unsigned short *make_id2insn(const insn_map *insns, unsigned int size)
 	unsigned short max_id = insns[size - 1].id;
 	unsigned short i;
 
-	unsigned short *cache = (unsigned short *)cs_mem_malloc(sizeof(*cache) * (max_id + 1));
+	// Ids missing from the table must map to 0 (not found).
+	unsigned short *cache = (unsigned short *)cs_mem_calloc(max_id + 1, sizeof(*cache));
 
 	for (i = 1; i < size; i++)
 		cache[insns[i].id] = i;
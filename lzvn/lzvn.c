@@ -104,6 +104,23 @@ LZFSE_INLINE void store8(void *ptr, uint64_t data) {
   memcpy(ptr, &data, sizeof data);
 }
 
+/*! @abstract Copy 16 or 32 bytes as 8-byte words; all words are loaded before
+ *  any is stored, so \p src may precede \p dst by the copy size or more. */
+LZFSE_INLINE void copy16(unsigned char *dst, const unsigned char *src) {
+  uint64_t a = load8(src), b = load8(src + 8);
+  store8(dst, a);
+  store8(dst + 8, b);
+}
+
+LZFSE_INLINE void copy32(unsigned char *dst, const unsigned char *src) {
+  uint64_t a = load8(src), b = load8(src + 8);
+  uint64_t c = load8(src + 16), d = load8(src + 24);
+  store8(dst, a);
+  store8(dst + 8, b);
+  store8(dst + 16, c);
+  store8(dst + 24, d);
+}
+
 /*! @abstract Extracts \p width bits from \p container, starting with \p lsb; if
  * we view \p container as a bit array, we extract \c container[lsb:lsb+width]. */
 LZFSE_INLINE uintmax_t extract(uintmax_t container, unsigned lsb,
@@ -543,7 +560,15 @@ copy_match:
   //
   //  i.e. it splats the previous byte. This means that we need to be very
   //  careful about using wide loads or stores to perform the copy operation.
-  if (__builtin_expect(dst_len >= M + 7 && D >= 8, 1)) {
+  if (__builtin_expect(dst_len >= M + 31 && D >= 32, 1)) {
+    //  Long distance matches far from the end of the buffer are copied in
+    //  32 byte chunks, which never overlap their own source.
+    for (size_t i = 0; i < M; i += 32)
+      copy32(&dst_ptr[i], dst_ptr + i - D);
+  } else if (__builtin_expect(dst_len >= M + 15 && D >= 16, 1)) {
+    for (size_t i = 0; i < M; i += 16)
+      copy16(&dst_ptr[i], dst_ptr + i - D);
+  } else if (__builtin_expect(dst_len >= M + 7 && D >= 8, 1)) {
     //  We are not near the end of the buffer, and the match distance
     //  is at least eight. Thus, we can safely loop using eight byte
     //  copies. The last of these may slop over the intended end of
@@ -551,6 +576,15 @@ copy_match:
     //  away from the end of the destination buffer.
     for (size_t i = 0; i < M; i += 8)
       store8(&dst_ptr[i], load8(dst_ptr + i - D));
+  } else if (dst_len >= M + 7 && M > 16 && D != 0) {
+    //  Short distance runs are periodic in D, and thus in the smallest
+    //  multiple of D which is at least eight. Once that many bytes are
+    //  written byte-by-byte, the rest can be copied with eight byte copies.
+    size_t E = D * ((8 + D - 1) / D);
+    for (size_t i = 0; i < E; ++i)
+      dst_ptr[i] = *(dst_ptr + i - D);
+    for (size_t i = E; i < M; i += 8)
+      store8(&dst_ptr[i], load8(dst_ptr + i - E));
   } else if (M <= dst_len) {
     //  Either the match distance is too small, or we are too close to
     //  the end of the buffer to safely use eight byte copies. Fall back
@@ -617,6 +651,10 @@ sml_m:
     return; // source truncated
   M = (size_t)extract(opc, 0, 4);
   PTR_LEN_INC(src_ptr, src_len, opc_len);
+  //  There is no previous match distance before the first match, the copy
+  //  would only repeat whatever the output buffer contained.
+  if (D == 0)
+    goto invalid_match_distance;
   goto copy_match;
 
 #if HAVE_LABELS_AS_VALUES
@@ -635,6 +673,10 @@ lrg_m:
     return; // source truncated
   M = src_ptr[1] + 16;
   PTR_LEN_INC(src_ptr, src_len, opc_len);
+  //  There is no previous match distance before the first match, the copy
+  //  would only repeat whatever the output buffer contained.
+  if (D == 0)
+    goto invalid_match_distance;
   goto copy_match;
 
 // ===============================================================
@@ -694,10 +736,14 @@ copy_literal:
     return; // source truncated
   PTR_LEN_INC(src_ptr, src_len, opc_len);
   //  Now we copy the literal from the source pointer to the destination.
-  if (dst_len >= L + 7 && src_len >= L + 7) {
+  if (L > 8 && dst_len >= L + 15 && src_len >= L + 15) {
     //  We are not near the end of the source or destination buffers; thus
     //  we can safely copy the literal using wide copies, without worrying
-    //  about reading or writing past the end of either buffer.
+    //  about reading or writing past the end of either buffer. Literals
+    //  of up to eight bytes take a single eight byte copy below.
+    for (size_t i = 0; i < L; i += 16)
+      copy16(&dst_ptr[i], &src_ptr[i]);
+  } else if (dst_len >= L + 7 && src_len >= L + 7) {
     for (size_t i = 0; i < L; i += 8)
       store8(&dst_ptr[i], load8(&src_ptr[i]));
   } else if (L <= dst_len) {
@@ -839,3 +885,237 @@ size_t lzvn_decode_buffer(void *dst, size_t dst_size,
   // This is how much we decompressed
   return dstate.dst - (unsigned char*) dst;
 }
+
+/*! @abstract Continue decoding into \p dst, which already holds \p *dst_used
+ *  decoded bytes serving as match history, with the previous match distance
+ *  \p *d_prev (0 initially). Decoding stops before an instruction not fully
+ *  contained in \p src, so the caller may resubmit the remaining bytes with
+ *  more data appended.
+ *  @return number of consumed source bytes. */
+size_t lzvn_decode_partial(void *dst, size_t dst_size, size_t *dst_used,
+                           size_t *d_prev, const void *src, size_t src_size) {
+  lzvn_decoder_state dstate;
+  memset(&dstate, 0x00, sizeof(dstate));
+  dstate.src = src;
+  dstate.src_end = src + src_size;
+
+  dstate.dst_begin = dst;
+  dstate.dst = dst + *dst_used;
+  dstate.dst_end = dst + dst_size;
+
+  dstate.d_prev = *d_prev;
+  dstate.end_of_stream = 0;
+
+  lzvn_decode(&dstate);
+
+  *dst_used = dstate.dst - (unsigned char*) dst;
+  *d_prev = dstate.d_prev;
+  return dstate.src - (const unsigned char*) src;
+}
+
+// LZVN low-level encoder
+
+#define LZVN_ENCODE_HASH_BITS 14
+#define LZVN_ENCODE_MAX_DISTANCE 0xFFFF
+#define LZVN_ENCODE_MIN_MATCH 4
+#define LZVN_ENCODE_DEPTH 16
+
+/*! @abstract Encoder match finder state, provided by the caller as work
+ *  memory of lzvn_encode_scratch_size() bytes. */
+typedef struct {
+  // Latest position + 1 for every hash of 4 bytes, or 0
+  uint32_t head[1 << LZVN_ENCODE_HASH_BITS];
+  // Distance to the previous position with the same hash, or 0, indexed by
+  // position modulo 64 KB
+  uint16_t prev[LZVN_ENCODE_MAX_DISTANCE + 1];
+} lzvn_encoder_work;
+
+LZFSE_INLINE uint32_t lzvn_hash4(const unsigned char *p) {
+  return (load4(p) * 2654435761U) >> (32 - LZVN_ENCODE_HASH_BITS);
+}
+
+LZFSE_INLINE void store2(void *ptr, uint16_t data) {
+  memcpy(ptr, &data, sizeof data);
+}
+
+/*! @abstract Emit literal-only opcodes for \p L bytes at \p p.
+ *  @return next byte to write in \p q, or NULL if \p q1 is reached. */
+static unsigned char *lzvn_emit_literal(const unsigned char *p,
+                                        unsigned char *q, unsigned char *q1,
+                                        size_t L) {
+  while (L > 15) {
+    size_t x = L < 271 ? L : 271;
+    if ((size_t)(q1 - q) < x + 2)
+      return NULL;
+    store2(q, (uint16_t)(0xE0 + ((x - 16) << 8))); // 11100000 LLLLLLLL
+    memcpy(q + 2, p, x);
+    q += x + 2;
+    p += x;
+    L -= x;
+  }
+  if (L > 0) {
+    if ((size_t)(q1 - q) < L + 1)
+      return NULL;
+    *q++ = (unsigned char)(0xE0 + L); // 1110LLLL
+    memcpy(q, p, L);
+    q += L;
+  }
+  return q;
+}
+
+/*! @abstract Emit \p L literal bytes at \p p followed by a match of \p M
+ *  bytes at distance \p D, using \p D_prev when it allows shorter opcodes.
+ *  @return next byte to write in \p q, or NULL if \p q1 is reached. */
+static unsigned char *lzvn_emit(const unsigned char *p, unsigned char *q,
+                                unsigned char *q1, size_t L, size_t M,
+                                size_t D, size_t D_prev) {
+  // Only up to 3 literal bytes fit into a match opcode
+  if (L > 3) {
+    size_t head = L & ~(size_t)3;
+    if (L < 16)
+      head = L;
+    q = lzvn_emit_literal(p, q, q1, head);
+    if (q == NULL)
+      return NULL;
+    p += head;
+    L -= head;
+  }
+
+  // Match length carried by the first opcode, the remainder is emitted as
+  // match-only opcodes reusing the distance
+  size_t x = M <= 10 - 2 * L ? M : 10 - 2 * L;
+  M -= x;
+  x -= 3;
+
+  if ((size_t)(q1 - q) < 3 + L)
+    return NULL;
+
+  if (D == D_prev) {
+    if (L == 0) {
+      *q++ = (unsigned char)(0xF0 + (x + 3)); // 1111MMMM
+    } else {
+      *q++ = (unsigned char)((L << 6) + (x << 3) + 6); // LLMMM110
+    }
+  } else if (D < 2048 - 2 * 256) {
+    *q++ = (unsigned char)((D >> 8) + (L << 6) + (x << 3)); // LLMMMDDD DDDDDDDD
+    *q++ = (unsigned char)(D & 0xFF);
+  } else if (D >= (1 << 14) || M == 0 || (x + 3) + M > 34) {
+    *q++ = (unsigned char)((L << 6) + (x << 3) + 7); // LLMMM111 DDDDDDDD DDDDDDDD
+    store2(q, (uint16_t)D);
+    q += 2;
+  } else {
+    x += M;
+    M = 0;
+    *q++ = (unsigned char)(0xA0 + (x >> 2) + (L << 3)); // 101LLMMM DDDDDDMM DDDDDDDD
+    store2(q, (uint16_t)(D << 2 | (x & 3)));
+    q += 2;
+  }
+
+  for (size_t i = 0; i < L; ++i)
+    *q++ = p[i];
+
+  while (M > 15) {
+    x = M < 271 ? M : 271;
+    if ((size_t)(q1 - q) < 2)
+      return NULL;
+    store2(q, (uint16_t)(0xF0 + ((x - 16) << 8))); // 11110000 MMMMMMMM
+    q += 2;
+    M -= x;
+  }
+  if (M > 0) {
+    if (q == q1)
+      return NULL;
+    *q++ = (unsigned char)(0xF0 + M); // 1111MMMM
+  }
+  return q;
+}
+
+size_t lzvn_encode_scratch_size(void) {
+  return sizeof(lzvn_encoder_work);
+}
+
+size_t lzvn_encode_buffer(void *dst, size_t dst_size,
+                          const void *src, size_t src_size,
+                          void *work) {
+  lzvn_encoder_work *w = (lzvn_encoder_work *)work;
+  const unsigned char *s = (const unsigned char *)src;
+  unsigned char *q = (unsigned char *)dst;
+  unsigned char *q1 = q + dst_size;
+  size_t lit = 0, pos = 0, D_prev = 0;
+
+  memset(w->head, 0, sizeof w->head);
+
+  while (src_size >= LZVN_ENCODE_MIN_MATCH &&
+         pos <= src_size - LZVN_ENCODE_MIN_MATCH) {
+    uint32_t h = lzvn_hash4(s + pos);
+    size_t limit = src_size - pos;
+    size_t best = LZVN_ENCODE_MIN_MATCH - 1, best_d = 0;
+
+    // Try the previous distance first, it is the cheapest to encode
+    if (D_prev != 0 && D_prev <= pos && load4(s + pos - D_prev) == load4(s + pos)) {
+      size_t l = LZVN_ENCODE_MIN_MATCH;
+      while (l < limit && s[pos + l - D_prev] == s[pos + l])
+        ++l;
+      best = l;
+      best_d = D_prev;
+    }
+
+    size_t cand = w->head[h];
+    for (int n = LZVN_ENCODE_DEPTH; cand != 0 && n > 0 && best < limit; --n) {
+      size_t c = cand - 1;
+      size_t d = pos - c;
+      if (d > LZVN_ENCODE_MAX_DISTANCE)
+        break;
+      if (s[c + best] == s[pos + best] && load4(s + c) == load4(s + pos)) {
+        size_t l = LZVN_ENCODE_MIN_MATCH;
+        while (l < limit && s[c + l] == s[pos + l])
+          ++l;
+        if (l > best) {
+          best = l;
+          best_d = d;
+        }
+      }
+      uint16_t delta = w->prev[c & LZVN_ENCODE_MAX_DISTANCE];
+      cand = delta != 0 ? cand - delta : 0;
+    }
+
+    // Register current position in the chain
+    size_t last = w->head[h];
+    w->prev[pos & LZVN_ENCODE_MAX_DISTANCE] =
+        (last != 0 && pos + 1 - last <= LZVN_ENCODE_MAX_DISTANCE) ? (uint16_t)(pos + 1 - last) : 0;
+    w->head[h] = (uint32_t)(pos + 1);
+
+    if (best_d == 0) {
+      ++pos;
+      continue;
+    }
+
+    q = lzvn_emit(s + lit, q, q1, pos - lit, best, best_d, D_prev);
+    if (q == NULL)
+      return 0;
+
+    // Register positions covered by the match
+    for (size_t i = pos + 1; i < pos + best && i <= src_size - LZVN_ENCODE_MIN_MATCH; ++i) {
+      uint32_t hi = lzvn_hash4(s + i);
+      size_t li = w->head[hi];
+      w->prev[i & LZVN_ENCODE_MAX_DISTANCE] =
+          (li != 0 && i + 1 - li <= LZVN_ENCODE_MAX_DISTANCE) ? (uint16_t)(i + 1 - li) : 0;
+      w->head[hi] = (uint32_t)(i + 1);
+    }
+
+    pos += best;
+    lit = pos;
+    D_prev = best_d;
+  }
+
+  q = lzvn_emit_literal(s + lit, q, q1, src_size - lit);
+  if (q == NULL || (size_t)(q1 - q) < 8)
+    return 0;
+
+  // End of stream: 00000110 followed by 7 zero bytes
+  memset(q, 0, 8);
+  q[0] = 0x06;
+  q += 8;
+
+  return q - (unsigned char *)dst;
+}
@@ -35,6 +35,21 @@ size_t lzvn_decode_buffer(void* dst,
                           const void* src,
                           size_t src_size);
 
+size_t lzvn_decode_partial(void* dst,
+                           size_t dst_size,
+                           size_t* dst_used,
+                           size_t* d_prev,
+                           const void* src,
+                           size_t src_size);
+
+size_t lzvn_encode_scratch_size(void);
+
+size_t lzvn_encode_buffer(void* dst,
+                          size_t dst_size,
+                          const void* src,
+                          size_t src_size,
+                          void* work);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
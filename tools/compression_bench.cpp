@@ -0,0 +1,137 @@
+//
+//  compression_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_compression.hpp>
+
+#include <zlib.h>
+
+#include <chrono>
+
+#include "corpus.hpp"
+#include "lzfse_encoder.hpp"
+#include "lzvn_reference.h"
+
+/**
+ *  Benchmarked codec, zlib and lzfse are only decoded by Lilu and thus encoded by zlib and the host lzfse writer,
+ *  reference codecs decode with the previous host decoder to measure the speedup of the current one
+ */
+struct Codec {
+	const char *name;
+	uint32_t mode;
+	Compression::Level level;
+	bool reference {false};
+};
+
+static const Codec codecs[] {
+	{"lzss-fast", Compression::ModeLZSS, Compression::LevelFast},
+	{"lzss", Compression::ModeLZSS, Compression::LevelDefault},
+	{"lzss-max", Compression::ModeLZSS, Compression::LevelMax},
+	{"lzvn", Compression::ModeLZVN, Compression::LevelDefault},
+	{"lzvn-ref", Compression::ModeLZVN, Compression::LevelDefault, true},
+	{"zlib", Compression::ModeZLIB, Compression::LevelDefault},
+	{"lzfse", Compression::ModeLZFSE, Compression::LevelDefault},
+};
+
+template <typename F>
+static double measure(size_t repetitions, F func) {
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < repetitions; i++)
+		if (!func())
+			return -1;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repetitions;
+}
+
+static bool compressSample(const Codec &codec, const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+	if (codec.mode == Compression::ModeZLIB) {
+		uLongf size = compressBound(in.size());
+		out.resize(size);
+		if (compress2(out.data(), &size, in.data(), in.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+			return false;
+		out.resize(size);
+		return true;
+	}
+
+	if (codec.mode == Compression::ModeLZFSE) {
+		out = LZFSEEncoder::encode(in, {LZFSEEncoder::BlockV2}, 1024*1024);
+		return !out.empty();
+	}
+
+	uint32_t size = static_cast<uint32_t>(in.size() + in.size() / 8 + 1024);
+	out.resize(size);
+	if (!Compression::compress(codec.mode, size, in.data(), static_cast<uint32_t>(in.size()), codec.level, out.data()))
+		return false;
+	out.resize(size);
+	return true;
+}
+
+static bool decompressSample(const Codec &codec, const std::vector<uint8_t> &packed, std::vector<uint8_t> &out) {
+	if (codec.reference)
+		return lzvn_reference_decode_buffer(out.data(), out.size(), packed.data(), packed.size()) == out.size();
+
+	return Compression::decompress(codec.mode, static_cast<uint32_t>(out.size()), packed.data(),
+		static_cast<uint32_t>(packed.size()), out.data()) != nullptr;
+}
+
+static bool benchSample(const Corpus::Sample &sample, size_t repetitions) {
+	auto &in = sample.data;
+	double mb = in.size() / 1e6;
+	bool ok = true;
+
+	for (auto &codec : codecs) {
+		std::vector<uint8_t> packed;
+		double compressTime = measure(repetitions, [&]() { return compressSample(codec, in, packed); });
+
+		std::vector<uint8_t> out(in.size());
+		double decompressTime = measure(repetitions, [&]() { return decompressSample(codec, packed, out); });
+
+		if (compressTime < 0 || decompressTime < 0 || out != in) {
+			fprintf(stderr, "%s failed for %s\n", codec.name, sample.name.c_str());
+			ok = false;
+			continue;
+		}
+
+		printf("%-24s %-10s %10zu %10zu %7.2f %10.1f %10.1f\n", sample.name.c_str(), codec.name, in.size(), packed.size(),
+			static_cast<double>(in.size()) / packed.size(), mb / compressTime, mb / decompressTime);
+	}
+
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	size_t repetitions = 5;
+	std::vector<Corpus::Sample> samples;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			repetitions = strtoul(argv[++i], nullptr, 0);
+			continue;
+		}
+
+		Corpus::Sample sample;
+		if (!Corpus::load(argv[i], sample) || sample.data.empty()) {
+			fprintf(stderr, "failed to read %s\n", argv[i]);
+			return 1;
+		}
+		samples.push_back(sample);
+	}
+
+	// Synthetic samples are used when no corpus files are given
+	if (samples.empty()) {
+		std::mt19937_64 rng(50);
+		for (int k = 0; k < Corpus::KindTotal; k++) {
+			auto kind = static_cast<Corpus::Kind>(k);
+			samples.push_back({Corpus::kindName(kind), Corpus::generate(kind, 4*1024*1024, rng)});
+		}
+	}
+
+	printf("%-24s %-10s %10s %10s %7s %10s %10s\n", "sample", "mode", "size", "packed", "ratio", "comp MB/s", "dec MB/s");
+	bool ok = true;
+	for (auto &sample : samples)
+		ok &= benchSample(sample, repetitions > 0 ? repetitions : 1);
+
+	return ok ? 0 : 1;
+}
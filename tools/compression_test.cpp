@@ -0,0 +1,438 @@
+//
+//  compression_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_compression.hpp>
+
+#include <lzvn.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "corpus.hpp"
+#include "lzfse_encoder.hpp"
+#include "lzvn_reference.h"
+
+static size_t failures = 0;
+
+#define CHECK(cond, fmt, ...)                                                            \
+	do {                                                                                 \
+		if (!(cond)) {                                                                   \
+			failures++;                                                                  \
+			fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__, #cond, ## __VA_ARGS__); \
+		}                                                                                \
+	} while (0)
+
+static const uint32_t modes[] {Compression::ModeLZSS, Compression::ModeLZVN, Compression::ModeZLIB};
+
+static const char *modeName(uint32_t mode) {
+	switch (mode) {
+		case Compression::ModeLZSS: return "lzss";
+		case Compression::ModeLZVN: return "lzvn";
+		case Compression::ModeZLIB: return "zlib";
+		default: return "unknown";
+	}
+}
+
+/**
+ *  Compress data with Lilu encoders or zlib, which Lilu only decodes
+ */
+static bool compressData(uint32_t mode, const std::vector<uint8_t> &in, std::vector<uint8_t> &out,
+						 Compression::Level level=Compression::LevelDefault) {
+	if (mode == Compression::ModeZLIB) {
+		uLongf size = compressBound(in.size());
+		out.resize(size);
+		if (compress2(out.data(), &size, in.data(), in.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+			return false;
+		out.resize(size);
+		return true;
+	}
+
+	uint32_t size = static_cast<uint32_t>(in.size() + in.size() / 8 + 1024);
+	out.resize(size);
+	if (!Compression::compress(mode, size, in.data(), static_cast<uint32_t>(in.size()), level, out.data()))
+		return false;
+	out.resize(size);
+	return true;
+}
+
+/**
+ *  LZSS decoder of kext_tools/compression.c used before decoding directly into the output.
+ *  The original leaves the ring tail uninitialised, here it is filled with ' ' like the rest.
+ */
+static size_t referenceDecompressLZSS(uint8_t *dst, uint32_t dstlen, const uint8_t *src, uint32_t srclen) {
+	static constexpr int RBSIZE = 4096;
+	static constexpr int UPLIM = 18;
+	static constexpr int THRESHOLD = 2;
+
+	uint8_t text_buf[RBSIZE + UPLIM - 1];
+	uint8_t *dststart = dst;
+	const uint8_t *dstend = dst + dstlen;
+	const uint8_t *srcend = src + srclen;
+	int i, j, k, r, c;
+	unsigned int flags;
+
+	for (i = 0; i < RBSIZE; i++)
+		text_buf[i] = ' ';
+	r = RBSIZE - UPLIM;
+	flags = 0;
+	for ( ; ; ) {
+		if (((flags >>= 1) & 0x100) == 0) {
+			if (src < srcend) c = *src++; else break;
+			flags = c | 0xFF00;
+		}
+		if (flags & 1) {
+			if (src < srcend) c = *src++; else break;
+			if (dst < dstend) *dst++ = c; else break;
+			text_buf[r++] = c;
+			r &= (RBSIZE - 1);
+		} else {
+			if (src < srcend) i = *src++; else break;
+			if (src < srcend) j = *src++; else break;
+			i |= ((j & 0xF0) << 4);
+			j  =  (j & 0x0F) + THRESHOLD;
+			for (k = 0; k <= j; k++) {
+				c = text_buf[(i + k) & (RBSIZE - 1)];
+				if (dst < dstend) *dst++ = c; else break;
+				text_buf[r++] = c;
+				r &= (RBSIZE - 1);
+			}
+		}
+	}
+
+	return dst - dststart;
+}
+
+/**
+ *  Encoders and decoders round trip every sample at every effort level
+ */
+static void testRoundTrip(std::mt19937_64 &rng) {
+	static const size_t sizes[] {1, 2, 3, 17, 4095, 4096, 4097, 65537, 1024*1024};
+	static const Compression::Level levels[] {Compression::LevelFast, Compression::LevelDefault, Compression::LevelMax};
+
+	for (int k = 0; k < Corpus::KindTotal; k++) {
+		auto kind = static_cast<Corpus::Kind>(k);
+		for (auto size : sizes) {
+			auto in = Corpus::generate(kind, size, rng);
+			for (auto mode : {Compression::ModeLZSS, Compression::ModeLZVN}) {
+				for (auto level : levels) {
+					std::vector<uint8_t> packed;
+					CHECK(compressData(mode, in, packed, level), "%s %s %zu level %u", modeName(mode), Corpus::kindName(kind), size, level);
+
+					std::vector<uint8_t> out(size + 1, 0xAA);
+					bool ok = Compression::decompress(mode, static_cast<uint32_t>(size), packed.data(),
+						static_cast<uint32_t>(packed.size()), out.data()) != nullptr;
+					CHECK(ok && std::equal(in.begin(), in.end(), out.begin()) && out[size] == 0xAA,
+						"%s %s %zu level %u", modeName(mode), Corpus::kindName(kind), size, level);
+
+					// LZVN has a single effort level
+					if (mode == Compression::ModeLZVN)
+						break;
+				}
+			}
+		}
+	}
+}
+
+/**
+ *  LZSS decoder matches the reference decoder on valid, truncated, and random input with any output size
+ */
+static void testLZSSReference(std::mt19937_64 &rng) {
+	auto check = [](const uint8_t *src, size_t srclen, size_t dstlen) {
+		std::vector<uint8_t> expected(dstlen + 1), actual(dstlen + 1);
+		size_t want = referenceDecompressLZSS(expected.data(), static_cast<uint32_t>(dstlen), src, static_cast<uint32_t>(srclen));
+		uint32_t got = static_cast<uint32_t>(dstlen);
+		Compression::decompress(Compression::ModeLZSS, &got, src, static_cast<uint32_t>(srclen), actual.data());
+		CHECK(got == want && std::equal(expected.begin(), expected.begin() + want, actual.begin()),
+			"srclen %zu dstlen %zu: %u vs %zu", srclen, dstlen, got, want);
+	};
+
+	for (int it = 0; it < 20000; it++) {
+		std::vector<uint8_t> src(rng() % 600);
+		for (auto &c : src)
+			c = static_cast<uint8_t>(rng());
+		check(src.data(), src.size(), rng() % 3000);
+	}
+
+	for (int it = 0; it < 500; it++) {
+		auto kind = static_cast<Corpus::Kind>(it % Corpus::KindTotal);
+		auto in = Corpus::generate(kind, 1 + rng() % 20000, rng);
+		std::vector<uint8_t> packed;
+		CHECK(compressData(Compression::ModeLZSS, in, packed), "%s %zu", Corpus::kindName(kind), in.size());
+		check(packed.data(), packed.size(), in.size());
+		check(packed.data(), packed.size(), rng() % (in.size() + 1));
+		check(packed.data(), rng() % (packed.size() + 1), in.size());
+	}
+}
+
+/**
+ *  LZVN decoder matches the decoder before the wide copy fast paths on valid, mutated, truncated,
+ *  and random input with any output size, and never writes past the output
+ */
+static void testLZVNReference(std::mt19937_64 &rng) {
+	auto check = [](const uint8_t *src, size_t srclen, size_t dstlen) {
+		// Both outputs start with the same contents, the guard catches writes past the output.
+		static constexpr size_t Guard = 64;
+		std::vector<uint8_t> expected(dstlen + Guard, 0xAA), actual(dstlen + Guard, 0xAA);
+		size_t want = lzvn_reference_decode_buffer(expected.data(), dstlen, src, srclen);
+		size_t got = lzvn_decode_buffer(actual.data(), dstlen, src, srclen);
+		CHECK(got == want && std::equal(expected.begin(), expected.begin() + want, actual.begin()),
+			"srclen %zu dstlen %zu: %zu vs %zu", srclen, dstlen, got, want);
+		CHECK(std::all_of(actual.begin() + dstlen, actual.end(), [](uint8_t c) { return c == 0xAA; }),
+			"srclen %zu dstlen %zu: written past the output", srclen, dstlen);
+	};
+
+	// Random opcodes mostly stop early, so short sources are enough.
+	for (int it = 0; it < 20000; it++) {
+		std::vector<uint8_t> src(rng() % 600);
+		for (auto &c : src)
+			c = static_cast<uint8_t>(rng());
+		check(src.data(), src.size(), rng() % 3000);
+	}
+
+	for (int it = 0; it < 2000; it++) {
+		auto kind = static_cast<Corpus::Kind>(it % Corpus::KindTotal);
+		auto in = Corpus::generate(kind, 1 + rng() % 20000, rng);
+		std::vector<uint8_t> packed;
+		CHECK(compressData(Compression::ModeLZVN, in, packed), "%s %zu", Corpus::kindName(kind), in.size());
+		check(packed.data(), packed.size(), in.size());
+		check(packed.data(), packed.size(), rng() % (in.size() + 1));
+		check(packed.data(), rng() % (packed.size() + 1), in.size());
+
+		// Mutations change opcodes, lengths and distances, including ones reaching before the output.
+		auto mutated = packed;
+		for (size_t i = 0, num = 1 + rng() % 8; i < num; i++)
+			mutated[rng() % mutated.size()] ^= static_cast<uint8_t>(1 + rng() % 255);
+		check(mutated.data(), mutated.size(), in.size() + rng() % 64);
+	}
+}
+
+/**
+ *  Stream decodes chunked input like the one-shot decoder and computes the same adler32 as zlib
+ */
+static void testStream(std::mt19937_64 &rng) {
+	for (int it = 0; it < 120; it++) {
+		auto kind = static_cast<Corpus::Kind>(it % Corpus::KindTotal);
+		auto in = Corpus::generate(kind, 1 + rng() % 300000, rng);
+		for (auto mode : modes) {
+			std::vector<uint8_t> packed;
+			CHECK(compressData(mode, in, packed), "%s %s", modeName(mode), Corpus::kindName(kind));
+
+			std::vector<uint8_t> out(in.size() + 1, 0xAA);
+			Compression::Stream stream;
+			bool ok = stream.init(mode, out.data(), static_cast<uint32_t>(in.size()), true);
+			size_t maxChunk = it % 4 == 0 ? 20 : Compression::Stream::ChunkSize;
+			for (size_t pos = 0; ok && pos < packed.size(); ) {
+				uint32_t chunk = static_cast<uint32_t>(std::min<size_t>(packed.size() - pos, 1 + rng() % maxChunk));
+				memcpy(stream.input(), packed.data() + pos, chunk);
+				pos += chunk;
+				ok = stream.feed(chunk, pos == packed.size());
+			}
+
+			uint32_t adler = static_cast<uint32_t>(adler32(1, in.data(), static_cast<uInt>(in.size())));
+			CHECK(ok && stream.produced() == in.size() && std::equal(in.begin(), in.end(), out.begin()) && out[in.size()] == 0xAA,
+				"%s %s %zu", modeName(mode), Corpus::kindName(kind), in.size());
+			CHECK(stream.checksum() == adler, "%s %s %zu", modeName(mode), Corpus::kindName(kind), in.size());
+			stream.deinit();
+		}
+	}
+}
+
+/**
+ *  Prefix decoding produces exactly the requested amount of data
+ */
+static void testPrefix(std::mt19937_64 &rng) {
+	for (int it = 0; it < 200; it++) {
+		auto kind = static_cast<Corpus::Kind>(it % Corpus::KindTotal);
+		auto in = Corpus::generate(kind, 1 + rng() % 200000, rng);
+		for (auto mode : modes) {
+			std::vector<uint8_t> packed;
+			CHECK(compressData(mode, in, packed), "%s %s", modeName(mode), Corpus::kindName(kind));
+
+			uint32_t want = static_cast<uint32_t>(1 + rng() % in.size());
+			uint32_t consumed = 0;
+			std::vector<uint8_t> out(want + 1, 0xAA);
+			bool ok = Compression::decompressPrefix(mode, want, packed.data(), static_cast<uint32_t>(packed.size()),
+				consumed, out.data()) != nullptr;
+			CHECK(ok && std::equal(out.begin(), out.begin() + want, in.begin()) && out[want] == 0xAA && consumed <= packed.size(),
+				"%s %s %u of %zu", modeName(mode), Corpus::kindName(kind), want, in.size());
+		}
+	}
+}
+
+/**
+ *  adler32 matches zlib for any size and alignment
+ */
+static void testAdler32(std::mt19937_64 &rng) {
+	for (int it = 0; it < 2000; it++) {
+		auto in = Corpus::generate(static_cast<Corpus::Kind>(it % Corpus::KindTotal), rng() % 20000, rng);
+		size_t skip = in.empty() ? 0 : rng() % std::min<size_t>(in.size(), 16);
+		uint32_t expected = static_cast<uint32_t>(adler32(1, in.data() + skip, static_cast<uInt>(in.size() - skip)));
+		CHECK(Compression::adler32(1, in.data() + skip, in.size() - skip) == expected, "%zu at %zu", in.size(), skip);
+	}
+
+	// Sums must be reduced before overflowing with all bytes at maximum
+	std::vector<uint8_t> ones(1024*1024, 0xFF);
+	CHECK(Compression::adler32(1, ones.data(), ones.size()) == adler32(1, ones.data(), static_cast<uInt>(ones.size())), "0xFF");
+}
+
+/**
+ *  Decode an lzfse stream expected to fail or succeed without touching memory past the output
+ *
+ *  @param src     compressed data
+ *  @param srclen  compressed data size
+ *  @param plain   expected data
+ *
+ *  @return true when decoding succeeded with the expected data
+ */
+static bool decodeLZFSE(const uint8_t *src, size_t srclen, const std::vector<uint8_t> &plain) {
+	// Data is copied to an exactly sized buffer, so that sanitizers catch reads past the end.
+	std::vector<uint8_t> in(src, src + srclen);
+	std::vector<uint8_t> out(plain.size() + 64, 0xAA);
+	bool ok = Compression::decompress(Compression::ModeLZFSE, static_cast<uint32_t>(plain.size()),
+		in.empty() ? nullptr : in.data(), static_cast<uint32_t>(in.size()), out.data()) != nullptr;
+	CHECK(std::all_of(out.begin() + plain.size(), out.end(), [](uint8_t c) { return c == 0xAA; }), "overrun of %zu", plain.size());
+	return ok && std::equal(plain.begin(), plain.end(), out.begin());
+}
+
+/**
+ *  Vectors assembled by hand from the lzfse block format, independent of any encoder
+ */
+static void testLZFSEVectors() {
+	static const uint8_t raw[] {
+		'b', 'v', 'x', '-', 3, 0, 0, 0, 'a', 'b', 'c',
+		'b', 'v', 'x', '$'
+	};
+	// lzvn: 4 literals, match of 8 at distance 4 with a 1 literal prefix, end of stream.
+	static const uint8_t lzvn[] {
+		'b', 'v', 'x', 'n', 13, 0, 0, 0, 16, 0, 0, 0,
+		0xE4, 'a', 'b', 'c', 'd', 0x68, 0x04, 'x',
+		0x06, 0, 0, 0, 0, 0, 0, 0,
+		'b', 'v', 'x', '$'
+	};
+
+	std::vector<uint8_t> rawPlain {'a', 'b', 'c'};
+	CHECK(decodeLZFSE(raw, sizeof(raw), rawPlain), "bvx-");
+	CHECK(Compression::lzfseDecompressedSize(raw, sizeof(raw)) == 3, "bvx- size");
+
+	std::vector<uint8_t> lzvnPlain {'a', 'b', 'c', 'd', 'x', 'b', 'c', 'd', 'x', 'b', 'c', 'd', 'x'};
+	CHECK(decodeLZFSE(lzvn, sizeof(lzvn), lzvnPlain), "bvxn");
+	CHECK(Compression::lzfseDecompressedSize(lzvn, sizeof(lzvn)) == lzvnPlain.size(), "bvxn size");
+
+	// bvx1 is never written by the reference encoder and is not supported.
+	uint8_t v1[sizeof(raw)];
+	memcpy(v1, raw, sizeof(raw));
+	v1[3] = '1';
+	CHECK(!decodeLZFSE(v1, sizeof(v1), rawPlain) && Compression::lzfseDecompressedSize(v1, sizeof(v1)) == 0, "bvx1");
+}
+
+/**
+ *  Streams produced by the reference format writer round trip, truncated and corrupted ones fail cleanly
+ */
+static void testLZFSE(std::mt19937_64 &rng) {
+	using namespace LZFSEEncoder;
+	static const size_t sizes[] {1, 3, 100, 4096, 70000, 300000};
+	static const std::vector<BlockType> layouts[] {{BlockV2}, {BlockLZVN}, {BlockRaw}, {BlockV2, BlockLZVN, BlockRaw}};
+
+	for (int k = 0; k < Corpus::KindTotal; k++) {
+		auto kind = static_cast<Corpus::Kind>(k);
+		for (auto size : sizes) {
+			auto in = Corpus::generate(kind, size, rng);
+			for (auto &layout : layouts) {
+				auto packed = encode(in, layout, 32*1024);
+				CHECK(!packed.empty(), "encode %s %zu", Corpus::kindName(kind), size);
+				CHECK(Compression::lzfseDecompressedSize(packed.data(), static_cast<uint32_t>(packed.size())) == size,
+					"size %s %zu layout %u", Corpus::kindName(kind), size, layout[0]);
+				CHECK(decodeLZFSE(packed.data(), packed.size(), in), "%s %zu layout %u", Corpus::kindName(kind), size, layout[0]);
+
+				uint32_t want = static_cast<uint32_t>(1 + rng() % size), consumed = 0;
+				std::vector<uint8_t> out(want + 1, 0xAA);
+				bool ok = Compression::decompressPrefix(Compression::ModeLZFSE, want, packed.data(),
+					static_cast<uint32_t>(packed.size()), consumed, out.data()) != nullptr;
+				CHECK(ok && std::equal(out.begin(), out.begin() + want, in.begin()) && out[want] == 0xAA && consumed <= packed.size(),
+					"prefix %u of %s %zu", want, Corpus::kindName(kind), size);
+
+				// Anything short of the end of stream marker misses data.
+				for (int t = 0; t < 16; t++) {
+					size_t cut = rng() % (packed.size() - 4);
+					CHECK(!decodeLZFSE(packed.data(), cut, in), "truncated to %zu of %zu", cut, packed.size());
+					CHECK(Compression::lzfseDecompressedSize(packed.data(), static_cast<uint32_t>(cut)) == 0, "size truncated to %zu", cut);
+				}
+
+				// Random corruption may decode to wrong data but must stay in bounds.
+				for (int t = 0; t < 16; t++) {
+					auto bad = packed;
+					for (int n = 0; n < 4; n++)
+						bad[rng() % bad.size()] ^= static_cast<uint8_t>(1 + rng() % 255);
+					decodeLZFSE(bad.data(), bad.size(), in);
+					Compression::lzfseDecompressedSize(bad.data(), static_cast<uint32_t>(bad.size()));
+				}
+			}
+		}
+	}
+
+	// Corrupted first block header fields that must be rejected.
+	auto in = Corpus::generate(Corpus::KindText, 20000, rng);
+	for (auto type : {BlockV2, BlockLZVN, BlockRaw}) {
+		auto packed = encode(in, {type});
+		auto corrupt = [&](size_t off, uint32_t value, const char *what) {
+			auto bad = packed;
+			memcpy(&bad[off], &value, sizeof(value));
+			CHECK(!decodeLZFSE(bad.data(), bad.size(), in), "%s in block %u", what, type);
+		};
+
+		uint32_t nraw;
+		memcpy(&nraw, &packed[4], sizeof(nraw));
+		corrupt(0, 0x31787662, "bvx1 magic");
+		corrupt(0, 0x12345678, "unknown magic");
+		corrupt(4, nraw - 1, "smaller raw size");
+		if (type == BlockV2) {
+			corrupt(28, 0xFFFFFFFF, "out of range states");
+			corrupt(24, 8, "short header");
+			corrupt(24, 0x7FFFFFFF, "oversized header");
+		} else if (type == BlockLZVN) {
+			corrupt(8, 0x7FFFFFFF, "oversized payload");
+		}
+	}
+}
+
+/**
+ *  Streams made by Apple or reference lzfse tools, passed as pairs of compressed and original files
+ */
+static void testLZFSEFiles(int argc, char **argv) {
+	for (int i = 1; i + 1 < argc; i += 2) {
+		Corpus::Sample packed, plain;
+		if (!Corpus::load(argv[i], packed) || !Corpus::load(argv[i + 1], plain)) {
+			CHECK(false, "failed to read %s or %s", argv[i], argv[i + 1]);
+			continue;
+		}
+		CHECK(Compression::lzfseDecompressedSize(packed.data.data(), static_cast<uint32_t>(packed.data.size())) == plain.data.size(),
+			"size of %s", argv[i]);
+		CHECK(decodeLZFSE(packed.data.data(), packed.data.size(), plain.data), "%s", argv[i]);
+	}
+}
+
+int main(int argc, char **argv) {
+	std::mt19937_64 rng(7);
+
+	testRoundTrip(rng);
+	testLZSSReference(rng);
+	testLZVNReference(rng);
+	testStream(rng);
+	testPrefix(rng);
+	testAdler32(rng);
+	testLZFSEVectors();
+	testLZFSE(rng);
+	testLZFSEFiles(argc, argv);
+
+	if (failures > 0) {
+		fprintf(stderr, "%zu checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all compression checks passed\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+//
+//  corpus.hpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef corpus_hpp
+#define corpus_hpp
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace Corpus {
+	/**
+	 *  Named block of data to compress
+	 */
+	struct Sample {
+		std::string name;
+		std::vector<uint8_t> data;
+	};
+
+	/**
+	 *  Sample kinds resembling the contents of kernel binaries
+	 */
+	enum Kind {
+		KindCode,    // short repeats with mutations, similar to machine code
+		KindText,    // dictionary words, similar to symbol and string tables
+		KindSparse,  // mostly zeroes with scattered words, similar to data segments
+		KindRandom,  // incompressible data, similar to embedded compressed resources
+		KindTotal
+	};
+
+	/**
+	 *  Obtain sample kind name
+	 *
+	 *  @param kind  sample kind
+	 *
+	 *  @return kind name
+	 */
+	inline const char *kindName(Kind kind) {
+		static const char *names[KindTotal] {"code", "text", "sparse", "random"};
+		return names[kind];
+	}
+
+	/**
+	 *  Generate a deterministic sample
+	 *
+	 *  @param kind  sample kind
+	 *  @param size  sample size
+	 *  @param rng   random generator
+	 *
+	 *  @return sample data
+	 */
+	inline std::vector<uint8_t> generate(Kind kind, size_t size, std::mt19937_64 &rng) {
+		static const char *words[] {
+			"_kernel_", "thread_", "vm_map", "_task", "IOService", "::start", "OSKext", "proc_", "lock",
+			"_init", "memory", "__ZN", "Lilu", "0x", " ", "\n", "_mach", "vnode", "kauth", "_get"
+		};
+
+		std::vector<uint8_t> data(size);
+		size_t i = 0;
+		switch (kind) {
+			case KindCode:
+				for (; i < size; i++)
+					data[i] = i > 64 && rng() % 6 ? data[i - 1 - rng() % 64] : static_cast<uint8_t>(rng() % 64);
+				break;
+			case KindText:
+				while (i < size) {
+					const char *word = words[rng() % (sizeof(words) / sizeof(words[0]))];
+					for (size_t j = 0; word[j] != '\0' && i < size; j++)
+						data[i++] = static_cast<uint8_t>(word[j]);
+				}
+				break;
+			case KindSparse:
+				for (; i < size; i++)
+					data[i] = rng() % 16 == 0 ? static_cast<uint8_t>(rng()) : 0;
+				break;
+			case KindRandom:
+			case KindTotal:
+				for (; i < size; i++)
+					data[i] = static_cast<uint8_t>(rng());
+				break;
+		}
+
+		return data;
+	}
+
+	/**
+	 *  Load a sample from file
+	 *
+	 *  @param path    file path
+	 *  @param sample  loaded sample
+	 *
+	 *  @return true on success
+	 */
+	inline bool load(const char *path, Sample &sample) {
+		FILE *fp = fopen(path, "rb");
+		if (!fp)
+			return false;
+
+		sample.name = path;
+		sample.data.clear();
+		uint8_t buf[64*1024];
+		size_t n;
+		while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+			sample.data.insert(sample.data.end(), buf, buf + n);
+
+		bool ok = ferror(fp) == 0;
+		fclose(fp);
+		return ok;
+	}
+}
+
+#endif /* corpus_hpp */
@@ -0,0 +1,164 @@
+//
+//  disasm_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_disasm.hpp>
+
+#include <capstone.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+/**
+ *  Instructions found in function prologues and the code right after them
+ */
+static const std::vector<uint8_t> common[] {
+	{0x55},                                           // push rbp
+	{0x48, 0x89, 0xE5},                               // mov rbp, rsp
+	{0x41, 0x57},                                     // push r15
+	{0x41, 0x56},                                     // push r14
+	{0x53},                                           // push rbx
+	{0x50},                                           // push rax
+	{0x48, 0x83, 0xEC, 0x28},                         // sub rsp, 0x28
+	{0x48, 0x81, 0xEC, 0x00, 0x01, 0x00, 0x00},       // sub rsp, 0x100
+	{0x49, 0x89, 0xFE},                               // mov r14, rdi
+	{0x48, 0x89, 0x7D, 0xF8},                         // mov [rbp-8], rdi
+	{0x48, 0x8B, 0x05, 0x10, 0x20, 0x30, 0x00},       // mov rax, [rip+0x302010]
+	{0x48, 0x8D, 0x3D, 0x10, 0x20, 0x30, 0x00},       // lea rdi, [rip+0x302010]
+	{0x48, 0x8B, 0x07},                               // mov rax, [rdi]
+	{0xFF, 0x90, 0x28, 0x01, 0x00, 0x00},             // call [rax+0x128]
+	{0x4C, 0x8B, 0x44, 0x24, 0x08},                   // mov r8, [rsp+8]
+	{0x31, 0xC0},                                     // xor eax, eax
+	{0x85, 0xC0},                                     // test eax, eax
+	{0xE8, 0x00, 0x00, 0x00, 0x00},                   // call rel32
+	{0x0F, 0x84, 0x00, 0x01, 0x00, 0x00},             // je rel32
+	{0x74, 0x10},                                     // je rel8
+	{0xBE, 0x01, 0x00, 0x00, 0x00},                   // mov esi, 1
+	{0xC7, 0x45, 0xEC, 0x00, 0x00, 0x00, 0x00},       // mov dword [rbp-0x14], 0
+	{0x0F, 0xB6, 0x47, 0x01},                         // movzx eax, byte [rdi+1]
+	{0xF6, 0x47, 0x10, 0x01},                         // test byte [rdi+0x10], 1
+	{0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},             // nop word [rax+rax]
+	{0xF0, 0x0F, 0xB1, 0x0F},                         // lock cmpxchg [rdi], ecx
+	{0x48, 0x83, 0xC4, 0x28},                         // add rsp, 0x28
+	{0x5B},                                           // pop rbx
+	{0x5D},                                           // pop rbp
+	{0xC3},                                           // ret
+};
+
+/**
+ *  Random stream of common instructions
+ *
+ *  @param count  amount of instructions
+ */
+static std::vector<uint8_t> makeStream(size_t count) {
+	std::mt19937 rng(30);
+	std::vector<uint8_t> code;
+	for (size_t i = 0; i < count; i++) {
+		auto &insn = common[rng() % (sizeof(common) / sizeof(common[0]))];
+		code.insert(code.end(), insn.begin(), insn.end());
+	}
+	return code;
+}
+
+/**
+ *  Walk the stream instruction by instruction and report nanoseconds per instruction
+ *
+ *  @param code         instruction stream followed by at least 32 bytes of padding
+ *  @param size         stream size without padding
+ *  @param repetitions  amount of walks
+ *  @param count        amount of decoded instructions per walk
+ *  @param func         decoder returning instruction size or 0
+ */
+template <typename F>
+static double run(const std::vector<uint8_t> &code, size_t size, size_t repetitions, size_t &count, F func) {
+	count = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repetitions; r++) {
+		count = 0;
+		for (size_t off = 0; off < size; count++) {
+			size_t len = func(&code[off]);
+			off += len > 0 ? len : 1;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return seconds * 1e9 / (count * repetitions);
+}
+
+/**
+ *  Compare quickInstructionSize with hde_disasm and capstone on one instruction stream
+ *
+ *  @return true when quickInstructionSize and HDE walk the same amount of instructions
+ */
+static bool bench(const char *name, std::vector<uint8_t> code, size_t repetitions, csh handle) {
+	size_t size = code.size();
+	code.resize(size + 32, 0x90);
+
+	size_t quickCount, hdeCount, capstoneCount;
+	double quick = run(code, size, repetitions, quickCount, [](const uint8_t *insn) {
+		return Disassembler::quickInstructionSize(reinterpret_cast<mach_vm_address_t>(insn), 1);
+	});
+	double hde = run(code, size, repetitions, hdeCount, [](const uint8_t *insn) {
+		Disassembler::hde_t hs;
+		size_t len = Disassembler::hde_disasm(insn, &hs);
+		return (hs.flags & F_ERROR) ? 0 : len;
+	});
+
+	// Same single instruction calls as Disassembler::instructionSize.
+	double cs = run(code, size, repetitions, capstoneCount, [&](const uint8_t *ptr) {
+		cs_insn *insn = nullptr;
+		size_t count = cs_disasm(handle, ptr, 15, 0, 1, &insn);
+		size_t len = count == 1 ? insn->size : 0;
+		if (insn)
+			cs_free(insn, count);
+		return len;
+	});
+
+	printf("%10s %10zu %10.2f %10.2f %10.2f %8.2f\n", name, quickCount, quick, hde, cs, hde / quick);
+	return quickCount == hdeCount;
+}
+
+/**
+ *  Read a binary region, e.g. kernel __text
+ */
+static bool readFile(const char *path, long off, long size, std::vector<uint8_t> &buf) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	buf.resize(size);
+	bool ok = fseek(fp, off, SEEK_SET) == 0 && fread(buf.data(), 1, size, fp) == static_cast<size_t>(size);
+	fclose(fp);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10;
+	if (scale == 0)
+		scale = 1;
+
+	csh handle;
+	if (cs_open(CS_ARCH_X86, CS_MODE_64, &handle) != CS_ERR_OK) {
+		fprintf(stderr, "failed to open capstone\n");
+		return 1;
+	}
+
+	printf("%10s %10s %10s %10s %10s %8s\n", "stream", "insns", "quick ns", "hde ns", "cs ns", "speedup");
+	bool ok = bench("common", makeStream(100000), scale * 10, handle);
+
+	if (argc == 5) {
+		std::vector<uint8_t> buf;
+		if (!readFile(argv[2], strtol(argv[3], nullptr, 0), strtol(argv[4], nullptr, 0), buf)) {
+			fprintf(stderr, "failed to read %s\n", argv[2]);
+			return 1;
+		}
+		ok &= bench("file", buf, scale, handle);
+	}
+
+	cs_close(&handle);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+//
+//  disasm_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_disasm.hpp>
+
+#include <capstone.h>
+#include <stdlib.h>
+
+#include <random>
+#include <vector>
+
+static size_t failures = 0;
+
+/**
+ *  Capstone handle, amount of instructions it decoded and of those HDE decodes differently
+ */
+static csh capstone;
+static size_t capstoneDecoded = 0;
+static size_t capstoneHDEMismatches = 0;
+
+/**
+ *  Compare quickInstructionSize with capstone, which rejects invalid encodings and the instruction sets
+ *  removed from the kext build. Whenever capstone and HDE agree quickInstructionSize must agree too,
+ *  instructions HDE decodes differently are only counted.
+ *
+ *  @param code  instruction pointer with at least 32 valid bytes
+ */
+static void compareWithCapstone(const uint8_t *code) {
+	static constexpr size_t MaxInstruction {15};
+
+	cs_insn *insn = nullptr;
+	size_t count = cs_disasm(capstone, code, MaxInstruction, 0, 1, &insn);
+	if (count != 1) {
+		if (insn)
+			cs_free(insn, count);
+		return;
+	}
+
+	size_t expected = insn->size;
+	cs_free(insn, count);
+	capstoneDecoded++;
+
+	Disassembler::hde_t hs;
+	if (Disassembler::hde_disasm(code, &hs) != expected || (hs.flags & F_ERROR)) {
+		capstoneHDEMismatches++;
+		return;
+	}
+
+	size_t actual = Disassembler::quickInstructionSize(reinterpret_cast<mach_vm_address_t>(code), 1);
+	if (actual != expected) {
+		failures++;
+		if (failures < 20) {
+			fprintf(stderr, "length %zu instead of capstone %zu:", actual, expected);
+			for (size_t i = 0; i < MaxInstruction; i++)
+				fprintf(stderr, " %02X", code[i]);
+			fprintf(stderr, "\n");
+		}
+	}
+}
+
+/**
+ *  Compare quickInstructionSize, which tries the table-driven decoder first, with HDE alone
+ *
+ *  @param code  instruction pointer with at least 32 valid bytes
+ *
+ *  @return instruction size decoded by HDE
+ */
+static size_t compareWithHDE(const uint8_t *code) {
+	compareWithCapstone(code);
+
+	Disassembler::hde_t hs;
+	size_t expected = Disassembler::hde_disasm(code, &hs);
+	// Invalid encodings are only decoded by HDE, their length is irrelevant.
+	if (hs.flags & F_ERROR)
+		return expected > 0 ? expected : 1;
+
+	size_t actual = Disassembler::quickInstructionSize(reinterpret_cast<mach_vm_address_t>(code), 1);
+	if (actual != expected) {
+		failures++;
+		if (failures < 20) {
+			fprintf(stderr, "length %zu instead of %zu:", actual, expected);
+			for (size_t i = 0; i < 15; i++)
+				fprintf(stderr, " %02X", code[i]);
+			fprintf(stderr, "\n");
+		}
+	}
+
+	return expected;
+}
+
+/**
+ *  Common function prologue instructions
+ */
+static void testPrologues() {
+	static const std::vector<uint8_t> prologues[] {
+		{0x55},                                           // push rbp
+		{0x48, 0x89, 0xE5},                               // mov rbp, rsp
+		{0x41, 0x57},                                     // push r15
+		{0x53},                                           // push rbx
+		{0x48, 0x83, 0xEC, 0x28},                         // sub rsp, 0x28
+		{0x48, 0x81, 0xEC, 0x00, 0x01, 0x00, 0x00},       // sub rsp, 0x100
+		{0x48, 0x89, 0x7D, 0xF8},                         // mov [rbp-8], rdi
+		{0x48, 0x8B, 0x05, 0x10, 0x20, 0x30, 0x00},       // mov rax, [rip+0x302010]
+		{0x48, 0x8D, 0x3D, 0x10, 0x20, 0x30, 0x00},       // lea rdi, [rip+0x302010]
+		{0x4C, 0x8B, 0x44, 0x24, 0x08},                   // mov r8, [rsp+8]
+		{0x89, 0x04, 0x25, 0x00, 0x10, 0x00, 0x00},       // mov [0x1000], eax
+		{0xE8, 0x00, 0x00, 0x00, 0x00},                   // call rel32
+		{0xE9, 0x00, 0x00, 0x00, 0x00},                   // jmp rel32
+		{0x0F, 0x84, 0x00, 0x01, 0x00, 0x00},             // je rel32
+		{0x74, 0x10},                                     // je rel8
+		{0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8},             // mov rax, imm64
+		{0x66, 0xB8, 0x34, 0x12},                         // mov ax, imm16
+		{0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},             // nop word [rax+rax]
+		{0xF6, 0x47, 0x10, 0x01},                         // test byte [rdi+0x10], 1
+		{0xF7, 0xD8},                                     // neg eax
+		{0xF3, 0x48, 0xAB},                               // rep stosq
+		{0xC8, 0x10, 0x00, 0x00},                         // enter 0x10, 0
+		{0x0F, 0xB6, 0x47, 0x01},                         // movzx eax, byte [rdi+1]
+		{0x67, 0x8B, 0x00},                               // mov eax, [eax]
+	};
+
+	for (auto &prologue : prologues) {
+		std::vector<uint8_t> code(prologue);
+		code.resize(64, 0x90);
+		size_t len = compareWithHDE(code.data());
+		if (len != prologue.size()) {
+			failures++;
+			fprintf(stderr, "HDE length %zu instead of %zu for %02X\n", len, prologue.size(), prologue[0]);
+		}
+	}
+}
+
+/**
+ *  Prologues that a long jump may or may not overwrite
+ */
+static void testLinearCode() {
+	static const struct {
+		std::vector<uint8_t> code;
+		bool linear;
+	} prologues[] {
+		{{0x55, 0x48, 0x89, 0xE5, 0x41, 0x57, 0x41, 0x56, 0x53, 0x50, 0x49, 0x89, 0xFE, 0x48}, true},
+		{{0x55, 0x48, 0x89, 0xE5, 0x48, 0x8D, 0x05, 0x10, 0x20, 0x30, 0x00, 0x48, 0x89, 0x07}, true}, // lea rax, [rip+vtable]
+		{{0x31, 0xC0, 0xC3, 0x90, 0x90, 0x55, 0x48, 0x89, 0xE5}, false},                               // xor eax, eax; ret
+		{{0x48, 0x8B, 0x07, 0xFF, 0x60, 0x10, 0xCC, 0xCC}, false},                                     // jmp [rax+0x10]
+		{{0xE9, 0x00, 0x10, 0x00, 0x00, 0x55}, false},                                                 // jmp rel32
+		{{0x55, 0x48, 0x89, 0xE5, 0x0F, 0x0B, 0x55}, false},                                           // ud2
+		{{0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xEC, 0x10, 0x74, 0x02, 0x31, 0xC0, 0xFF, 0xE0}, true},  // jmp rax ends at 14 bytes
+		{{0x55, 0x48, 0x89, 0xE5, 0xFF, 0x50, 0x08, 0x5D, 0xC3}, false},                               // call [rax+8]; pop rbp; ret
+		{{0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8, 0x48, 0x89, 0xC7, 0xFF, 0xE0}, true},                    // jmp rax crosses 14 bytes
+		{{0x48, 0xB8, 1, 2, 3, 4, 5, 6, 7, 8, 0xFF, 0xE0}, false},                                     // jmp rax ends at 12 bytes
+	};
+
+	for (auto &prologue : prologues) {
+		std::vector<uint8_t> code(prologue.code);
+		code.resize(64, 0xCC);
+		bool linear = Disassembler::isLinearCode(reinterpret_cast<mach_vm_address_t>(code.data()), 14);
+		if (linear != prologue.linear) {
+			failures++;
+			fprintf(stderr, "linear code %d instead of %d for %02X %02X %02X\n", linear, prologue.linear,
+				code[0], code[1], code[2]);
+		}
+	}
+}
+
+/**
+ *  Random instruction streams biased towards prefixes and common opcodes
+ */
+static void testRandom() {
+	static const uint8_t common[] {0x0F, 0x40, 0x41, 0x44, 0x48, 0x49, 0x4C, 0x4D, 0x66, 0xF2, 0xF3, 0x89, 0x8B, 0x8D, 0x83, 0x81, 0xF6, 0xF7, 0xFF, 0xC7};
+
+	std::mt19937_64 rng(30);
+	std::vector<uint8_t> code(64);
+	for (size_t it = 0; it < 2000000; it++) {
+		for (auto &c : code)
+			c = rng() % 3 == 0 ? common[rng() % sizeof(common)] : static_cast<uint8_t>(rng());
+		compareWithHDE(code.data());
+	}
+}
+
+/**
+ *  Every instruction of a binary region, e.g. kernel __text
+ */
+static bool testFile(const char *path, long off, long size) {
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+
+	std::vector<uint8_t> buf(size + 32);
+	bool ok = fseek(fp, off, SEEK_SET) == 0 && fread(buf.data(), 1, size, fp) == static_cast<size_t>(size);
+	fclose(fp);
+
+	for (long i = 0; ok && i < size; )
+		i += compareWithHDE(&buf[i]);
+
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if (cs_open(CS_ARCH_X86, CS_MODE_64, &capstone) != CS_ERR_OK) {
+		fprintf(stderr, "failed to open capstone\n");
+		return 1;
+	}
+
+	testPrologues();
+	testLinearCode();
+	testRandom();
+
+	if (argc == 4 && !testFile(argv[1], strtol(argv[2], nullptr, 0), strtol(argv[3], nullptr, 0))) {
+		fprintf(stderr, "failed to read %s\n", argv[1]);
+		return 1;
+	}
+
+	cs_close(&capstone);
+
+	printf("capstone decoded %zu instructions, %zu of them differently from HDE\n", capstoneDecoded, capstoneHDEMismatches);
+
+	if (failures > 0) {
+		fprintf(stderr, "%zu instructions mismatched\n", failures);
+		return 1;
+	}
+
+	printf("all instruction lengths match HDE and capstone\n");
+	return 0;
+}
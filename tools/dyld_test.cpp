@@ -0,0 +1,435 @@
+//
+//  dyld_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_dyld.hpp>
+
+#include <mach-o/loader.h>
+#include <sys/param.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+static size_t failures {0};
+
+#define CHECK(cond, fmt, ...)                                                            \
+	do {                                                                                 \
+		if (!(cond)) {                                                                   \
+			failures++;                                                                  \
+			fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__, #cond, ## __VA_ARGS__); \
+		}                                                                                \
+	} while (0)
+
+using Files = std::map<std::string, std::vector<uint8_t>>;
+
+/**
+ *  In-memory cache files served through DyldCache::Reader
+ */
+struct Storage {
+	Files files;
+	size_t opened {0};
+	size_t closed {0};
+	size_t reads {0};
+	size_t failReadsAfter {SIZE_MAX};
+};
+
+static void *openFile(const char *path, void *user) {
+	auto storage = static_cast<Storage *>(user);
+	auto it = storage->files.find(path);
+	if (it == storage->files.end())
+		return nullptr;
+	storage->opened++;
+	return &it->second;
+}
+
+static int readFile(void *file, void *buffer, off_t off, size_t size, void *user) {
+	auto storage = static_cast<Storage *>(user);
+	auto data = static_cast<std::vector<uint8_t> *>(file);
+	if (storage->reads++ >= storage->failReadsAfter)
+		return EIO;
+	if (off < 0 || static_cast<size_t>(off) > data->size() || size > data->size() - static_cast<size_t>(off))
+		return EIO;
+	memcpy(buffer, data->data() + off, size);
+	return 0;
+}
+
+static void closeFile(void *, void *user) {
+	static_cast<Storage *>(user)->closed++;
+}
+
+static DyldCache::Reader makeReader(Storage &storage) {
+	return {openFile, readFile, closeFile, &storage};
+}
+
+/**
+ *  Cache file under construction
+ */
+struct Blob {
+	std::vector<uint8_t> data;
+
+	void put(size_t off, const void *src, size_t size) {
+		if (data.size() < off + size)
+			data.resize(off + size);
+		memcpy(data.data() + off, src, size);
+	}
+
+	template <typename T>
+	void put(size_t off, const T &value) {
+		put(off, &value, sizeof(T));
+	}
+};
+
+/**
+ *  Cache header variants
+ */
+enum class Layout {
+	// Single file with the images table in imagesOffsetOld.
+	Legacy,
+	// 12.x split cache: subcache array without suffixes, files named .1, .2.
+	SplitNumbered,
+	// 13.x and newer: subcache array with suffixes and the images table in imagesOffset.
+	SplitSuffixed
+};
+
+static constexpr uint64_t CacheBase     {0x7FF800000000ULL};
+static constexpr uint64_t FileSpan      {0x100000};
+static constexpr size_t ImageSlot       {0x1000};
+static constexpr size_t ImagesArea      {0x8000};
+static constexpr size_t PathsArea       {0x10000};
+
+/**
+ *  Expected segments of an image in the synthetic cache
+ */
+struct Expected {
+	std::string path;
+	uint64_t text, textSize;
+	uint64_t data, dataSize;
+	bool present;
+};
+
+/**
+ *  Write a cache image mach header with __TEXT, __DATA_CONST, __DATA and __LINKEDIT segments
+ */
+static void putImage(Blob &blob, size_t off, const Expected &image) {
+	const char *names[] = {"__TEXT", "__DATA_CONST", "__DATA", "__LINKEDIT"};
+	uint64_t addrs[] = {image.text, image.data, image.data + image.dataSize, image.data + image.dataSize + 0x4000};
+	uint64_t sizes[] = {image.textSize, image.dataSize, 0x4000, 0x1000};
+
+	mach_header_64 header {};
+	header.magic = MH_MAGIC_64;
+	header.filetype = MH_DYLIB;
+	header.ncmds = arrsize(names);
+	header.sizeofcmds = header.ncmds * sizeof(segment_command_64);
+	blob.put(off, header);
+
+	for (size_t i = 0; i < arrsize(names); i++) {
+		segment_command_64 seg {};
+		seg.cmd = LC_SEGMENT_64;
+		seg.cmdsize = sizeof(seg);
+		strncpy(seg.segname, names[i], sizeof(seg.segname) - 1);
+		seg.vmaddr = addrs[i];
+		seg.vmsize = sizes[i];
+		blob.put(off + sizeof(header) + i * sizeof(seg), seg);
+	}
+}
+
+static void putHeader(Blob &blob, uint32_t mappingOffset, uint64_t address) {
+	DyldCache::Header header {};
+	memcpy(header.magic, "dyld_v1  x86_64h", sizeof(header.magic));
+	header.mappingOffset = mappingOffset;
+	header.mappingCount = 1;
+	// Older headers end before mappingOffset, the rest of the structure overlaps the mappings.
+	blob.put(0, &header, mappingOffset < sizeof(header) ? mappingOffset : sizeof(header));
+
+	DyldCache::Mapping mapping {address, FileSpan, 0, VM_PROT_READ, VM_PROT_READ};
+	blob.put(mappingOffset, mapping);
+}
+
+/**
+ *  Build a cache with images spread over the main cache and its subcaches
+ *
+ *  @param layout     header variant
+ *  @param path       main cache path
+ *  @param images     images to store, their addresses are assigned here
+ *  @param subCaches  amount of subcache files, ignored for Legacy
+ *  @param pathPad    bytes left after the last path in the main file
+ *  @param inMain     store images in the main file as well as in the subcaches
+ *
+ *  @return cache files
+ */
+static Files buildCache(Layout layout, const std::string &path, std::vector<Expected> &images, size_t subCaches, size_t pathPad, bool inMain = true) {
+	uint32_t mappingOffset = 0x98;
+	if (layout == Layout::SplitNumbered)
+		mappingOffset = 0x1B0;
+	else if (layout == Layout::SplitSuffixed)
+		mappingOffset = 0x200;
+	if (layout == Layout::Legacy)
+		subCaches = 0;
+
+	std::vector<Blob> blobs(subCaches + 1);
+	for (size_t i = 0; i <= subCaches; i++)
+		putHeader(blobs[i], i == 0 ? mappingOffset : 0x20, CacheBase + i * FileSpan);
+
+	// Images are placed round-robin into the files after the main file tables.
+	size_t imagesOff = 0x1000;
+	size_t pathsOff = imagesOff + ImagesArea;
+	size_t firstImage = pathsOff + PathsArea;
+	std::vector<size_t> nextSlot(subCaches + 1, firstImage);
+	size_t pathOff = pathsOff;
+
+	for (size_t i = 0; i < images.size(); i++) {
+		auto &image = images[i];
+		size_t file = inMain || subCaches == 0 ? i % (subCaches + 1) : 1 + i % subCaches;
+		size_t slot = nextSlot[file];
+		nextSlot[file] += ImageSlot;
+		uint64_t address = CacheBase + file * FileSpan + slot;
+		image.text = address;
+		image.textSize = 0x3000 + i * 0x10;
+		image.data = 0x7FF900000000ULL + i * 0x100000;
+		image.dataSize = 0x2000 + i * 0x20;
+
+		DyldCache::Image entry {};
+		entry.address = address;
+		entry.pathFileOffset = static_cast<uint32_t>(pathOff);
+		blobs[0].put(imagesOff + i * sizeof(entry), entry);
+		blobs[0].put(pathOff, image.path.c_str(), image.path.size() + 1);
+		pathOff += image.path.size() + 1;
+
+		putImage(blobs[file], slot, image);
+	}
+
+	auto &main = blobs[0];
+	auto count = static_cast<uint32_t>(images.size());
+	if (layout == Layout::SplitSuffixed) {
+		main.put(offsetof(DyldCache::Header, imagesOffset), static_cast<uint32_t>(imagesOff));
+		main.put(offsetof(DyldCache::Header, imagesCount), count);
+	} else {
+		main.put(offsetof(DyldCache::Header, imagesOffsetOld), static_cast<uint32_t>(imagesOff));
+		main.put(offsetof(DyldCache::Header, imagesCountOld), count);
+	}
+
+	Files files;
+	if (layout != Layout::Legacy) {
+		size_t arrayOff = 0x800;
+		main.put(offsetof(DyldCache::Header, subCacheArrayOffset), static_cast<uint32_t>(arrayOff));
+		main.put(offsetof(DyldCache::Header, subCacheArrayCount), static_cast<uint32_t>(subCaches));
+		size_t entrySize = layout == Layout::SplitSuffixed ? sizeof(DyldCache::SubCache) : offsetof(DyldCache::SubCache, fileSuffix);
+		for (size_t i = 0; i < subCaches; i++) {
+			DyldCache::SubCache sub {};
+			sub.cacheVMOffset = (i + 1) * FileSpan;
+			char suffix[32];
+			if (layout == Layout::SplitSuffixed)
+				snprintf(suffix, sizeof(suffix), ".%02zu", i + 1);
+			else
+				snprintf(suffix, sizeof(suffix), ".%zu", i + 1);
+			strncpy(sub.fileSuffix, suffix, sizeof(sub.fileSuffix));
+			main.put(arrayOff + i * entrySize, &sub, entrySize);
+			files[path + suffix] = std::move(blobs[i + 1].data);
+		}
+	}
+
+	// Pad the main file so that it ends right after the paths when there are no images in it.
+	if (main.data.size() < pathOff + pathPad)
+		main.data.resize(pathOff + pathPad);
+	files[path] = std::move(main.data);
+	return files;
+}
+
+static std::vector<Expected> makeImages(size_t count, size_t pathLength = 0) {
+	std::vector<Expected> images;
+	for (size_t i = 0; i < count; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "/System/Library/Frameworks/Image%03zu.framework/Image%03zu", i, i);
+		std::string path = name;
+		if (path.size() < pathLength)
+			path += std::string(pathLength - path.size(), 'x');
+		images.push_back({path, 0, 0, 0, 0, true});
+	}
+	return images;
+}
+
+static std::vector<DyldCache::MapEntry> makeEntries(const std::vector<std::string> &paths) {
+	std::vector<DyldCache::MapEntry> entries;
+	for (auto &path : paths)
+		entries.push_back({path.c_str(), path.size(), 0, 0, 0, 0, false});
+	return entries;
+}
+
+static void checkEntry(const DyldCache::MapEntry &entry, const Expected &image) {
+	CHECK(entry.mapped, "%s not mapped", image.path.c_str());
+	CHECK(entry.startTEXT == image.text && entry.endTEXT == image.text + image.textSize,
+		"%s TEXT %lX-%lX", image.path.c_str(), entry.startTEXT, entry.endTEXT);
+	CHECK(entry.startDATA == image.data && entry.endDATA == image.data + image.dataSize,
+		"%s DATA %lX-%lX", image.path.c_str(), entry.startDATA, entry.endDATA);
+}
+
+/**
+ *  Look up every other image plus a missing and a duplicated path in each layout
+ */
+static void testLayout(Layout layout, size_t subCaches) {
+	const std::string cachePath = "/cache/dyld_shared_cache_x86_64h";
+	auto images = makeImages(40);
+	Storage storage;
+	storage.files = buildCache(layout, cachePath, images, subCaches, 0x10000);
+	auto reader = makeReader(storage);
+
+	std::vector<std::string> paths;
+	std::vector<const Expected *> expected;
+	for (size_t i = 0; i < images.size(); i += 2) {
+		paths.push_back(images[i].path);
+		expected.push_back(&images[i]);
+	}
+	paths.push_back("/usr/lib/libmissing.dylib");
+	expected.push_back(nullptr);
+	paths.push_back(images[6].path);
+	expected.push_back(&images[6]);
+
+	auto entries = makeEntries(paths);
+	size_t nfound = 0;
+	CHECK(DyldCache::mapAddresses(reader, cachePath.c_str(), entries.data(), entries.size(), nfound), "layout %d", static_cast<int>(layout));
+	CHECK(nfound == entries.size() - 1, "layout %d found %zu of %zu", static_cast<int>(layout), nfound, entries.size());
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (expected[i])
+			checkEntry(entries[i], *expected[i]);
+		else
+			CHECK(!entries[i].mapped && !entries[i].startTEXT, "missing image mapped");
+	}
+	CHECK(storage.opened == storage.closed, "opened %zu closed %zu", storage.opened, storage.closed);
+}
+
+/**
+ *  Paths crossing the read window boundary and a path near the end of file
+ */
+static void testPathWindow() {
+	const std::string cachePath = "/cache/window";
+	// 200 paths of 120 bytes do not fit into a single 16 KB window.
+	auto images = makeImages(200, 120);
+	Storage storage;
+	// Legacy cache keeps all the images in the main file, so the paths are followed by images.
+	storage.files = buildCache(Layout::Legacy, cachePath, images, 0, 0);
+	auto reader = makeReader(storage);
+
+	std::vector<std::string> paths;
+	for (auto &image : images)
+		paths.push_back(image.path);
+	auto entries = makeEntries(paths);
+	size_t nfound = 0;
+	CHECK(DyldCache::mapAddresses(reader, cachePath.c_str(), entries.data(), entries.size(), nfound), "window");
+	CHECK(nfound == images.size(), "window found %zu", nfound);
+	for (size_t i = 0; i < entries.size(); i++)
+		checkEntry(entries[i], images[i]);
+
+	// Split cache main file ending shortly after the last path, the full window read fails.
+	images = makeImages(3);
+	storage.files = buildCache(Layout::SplitSuffixed, cachePath, images, 3, MAXPATHLEN, false);
+	paths = {images[1].path, images[2].path};
+	entries = makeEntries(paths);
+	CHECK(DyldCache::mapAddresses(reader, cachePath.c_str(), entries.data(), entries.size(), nfound), "short window");
+	CHECK(nfound == 2, "short window found %zu", nfound);
+	checkEntry(entries[0], images[1]);
+	checkEntry(entries[1], images[2]);
+
+	CHECK(DyldCache::hasPathInWindow("abc", 4), "terminated path");
+	CHECK(!DyldCache::hasPathInWindow("abcd", 4), "cut path");
+	CHECK(!DyldCache::hasPathInWindow("", 0), "empty window");
+}
+
+/**
+ *  Corrupted, truncated and missing input
+ */
+static void testCorrupt() {
+	const std::string cachePath = "/cache/corrupt";
+	auto images = makeImages(8);
+	auto pristine = buildCache(Layout::SplitSuffixed, cachePath, images, 2, 0x1000);
+
+	std::vector<std::string> paths;
+	for (auto &image : images)
+		paths.push_back(image.path);
+
+	auto run = [&](Storage &storage, size_t &nfound) {
+		auto reader = makeReader(storage);
+		auto entries = makeEntries(paths);
+		bool res = DyldCache::mapAddresses(reader, cachePath.c_str(), entries.data(), entries.size(), nfound);
+		size_t mapped = 0;
+		for (size_t i = 0; i < entries.size(); i++) {
+			if (entries[i].mapped) {
+				checkEntry(entries[i], images[i]);
+				mapped++;
+			}
+		}
+		CHECK(mapped == nfound, "mapped %zu found %zu", mapped, nfound);
+		CHECK(storage.opened == storage.closed, "opened %zu closed %zu", storage.opened, storage.closed);
+		return res;
+	};
+
+	size_t nfound = 0;
+	Storage storage;
+	CHECK(!run(storage, nfound) && nfound == 0, "no cache");
+
+	storage.files = pristine;
+	storage.files[cachePath][0] = 'x';
+	CHECK(!run(storage, nfound) && nfound == 0, "bad magic");
+
+	// Truncated right inside the images table.
+	storage.files = pristine;
+	storage.files[cachePath].resize(0x1000 + sizeof(DyldCache::Image) * 3);
+	CHECK(!run(storage, nfound) && nfound == 0, "truncated images");
+
+	// A missing subcache only loses its own images.
+	storage.files = pristine;
+	storage.files.erase(cachePath + ".02");
+	CHECK(run(storage, nfound) && nfound == 6, "missing subcache found %zu", nfound);
+
+	// Corrupted image headers and load commands.
+	storage.files = pristine;
+	auto &sub = storage.files[cachePath + ".01"];
+	size_t slot = images[1].text - CacheBase - FileSpan;
+	sub[slot] ^= 0xFF;
+	slot = images[4].text - CacheBase - FileSpan;
+	reinterpret_cast<mach_header_64 *>(&sub[slot])->sizeofcmds = DyldCache::MaxCommands + 1;
+	slot = images[7].text - CacheBase - FileSpan;
+	reinterpret_cast<segment_command_64 *>(&sub[slot + sizeof(mach_header_64)])->cmdsize = 0;
+	CHECK(run(storage, nfound) && nfound == 5, "corrupt images found %zu", nfound);
+
+	// Image address outside of every mapping.
+	storage.files = pristine;
+	reinterpret_cast<DyldCache::Image *>(&storage.files[cachePath][0x1000])[0].address = 0x1000;
+	CHECK(run(storage, nfound) && nfound == 7, "unmapped address found %zu", nfound);
+
+	// Read failures at every step must not leak or crash.
+	for (size_t fail = 0; fail < 40; fail++) {
+		storage.files = pristine;
+		storage.reads = 0;
+		storage.failReadsAfter = fail;
+		run(storage, nfound);
+	}
+	storage.failReadsAfter = SIZE_MAX;
+
+	DyldCache::MapEntry entry {};
+	auto reader = makeReader(storage);
+	CHECK(!DyldCache::mapAddresses(reader, cachePath.c_str(), &entry, 0, nfound), "no entries");
+	CHECK(!DyldCache::mapAddresses(reader, nullptr, &entry, 1, nfound), "no path");
+}
+
+int main() {
+	CHECK(DyldCache::hashPath("/usr/lib/libc.dylib", 19) != DyldCache::hashPath("/usr/lib/libd.dylib", 19), "hash");
+
+	testLayout(Layout::Legacy, 0);
+	testLayout(Layout::SplitNumbered, 1);
+	testLayout(Layout::SplitNumbered, 3);
+	testLayout(Layout::SplitSuffixed, 4);
+	testPathWindow();
+	testCorrupt();
+
+	if (failures) {
+		fprintf(stderr, "%zu failures\n", failures);
+		return 1;
+	}
+
+	printf("all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,124 @@
+//
+//  inflate_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_compression.hpp>
+
+#include <zlib.h>
+
+#include <chrono>
+
+#include "corpus.hpp"
+
+/**
+ *  Equally sized zlib streams with their original contents
+ */
+struct Workload {
+	const char *name;
+	size_t blockSize;
+	std::vector<std::vector<uint8_t>> plain;
+	std::vector<std::vector<uint8_t>> packed;
+};
+
+static Workload makeWorkload(const char *name, size_t blockSize, size_t totalSize, std::mt19937_64 &rng) {
+	Workload w {name, blockSize, {}, {}};
+	for (size_t i = 0; i < totalSize / blockSize; i++) {
+		auto kind = static_cast<Corpus::Kind>(i % Corpus::KindRandom);
+		w.plain.push_back(Corpus::generate(kind, blockSize, rng));
+		uLongf size = compressBound(blockSize);
+		std::vector<uint8_t> out(size);
+		compress2(out.data(), &size, w.plain.back().data(), blockSize, Z_DEFAULT_COMPRESSION);
+		out.resize(size);
+		w.packed.push_back(out);
+	}
+	return w;
+}
+
+/**
+ *  Decompress every stream of the workload and report the throughput
+ */
+template <typename F>
+static bool run(const Workload &w, const char *method, size_t repetitions, F func) {
+	std::vector<uint8_t> out(w.blockSize);
+	size_t total = 0;
+	bool ok = true;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repetitions; r++) {
+		for (size_t i = 0; i < w.packed.size(); i++) {
+			uint32_t size = static_cast<uint32_t>(w.blockSize);
+			ok &= func(out.data(), size, w.packed[i]) && size == w.blockSize;
+			total += size;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Only verify outside of the timed loop.
+	for (size_t i = 0; ok && i < w.packed.size(); i++) {
+		uint32_t size = static_cast<uint32_t>(w.blockSize);
+		ok = func(out.data(), size, w.packed[i]) && out == w.plain[i];
+	}
+
+	if (!ok) {
+		fprintf(stderr, "%s failed for %s\n", method, w.name);
+		return false;
+	}
+
+	printf("%-12s %8zu %8zu %-12s %10.1f %10.2f\n", w.name, w.blockSize, w.packed.size(), method,
+		total / 1e6 / seconds, seconds * 1e6 / (repetitions * w.packed.size()));
+	return true;
+}
+
+static bool benchWorkload(const Workload &w, size_t repetitions) {
+	bool ok = true;
+
+	ok &= run(w, "temporary", repetitions, [](uint8_t *dst, uint32_t &size, const std::vector<uint8_t> &src) {
+		Compression::Inflate inflater;
+		bool res = inflater.init() && inflater.decompress(dst, size, src.data(), static_cast<uint32_t>(src.size()));
+		inflater.deinit();
+		return res;
+	});
+
+	Compression::Inflate reused;
+	ok &= reused.init();
+	ok &= run(w, "reused", repetitions, [&reused](uint8_t *dst, uint32_t &size, const std::vector<uint8_t> &src) {
+		return reused.decompress(dst, size, src.data(), static_cast<uint32_t>(src.size()));
+	});
+	reused.deinit();
+
+	ok &= run(w, "decompress", repetitions, [](uint8_t *dst, uint32_t &size, const std::vector<uint8_t> &src) {
+		return Compression::decompress(Compression::ModeZLIB, &size, src.data(), static_cast<uint32_t>(src.size()), dst) != nullptr;
+	});
+
+	ok &= run(w, "zlib", repetitions, [](uint8_t *dst, uint32_t &size, const std::vector<uint8_t> &src) {
+		uLongf len = size;
+		bool res = uncompress(dst, &len, src.data(), src.size()) == Z_OK;
+		size = static_cast<uint32_t>(len);
+		return res;
+	});
+
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	size_t repetitions = argc > 1 ? strtoul(argv[1], nullptr, 0) : 5;
+	if (repetitions == 0)
+		repetitions = 1;
+
+	std::mt19937_64 rng(48);
+	static constexpr size_t TotalSize = 16*1024*1024;
+	Workload workloads[] {
+		makeWorkload("many-small", 4096, TotalSize, rng),
+		makeWorkload("few-large", 4*1024*1024, TotalSize, rng),
+	};
+
+	printf("%-12s %8s %8s %-12s %10s %10s\n", "workload", "block", "count", "method", "MB/s", "us/call");
+	bool ok = true;
+	for (auto &w : workloads)
+		ok &= benchWorkload(w, repetitions);
+
+	return ok ? 0 : 1;
+}
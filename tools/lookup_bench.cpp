@@ -0,0 +1,193 @@
+//
+//  lookup_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_lookup.hpp>
+
+#include <chrono>
+
+#include "corpus.hpp"
+
+/**
+ *  Pages generated from the corpus, code, text and sparse pages alternate
+ */
+struct Pages {
+	std::vector<uint8_t> data;
+	std::vector<const uint8_t *> ptrs;
+};
+
+static Pages makePages(size_t count, std::mt19937_64 &rng) {
+	Pages pages;
+	pages.data.reserve(count * PAGE_SIZE);
+	for (size_t i = 0; i < count; i++) {
+		auto page = Corpus::generate(static_cast<Corpus::Kind>(i % Corpus::KindRandom), PAGE_SIZE, rng);
+		pages.data.insert(pages.data.end(), page.begin(), page.end());
+	}
+	for (size_t i = 0; i < count; i++)
+		pages.ptrs.push_back(pages.data.data() + i * PAGE_SIZE);
+	return pages;
+}
+
+/**
+ *  Lookup statistics of a replay
+ */
+struct Stats {
+	size_t pages {0};
+	size_t filtered {0};
+	size_t slots {0};
+	size_t candidates {0};
+	size_t found {0};
+};
+
+/**
+ *  Index size PageLookup chooses for the amount of pages, used to count probed slots
+ */
+static size_t indexMask(size_t num) {
+	size_t size = PageLookup::MinIndexSize;
+	while (size < num * 2)
+		size *= 2;
+	return size - 1;
+}
+
+/**
+ *  Look up a page the way UserPatcher::performPagePatch and patchLookupPage do,
+ *  comparing page contents in place of the digest check
+ *
+ *  @return matching page index or lookup size
+ */
+static size_t findHashed(const PageLookup &lookup, const Pages &pages, const uint8_t *page, size_t mask, Stats &stats) {
+	uint64_t value = lookup.key(page);
+	stats.pages++;
+	if (!lookup.mayContain(value))
+		return lookup.size();
+
+	stats.filtered++;
+	size_t start = PageLookup::hash(value) & mask;
+	size_t slot = start;
+	size_t p;
+	while ((p = lookup.findCandidate(value, slot)) < lookup.size()) {
+		stats.candidates++;
+		if (lookup.matchCandidate(page, p) && !memcmp(page, pages.ptrs[p], PAGE_SIZE))
+			break;
+	}
+
+	// A hit stops right after the matching slot, a miss at the empty slot ending the probe sequence.
+	stats.slots += p < lookup.size() ? ((slot - start) & mask) : ((slot - start) & mask) + 1;
+	if (p < lookup.size())
+		stats.found++;
+	return p;
+}
+
+/**
+ *  Linear c[0] scan like performPagePatch before the hashed index, trying every candidate
+ */
+static size_t findLinear(const PageLookup &lookup, const Pages &pages, const uint8_t *page) {
+	size_t sz = lookup.size();
+	uint64_t value = *reinterpret_cast<const uint64_t *>(page + lookup.offs[0]);
+	for (size_t p = 0; p < sz; p++) {
+		if (lookup.c[0][p] == value && lookup.matchCandidate(page, p) && !memcmp(page, pages.ptrs[p], PAGE_SIZE))
+			return p;
+	}
+	return sz;
+}
+
+/**
+ *  First stored page with the same contents, found by comparing every page
+ */
+static size_t findReference(const Pages &pages, const uint8_t *page) {
+	for (size_t p = 0; p < pages.ptrs.size(); p++) {
+		if (!memcmp(page, pages.ptrs[p], PAGE_SIZE))
+			return p;
+	}
+	return pages.ptrs.size();
+}
+
+/**
+ *  Replay random pages against a lookup of the given size
+ *
+ *  @param stored    amount of pages in the lookup
+ *  @param foreign   pool of pages which are not in the lookup
+ *  @param replay    amount of pages to look up
+ *  @param rng       random generator
+ *
+ *  @return false on lookup errors
+ */
+static bool bench(size_t stored, const Pages &foreign, size_t replay, std::mt19937_64 &rng) {
+	auto pages = makePages(stored, rng);
+	PageLookup lookup;
+	if (!lookup.init(pages.ptrs.data(), stored)) {
+		fprintf(stderr, "failed to init lookup of %zu pages\n", stored);
+		return false;
+	}
+
+	bool ok = true;
+	size_t mask = indexMask(stored);
+
+	// Pages sharing all four fingerprints are common, every lookup must still find the first identical page.
+	Stats storedStats, foreignStats;
+	for (size_t i = 0; i < stored; i++) {
+		size_t expected = findReference(pages, pages.ptrs[i]);
+		size_t p = findHashed(lookup, pages, pages.ptrs[i], mask, storedStats);
+		if (p != expected || findLinear(lookup, pages, pages.ptrs[i]) != expected) {
+			fprintf(stderr, "stored page %zu of %zu found as %zu instead of %zu\n", i, stored, p, expected);
+			ok = false;
+		}
+	}
+	for (auto page : foreign.ptrs) {
+		size_t expected = findReference(pages, page);
+		if (findHashed(lookup, pages, page, mask, foreignStats) != expected || findLinear(lookup, pages, page) != expected) {
+			fprintf(stderr, "foreign page mismatch in %zu pages\n", stored);
+			ok = false;
+		}
+	}
+
+	// Page-in traffic is mostly foreign, one in 16 pages belongs to a patched image.
+	std::vector<const uint8_t *> order(replay);
+	for (auto &page : order)
+		page = rng() % 16 == 0 ? pages.ptrs[rng() % stored] : foreign.ptrs[rng() % foreign.ptrs.size()];
+
+	Stats replayStats;
+	size_t hashedFound = 0, linearFound = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (auto page : order)
+		hashedFound += findHashed(lookup, pages, page, mask, replayStats) < stored;
+	double hashed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (auto page : order)
+		linearFound += findLinear(lookup, pages, page) < stored;
+	double linear = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ok &= hashedFound == linearFound;
+
+	auto perPage = [](size_t v, size_t n) { return n ? static_cast<double>(v) / n : 0.0; };
+	printf("%8zu %12.2f %12.2f %12.2f %12.3f %12.1f %12.1f\n", stored,
+		perPage(storedStats.slots, storedStats.pages),
+		perPage(storedStats.candidates, storedStats.pages),
+		perPage(foreignStats.filtered * 100, foreignStats.pages),
+		perPage(foreignStats.slots, foreignStats.pages),
+		hashed * 1e9 / replay, linear * 1e9 / replay);
+
+	lookup.deinit();
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10;
+	if (scale == 0)
+		scale = 1;
+
+	std::mt19937_64 rng(31);
+	auto foreign = makePages(1024 * scale, rng);
+
+	printf("%8s %12s %12s %12s %12s %12s %12s\n", "pages", "hit slots", "hit cands", "miss pass %", "miss slots", "hashed ns", "linear ns");
+
+	bool ok = true;
+	for (size_t stored : {10, 100, 1000, 10000})
+		ok &= bench(stored, foreign, 20000 * scale, rng);
+
+	return ok ? 0 : 1;
+}
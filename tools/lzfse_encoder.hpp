@@ -0,0 +1,442 @@
+//
+//  lzfse_encoder.hpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef lzfse_encoder_hpp
+#define lzfse_encoder_hpp
+
+#include <lzvn.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+/**
+ *  Host lzfse block writer following the reference lzfse encoder (lzfse_encode_base.c, lzfse_fse.c):
+ *  FSE tables, backward bit stream, v2 header packing and its frequency prefix code.
+ *  Lilu only decodes lzfse, this writer produces test vectors and benchmark input.
+ */
+namespace LZFSEEncoder {
+	/**
+	 *  Block kinds written by the reference encoder
+	 */
+	enum BlockType {
+		BlockV2,    // bvx2, FSE compressed literals and L, M, D values
+		BlockLZVN,  // bvxn, lzvn payload
+		BlockRaw,   // bvx-, stored data
+	};
+
+	static constexpr uint32_t MagicEnd  {0x24787662}; // bvx$
+	static constexpr uint32_t MagicRaw  {0x2d787662}; // bvx-
+	static constexpr uint32_t MagicV2   {0x32787662}; // bvx2
+	static constexpr uint32_t MagicLZVN {0x6e787662}; // bvxn
+
+	static constexpr size_t LSymbols {20}, MSymbols {20}, DSymbols {64}, LiteralSymbols {256};
+	static constexpr size_t LStates {64}, MStates {64}, DStates {256}, LiteralStates {1024};
+	static constexpr size_t MatchesPerBlock {10000};
+	static constexpr size_t LiteralsPerBlock {4 * MatchesPerBlock};
+	static constexpr uint32_t MaxL {315}, MaxM {2359}, MaxD {262139};
+
+	static const uint8_t lExtraBits[LSymbols] {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 5, 8};
+	static const uint32_t lBaseValue[LSymbols] {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 20, 28, 60};
+	static const uint8_t mExtraBits[MSymbols] {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 5, 8, 11};
+	static const uint32_t mBaseValue[MSymbols] {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 24, 56, 312};
+	static const uint8_t dExtraBits[DSymbols] {
+		0,  0,  0,  0,  1,  1,  1,  1,  2,  2,  2,  2,  3,  3,  3,  3,
+		4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,  6,  7,  7,  7,  7,
+		8,  8,  8,  8,  9,  9,  9,  9,  10, 10, 10, 10, 11, 11, 11, 11,
+		12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+	};
+	static const uint32_t dBaseValue[DSymbols] {
+		0,      1,      2,      3,     4,     6,     8,     10,    12,    16,
+		20,     24,     28,     36,    44,    52,    60,    76,    92,    108,
+		124,    156,    188,    220,   252,   316,   380,   444,   508,   636,
+		764,    892,    1020,   1276,  1532,  1788,  2044,  2556,  3068,  3580,
+		4092,   5116,   6140,   7164,  8188,  10236, 12284, 14332, 16380, 20476,
+		24572,  28668,  32764,  40956, 49148, 57340, 65532, 81916, 98300, 114684,
+		131068, 163836, 196604, 229372
+	};
+
+	/**
+	 *  Forward bit writer, the decoder reads the bits back from the end of the payload
+	 */
+	struct OutStream {
+		std::vector<uint8_t> &buf;
+		uint64_t accum {0};
+		int nbits {0};
+
+		explicit OutStream(std::vector<uint8_t> &b) : buf(b) {}
+
+		void push(int n, uint64_t bits) {
+			accum |= bits << nbits;
+			nbits += n;
+		}
+
+		void flush() {
+			int n = nbits & -8;
+			for (int i = 0; i < n; i += 8)
+				buf.push_back(static_cast<uint8_t>(accum >> i));
+			accum = n < 64 ? accum >> n : 0;
+			nbits -= n;
+		}
+
+		/**
+		 *  Emit the last partial byte
+		 *
+		 *  @return negated amount of unused bits in the last byte as stored in the block header
+		 */
+		int finish() {
+			int n = (nbits + 7) & -8;
+			for (int i = 0; i < n; i += 8)
+				buf.push_back(static_cast<uint8_t>(accum >> i));
+			int result = nbits - n;
+			accum = 0;
+			nbits = 0;
+			return result;
+		}
+	};
+
+	/**
+	 *  Encoder entry of a symbol, see fse_init_encoder_table
+	 */
+	struct EncoderEntry {
+		int s0 {0};
+		int k {0};
+		int delta0 {0};
+		int delta1 {0};
+	};
+
+	/**
+	 *  Scale symbol counts to frequencies summing to the state count, every used symbol keeps at least one state
+	 */
+	inline void normalize(size_t nstates, size_t nsymbols, const uint32_t *counts, uint16_t *freq) {
+		uint64_t total = 0;
+		for (size_t i = 0; i < nsymbols; i++)
+			total += counts[i];
+
+		memset(freq, 0, nsymbols * sizeof(uint16_t));
+		if (total == 0)
+			return;
+
+		int64_t remaining = static_cast<int64_t>(nstates);
+		for (size_t i = 0; i < nsymbols; i++) {
+			if (counts[i] == 0)
+				continue;
+			uint64_t f = (static_cast<uint64_t>(counts[i]) * nstates + total / 2) / total;
+			freq[i] = static_cast<uint16_t>(f > 0 ? f : 1);
+			remaining -= freq[i];
+		}
+
+		// Hand the rounding error to the most frequent symbols.
+		while (remaining != 0) {
+			size_t best = 0;
+			for (size_t i = 1; i < nsymbols; i++)
+				if (freq[i] > freq[best])
+					best = i;
+			if (remaining > 0) {
+				freq[best] += static_cast<uint16_t>(remaining);
+				remaining = 0;
+			} else {
+				int64_t take = freq[best] - 1 < -remaining ? freq[best] - 1 : -remaining;
+				freq[best] -= static_cast<uint16_t>(take);
+				remaining += take;
+				if (take == 0)
+					break;
+			}
+		}
+	}
+
+	inline void initEncoderTable(size_t nstates, size_t nsymbols, const uint16_t *freq, EncoderEntry *table) {
+		int offset = 0;
+		int nclz = __builtin_clz(static_cast<uint32_t>(nstates));
+		for (size_t i = 0; i < nsymbols; i++) {
+			int f = freq[i];
+			if (f == 0)
+				continue;
+			int k = __builtin_clz(static_cast<uint32_t>(f)) - nclz;
+			table[i].s0 = (f << k) - static_cast<int>(nstates);
+			table[i].k = k;
+			table[i].delta0 = offset - f + static_cast<int>(nstates >> k);
+			table[i].delta1 = k > 0 ? offset - f + static_cast<int>(nstates >> (k - 1)) : 0;
+			offset += f;
+		}
+	}
+
+	inline void encodeState(int &state, const EncoderEntry &e, OutStream &out) {
+		bool hi = state >= e.s0;
+		int nbits = hi ? e.k : e.k - 1;
+		out.push(nbits, static_cast<uint64_t>(state) & ((1ULL << nbits) - 1));
+		state = (hi ? e.delta0 : e.delta1) + (state >> nbits);
+	}
+
+	inline size_t valueSymbol(uint32_t value, const uint32_t *base, size_t nsymbols) {
+		size_t s = 0;
+		while (s + 1 < nsymbols && base[s + 1] <= value)
+			s++;
+		return s;
+	}
+
+	inline void encodeValue(int &state, const EncoderEntry *table, const uint8_t *extra, const uint32_t *base,
+							size_t nsymbols, uint32_t value, OutStream &out) {
+		size_t s = valueSymbol(value, base, nsymbols);
+		out.push(extra[s], value - base[s]);
+		encodeState(state, table[s], out);
+	}
+
+	/**
+	 *  Frequency prefix code, the inverse of lzfse_decode_v1_freq_value
+	 */
+	inline uint32_t freqCode(uint16_t value, int &nbits) {
+		static const uint8_t small[8][2] {{0x0, 2}, {0x2, 2}, {0x1, 3}, {0x5, 3}, {0x3, 5}, {0xB, 5}, {0x13, 5}, {0x1B, 5}};
+		if (value < 8) {
+			nbits = small[value][1];
+			return small[value][0];
+		}
+		if (value < 24) {
+			nbits = 8;
+			return 0x7 | ((value - 8U) << 4);
+		}
+		nbits = 14;
+		return 0xF | ((value - 24U) << 4);
+	}
+
+	/**
+	 *  Literal, match, and distance triple
+	 */
+	struct LMD {
+		uint32_t l, m, d;
+	};
+
+	/**
+	 *  Greedy hash match parse of one block, matches may reach into preceding blocks
+	 */
+	inline void parse(const uint8_t *base, size_t start, size_t end, std::vector<LMD> &lmds, std::vector<uint8_t> &literals) {
+		static constexpr size_t HashBits = 14;
+		std::vector<uint32_t> head(1U << HashBits, UINT32_MAX);
+		auto hash = [base](size_t p) {
+			uint32_t v;
+			memcpy(&v, base + p, sizeof(v));
+			return (v * 2654435761U) >> (32 - HashBits);
+		};
+
+		size_t histStart = start > MaxD ? start - MaxD : 0;
+		for (size_t p = histStart; p + 4 <= start; p++)
+			head[hash(p)] = static_cast<uint32_t>(p);
+
+		size_t pos = start, litStart = start;
+		uint32_t pendingL = 0;
+		auto emitLiterals = [&](size_t upto) {
+			while (litStart < upto) {
+				literals.push_back(base[litStart++]);
+				if (++pendingL == MaxL) {
+					lmds.push_back({pendingL, 0, 0});
+					pendingL = 0;
+				}
+			}
+		};
+
+		// Leave room for pending literals, which take one more triple per MaxL bytes.
+		auto full = [&]() {
+			size_t pending = pos - litStart;
+			return literals.size() + pending + 8 >= LiteralsPerBlock || lmds.size() + pending / MaxL + 3 >= MatchesPerBlock;
+		};
+
+		while (pos + 4 <= end && !full()) {
+			size_t h = hash(pos);
+			size_t cand = head[h];
+			head[h] = static_cast<uint32_t>(pos);
+			if (cand != UINT32_MAX && pos - cand <= MaxD && memcmp(base + cand, base + pos, 4) == 0) {
+				size_t m = 4;
+				while (pos + m < end && m < MaxM && base[cand + m] == base[pos + m])
+					m++;
+				emitLiterals(pos);
+				lmds.push_back({pendingL, static_cast<uint32_t>(m), static_cast<uint32_t>(pos - cand)});
+				pendingL = 0;
+				for (size_t i = 1; i < m && pos + i + 4 <= end; i++)
+					head[hash(pos + i)] = static_cast<uint32_t>(pos + i);
+				pos += m;
+				litStart = pos;
+			} else {
+				pos++;
+			}
+		}
+
+		emitLiterals(pos + 4 <= end ? pos : end);
+		if (pendingL > 0 || lmds.empty())
+			lmds.push_back({pendingL, 0, 0});
+	}
+
+	/**
+	 *  Encode a bvx2 block of base[start, end), matches may refer to base[0, start)
+	 *
+	 *  @return false when the data does not fit a single block
+	 */
+	inline bool encodeV2(const uint8_t *base, size_t start, size_t end, std::vector<uint8_t> &out, size_t &consumed) {
+		std::vector<LMD> lmds;
+		std::vector<uint8_t> literals;
+		parse(base, start, end, lmds, literals);
+
+		consumed = 0;
+		for (auto &lmd : lmds)
+			consumed += lmd.l + lmd.m;
+
+		// Repeated distances are stored as 0.
+		uint32_t prevD = 0;
+		for (auto &lmd : lmds) {
+			if (lmd.m == 0)
+				lmd.d = 0;
+			else if (lmd.d == prevD)
+				lmd.d = 0;
+			else
+				prevD = lmd.d;
+		}
+
+		while (literals.size() % 4 != 0)
+			literals.push_back(0);
+
+		uint32_t counts[LSymbols + MSymbols + DSymbols + LiteralSymbols] {};
+		uint32_t *lCounts = counts, *mCounts = lCounts + LSymbols, *dCounts = mCounts + MSymbols, *litCounts = dCounts + DSymbols;
+		for (auto &lmd : lmds) {
+			lCounts[valueSymbol(lmd.l, lBaseValue, LSymbols)]++;
+			mCounts[valueSymbol(lmd.m, mBaseValue, MSymbols)]++;
+			dCounts[valueSymbol(lmd.d, dBaseValue, DSymbols)]++;
+		}
+		for (auto c : literals)
+			litCounts[c]++;
+
+		uint16_t freq[LSymbols + MSymbols + DSymbols + LiteralSymbols];
+		uint16_t *lFreq = freq, *mFreq = lFreq + LSymbols, *dFreq = mFreq + MSymbols, *litFreq = dFreq + DSymbols;
+		normalize(LStates, LSymbols, lCounts, lFreq);
+		normalize(MStates, MSymbols, mCounts, mFreq);
+		normalize(DStates, DSymbols, dCounts, dFreq);
+		normalize(LiteralStates, LiteralSymbols, litCounts, litFreq);
+
+		EncoderEntry lTable[LSymbols], mTable[MSymbols], dTable[DSymbols], litTable[LiteralSymbols];
+		initEncoderTable(LStates, LSymbols, lFreq, lTable);
+		initEncoderTable(MStates, MSymbols, mFreq, mTable);
+		initEncoderTable(DStates, DSymbols, dFreq, dTable);
+		initEncoderTable(LiteralStates, LiteralSymbols, litFreq, litTable);
+
+		// Frequency table follows the fixed 32-byte header.
+		std::vector<uint8_t> header(32);
+		uint64_t accum = 0;
+		int accumBits = 0;
+		for (auto f : freq) {
+			int nbits;
+			accum |= static_cast<uint64_t>(freqCode(f, nbits)) << accumBits;
+			accumBits += nbits;
+			while (accumBits >= 8) {
+				header.push_back(static_cast<uint8_t>(accum));
+				accum >>= 8;
+				accumBits -= 8;
+			}
+		}
+		if (accumBits > 0)
+			header.push_back(static_cast<uint8_t>(accum));
+
+		// Payloads start with 8 zero bytes, so that the decoder can always load a full word.
+		std::vector<uint8_t> litPayload(8), lmdPayload(8);
+		int litState[4] {};
+		OutStream litOut(litPayload);
+		for (size_t i = literals.size(); i > 0; i -= 4) {
+			for (int j = 3; j >= 0; j--)
+				encodeState(litState[j], litTable[literals[i - 4 + j]], litOut);
+			litOut.flush();
+		}
+		int literalBits = litOut.finish();
+
+		int lState = 0, mState = 0, dState = 0;
+		OutStream lmdOut(lmdPayload);
+		for (size_t i = lmds.size(); i > 0; i--) {
+			auto &lmd = lmds[i - 1];
+			encodeValue(dState, dTable, dExtraBits, dBaseValue, DSymbols, lmd.d, lmdOut);
+			encodeValue(mState, mTable, mExtraBits, mBaseValue, MSymbols, lmd.m, lmdOut);
+			encodeValue(lState, lTable, lExtraBits, lBaseValue, LSymbols, lmd.l, lmdOut);
+			lmdOut.flush();
+		}
+		int lmdBits = lmdOut.finish();
+
+		if (litPayload.size() >= (1U << 20) || lmdPayload.size() >= (1U << 20))
+			return false;
+
+		uint64_t v0 = literals.size() | (static_cast<uint64_t>(litPayload.size()) << 20) |
+			(static_cast<uint64_t>(lmds.size()) << 40) | (static_cast<uint64_t>(literalBits + 7) << 60);
+		uint64_t v1 = litState[0] | (static_cast<uint64_t>(litState[1]) << 10) | (static_cast<uint64_t>(litState[2]) << 20) |
+			(static_cast<uint64_t>(litState[3]) << 30) | (static_cast<uint64_t>(lmdPayload.size()) << 40) |
+			(static_cast<uint64_t>(lmdBits + 7) << 60);
+		uint64_t v2 = header.size() | (static_cast<uint64_t>(lState) << 32) | (static_cast<uint64_t>(mState) << 42) |
+			(static_cast<uint64_t>(dState) << 52);
+
+		uint32_t magic = MagicV2, nraw = static_cast<uint32_t>(consumed);
+		memcpy(&header[0], &magic, 4);
+		memcpy(&header[4], &nraw, 4);
+		memcpy(&header[8], &v0, 8);
+		memcpy(&header[16], &v1, 8);
+		memcpy(&header[24], &v2, 8);
+
+		out.insert(out.end(), header.begin(), header.end());
+		out.insert(out.end(), litPayload.begin(), litPayload.end());
+		out.insert(out.end(), lmdPayload.begin(), lmdPayload.end());
+		return true;
+	}
+
+	inline void put32(std::vector<uint8_t> &out, uint32_t v) {
+		for (int i = 0; i < 4; i++)
+			out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+	}
+
+	inline bool encodeLZVN(const uint8_t *src, size_t size, std::vector<uint8_t> &out) {
+		std::vector<uint8_t> work(lzvn_encode_scratch_size());
+		std::vector<uint8_t> payload(size + size / 8 + 1024);
+		size_t n = lzvn_encode_buffer(payload.data(), payload.size(), src, size, work.data());
+		if (n == 0)
+			return false;
+		put32(out, MagicLZVN);
+		put32(out, static_cast<uint32_t>(size));
+		put32(out, static_cast<uint32_t>(n));
+		out.insert(out.end(), payload.begin(), payload.begin() + n);
+		return true;
+	}
+
+	inline void encodeRaw(const uint8_t *src, size_t size, std::vector<uint8_t> &out) {
+		put32(out, MagicRaw);
+		put32(out, static_cast<uint32_t>(size));
+		out.insert(out.end(), src, src + size);
+	}
+
+	/**
+	 *  Encode a whole stream ending with bvx$
+	 *
+	 *  @param in         data to encode
+	 *  @param types      block types used in turn
+	 *  @param blockSize  maximum raw size of lzvn and stored blocks
+	 *
+	 *  @return encoded stream, empty on failure
+	 */
+	inline std::vector<uint8_t> encode(const std::vector<uint8_t> &in, std::vector<BlockType> types, size_t blockSize=64*1024) {
+		std::vector<uint8_t> out;
+		size_t pos = 0, n = 0;
+		while (pos < in.size()) {
+			BlockType type = types[n++ % types.size()];
+			size_t size = in.size() - pos < blockSize ? in.size() - pos : blockSize;
+			if (type == BlockV2) {
+				if (!encodeV2(in.data(), pos, pos + size, out, size))
+					return {};
+			} else if (type == BlockLZVN) {
+				if (!encodeLZVN(in.data() + pos, size, out))
+					return {};
+			} else {
+				encodeRaw(in.data() + pos, size, out);
+			}
+			pos += size;
+		}
+		put32(out, MagicEnd);
+		return out;
+	}
+}
+
+#endif /* lzfse_encoder_hpp */
@@ -0,0 +1,35 @@
+//
+//  lzvn_reference.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef lzvn_reference_h
+#define lzvn_reference_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  lzvn_decode_buffer before the wide copy fast paths, kept as the reference decoder
+ *
+ *  @param dst       destination buffer
+ *  @param dst_size  destination buffer size
+ *  @param src       compressed data
+ *  @param src_size  compressed data size
+ *
+ *  @return amount of decoded bytes
+ */
+size_t lzvn_reference_decode_buffer(void *dst, size_t dst_size, const void *src, size_t src_size);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* lzvn_reference_h */
@@ -0,0 +1,184 @@
+//
+//  nvram_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_compression.hpp>
+#include <Headers/kern_nvram.hpp>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "corpus.hpp"
+
+static size_t failures = 0;
+
+#define CHECK(cond, fmt, ...)                                                            \
+	do {                                                                                 \
+		if (!(cond)) {                                                                   \
+			failures++;                                                                  \
+			fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__, #cond, ## __VA_ARGS__); \
+		}                                                                                \
+	} while (0)
+
+using Opts = NVStorage::Options;
+
+static constexpr const char *Key = NVRAM_PREFIX(LILU_VENDOR_GUID, "test");
+
+/**
+ *  Read a value and compare it with the expected contents
+ *
+ *  @param nvs       storage
+ *  @param opts      read options
+ *  @param expected  expected contents, empty if reading must fail
+ */
+static void checkRead(NVStorage &nvs, uint8_t opts, const std::vector<uint8_t> &expected) {
+	uint32_t size = 0;
+	auto buf = nvs.read(Key, size, opts);
+	if (expected.empty()) {
+		CHECK(buf == nullptr, "opts %X read %u bytes", opts, size);
+	} else {
+		CHECK(buf && size == expected.size() && !memcmp(buf, expected.data(), size),
+			"opts %X read %u bytes instead of %zu", opts, buf ? size : 0, expected.size());
+	}
+	if (buf)
+		Buffer::deleter(buf);
+}
+
+/**
+ *  Value stored with a raw header as written by any version
+ *
+ *  @param version  header version
+ *  @param opts     header options
+ *  @param payload  payload after the header
+ */
+static std::vector<uint8_t> makeValue(uint8_t version, uint8_t opts, const std::vector<uint8_t> &payload) {
+	NVStorage::Header hdr {};
+	hdr.version = version;
+	hdr.opts = opts;
+	std::vector<uint8_t> value(sizeof(hdr) + payload.size());
+	memcpy(value.data(), &hdr, sizeof(hdr));
+	std::copy(payload.begin(), payload.end(), value.begin() + sizeof(hdr));
+	return value;
+}
+
+/**
+ *  Compressed payload with the decompressed size prefix
+ */
+static std::vector<uint8_t> makePayload(uint32_t mode, const std::vector<uint8_t> &in) {
+	uint32_t size = static_cast<uint32_t>(in.size() + 1024);
+	std::vector<uint8_t> out(sizeof(uint32_t) + size);
+	auto orgSize = static_cast<uint32_t>(in.size());
+	memcpy(out.data(), &orgSize, sizeof(orgSize));
+	if (!Compression::compress(mode, size, in.data(), orgSize, Compression::LevelDefault, out.data() + sizeof(uint32_t)))
+		return {};
+	out.resize(sizeof(uint32_t) + size);
+	return out;
+}
+
+static std::vector<uint8_t> readRaw(NVStorage &nvs) {
+	uint32_t size = 0;
+	auto buf = nvs.read(Key, size, Opts::OptRaw);
+	if (!buf)
+		return {};
+	std::vector<uint8_t> value(buf, buf + size);
+	Buffer::deleter(buf);
+	return value;
+}
+
+/**
+ *  Compressed values are readable regardless of the compression options of the reader,
+ *  other options stored in the header remain requirements
+ */
+static void testVersions(NVStorage &nvs, const std::vector<uint8_t> &in) {
+	static const uint8_t readOpts[] {
+		Opts::OptAuto,
+		Opts::OptCompressed,
+		Opts::OptCompressed | Opts::OptCompressFast,
+		Opts::OptCompressed | Opts::OptCompressLZVN,
+	};
+
+	// Version 1 LZSS values written before LZVN support.
+	auto lzss = makeValue(NVStorage::Header::LZSSVer, Opts::OptCompressed, makePayload(Compression::ModeLZSS, in));
+	CHECK(nvs.write(Key, lzss.data(), static_cast<uint32_t>(lzss.size()), Opts::OptRaw), "lzss v1");
+	for (auto opts : readOpts)
+		checkRead(nvs, opts, in);
+	checkRead(nvs, Opts::OptCompressed | Opts::OptChecksum, {});
+	checkRead(nvs, Opts::OptCompressed | Opts::OptEncrypted, {});
+
+	// Version 2 LZVN values.
+	CHECK(nvs.write(Key, in.data(), static_cast<uint32_t>(in.size()), Opts::OptCompressed | Opts::OptCompressLZVN), "lzvn v2");
+	auto raw = readRaw(nvs);
+	auto hdr = reinterpret_cast<const NVStorage::Header *>(raw.data());
+	CHECK(raw.size() > sizeof(NVStorage::Header) && hdr->version == NVStorage::Header::MaxVer &&
+		hdr->opts == (Opts::OptCompressed | Opts::OptCompressLZVN), "lzvn v2 header");
+	for (auto opts : readOpts)
+		checkRead(nvs, opts, in);
+
+	// LZSS values are still written as version 1.
+	CHECK(nvs.write(Key, in.data(), static_cast<uint32_t>(in.size()), Opts::OptCompressed | Opts::OptCompressFast), "lzss");
+	raw = readRaw(nvs);
+	hdr = reinterpret_cast<const NVStorage::Header *>(raw.data());
+	CHECK(raw.size() > sizeof(NVStorage::Header) && hdr->version == NVStorage::Header::LZSSVer &&
+		hdr->opts == Opts::OptCompressed, "lzss v1 header");
+	for (auto opts : readOpts)
+		checkRead(nvs, opts, in);
+
+	// Uncompressed values drop OptCompressLZVN and stay readable by older versions.
+	CHECK(nvs.write(Key, in.data(), static_cast<uint32_t>(in.size()), Opts::OptCompressLZVN | Opts::OptChecksum), "plain");
+	raw = readRaw(nvs);
+	hdr = reinterpret_cast<const NVStorage::Header *>(raw.data());
+	CHECK(raw.size() > sizeof(NVStorage::Header) && hdr->version == NVStorage::Header::LZSSVer &&
+		hdr->opts == Opts::OptChecksum, "plain header");
+	checkRead(nvs, Opts::OptChecksum | Opts::OptCompressLZVN, in);
+	checkRead(nvs, Opts::OptAuto, in);
+	checkRead(nvs, Opts::OptCompressed, {});
+
+	// Checksummed LZVN values detect corruption.
+	CHECK(nvs.write(Key, in.data(), static_cast<uint32_t>(in.size()), Opts::OptCompressed | Opts::OptCompressLZVN | Opts::OptChecksum), "checksum");
+	checkRead(nvs, Opts::OptChecksum, in);
+	raw = readRaw(nvs);
+	raw[raw.size() / 2] ^= 1;
+	CHECK(nvs.write(Key, raw.data(), static_cast<uint32_t>(raw.size()), Opts::OptRaw), "corrupted");
+	checkRead(nvs, Opts::OptCompressLZVN, {});
+
+	// Unknown versions and magic are rejected.
+	auto future = makeValue(NVStorage::Header::MaxVer + 1, Opts::OptCompressed, makePayload(Compression::ModeLZSS, in));
+	CHECK(nvs.write(Key, future.data(), static_cast<uint32_t>(future.size()), Opts::OptRaw), "future");
+	checkRead(nvs, Opts::OptCompressLZVN, {});
+	lzss[0] ^= 1;
+	CHECK(nvs.write(Key, lzss.data(), static_cast<uint32_t>(lzss.size()), Opts::OptRaw), "magic");
+	checkRead(nvs, Opts::OptAuto, {});
+
+	CHECK(nvs.remove(Key), "remove");
+	checkRead(nvs, Opts::OptAuto, {});
+}
+
+int main() {
+	NVStorage nvs;
+	if (!nvs.init()) {
+		fprintf(stderr, "failed to init storage\n");
+		return 1;
+	}
+
+	std::mt19937_64 rng(43);
+	for (int k = 0; k < Corpus::KindTotal; k++) {
+		auto kind = static_cast<Corpus::Kind>(k);
+		// NVStorage leaves 1 KB for expansion, which incompressible LZSS data exceeds after 8 KB.
+		for (size_t size : {1, 100, 4096})
+			testVersions(nvs, Corpus::generate(kind, size, rng));
+	}
+
+	nvs.deinit();
+
+	if (failures) {
+		fprintf(stderr, "%zu failures\n", failures);
+		return 1;
+	}
+
+	printf("all nvram checks passed\n");
+	return 0;
+}
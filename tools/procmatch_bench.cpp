@@ -0,0 +1,89 @@
+//
+//  procmatch_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include "procmatch_reference.hpp"
+
+#include <chrono>
+
+using namespace ProcReference;
+
+/**
+ *  Plugin process list extended with generated entries of every mode
+ *
+ *  @param extra  amount of generated entries
+ */
+static std::vector<ProcInfo> makeProcs(size_t extra) {
+	auto procs = pluginProcs();
+	for (size_t i = 0; i < extra; i++) {
+		auto n = std::to_string(i);
+		switch (i % 4) {
+			case 0:
+				procs.push_back({"/Applications/App" + n + ".app/Contents/MacOS/App" + n, MatchExact});
+				break;
+			case 1:
+				procs.push_back({"/Library/Application Support/Vendor" + n + "/", MatchPrefix});
+				break;
+			case 2:
+				procs.push_back({"/Contents/MacOS/Tool" + n, MatchSuffix});
+				break;
+			default:
+				procs.push_back({"Helper" + n, MatchAny});
+				break;
+		}
+	}
+	return procs;
+}
+
+/**
+ *  Match every path and report nanoseconds per path
+ */
+template <typename F>
+static double run(const std::vector<std::string> &paths, size_t repetitions, size_t &matched, F func) {
+	matched = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repetitions; r++) {
+		for (auto &path : paths)
+			matched += func(path.c_str(), static_cast<uint32_t>(path.size()));
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return seconds * 1e9 / (paths.size() * repetitions);
+}
+
+int main(int argc, char **argv) {
+	size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10;
+	if (scale == 0)
+		scale = 1;
+
+	auto paths = execPaths(10000, 37);
+	bool ok = true;
+
+	printf("%8s %10s %12s %12s %12s %10s\n", "procs", "nodes", "compile us", "linear ns", "matcher ns", "matched %");
+	for (size_t extra : {0, 10, 100, 1000}) {
+		auto procs = makeProcs(extra);
+
+		ProcMatcher matcher;
+		auto start = std::chrono::steady_clock::now();
+		ok &= compile(matcher, procs);
+		double compileTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		size_t linearMatched, matcherMatched;
+		size_t repetitions = extra >= 1000 ? scale : scale * 10;
+		double linear = run(paths, repetitions, linearMatched, [&](const char *path, uint32_t len) {
+			return match(procs, path, len);
+		});
+		double compiled = run(paths, repetitions, matcherMatched, [&](const char *path, uint32_t len) {
+			return matcher.match(path, len);
+		});
+
+		ok &= linearMatched == matcherMatched;
+		printf("%8zu %10zu %12.1f %12.1f %12.1f %10.1f\n", procs.size(), matcher.size(), compileTime * 1e6,
+			linear, compiled, 100.0 * matcherMatched / (paths.size() * repetitions));
+		matcher.deinit();
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+//
+//  procmatch_reference.hpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef procmatch_reference_hpp
+#define procmatch_reference_hpp
+
+#include <Headers/kern_procmatch.hpp>
+
+#include <string>
+#include <vector>
+
+/**
+ *  UserPatcher::ProcInfo process list entries and the linear matching loop
+ *  UserPatcher::matchProcInfo used before ProcMatcher, kept as the reference
+ */
+namespace ProcReference {
+	/**
+	 *  UserPatcher::ProcInfo::ProcFlags
+	 */
+	enum ProcFlags {
+		MatchExact  = 0,
+		MatchAny    = 1,
+		MatchPrefix = 2,
+		MatchSuffix = 4,
+		MatchMask   = MatchExact | MatchAny | MatchPrefix | MatchSuffix
+	};
+
+	struct ProcInfo {
+		std::string path;
+		uint32_t flags;
+	};
+
+	/**
+	 *  UserPatcher::matchProcInfo
+	 */
+	inline bool match(const std::vector<ProcInfo> &procs, const char *path, uint32_t len) {
+		for (auto &p : procs) {
+			auto plen = static_cast<uint32_t>(p.path.size());
+			if (len >= plen) {
+				auto match = p.flags & MatchMask;
+				if ((match == MatchExact && len == plen && !strncmp(p.path.c_str(), path, len)) ||
+					(match == MatchPrefix && !strncmp(p.path.c_str(), path, plen)) ||
+					(match == MatchSuffix && !strncmp(p.path.c_str(), path + (len - plen), plen+1)) ||
+					(match == MatchAny && strstr(path, p.path.c_str()))) {
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 *  UserPatcher::compileProcMatcher
+	 */
+	inline bool compile(ProcMatcher &matcher, const std::vector<ProcInfo> &procs) {
+		if (!matcher.init())
+			return false;
+
+		for (auto &p : procs) {
+			auto len = static_cast<uint32_t>(p.path.size());
+			bool res = true;
+			switch (p.flags & MatchMask) {
+				case MatchExact:
+					res = matcher.add(p.path.c_str(), len, ProcMatcher::ModeExact);
+					break;
+				case MatchPrefix:
+					res = matcher.add(p.path.c_str(), len, ProcMatcher::ModePrefix);
+					break;
+				case MatchSuffix:
+					res = matcher.add(p.path.c_str(), len, ProcMatcher::ModeSuffix);
+					break;
+				case MatchAny:
+					res = matcher.add(p.path.c_str(), len, ProcMatcher::ModeAny);
+					break;
+			}
+
+			if (!res)
+				return false;
+		}
+
+		return matcher.finish();
+	}
+
+	/**
+	 *  Process list resembling the ones Lilu plugins register
+	 */
+	inline std::vector<ProcInfo> pluginProcs() {
+		return {
+			{"/System/Library/Frameworks/ApplicationServices.framework/Frameworks/CoreGraphics.framework/Resources/WindowServer", MatchExact},
+			{"/System/Library/PrivateFrameworks/SkyLight.framework/Versions/A/Resources/WindowServer", MatchExact},
+			{"/System/Library/CoreServices/loginwindow.app/Contents/MacOS/loginwindow", MatchExact},
+			{"/System/Library/CoreServices/Finder.app/Contents/MacOS/Finder", MatchExact},
+			{"/System/Library/CoreServices/SystemUIServer.app/Contents/MacOS/SystemUIServer", MatchExact},
+			{"/System/Library/Frameworks/VideoToolbox.framework/Versions/A/XPCServices/VTDecoderXPCService.xpc/Contents/MacOS/VTDecoderXPCService", MatchExact},
+			{"/System/Library/Frameworks/VideoToolbox.framework/Versions/A/XPCServices/VTEncoderXPCService.xpc/Contents/MacOS/VTEncoderXPCService", MatchExact},
+			{"/System/Applications/Utilities/System Information.app/Contents/MacOS/System Information", MatchExact},
+			{"/Applications/Utilities/System Information.app/Contents/MacOS/System Information", MatchExact},
+			{"/usr/libexec/amfid", MatchExact},
+			{"/usr/sbin/bluetoothd", MatchExact},
+			{"/usr/sbin/coreaudiod", MatchExact},
+			{"/usr/libexec/hidd", MatchExact},
+			{"/System/Library/Frameworks/WebKit.framework/", MatchPrefix},
+			{"/Applications/Safari.app/", MatchPrefix},
+			{"/Contents/MacOS/iTunes", MatchSuffix},
+			{"/Contents/MacOS/Music", MatchSuffix},
+			{"/Contents/MacOS/TV", MatchSuffix},
+			{"/Contents/MacOS/QuickTime Player", MatchSuffix},
+			{"com.apple.WebKit.GPU", MatchAny},
+			{"Photo Booth", MatchAny}
+		};
+	}
+
+	/**
+	 *  Executable paths resembling exec traffic during boot and user sessions
+	 *
+	 *  @param count  amount of paths
+	 *  @param seed   random seed
+	 */
+	inline std::vector<std::string> execPaths(size_t count, uint32_t seed) {
+		static const char *names[] {
+			"Safari", "Music", "TV", "Mail", "Notes", "Xcode", "Terminal", "Photo Booth", "Preview", "iTunes",
+			"Finder", "SystemUIServer", "Dock", "Spotlight", "QuickTime Player", "Calendar", "Messages", "Maps"
+		};
+		static const char *tools[] {
+			"sh", "bash", "zsh", "ls", "cat", "grep", "launchctl", "log", "sysctl", "ioreg", "kextstat",
+			"mdworker_shared", "amfid", "bluetoothd", "coreaudiod", "hidd", "trustd", "syspolicyd"
+		};
+		static const char *services[] {
+			"com.apple.WebKit.GPU", "com.apple.WebKit.WebContent", "com.apple.WebKit.Networking",
+			"VTDecoderXPCService", "VTEncoderXPCService", "com.apple.audio.SandboxHelper"
+		};
+
+		uint32_t state = seed;
+		auto next = [&state]() {
+			state = state * 1103515245 + 12345;
+			return state >> 8;
+		};
+
+		auto procs = pluginProcs();
+		std::vector<std::string> paths;
+		for (size_t i = 0; i < count; i++) {
+			std::string path;
+			switch (next() % 8) {
+				case 0:
+					path = procs[next() % procs.size()].path;
+					break;
+				case 1:
+				case 2: {
+					const char *name = names[next() % (sizeof(names) / sizeof(names[0]))];
+					path = std::string(next() % 2 ? "/System/Applications/" : "/Applications/") + name + ".app/Contents/MacOS/" + name;
+					break;
+				}
+				case 3:
+				case 4:
+					path = std::string(next() % 2 ? "/usr/bin/" : (next() % 2 ? "/usr/libexec/" : "/usr/sbin/")) +
+						tools[next() % (sizeof(tools) / sizeof(tools[0]))];
+					break;
+				case 5: {
+					const char *service = services[next() % (sizeof(services) / sizeof(services[0]))];
+					path = std::string("/System/Library/Frameworks/WebKit.framework/Versions/A/XPCServices/") +
+						service + ".xpc/Contents/MacOS/" + service;
+					break;
+				}
+				case 6: {
+					const char *service = services[next() % (sizeof(services) / sizeof(services[0]))];
+					path = std::string("/System/Library/PrivateFrameworks/Example") + std::to_string(next() % 100) +
+						".framework/Versions/A/XPCServices/" + service + ".xpc/Contents/MacOS/" + service;
+					break;
+				}
+				default:
+					path = "/Library/Apple/System/Library/StagedFrameworks/Safari/SafariShared.framework/Versions/A/XPCServices/com.apple.Safari.History.xpc/Contents/MacOS/com.apple.Safari.History";
+					break;
+			}
+			paths.push_back(path);
+		}
+
+		return paths;
+	}
+}
+
+#endif /* procmatch_reference_hpp */
@@ -0,0 +1,141 @@
+//
+//  procmatch_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include "procmatch_reference.hpp"
+
+#include <random>
+
+using namespace ProcReference;
+
+static size_t failures {0};
+
+#define CHECK(cond, fmt, ...)                                                            \
+	do {                                                                                 \
+		if (!(cond)) {                                                                   \
+			failures++;                                                                  \
+			fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__, #cond, ## __VA_ARGS__); \
+		}                                                                                \
+	} while (0)
+
+static std::string describe(const std::vector<ProcInfo> &procs) {
+	std::string str;
+	for (auto &p : procs)
+		str += "{\"" + p.path + "\", " + std::to_string(p.flags) + "} ";
+	return str;
+}
+
+/**
+ *  Compare ProcMatcher against the linear loop for every path
+ *
+ *  @param procs     process list
+ *  @param paths     paths to match
+ *  @param expected  expected results, empty to only compare with the reference
+ */
+static void compare(const std::vector<ProcInfo> &procs, const std::vector<std::string> &paths, const std::vector<bool> &expected = {}) {
+	ProcMatcher matcher;
+	CHECK(compile(matcher, procs), "%s", describe(procs).c_str());
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		auto &path = paths[i];
+		auto len = static_cast<uint32_t>(path.size());
+		bool ref = match(procs, path.c_str(), len);
+		bool res = matcher.match(path.c_str(), len);
+		CHECK(ref == res, "\"%s\" reference %d matcher %d for %s", path.c_str(), ref, res, describe(procs).c_str());
+		if (!expected.empty())
+			CHECK(ref == expected[i], "\"%s\" expected %d for %s", path.c_str(), static_cast<int>(expected[i]), describe(procs).c_str());
+	}
+
+	matcher.deinit();
+}
+
+static void testModes() {
+	compare({{"/usr/bin/ls", MatchExact}}, {"/usr/bin/ls", "/usr/bin/l", "/usr/bin/lsx", "x/usr/bin/ls", ""}, {true, false, false, false, false});
+	compare({{"/usr/", MatchPrefix}}, {"/usr/", "/usr/bin/ls", "/usr", "/bin/usr/"}, {true, true, false, false});
+	compare({{"/ls", MatchSuffix}}, {"/ls", "/usr/bin/ls", "/usr/bin/lsx", "ls"}, {true, true, false, false});
+	compare({{"bin", MatchAny}}, {"bin", "/usr/bin/ls", "/usr/bi/n", "bi"}, {true, true, false, false});
+
+	// Partial matches must not hide the next candidate.
+	compare({{"ab", MatchAny}}, {"aab", "abab", "aaab", "ba"}, {true, true, true, false});
+	compare({{"aab", MatchAny}}, {"aaab", "aabaab", "abaab"}, {true, true, true});
+	compare({{"abcd", MatchAny}, {"bc", MatchAny}}, {"abce", "xbcx", "abd"}, {true, true, false});
+
+	// Empty paths match everything of sufficient length in their mode.
+	compare({{"", MatchPrefix}}, {"", "/a"}, {true, true});
+	compare({{"", MatchSuffix}}, {"", "/a"}, {true, true});
+	compare({{"", MatchAny}}, {"", "/a"}, {true, true});
+	compare({{"", MatchExact}}, {"", "/a"}, {true, false});
+
+	// Combined matching flags never match.
+	compare({{"/a", MatchAny | MatchPrefix}, {"/a", MatchPrefix | MatchSuffix}, {"/a", MatchMask}}, {"/a", "/a/b", "/b/a"}, {false, false, false});
+
+	// Modes sharing a trie do not leak into each other.
+	compare({{"/usr/bin", MatchExact}, {"/usr/bin/ls", MatchPrefix}}, {"/usr/bin", "/usr/bin/", "/usr/bin/ls", "/usr/bin/lsof"}, {true, false, true, true});
+	compare({{"/a/b", MatchSuffix}, {"/b", MatchExact}}, {"/b", "/x/b", "/x/a/b"}, {true, false, true});
+
+	ProcMatcher matcher;
+	CHECK(!matcher.add("/a", 2, ProcMatcher::ModeExact), "add before init");
+	CHECK(!matcher.finish(), "finish before init");
+}
+
+/**
+ *  Random process lists and paths over a small alphabet, so that every mode overlaps often
+ */
+static void testRandom() {
+	static const char alphabet[] {'a', 'b', '/', '.'};
+	static const uint32_t flags[] {MatchExact, MatchAny, MatchPrefix, MatchSuffix, MatchAny | MatchSuffix};
+
+	std::mt19937 rng(37);
+	auto randomString = [&](size_t maxLen) {
+		std::string str;
+		size_t len = rng() % (maxLen + 1);
+		for (size_t i = 0; i < len; i++)
+			str += alphabet[rng() % sizeof(alphabet)];
+		return str;
+	};
+
+	for (size_t round = 0; round < 5000; round++) {
+		std::vector<ProcInfo> procs;
+		size_t num = 1 + rng() % 6;
+		for (size_t i = 0; i < num; i++)
+			procs.push_back({randomString(4), flags[rng() % (sizeof(flags) / sizeof(flags[0]))]});
+
+		std::vector<std::string> paths;
+		for (size_t i = 0; i < 40; i++)
+			paths.push_back(randomString(10));
+
+		compare(procs, paths);
+	}
+}
+
+static void testPlugins() {
+	auto procs = pluginProcs();
+	auto paths = execPaths(20000, 37);
+	compare(procs, paths);
+
+	// Registered paths with their last character removed or one more appended.
+	std::vector<std::string> own;
+	for (auto &p : procs) {
+		own.push_back(p.path);
+		own.push_back(p.path.substr(0, p.path.size() - 1));
+		own.push_back(p.path + "x");
+	}
+	compare(procs, own);
+}
+
+int main() {
+	testModes();
+	testRandom();
+	testPlugins();
+
+	if (failures) {
+		fprintf(stderr, "%zu failures\n", failures);
+		return 1;
+	}
+
+	printf("all tests passed\n");
+	return 0;
+}
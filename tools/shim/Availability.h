@@ -0,0 +1,6 @@
+//
+//  Availability.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
@@ -0,0 +1,16 @@
+//
+//  kern_config.hpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef kern_config_hpp
+#define kern_config_hpp
+
+/**
+ *  Only portable Lilu sources are built on the host
+ */
+#define LILU_COMPRESSION_SUPPORT 1
+
+#endif /* kern_config_hpp */
@@ -0,0 +1,27 @@
+//
+//  IOLib.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef IOLib_h
+#define IOLib_h
+
+#include <stdint.h>
+
+typedef uint32_t IOItemCount;
+typedef struct host_recursive_lock IORecursiveLock;
+
+IORecursiveLock *IORecursiveLockAlloc();
+void IORecursiveLockFree(IORecursiveLock *lock);
+void IORecursiveLockLock(IORecursiveLock *lock);
+void IORecursiveLockUnlock(IORecursiveLock *lock);
+
+extern "C" {
+	[[noreturn]] void panic(const char *format, ...);
+	bool ml_get_interrupts_enabled();
+	bool PE_parse_boot_argn(const char *arg, void *ptr, int max);
+}
+
+#endif /* IOLib_h */
@@ -0,0 +1,25 @@
+//
+//  IONVRAM.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef IONVRAM_h
+#define IONVRAM_h
+
+#include <IOKit/IOService.h>
+
+/**
+ *  NVRAM entry kept in memory, sync does nothing
+ */
+class IODTNVRAM : public IORegistryEntry {
+public:
+	bool safeToSync() {
+		return true;
+	}
+
+	void sync() {}
+};
+
+#endif /* IONVRAM_h */
@@ -0,0 +1,117 @@
+//
+//  IOService.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef IOService_h
+#define IOService_h
+
+#include <libkern/c++/OSObject.h>
+#include <IOKit/IOLib.h>
+
+#include <map>
+#include <string>
+
+/**
+ *  Immutable byte buffer
+ */
+class OSData : public OSObject {
+	std::string bytes;
+
+public:
+	static OSData *withBytes(const void *bytes, unsigned int numBytes) {
+		auto data = new OSData;
+		data->bytes.assign(static_cast<const char *>(bytes), numBytes);
+		return data;
+	}
+
+	unsigned int getLength() const {
+		return static_cast<unsigned int>(bytes.size());
+	}
+
+	const void *getBytesNoCopy() const {
+		return bytes.data();
+	}
+};
+
+/**
+ *  Text buffer filled by IORegistryEntry::serializeProperties
+ */
+class OSSerialize : public OSObject {
+	std::string str;
+
+public:
+	static OSSerialize *withCapacity(unsigned int capacity) {
+		auto s = new OSSerialize;
+		s->str.reserve(capacity);
+		return s;
+	}
+
+	bool addString(const char *cString) {
+		str += cString;
+		return true;
+	}
+
+	char *text() const {
+		return const_cast<char *>(str.c_str());
+	}
+
+	uint32_t getLength() const {
+		return static_cast<uint32_t>(str.size() + 1);
+	}
+};
+
+struct IORegistryPlane;
+extern const IORegistryPlane *gIODTPlane;
+
+/**
+ *  Registry entry holding retained properties by name
+ */
+class IORegistryEntry : public OSObject {
+	std::map<std::string, OSObject *> properties;
+
+public:
+	~IORegistryEntry() override {
+		for (auto &prop : properties)
+			prop.second->release();
+	}
+
+	/**
+	 *  Only IODeviceTree:/options is available, it is created on first use
+	 */
+	static IORegistryEntry *fromPath(const char *path, const IORegistryPlane *plane);
+
+	OSObject *getProperty(const char *key) const {
+		auto it = properties.find(key);
+		return it != properties.end() ? it->second : nullptr;
+	}
+
+	bool setProperty(const char *key, OSObject *object) {
+		object->retain();
+		removeProperty(key);
+		properties[key] = object;
+		return true;
+	}
+
+	void removeProperty(const char *key) {
+		auto it = properties.find(key);
+		if (it != properties.end()) {
+			it->second->release();
+			properties.erase(it);
+		}
+	}
+
+	bool serializeProperties(OSSerialize *s) const {
+		s->addString("<dict>");
+		for (auto &prop : properties) {
+			s->addString("<key>");
+			s->addString(prop.first.c_str());
+			s->addString("</key>");
+		}
+		return s->addString("</dict>");
+	}
+};
+
+#endif /* IOService_h */
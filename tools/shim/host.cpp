@@ -0,0 +1,133 @@
+//
+//  host.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_util.hpp>
+
+#include <stdarg.h>
+
+#include <mutex>
+
+/**
+ *  Host replacements of the kernel and Lilu runtime used by portable Lilu sources
+ */
+bool ADDPR(debugEnabled) = false;
+uint32_t ADDPR(debugPrintDelay) = 0;
+const int version_major = KernelVersion::Tahoe;
+const int version_minor = 0;
+vm_map_t kernel_map = nullptr;
+proc_t kernproc = nullptr;
+
+// Tests provoke many expected failures, so logging is only enabled with LILU_SYSLOG set.
+void lilu_os_log(const char *format, ...) {
+	if (!getenv("LILU_SYSLOG"))
+		return;
+	va_list va;
+	va_start(va, format);
+	vfprintf(stderr, format, va);
+	va_end(va);
+}
+
+void OSReportWithBacktrace(const char *format, ...) {
+	va_list va;
+	va_start(va, format);
+	vfprintf(stderr, format, va);
+	va_end(va);
+}
+
+void panic(const char *format, ...) {
+	va_list va;
+	va_start(va, format);
+	vfprintf(stderr, format, va);
+	va_end(va);
+	abort();
+}
+
+bool ml_get_interrupts_enabled() {
+	return true;
+}
+
+bool PE_parse_boot_argn(const char *, void *, int) {
+	return false;
+}
+
+void *kern_os_malloc(size_t size) {
+	return calloc(1, size);
+}
+
+void *kern_os_calloc(size_t num, size_t size) {
+	return calloc(num, size);
+}
+
+void kern_os_free(void *addr) {
+	free(addr);
+}
+
+void *kern_os_realloc(void *addr, size_t nsize) {
+	return realloc(addr, nsize);
+}
+
+void lilu_os_free(void *addr) {
+	free(addr);
+}
+
+static thread_local thread_t currentThreadOverride;
+static thread_local char currentThreadAnchor;
+
+thread_t current_thread() {
+	if (currentThreadOverride)
+		return currentThreadOverride;
+	return reinterpret_cast<thread_t>(&currentThreadAnchor);
+}
+
+void host_set_current_thread(thread_t thread) {
+	currentThreadOverride = thread;
+}
+
+struct host_recursive_lock {
+	std::recursive_mutex mutex;
+};
+
+IORecursiveLock *IORecursiveLockAlloc() {
+	return new IORecursiveLock;
+}
+
+void IORecursiveLockFree(IORecursiveLock *lock) {
+	delete lock;
+}
+
+void IORecursiveLockLock(IORecursiveLock *lock) {
+	lock->mutex.lock();
+}
+
+void IORecursiveLockUnlock(IORecursiveLock *lock) {
+	lock->mutex.unlock();
+}
+
+const char *strstr(const char *stack, const char *needle, size_t len) {
+	if (len == 0) {
+		len = strlen(needle);
+		if (len == 0) return stack;
+	}
+
+	for (; *stack; stack++) {
+		if (!strncmp(stack, needle, len))
+			return stack;
+	}
+
+	return nullptr;
+}
+
+#undef strrchr
+#undef qsort
+
+char *lilu_host_strrchr(const char *stack, int ch) {
+	return const_cast<char *>(strrchr(stack, ch));
+}
+
+void lilu_host_qsort(void *a, size_t n, size_t es, int (*cmp)(const void *, const void *)) {
+	qsort(a, n, es, cmp);
+}
@@ -0,0 +1,13 @@
+//
+//  OSDebug.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef OSDebug_h
+#define OSDebug_h
+
+extern "C" void OSReportWithBacktrace(const char *format, ...);
+
+#endif /* OSDebug_h */
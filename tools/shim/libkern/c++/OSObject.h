@@ -0,0 +1,34 @@
+//
+//  OSObject.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef OSObject_h
+#define OSObject_h
+
+/**
+ *  Reference counted base of the registry objects used by kern_nvram.cpp
+ */
+class OSObject {
+	mutable int retainCount {1};
+
+public:
+	virtual ~OSObject() {}
+
+	void retain() const {
+		retainCount++;
+	}
+
+	void release() const {
+		if (--retainCount == 0)
+			delete this;
+	}
+};
+
+#define OSDynamicCast(type, inst) dynamic_cast<type *>(inst)
+
+#define OSDeclareDefaultStructors(className)
+
+#endif /* OSObject_h */
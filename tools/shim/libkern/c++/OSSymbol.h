@@ -0,0 +1,13 @@
+//
+//  OSSymbol.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef OSSymbol_h
+#define OSSymbol_h
+
+#include <libkern/c++/OSObject.h>
+
+#endif /* OSSymbol_h */
@@ -0,0 +1,30 @@
+//
+//  libkern.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef libkern_h
+#define libkern_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define __printflike(a, b) __attribute__((format(printf, a, b)))
+
+// Lilu declares its own strstr, strrchr and qsort, which clash with the C++ overloads of the C library.
+#define strstr lilu_host_strstr
+#define strrchr lilu_host_strrchr
+#define qsort lilu_host_qsort
+
+#ifdef __cplusplus
+// Kernel crc32 takes any buffer, it overloads the zlib one on the host.
+uint32_t crc32(uint32_t crc, const void *bufp, size_t len);
+#endif
+
+#endif /* libkern_h */
@@ -0,0 +1,8 @@
+//
+//  zlib.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <zlib.h>
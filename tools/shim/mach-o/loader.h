@@ -0,0 +1,50 @@
+//
+//  loader.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef loader_h
+#define loader_h
+
+#include <stdint.h>
+
+/**
+ *  Mach-O definitions used by portable Lilu sources
+ */
+struct mach_header_64 {
+	uint32_t magic;
+	int32_t cputype;
+	int32_t cpusubtype;
+	uint32_t filetype;
+	uint32_t ncmds;
+	uint32_t sizeofcmds;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+struct load_command {
+	uint32_t cmd;
+	uint32_t cmdsize;
+};
+
+struct segment_command_64 {
+	uint32_t cmd;
+	uint32_t cmdsize;
+	char segname[16];
+	uint64_t vmaddr;
+	uint64_t vmsize;
+	uint64_t fileoff;
+	uint64_t filesize;
+	int32_t maxprot;
+	int32_t initprot;
+	uint32_t nsects;
+	uint32_t flags;
+};
+
+#define MH_MAGIC_64    0xFEEDFACF
+#define MH_DYLIB       0x6
+#define LC_SEGMENT_64  0x19
+
+#endif /* loader_h */
@@ -0,0 +1,15 @@
+//
+//  vm_param.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef vm_param_h
+#define vm_param_h
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+#endif /* vm_param_h */
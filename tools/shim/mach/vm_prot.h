@@ -0,0 +1,18 @@
+//
+//  vm_prot.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef vm_prot_h
+#define vm_prot_h
+
+typedef int vm_prot_t;
+
+#define VM_PROT_NONE    0
+#define VM_PROT_READ    1
+#define VM_PROT_WRITE   2
+#define VM_PROT_EXECUTE 4
+
+#endif /* vm_prot_h */
@@ -0,0 +1,34 @@
+//
+//  vm_types.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef vm_types_h
+#define vm_types_h
+
+#include <stdint.h>
+
+typedef uint64_t mach_vm_address_t;
+typedef uintptr_t vm_address_t;
+typedef uintptr_t vm_offset_t;
+typedef uintptr_t vm_size_t;
+typedef struct host_vm_map *vm_map_t;
+typedef struct host_thread *thread_t;
+
+#ifdef __cplusplus
+/**
+ *  Current thread identifier, unique for every host thread unless overridden
+ */
+thread_t current_thread();
+
+/**
+ *  Override current thread identifier for the calling host thread, nullptr restores the default
+ *
+ *  @param thread  thread identifier to report
+ */
+void host_set_current_thread(thread_t thread);
+#endif
+
+#endif /* vm_types_h */
@@ -0,0 +1,46 @@
+//
+//  nvram.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_crypto.hpp>
+#include <Headers/kern_file.hpp>
+#include <IOKit/IONVRAM.h>
+
+#include <zlib.h>
+
+/**
+ *  Host replacements of the registry, crypto and file functions used by kern_nvram.cpp
+ */
+const IORegistryPlane *gIODTPlane = nullptr;
+
+IORegistryEntry *IORegistryEntry::fromPath(const char *path, const IORegistryPlane *) {
+	static IODTNVRAM *options = new IODTNVRAM;
+	if (strcmp(path, "/options"))
+		return nullptr;
+	options->retain();
+	return options;
+}
+
+uint32_t crc32(uint32_t crc, const void *bufp, size_t len) {
+	return static_cast<uint32_t>(::crc32(static_cast<uLong>(crc), static_cast<const Bytef *>(bufp), static_cast<uInt>(len)));
+}
+
+// Encryption needs the kernel AES implementation, so host values are never encrypted.
+uint8_t *Crypto::encrypt(const uint8_t *, const uint8_t *, uint32_t &) {
+	return nullptr;
+}
+
+uint8_t *Crypto::decrypt(const uint8_t *, const uint8_t *, uint32_t &) {
+	return nullptr;
+}
+
+int FileIO::writeBufferToFile(const char *path, void *buffer, size_t size, int, int) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+		return -1;
+	bool ok = fwrite(buffer, 1, size, fp) == size;
+	return (fclose(fp) == 0 && ok) ? 0 : -1;
+}
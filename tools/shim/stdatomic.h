@@ -0,0 +1,37 @@
+//
+//  stdatomic.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef __cplusplus
+#include_next <stdatomic.h>
+#else
+
+#ifndef stdatomic_h
+#define stdatomic_h
+
+#include <atomic>
+
+/**
+ *  C11 atomics used by the kernel sources, g++ only provides them as std::atomic
+ */
+#define _Atomic(T) std::atomic<T>
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+using std::memory_order_seq_cst;
+using std::atomic_init;
+using std::atomic_load;
+using std::atomic_store;
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_exchange_explicit;
+using std::atomic_fetch_add_explicit;
+using std::atomic_compare_exchange_strong_explicit;
+using std::atomic_compare_exchange_weak_explicit;
+
+#endif /* stdatomic_h */
+#endif /* __cplusplus */
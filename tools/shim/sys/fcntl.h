@@ -0,0 +1,18 @@
+//
+//  fcntl.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef lilu_host_fcntl_h
+#define lilu_host_fcntl_h
+
+#include_next <sys/fcntl.h>
+#include <sys/stat.h>
+
+#ifndef FWRITE
+#define FWRITE 0x0002
+#endif
+
+#endif /* lilu_host_fcntl_h */
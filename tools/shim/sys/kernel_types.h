@@ -0,0 +1,14 @@
+//
+//  kernel_types.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef kernel_types_h
+#define kernel_types_h
+
+typedef struct host_vnode *vnode_t;
+typedef struct host_vfs_context *vfs_context_t;
+
+#endif /* kernel_types_h */
@@ -0,0 +1,13 @@
+//
+//  proc.h
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#ifndef proc_h
+#define proc_h
+
+typedef struct host_proc *proc_t;
+
+#endif /* proc_h */
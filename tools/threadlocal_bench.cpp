@@ -0,0 +1,159 @@
+//
+//  threadlocal_bench.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_util.hpp>
+
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/**
+ *  Pending user patch storage before and after ThreadLocalMap
+ */
+using OldStorage = ThreadLocal<void *, 32>;
+using NewStorage = ThreadLocalMap<void *>;
+
+/**
+ *  Capacity UserPatcher uses for 8 CPUs
+ */
+static constexpr size_t NewCapacity {256};
+
+static thread_t fakeThread(size_t i) {
+	return reinterpret_cast<thread_t>(0xFFFFFF8012340000ULL + i * 0x5F0);
+}
+
+static bool initStorage(OldStorage &storage) {
+	storage.init();
+	return true;
+}
+
+static bool initStorage(NewStorage &storage) {
+	return storage.init(NewCapacity);
+}
+
+/**
+ *  Measure the exec path operations of one thread while other threads keep their entries
+ *
+ *  @param occupied  amount of other threads holding an entry
+ *  @param ops       amount of get, set, get and erase sequences
+ *
+ *  @return nanoseconds per sequence or -1 on failure
+ */
+template <typename S>
+static double benchOccupied(size_t occupied, size_t ops) {
+	S storage;
+	if (!initStorage(storage))
+		return -1;
+
+	for (size_t i = 0; i < occupied; i++) {
+		host_set_current_thread(fakeThread(i + 1));
+		if (!storage.set(reinterpret_cast<void *>(i + 1)))
+			return -1;
+	}
+
+	host_set_current_thread(fakeThread(0));
+	bool ok = true;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ops; i++) {
+		ok &= storage.get() == nullptr;
+		ok &= storage.set(reinterpret_cast<void *>(i + 1));
+		ok &= storage.get() != nullptr;
+		ok &= storage.erase();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	host_set_current_thread(nullptr);
+	storage.deinit();
+	return ok ? seconds * 1e9 / ops : -1;
+}
+
+template <typename S>
+struct Concurrent {
+	S storage;
+	size_t ops;
+	std::atomic<bool> start {false};
+	std::atomic<size_t> rejected {0};
+};
+
+template <typename S>
+static void *concurrentWorker(void *arg) {
+	auto c = static_cast<Concurrent<S> *>(arg);
+	while (!c->start.load(std::memory_order_acquire));
+
+	size_t rejected = 0;
+	for (size_t i = 0; i < c->ops; i++) {
+		if (!c->storage.set(reinterpret_cast<void *>(i + 1))) {
+			rejected++;
+			continue;
+		}
+		if (!c->storage.get() || !c->storage.erase())
+			rejected++;
+	}
+
+	c->rejected += rejected;
+	return nullptr;
+}
+
+/**
+ *  Measure set, get and erase sequences running on many threads at once
+ *
+ *  @param threads   amount of threads
+ *  @param ops       sequences per thread
+ *  @param rejected  sequences that failed, ThreadLocal rejects threads past its capacity
+ *
+ *  @return millions of sequences per second
+ */
+template <typename S>
+static double benchConcurrent(size_t threads, size_t ops, size_t &rejected) {
+	Concurrent<S> c;
+	c.ops = ops;
+	if (!initStorage(c.storage))
+		return -1;
+
+	std::vector<pthread_t> handles(threads);
+	for (auto &handle : handles)
+		pthread_create(&handle, nullptr, concurrentWorker<S>, &c);
+
+	auto start = std::chrono::steady_clock::now();
+	c.start.store(true, std::memory_order_release);
+	for (auto &handle : handles)
+		pthread_join(handle, nullptr);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	rejected = c.rejected;
+	c.storage.deinit();
+	return threads * ops / seconds / 1e6;
+}
+
+int main(int argc, char **argv) {
+	size_t scale = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10;
+	if (scale == 0)
+		scale = 1;
+
+	bool ok = true;
+
+	printf("%-28s %10s %12s %12s\n", "exec path", "occupied", "old ns", "new ns");
+	for (size_t occupied : {0, 1, 8, 16, 31}) {
+		double o = benchOccupied<OldStorage>(occupied, scale * 100000);
+		double n = benchOccupied<NewStorage>(occupied, scale * 100000);
+		ok &= o >= 0 && n >= 0;
+		printf("%-28s %10zu %12.1f %12.1f\n", "get/set/get/erase", occupied, o, n);
+	}
+
+	printf("\n%-28s %10s %12s %12s %12s %12s\n", "concurrent", "threads", "old Mops", "old rejected", "new Mops", "new rejected");
+	for (size_t threads : {1, 4, 16, 32, 64}) {
+		size_t oldRejected = 0, newRejected = 0;
+		double o = benchConcurrent<OldStorage>(threads, scale * 10000, oldRejected);
+		double n = benchConcurrent<NewStorage>(threads, scale * 10000, newRejected);
+		ok &= o >= 0 && n >= 0 && newRejected == 0;
+		printf("%-28s %10zu %12.2f %12zu %12.2f %12zu\n", "set/get/erase", threads, o, oldRejected, n, newRejected);
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+//
+//  threadlocal_test.cpp
+//  Lilu host tools
+//
+//  Copyright © 2016-2017 vit9696. All rights reserved.
+//
+
+#include <Headers/kern_util.hpp>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+static std::atomic<size_t> failures {0};
+
+#define CHECK(cond, fmt, ...)                                                            \
+	do {                                                                                 \
+		if (!(cond)) {                                                                   \
+			failures++;                                                                  \
+			fprintf(stderr, "%s:%d: %s: " fmt "\n", __FILE__, __LINE__, #cond, ## __VA_ARGS__); \
+		}                                                                                \
+	} while (0)
+
+/**
+ *  Fake thread identifiers spaced like kernel thread structures
+ */
+static thread_t fakeThread(size_t i) {
+	return reinterpret_cast<thread_t>(0xFFFFFF8012340000ULL + i * 0x5F0);
+}
+
+/**
+ *  Fill the map with fake threads, check every value, then drain and refill it
+ */
+static void testSequential(size_t capacity) {
+	ThreadLocalMap<uint64_t> map;
+	CHECK(map.init(capacity), "capacity %zu", capacity);
+
+	std::vector<size_t> stored;
+	for (size_t i = 0; i < capacity; i++) {
+		host_set_current_thread(fakeThread(i));
+		if (map.set(i + 1))
+			stored.push_back(i);
+	}
+
+	// The probe limit may reject a few threads of a completely full map, but not the first half.
+	CHECK(stored.size() >= capacity / 2, "stored %zu of %zu", stored.size(), capacity);
+
+	for (size_t i = 0; i < capacity; i++) {
+		host_set_current_thread(fakeThread(i));
+		auto value = map.get();
+		bool present = std::find(stored.begin(), stored.end(), i) != stored.end();
+		CHECK((value != nullptr) == present, "thread %zu presence %d", i, present);
+		if (value && present)
+			CHECK(*value == i + 1, "thread %zu value %llu", i, static_cast<unsigned long long>(*value));
+	}
+
+	// Overwriting keeps the slot.
+	host_set_current_thread(fakeThread(stored[0]));
+	CHECK(map.set(100), "overwrite");
+	CHECK(map.get() && *map.get() == 100, "overwritten value");
+
+	std::mt19937_64 rng(38);
+	std::shuffle(stored.begin(), stored.end(), rng);
+	for (auto i : stored) {
+		host_set_current_thread(fakeThread(i));
+		CHECK(map.erase(), "erase %zu", i);
+		CHECK(map.get() == nullptr, "erased %zu", i);
+		CHECK(!map.erase(), "double erase %zu", i);
+	}
+
+	// Once drained, the first half fits again.
+	for (size_t i = 0; i < capacity / 2; i++) {
+		host_set_current_thread(fakeThread(i + capacity));
+		CHECK(map.set(i), "refill %zu", i);
+	}
+
+	host_set_current_thread(nullptr);
+	map.deinit();
+	CHECK(!map.set(1) && map.get() == nullptr && !map.erase(), "deinitialised map");
+}
+
+/**
+ *  Shared state of a concurrent run
+ */
+struct Stress {
+	ThreadLocalMap<uint64_t> map;
+	size_t capacity;
+	size_t iterations;
+	std::atomic<size_t> holders {0};
+	std::atomic<size_t> maxHolders {0};
+	std::atomic<size_t> stored {0};
+	std::atomic<size_t> rejected {0};
+	std::atomic<bool> start {false};
+};
+
+struct Worker {
+	Stress *stress;
+	uint64_t id;
+};
+
+static void *stressWorker(void *arg) {
+	auto worker = static_cast<Worker *>(arg);
+	auto s = worker->stress;
+	std::mt19937_64 rng(worker->id);
+
+	while (!s->start.load(std::memory_order_acquire))
+		sched_yield();
+
+	for (size_t i = 0; i < s->iterations; i++) {
+		uint64_t value = (worker->id << 32) | i;
+		if (!s->map.set(value)) {
+			s->rejected++;
+			CHECK(s->map.get() == nullptr, "rejected thread %llu has a value", static_cast<unsigned long long>(worker->id));
+			continue;
+		}
+
+		// No two threads may hold the same slot, so the table never holds more threads than its capacity.
+		size_t holders = ++s->holders;
+		size_t prev = s->maxHolders.load();
+		while (prev < holders && !s->maxHolders.compare_exchange_weak(prev, holders));
+		CHECK(holders <= s->capacity, "%zu holders in %zu slots", holders, s->capacity);
+		s->stored++;
+
+		auto ptr = s->map.get();
+		CHECK(ptr && *ptr == value, "thread %llu lost its value", static_cast<unsigned long long>(worker->id));
+		if (rng() % 4 == 0)
+			sched_yield();
+		ptr = s->map.get();
+		CHECK(ptr && *ptr == value, "thread %llu value was overwritten", static_cast<unsigned long long>(worker->id));
+
+		if (rng() % 2 == 0) {
+			CHECK(s->map.set(value + 1), "thread %llu failed to overwrite", static_cast<unsigned long long>(worker->id));
+			ptr = s->map.get();
+			CHECK(ptr && *ptr == value + 1, "thread %llu overwrite lost", static_cast<unsigned long long>(worker->id));
+		}
+
+		--s->holders;
+		CHECK(s->map.erase(), "thread %llu failed to erase", static_cast<unsigned long long>(worker->id));
+		CHECK(s->map.get() == nullptr, "thread %llu value survived erase", static_cast<unsigned long long>(worker->id));
+		if (rng() % 8 == 0)
+			sched_yield();
+	}
+
+	return nullptr;
+}
+
+/**
+ *  Run set, get, overwrite and erase from many threads at once
+ *
+ *  @param threads     amount of threads
+ *  @param capacity    map capacity
+ *  @param iterations  operations per thread
+ *  @param lossless    every set must succeed
+ */
+static void testConcurrent(size_t threads, size_t capacity, size_t iterations, bool lossless) {
+	Stress s;
+	s.capacity = capacity;
+	s.iterations = iterations;
+	CHECK(s.map.init(capacity), "capacity %zu", capacity);
+
+	std::vector<pthread_t> handles(threads);
+	std::vector<Worker> workers(threads);
+	for (size_t i = 0; i < threads; i++) {
+		workers[i] = {&s, i + 1};
+		CHECK(pthread_create(&handles[i], nullptr, stressWorker, &workers[i]) == 0, "thread %zu", i);
+	}
+
+	s.start.store(true, std::memory_order_release);
+	for (auto &handle : handles)
+		pthread_join(handle, nullptr);
+
+	CHECK(s.stored + s.rejected == threads * iterations, "%zu stored and %zu rejected", s.stored.load(), s.rejected.load());
+	CHECK(s.stored > 0, "nothing stored");
+	if (lossless)
+		CHECK(s.rejected == 0, "%zu rejected with %zu threads in %zu slots", s.rejected.load(), threads, capacity);
+
+	printf("%3zu threads %4zu slots: %8zu stored %8zu rejected, at most %zu held at once\n",
+		threads, capacity, s.stored.load(), s.rejected.load(), s.maxHolders.load());
+
+	s.map.deinit();
+}
+
+int main() {
+	for (size_t capacity : {1, 2, 16, 64, 256})
+		testSequential(capacity);
+
+	// Small maps are contended and reject threads, larger ones must keep every value.
+	testConcurrent(64, 4, 20000, false);
+	testConcurrent(64, 16, 20000, false);
+	testConcurrent(64, 256, 20000, true);
+	testConcurrent(128, 1024, 5000, true);
+
+	if (failures) {
+		fprintf(stderr, "%zu failures\n", failures.load());
+		return 1;
+	}
+
+	printf("all tests passed\n");
+	return 0;
+}